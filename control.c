@@ -0,0 +1,675 @@
+/*
+ * control.c
+ *
+ * Local control socket for lcd-mp3.
+ *
+ * A single thread runs an epoll loop over a non-blocking Unix domain socket.
+ * The protocol is one command per line, one response line per command, in
+ * order.  Clients may pipeline as many commands as they like in one write;
+ * every complete line in a read is handled and all the responses go back in
+ * a single write.
+ *
+ *   play | pause | toggle | next | prev | info | mute
+ *   shuffle [on|off]        (no argument toggles)
+ *   volume [+|-]N           (0 - 99, +/- is relative)
+ *   seek [+|-]N             (seconds, +/- is relative)
+ *   enqueue /path/to/song.mp3
+ *   search words            (OK count=N<TAB>song=path... for the first SEARCH_SHOW)
+ *   filter [words]          (only play songs matching; no words plays everything)
+ *   status                  (OK key=value<TAB>key=value...)
+ *   subscribe | unsubscribe (push "EVENT key value" lines on changes)
+ *   zone N volume V         (V 0 - 100; zones count from 1, as given with -zone)
+ *   zone N next
+ *   ping
+ *
+ * Player commands are not run here; they go through the player command
+ * queue (state_send_cmd) to the main loop, exactly like the buttons.  The
+ * status command reads the published player snapshot without locking.  The
+ * zones have no command queue; zone_set_volume() and zone_next() are safe to
+ * call from here.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "control.h"
+#include "tagindex.h"
+#include "zone.h"
+
+#define MAX_CLIENTS  32
+#define MAX_KEYS     16
+#define EVENT_QUEUE  64
+#define IN_BUF_LEN   4096
+#define OUT_BUF_MAX  (256 * 1024) // slow clients past this get dropped
+#define SEARCH_SHOW  10           // songs listed in a search reply
+
+struct client {
+    int fd;
+    int subscribed;
+    size_t in_len;
+    char in_buf[IN_BUF_LEN];
+    size_t out_len;
+    size_t out_size;
+    char *out_buf;
+    int want_out; // EPOLLOUT is armed
+    int closing;  // the other end has stopped sending; close once the replies are out
+    int dropped;  // fell OUT_BUF_MAX behind; closed once the batch it's in is done
+    struct client *next_dead;
+};
+
+struct state_key {
+    char key[32];
+    char value[MAXDATALEN];
+};
+
+static int listen_fd = -1;
+static int epoll_fd = -1;
+static int event_fd = -1;
+static int stopping = FALSE;
+static char sock_path[108];
+static pthread_t control_tid;
+static int reader_slot = -1;
+
+// Markers so epoll events can tell the listener and eventfd from clients
+static int listen_marker, event_marker;
+
+static struct client *clients[MAX_CLIENTS];
+// Closed, but there may still be events for them in the epoll batch
+static struct client *dead = NULL;
+
+// Last value of every key (so unchanged values don't make events) and the
+// events waiting to go out to subscribers
+static pthread_mutex_t stateMutex = PTHREAD_MUTEX_INITIALIZER;
+static struct state_key state[MAX_KEYS];
+static int num_keys;
+static char event_queue[EVENT_QUEUE][MAXDATALEN + 40];
+static int event_head, event_tail;
+
+/*
+ * Output buffering
+ */
+// Returns -1 if the client is being dropped (its replies are then thrown away)
+static int client_append(struct client *c, const char *s, size_t len)
+{
+    if (c->dropped)
+        return -1;
+    if (c->out_len + len > c->out_size)
+    {
+        size_t size = c->out_size ? c->out_size : 1024;
+        char *p;
+
+        while (size < c->out_len + len)
+            size *= 2;
+        p = (size > OUT_BUF_MAX ? NULL : realloc(c->out_buf, size));
+        if (p == NULL)
+        {
+            // Half a reply would be worse than none
+            c->dropped = TRUE;
+            return -1;
+        }
+        c->out_buf = p;
+        c->out_size = size;
+    }
+    memcpy(c->out_buf + c->out_len, s, len);
+    c->out_len += len;
+    return 0;
+}
+
+static int client_printf(struct client *c, const char *fmt, ...)
+{
+    char line[MAXDATALEN * 8];
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (len < 0)
+        return -1;
+    if (len >= (int)sizeof(line))
+        len = sizeof(line) - 1;
+    return client_append(c, line, len);
+}
+
+// Closes c now; it's freed by reap_clients() once the epoll batch is done
+static void client_close(struct client *c)
+{
+    int i;
+
+    if (c->fd < 0)
+        return;
+    for (i = 0; i < MAX_CLIENTS; i++)
+    {
+        if (clients[i] == c)
+            clients[i] = NULL;
+    }
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    c->fd = -1;
+    c->next_dead = dead;
+    dead = c;
+}
+
+static void reap_clients(void)
+{
+    struct client *c;
+
+    while ((c = dead) != NULL)
+    {
+        dead = c->next_dead;
+        free(c->out_buf);
+        free(c);
+    }
+}
+
+// Write out as much as the socket takes; arm EPOLLOUT for the rest.
+// Returns -1 if the client should be closed (dropped, or all done).
+static int client_flush(struct client *c)
+{
+    size_t off = 0;
+    struct epoll_event ev;
+
+    if (c->dropped)
+        return -1;
+    while (off < c->out_len)
+    {
+        ssize_t n = write(c->fd, c->out_buf + off, c->out_len - off);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return -1;
+        }
+        off += n;
+    }
+    memmove(c->out_buf, c->out_buf + off, c->out_len - off);
+    c->out_len -= off;
+    if (c->closing && c->out_len == 0)
+        return -1;
+    if ((c->out_len > 0) != c->want_out || c->closing)
+    {
+        c->want_out = (c->out_len > 0);
+        ev.events = (c->closing ? 0 : EPOLLIN | EPOLLRDHUP) | (c->want_out ? EPOLLOUT : 0);
+        ev.data.ptr = c;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+    }
+    return 0;
+}
+
+/*
+ * Command handling
+ */
+// Parse "[+|-]N"; returns -1 if it isn't a number
+static int parse_number(const char *s, long *value, int *relative)
+{
+    char *end;
+
+    while (*s == ' ')
+        s++;
+    *relative = (*s == '+' || *s == '-');
+    *value = strtol(s, &end, 10);
+    if (end == s || *end != '\0')
+        return -1;
+    return 0;
+}
+
+// zone N volume V | zone N next
+static void zone_reply(struct client *c, char *arg)
+{
+    char *what, *end;
+    long zone, volume;
+
+    zone = (arg == NULL ? 0 : strtol(arg, &what, 10));
+    if (zone < 1 || zone > zone_count() || *what != ' ')
+    {
+        client_printf(c, zone_count() == 0 ? "ERR no zones\n" : "ERR usage: zone 1-%d volume V | zone 1-%d next\n",
+                      zone_count(), zone_count());
+        return;
+    }
+    what++;
+    if (strcmp(what, "next") == 0)
+        zone_next(zone - 1);
+    else if (strncmp(what, "volume ", 7) == 0)
+    {
+        volume = strtol(what + 7, &end, 10);
+        if (end == what + 7 || *end != '\0' || volume < 0 || volume > 100)
+        {
+            client_printf(c, "ERR usage: zone N volume 0-100\n");
+            return;
+        }
+        zone_set_volume(zone - 1, volume / 100.0);
+    }
+    else
+    {
+        client_printf(c, "ERR usage: zone N volume V | zone N next\n");
+        return;
+    }
+    client_printf(c, "OK\n");
+}
+
+static void status_reply(struct client *c)
+{
+    static const char *states[] = { "playing", "prev", "next", "paused", "info", "stopped", "shuffle", "quit" };
+    const struct player_snapshot *snap;
+
+    if (reader_slot < 0)
+        reader_slot = state_reader_register();
+    snap = (reader_slot < 0 ? NULL : state_read_lock(reader_slot));
+    if (snap == NULL)
+        client_printf(c, "OK\tstate=stopped\n");
+    else
+    {
+        client_printf(c, "OK\tstate=%s\tshuffle=%s\tvolume=%d\tmuted=%s",
+                      states[snap->play_status], snap->shuffle ? "on" : "off", snap->volume, snap->muted ? "yes" : "no");
+        if (snap->track != NULL)
+            client_printf(c, "\tindex=%d\tqueued=%s\tfile=%s\ttitle=%s\tartist=%s\talbum=%s\n",
+                          snap->track->index, snap->queued ? "yes" : "no", snap->track->filename,
+                          snap->track->title, snap->track->artist, snap->track->album);
+        else
+            client_append(c, "\n", 1);
+    }
+    if (reader_slot >= 0)
+        state_read_unlock(reader_slot);
+}
+
+// Searching is done right here; the index has its own lock
+static void search_reply(struct client *c, const char *query)
+{
+    char path[MAXDATALEN];
+    int *tracks, i, n;
+
+    if (query == NULL || *query == '\0')
+    {
+        client_printf(c, "ERR usage: search words\n");
+        return;
+    }
+    n = tagindex_search(query, &tracks);
+    if (n < 0)
+    {
+        client_printf(c, "ERR %s\n", strerror(errno));
+        return;
+    }
+    client_printf(c, "OK\tcount=%d", n);
+    for (i = 0; i < n && i < SEARCH_SHOW; i++)
+    {
+        if (tagindex_path(tracks[i], path, MAXDATALEN) == 0)
+            client_printf(c, "\tsong=%s", path);
+    }
+    client_append(c, "\n", 1);
+    free(tracks);
+}
+
+static void handle_line(struct client *c, char *line)
+{
+    static const struct {
+        const char *name;
+        int cmd;
+    } simple[] = {
+        { "play",   CMD_PLAY },
+        { "pause",  CMD_PAUSE },
+        { "toggle", CMD_TOGGLE },
+        { "next",   CMD_NEXT },
+        { "prev",   CMD_PREV },
+        { "info",   CMD_INFO },
+        { "mute",   CMD_MUTE },
+    };
+    char *arg;
+    long value;
+    int relative;
+    size_t i;
+
+    // Strip a trailing \r so telnet/nc -C work too
+    i = strlen(line);
+    if (i > 0 && line[i - 1] == '\r')
+        line[i - 1] = '\0';
+    if (line[0] == '\0')
+        return;
+    arg = strchr(line, ' ');
+    if (arg != NULL)
+        *arg++ = '\0';
+    for (i = 0; i < sizeof(simple) / sizeof(simple[0]); i++)
+    {
+        if (strcmp(line, simple[i].name) == 0)
+        {
+            if (state_send_cmd(simple[i].cmd, 0, FALSE, NULL) != 0)
+                client_printf(c, "ERR busy\n");
+            else
+                client_printf(c, "OK\n");
+            return;
+        }
+    }
+    if (strcmp(line, "ping") == 0)
+        client_printf(c, "OK pong\n");
+    else if (strcmp(line, "status") == 0)
+        status_reply(c);
+    else if (strcmp(line, "subscribe") == 0)
+    {
+        c->subscribed = TRUE;
+        client_printf(c, "OK\n");
+    }
+    else if (strcmp(line, "unsubscribe") == 0)
+    {
+        c->subscribed = FALSE;
+        client_printf(c, "OK\n");
+    }
+    else if (strcmp(line, "shuffle") == 0)
+    {
+        if (arg == NULL)
+            value = -1;
+        else if (strcmp(arg, "on") == 0)
+            value = 1;
+        else if (strcmp(arg, "off") == 0)
+            value = 0;
+        else
+        {
+            client_printf(c, "ERR usage: shuffle [on|off]\n");
+            return;
+        }
+        client_printf(c, state_send_cmd(CMD_SHUFFLE, value, FALSE, NULL) == 0 ? "OK\n" : "ERR busy\n");
+    }
+    else if (strcmp(line, "volume") == 0 || strcmp(line, "seek") == 0)
+    {
+        if (arg == NULL || parse_number(arg, &value, &relative) != 0)
+        {
+            client_printf(c, "ERR usage: %s [+|-]N\n", line);
+            return;
+        }
+        client_printf(c, state_send_cmd(line[0] == 'v' ? CMD_VOLUME : CMD_SEEK, value, relative, NULL) == 0 ? "OK\n" : "ERR busy\n");
+    }
+    else if (strcmp(line, "enqueue") == 0)
+    {
+        if (arg == NULL || *arg == '\0' || strlen(arg) >= MAXDATALEN)
+        {
+            client_printf(c, "ERR usage: enqueue path\n");
+            return;
+        }
+        if (access(arg, R_OK) != 0)
+        {
+            client_printf(c, "ERR %s\n", strerror(errno));
+            return;
+        }
+        client_printf(c, state_send_cmd(CMD_ENQUEUE, 0, FALSE, arg) == 0 ? "OK\n" : "ERR busy\n");
+    }
+    else if (strcmp(line, "search") == 0)
+        search_reply(c, arg);
+    else if (strcmp(line, "zone") == 0)
+        zone_reply(c, arg);
+    else if (strcmp(line, "filter") == 0)
+    {
+        if (arg != NULL && strlen(arg) >= MAXDATALEN)
+        {
+            client_printf(c, "ERR usage: filter [words]\n");
+            return;
+        }
+        client_printf(c, state_send_cmd(CMD_FILTER, 0, FALSE, arg == NULL ? "" : arg) == 0 ? "OK\n" : "ERR busy\n");
+    }
+    else
+        client_printf(c, "ERR unknown command '%s'\n", line);
+}
+
+// Read everything available, handle all complete lines, answer in one write
+static int client_read(struct client *c)
+{
+    for (;;)
+    {
+        ssize_t n = read(c->fd, c->in_buf + c->in_len, IN_BUF_LEN - c->in_len);
+        char *start, *nl;
+
+        // The other end has shut its side (e.g. nc -N, shutdown(SHUT_WR)): it
+        // still gets the replies, including one for a last line with no \n
+        if (n == 0)
+        {
+            if (c->in_len > 0)
+            {
+                c->in_buf[c->in_len] = '\0';
+                handle_line(c, c->in_buf);
+                c->in_len = 0;
+            }
+            c->closing = TRUE;
+            break;
+        }
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return -1;
+        }
+        c->in_len += n;
+        start = c->in_buf;
+        while (!c->dropped && (nl = memchr(start, '\n', c->in_len - (start - c->in_buf))) != NULL)
+        {
+            *nl = '\0';
+            handle_line(c, start);
+            start = nl + 1;
+        }
+        c->in_len -= start - c->in_buf;
+        memmove(c->in_buf, start, c->in_len);
+        // A line longer than the whole buffer is garbage; drop the client
+        if (c->dropped || c->in_len == IN_BUF_LEN)
+            return -1;
+    }
+    return client_flush(c);
+}
+
+static void accept_clients(void)
+{
+    struct epoll_event ev;
+    struct client *c;
+    int fd, i;
+
+    while ((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        for (i = 0; i < MAX_CLIENTS && clients[i] != NULL; i++)
+            ;
+        c = (i < MAX_CLIENTS ? calloc(1, sizeof(struct client)) : NULL);
+        if (c == NULL)
+        {
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        clients[i] = c;
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = c;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0)
+            client_close(c);
+    }
+}
+
+// Hand queued events to every subscriber
+static void push_events(void)
+{
+    uint64_t count;
+    int i;
+
+    if (read(event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        return;
+    pthread_mutex_lock(&stateMutex);
+    while (event_head != event_tail)
+    {
+        for (i = 0; i < MAX_CLIENTS; i++)
+        {
+            if (clients[i] != NULL && clients[i]->subscribed)
+                client_append(clients[i], event_queue[event_head], strlen(event_queue[event_head]));
+        }
+        event_head = (event_head + 1) % EVENT_QUEUE;
+    }
+    pthread_mutex_unlock(&stateMutex);
+    for (i = 0; i < MAX_CLIENTS; i++)
+    {
+        if (clients[i] != NULL && clients[i]->subscribed && client_flush(clients[i]) != 0)
+            client_close(clients[i]);
+    }
+}
+
+static void *control_thread(void *arg)
+{
+    struct epoll_event events[16];
+    int i, n;
+
+    while (!stopping)
+    {
+        n = epoll_wait(epoll_fd, events, 16, -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            printErr("epoll_wait failed", __FILE__, __LINE__);
+            break;
+        }
+        for (i = 0; i < n; i++)
+        {
+            struct client *c;
+
+            if (events[i].data.ptr == &listen_marker)
+            {
+                accept_clients();
+                continue;
+            }
+            if (events[i].data.ptr == &event_marker)
+            {
+                push_events();
+                continue;
+            }
+            c = events[i].data.ptr;
+            // Closed earlier in this batch (e.g. by push_events())
+            if (c->fd < 0)
+                continue;
+            // A client that has shut its sending side gets its replies before
+            // it's closed: reading the end of it sets closing, and client_flush()
+            // closes it once they're out
+            if (events[i].events & (EPOLLERR | EPOLLHUP))
+                client_close(c);
+            else if ((events[i].events & (EPOLLIN | EPOLLRDHUP)) && client_read(c) != 0)
+                client_close(c);
+            else if ((events[i].events & EPOLLOUT) && client_flush(c) != 0)
+                client_close(c);
+        }
+        reap_clients();
+    }
+    return NULL;
+}
+
+int control_start(const char *path)
+{
+    struct sockaddr_un addr;
+    struct epoll_event ev;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    strcpy(sock_path, path);
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0)
+        return -1;
+    // A stale socket from a previous run (e.g. after a power cut)
+    unlink(path);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, 16) != 0)
+        goto fail;
+    chmod(path, 0660);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd < 0 || event_fd < 0)
+        goto fail;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &listen_marker;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) != 0)
+        goto fail;
+    ev.data.ptr = &event_marker;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, event_fd, &ev) != 0)
+        goto fail;
+    if ((errno = pthread_create(&control_tid, NULL, control_thread, NULL)) != 0)
+        goto fail;
+    return 0;
+fail:
+    if (epoll_fd >= 0)
+        close(epoll_fd);
+    if (event_fd >= 0)
+        close(event_fd);
+    close(listen_fd);
+    unlink(path);
+    epoll_fd = event_fd = listen_fd = -1;
+    return -1;
+}
+
+void control_stop(void)
+{
+    uint64_t one = 1;
+    int i;
+
+    if (listen_fd < 0)
+        return;
+    stopping = TRUE;
+    if (write(event_fd, &one, sizeof(one)) < 0)
+        printErr("Error waking control thread", __FILE__, __LINE__);
+    pthread_join(control_tid, NULL);
+    for (i = 0; i < MAX_CLIENTS; i++)
+    {
+        if (clients[i] != NULL)
+            client_close(clients[i]);
+    }
+    reap_clients();
+    close(event_fd);
+    close(epoll_fd);
+    close(listen_fd);
+    unlink(sock_path);
+    epoll_fd = event_fd = listen_fd = -1;
+}
+
+void control_set(const char *key, const char *fmt, ...)
+{
+    char value[MAXDATALEN];
+    uint64_t one = 1;
+    va_list ap;
+    int i, changed = FALSE;
+
+    va_start(ap, fmt);
+    vsnprintf(value, sizeof(value), fmt, ap);
+    va_end(ap);
+    pthread_mutex_lock(&stateMutex);
+    for (i = 0; i < num_keys && strcmp(state[i].key, key) != 0; i++)
+        ;
+    if (i == num_keys && num_keys < MAX_KEYS)
+    {
+        snprintf(state[i].key, sizeof(state[i].key), "%s", key);
+        state[i].value[0] = '\0';
+        num_keys++;
+        changed = TRUE;
+    }
+    if (i < num_keys && (changed || strcmp(state[i].value, value) != 0))
+    {
+        strcpy(state[i].value, value);
+        changed = TRUE;
+        snprintf(event_queue[event_tail], sizeof(event_queue[0]), "EVENT %s %s\n", key, value);
+        event_tail = (event_tail + 1) % EVENT_QUEUE;
+        // Full; drop the oldest event
+        if (event_tail == event_head)
+            event_head = (event_head + 1) % EVENT_QUEUE;
+    }
+    pthread_mutex_unlock(&stateMutex);
+    if (changed && event_fd >= 0 && write(event_fd, &one, sizeof(one)) < 0)
+        printErr("Error waking control thread", __FILE__, __LINE__);
+}
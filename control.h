@@ -0,0 +1,28 @@
+/*
+ * header file for control.c
+ *
+ * Local control socket; lets a management agent drive the player
+ * the same way the buttons do.
+ */
+
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include "player_state.h"
+
+#define CONTROL_SOCKET "/run/lcd-mp3.sock"
+
+/*
+  Starts the socket server thread listening on path.
+  Returns 0 on success, -1 on failure (errno is set)
+*/
+int control_start(const char *path);
+void control_stop(void);
+
+/*
+  Publish a change in player state (e.g. "state", "title", "volume").
+  Subscribers get "EVENT key value" whenever the value changes.
+*/
+void control_set(const char *key, const char *fmt, ...);
+
+#endif
@@ -0,0 +1,40 @@
+/*
+ * debounce.c
+ *
+ * Button debouncing; see debounce.h.
+ *
+ * From http://www.arduino.cc/en/Tutorial/Debounce
+ *  created 21 Nov 2006 by David A. Mellis
+ *  modified 30 Aug 2011 by Limor Fried
+ *  modified 28 Dec 2012 by Mike Walters
+ *  This example code is in the public domain.
+ */
+
+#include "debounce.h"
+
+// LOW, as wiringPi has it
+#define PRESSED 0
+
+void debounce_set(struct debounce *b, int state, unsigned delay, unsigned now)
+{
+    b->state = b->last = state;
+    b->since = now;
+    b->delay = delay;
+}
+
+int debounce_pressed(struct debounce *b, int reading, unsigned now)
+{
+    int pressed = 0;
+
+    // Noise or a press; either way start timing again
+    if (reading != b->last)
+        b->since = now;
+    // It's been like this long enough to be taken as it is
+    if (now - b->since > b->delay && reading != b->state)
+    {
+        b->state = reading;
+        pressed = (reading == PRESSED);
+    }
+    b->last = reading;
+    return pressed;
+}
@@ -0,0 +1,28 @@
+/*
+ * header file for debounce.c
+ *
+ * Button debouncing, as in the Arduino debounce tutorial: a reading only
+ * counts once it has stayed the same for the debounce delay.
+ */
+
+#ifndef DEBOUNCE_H
+#define DEBOUNCE_H
+
+#define DEBOUNCE_MS 50
+
+struct debounce {
+	int state;           // the reading we go by
+	int last;            // the last reading, bouncing or not
+	unsigned since;      // vclock_ms() when the reading last changed
+	unsigned delay;      // ms it has to stay the same
+};
+
+// Starts off (or carries on) as state, as if it had been that way since now
+void debounce_set(struct debounce *b, int state, unsigned delay, unsigned now);
+/*
+  Feeds in a reading taken at now.
+  Returns TRUE if the button has just been pressed (gone LOW)
+*/
+int debounce_pressed(struct debounce *b, int reading, unsigned now);
+
+#endif
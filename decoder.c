@@ -0,0 +1,250 @@
+/*
+ * decoder.c
+ *
+ * mpg123 decoder choice; see decoder.h.
+ *
+ * A decoder is timed by decoding into a buffer (no sound card) and
+ * measuring the CPU time of this thread only, so whatever else is running
+ * doesn't count against it.  The choice is saved as one line:
+ * board<TAB>decoder<TAB>speed, where board is the device tree model (or
+ * the machine name) so an SD card moved to another board gets timed again.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/utsname.h>
+
+#include "decoder.h"
+
+static char chosen[64] = "";
+
+// Only 16 bit output, at any rate
+static void force_s16(mpg123_handle *mh)
+{
+    const long *rates;
+    size_t n, i;
+
+    mpg123_rates(&rates, &n);
+    mpg123_format_none(mh);
+    for (i = 0; i < n; i++)
+        mpg123_format(mh, rates[i], MPG123_MONO | MPG123_STEREO, MPG123_ENC_SIGNED_16);
+}
+
+void decoder_setup(mpg123_handle *mh)
+{
+    if (chosen[0] != '\0' && mpg123_decoder(mh, chosen) != MPG123_OK)
+        fprintf(stderr, "[%s - %d]: Cannot use decoder %s: %s\n", __FILE__, __LINE__, chosen, mpg123_strerror(mh));
+    force_s16(mh);
+}
+
+mpg123_handle *decoder_open(const char *path, long *rate, int *channels, int *encoding)
+{
+    mpg123_handle *mh;
+    mpg123_pars *mpar;
+    int err;
+
+    // Try to not show error messages
+    mpar = mpg123_new_pars(&err);
+    mpg123_par(mpar, MPG123_ADD_FLAGS, MPG123_QUIET, 0);
+    mh = mpg123_parnew(mpar, NULL, &err);
+    mpg123_delete_pars(mpar);
+    if (mh == NULL)
+    {
+        fprintf(stderr, "[%s - %d]: Cannot play '%s': %s\n", __FILE__, __LINE__, path, mpg123_plain_strerror(err));
+        return NULL;
+    }
+    decoder_setup(mh);
+    // The file may be gone (e.g. the stick was pulled out)
+    if (mpg123_open(mh, path) != MPG123_OK ||
+        mpg123_getformat(mh, rate, channels, encoding) != MPG123_OK || *rate <= 0)
+    {
+        fprintf(stderr, "[%s - %d]: Cannot play '%s': %s\n", __FILE__, __LINE__, path, mpg123_strerror(mh));
+        decoder_close(mh);
+        return NULL;
+    }
+    return mh;
+}
+
+void decoder_close(mpg123_handle *mh)
+{
+    mpg123_close(mh);
+    mpg123_delete(mh);
+}
+
+const char *decoder_name(void)
+{
+    return (chosen[0] != '\0' ? chosen : NULL);
+}
+
+static double cpu_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Seconds of audio per second of CPU; 0 if it can't decode song
+static double time_decoder(const char *name, const char *song, double seconds)
+{
+    mpg123_handle *mh;
+    unsigned char *buffer;
+    size_t size, done;
+    long rate;
+    int channels, encoding, err;
+    double t0, cpu, audio = 0, lap = 0;
+
+    mh = mpg123_new(name, &err);
+    if (mh == NULL)
+        return 0;
+    mpg123_param(mh, MPG123_ADD_FLAGS, MPG123_QUIET, 0);
+    force_s16(mh);
+    if (mpg123_open(mh, song) != MPG123_OK ||
+        mpg123_getformat(mh, &rate, &channels, &encoding) != MPG123_OK || rate <= 0)
+    {
+        mpg123_delete(mh);
+        return 0;
+    }
+    size = mpg123_outblock(mh);
+    buffer = malloc(size);
+    if (buffer == NULL)
+    {
+        mpg123_close(mh);
+        mpg123_delete(mh);
+        return 0;
+    }
+    t0 = cpu_secs();
+    while (audio < seconds)
+    {
+        err = mpg123_read(mh, buffer, size, &done);
+        audio += (double)done / (rate * channels * 2);
+        // A short song is played again from the top (unless it gave nothing at all)
+        if (err == MPG123_DONE)
+        {
+            if (audio == lap || mpg123_seek(mh, 0, SEEK_SET) < 0)
+                break;
+            lap = audio;
+        }
+        else if (err != MPG123_OK && err != MPG123_NEW_FORMAT)
+            break;
+    }
+    cpu = cpu_secs() - t0;
+    free(buffer);
+    mpg123_close(mh);
+    mpg123_delete(mh);
+    return (audio > 0 && cpu > 0 ? audio / cpu : 0);
+}
+
+int decoder_bench(const char *song, double seconds, struct decoder_result *results)
+{
+    const char **list;
+    int n;
+
+    mpg123_init();
+    list = mpg123_supported_decoders();
+    for (n = 0; list != NULL && list[n] != NULL && n < DECODER_MAX; n++)
+    {
+        results[n].name = list[n];
+        results[n].speed = time_decoder(list[n], song, seconds);
+    }
+    return n;
+}
+
+static int supported(const char *name)
+{
+    const char **list = mpg123_supported_decoders();
+
+    for (; list != NULL && *list != NULL; list++)
+    {
+        if (strcmp(*list, name) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+// What board this is, without tabs or new lines
+static void board_name(char *buf, size_t len)
+{
+    struct utsname u;
+    FILE *fp;
+    char *p;
+
+    buf[0] = '\0';
+    fp = fopen("/proc/device-tree/model", "r");
+    if (fp != NULL)
+    {
+        if (fgets(buf, len, fp) == NULL)
+            buf[0] = '\0';
+        fclose(fp);
+    }
+    if (buf[0] == '\0' && uname(&u) == 0)
+        snprintf(buf, len, "%s", u.machine);
+    for (p = buf; *p; p++)
+    {
+        if (*p == '\t' || *p == '\n')
+            *p = ' ';
+    }
+}
+
+int decoder_choose(const char *name, const char *song, const char *file)
+{
+    struct decoder_result results[DECODER_MAX];
+    char board[128], line[256], *saved, *end;
+    FILE *fp;
+    int i, n, best = -1;
+
+    mpg123_init();
+    chosen[0] = '\0';
+    if (name == NULL)
+        return 0;
+    if (strcmp(name, "auto") != 0)
+    {
+        if (!supported(name))
+        {
+            fprintf(stderr, "[%s - %d]: There is no decoder %s here\n", __FILE__, __LINE__, name);
+            return -1;
+        }
+        snprintf(chosen, sizeof(chosen), "%s", name);
+        return 0;
+    }
+    // Timed on this board before?
+    board_name(board, sizeof(board));
+    fp = (file != NULL ? fopen(file, "r") : NULL);
+    if (fp != NULL)
+    {
+        if (fgets(line, sizeof(line), fp) != NULL && (saved = strchr(line, '\t')) != NULL)
+        {
+            *saved++ = '\0';
+            end = strchr(saved, '\t');
+            if (end != NULL)
+                *end = '\0';
+            if (strcmp(line, board) == 0 && supported(saved))
+                snprintf(chosen, sizeof(chosen), "%s", saved);
+        }
+        fclose(fp);
+        if (chosen[0] != '\0')
+            return 0;
+    }
+    if (song == NULL)
+        return -1;
+    n = decoder_bench(song, DECODER_BENCH_SECS, results);
+    for (i = 0; i < n; i++)
+    {
+        printf("Decoder %-16s %6.1fx real time\n", results[i].name, results[i].speed);
+        if (results[i].speed > 0 && (best < 0 || results[i].speed > results[best].speed))
+            best = i;
+    }
+    if (best < 0)
+        return -1;
+    snprintf(chosen, sizeof(chosen), "%s", results[best].name);
+    printf("Using decoder %s on %s\n", chosen, board);
+    if (file != NULL)
+    {
+        fp = fopen(file, "w");
+        if (fp == NULL || fprintf(fp, "%s\t%s\t%.1f\n", board, chosen, results[best].speed) < 0 || fclose(fp) != 0)
+            fprintf(stderr, "[%s - %d]: Cannot save the decoder choice in %s\n", __FILE__, __LINE__, file);
+    }
+    return 0;
+}
@@ -0,0 +1,54 @@
+/*
+ * header file for decoder.c
+ *
+ * Which of mpg123's decoders to use.  mpg123 picks one for the CPU it was
+ * built for, which isn't always the fastest on the board it ends up on
+ * (e.g. a float decoder on an ARMv6 without much of an FPU).  With "auto"
+ * every decoder is timed on a song the first time we start on a board and
+ * the fastest one is remembered.
+ */
+
+#ifndef DECODER_H
+#define DECODER_H
+
+#include <mpg123.h>
+
+#define DECODER_FILE       "/var/lib/lcd-mp3/decoder"
+#define DECODER_BENCH_SECS 10   // seconds of audio each decoder is timed on
+#define DECODER_MAX        32
+
+struct decoder_result {
+	const char *name;
+	double speed;               // seconds of audio decoded per second of CPU; 0 if it failed
+};
+
+/*
+  Use decoder name (NULL for mpg123's own choice).  "auto" uses what
+  was saved in file for this board, or times every decoder on song and
+  saves the fastest.  Call before any songs are played.
+  Returns 0 on success, -1 on failure (we then leave it to mpg123)
+*/
+int decoder_choose(const char *name, const char *song, const char *file);
+// The decoder in use; NULL if it's up to mpg123
+const char *decoder_name(void);
+
+/*
+  Sets up a new handle: the chosen decoder and 16 bit output, which is
+  the cheapest for the integer decoders and what the sound card takes.
+*/
+void decoder_setup(mpg123_handle *mh);
+/*
+  A handle set up as above with path open and its format in rate,
+  channels and encoding; everything that plays or renders a song starts
+  here.  Returns NULL (having said why) if it can't be played.
+*/
+mpg123_handle *decoder_open(const char *path, long *rate, int *channels, int *encoding);
+void decoder_close(mpg123_handle *mh);
+
+/*
+  Times each decoder mpg123 has for this CPU on seconds of song.
+  Returns how many there are in results (at most DECODER_MAX)
+*/
+int decoder_bench(const char *song, double seconds, struct decoder_result *results);
+
+#endif
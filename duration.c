@@ -0,0 +1,324 @@
+/*
+ * duration.c
+ *
+ * mp3 length without decoding; see duration.h.
+ *
+ * A frame is taken to be the first one only if the next frame header
+ * follows it where it should (when that's in what was read), so a stray
+ * 0xFFE in a tag or junk isn't taken for one.  Counting frames goes a
+ * 64KB read at a time and only looks at the 4 header bytes of each frame;
+ * after a bad header it looks byte by byte for the next one like the
+ * first (same version, layer and rate).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "lcd-mp3.h"
+#include "duration.h"
+
+#define COUNT_CHUNK (64 * 1024)
+
+struct frame {
+    int version;        // 0 MPEG 1, 1 MPEG 2, 2 MPEG 2.5
+    int layer;          // 1 - 3
+    long rate;
+    int bitrate;        // kbit/s
+    int channels;
+    int length;         // bytes, header included
+    int samples;        // a channel
+};
+
+static const short bitrates[2][3][15] = {
+    {   // MPEG 1
+        { 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448 },
+        { 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384 },
+        { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },
+    },
+    {   // MPEG 2 and 2.5
+        { 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256 },
+        { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },
+        { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },
+    },
+};
+
+static const long rates[3][3] = {
+    { 44100, 48000, 32000 },
+    { 22050, 24000, 16000 },
+    { 11025, 12000, 8000 },
+};
+
+static long be32(const unsigned char *p)
+{
+    return ((long)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// Returns 0 if h is a frame header we can use (not free format)
+static int parse(const unsigned char *h, struct frame *f)
+{
+    static const int versions[4] = { 2, -1, 1, 0 };
+    int bitrate, rate, pad;
+
+    if (h[0] != 0xFF || (h[1] & 0xE0) != 0xE0)
+        return -1;
+    f->version = versions[(h[1] >> 3) & 3];
+    f->layer = 4 - ((h[1] >> 1) & 3);
+    bitrate = h[2] >> 4;
+    rate = (h[2] >> 2) & 3;
+    if (f->version < 0 || f->layer == 4 || bitrate == 0 || bitrate == 15 || rate == 3)
+        return -1;
+    pad = (h[2] >> 1) & 1;
+    f->bitrate = bitrates[f->version > 0][f->layer - 1][bitrate];
+    f->rate = rates[f->version][rate];
+    f->channels = ((h[3] >> 6) == 3 ? 1 : 2);
+    if (f->layer == 1)
+    {
+        f->samples = 384;
+        f->length = (12000 * f->bitrate / f->rate + pad) * 4;
+    }
+    else if (f->layer == 2 || f->version == 0)
+    {
+        f->samples = 1152;
+        f->length = 144000 * f->bitrate / f->rate + pad;
+    }
+    else
+    {
+        f->samples = 576;
+        f->length = 72000 * f->bitrate / f->rate + pad;
+    }
+    return 0;
+}
+
+static int same_stream(const struct frame *a, const struct frame *b)
+{
+    return (a->version == b->version && a->layer == b->layer && a->rate == b->rate);
+}
+
+// Where the audio starts: after the ID3v2 tag, if there is one
+static long audio_start(FILE *fp)
+{
+    unsigned char h[10];
+
+    if (fread(h, 1, 10, fp) != 10 || memcmp(h, "ID3", 3) != 0)
+        return 0;
+    return 10 + ((h[6] & 0x7f) << 21) + ((h[7] & 0x7f) << 14) + ((h[8] & 0x7f) << 7) + (h[9] & 0x7f) +
+           ((h[5] & 0x10) ? 10 : 0);
+}
+
+// The first frame in buf[0..len); returns its offset or -1
+static long first_frame(const unsigned char *buf, long len, struct frame *f)
+{
+    struct frame next;
+    long i;
+
+    for (i = 0; i + 4 <= len; i++)
+    {
+        if (parse(buf + i, f) != 0)
+            continue;
+        if (i + f->length + 4 > len || (parse(buf + i + f->length, &next) == 0 && same_stream(f, &next)))
+            return i;
+    }
+    return -1;
+}
+
+// A Xing/Info or VBRI header in the frame at p (len bytes); returns the frames, or -1
+static long vbr_frames(const unsigned char *p, long len, const struct frame *f, int *delay, int *padding)
+{
+    const unsigned char *x, *lame;
+    long flags, frames = -1;
+    int side;
+
+    *delay = *padding = 0;
+    if (f->layer != 3)
+        return -1;
+    side = (f->version == 0 ? (f->channels == 1 ? 17 : 32) : (f->channels == 1 ? 9 : 17));
+    x = p + 4 + side;
+    if (4 + side + 8 <= len && (memcmp(x, "Xing", 4) == 0 || memcmp(x, "Info", 4) == 0))
+    {
+        flags = be32(x + 4);
+        lame = x + 8;
+        if (flags & 1)
+        {
+            frames = be32(lame);
+            lame += 4;
+        }
+        lame += ((flags & 2) ? 4 : 0) + ((flags & 4) ? 100 : 0) + ((flags & 8) ? 4 : 0);
+        // LAME's (and ffmpeg's) tag has the encoder delay and padding
+        if (lame + 24 <= p + len && (memcmp(lame, "LAME", 4) == 0 || memcmp(lame, "Lavf", 4) == 0 || memcmp(lame, "Lavc", 4) == 0))
+        {
+            *delay = (lame[21] << 4) | (lame[22] >> 4);
+            *padding = ((lame[22] & 0x0f) << 8) | lame[23];
+        }
+        return frames;
+    }
+    x = p + 4 + 32;
+    if (4 + 32 + 18 <= len && memcmp(x, "VBRI", 4) == 0)
+        return be32(x + 14);
+    return -1;
+}
+
+int duration_read(const char *path, struct duration *d)
+{
+    unsigned char buf[DURATION_READ];
+    unsigned char tag[3];
+    struct frame f;
+    struct stat st;
+    FILE *fp;
+    long start, offset, len, frames, bytes;
+    int delay, padding;
+
+    memset(d, 0, sizeof(struct duration));
+    fp = fopen(path, "rb");
+    if (fp == NULL)
+        return -1;
+    if (fstat(fileno(fp), &st) != 0)
+    {
+        fclose(fp);
+        return -1;
+    }
+    start = audio_start(fp);
+    len = 0;
+    if (fseek(fp, start, SEEK_SET) == 0)
+        len = fread(buf, 1, sizeof(buf), fp);
+    offset = first_frame(buf, len, &f);
+    if (offset < 0)
+    {
+        fclose(fp);
+        errno = EINVAL;
+        return -1;
+    }
+    d->rate = f.rate;
+    d->channels = f.channels;
+    d->bitrate = f.bitrate;
+    frames = vbr_frames(buf + offset, len - offset, &f, &delay, &padding);
+    if (frames > 0)
+    {
+        d->samples = (long long)frames * f.samples - delay - padding;
+        if (d->samples < 0)
+            d->samples = 0;
+        d->exact = TRUE;
+    }
+    else
+    {
+        // As if every frame were like the first; less an ID3v1 tag at the end
+        bytes = st.st_size - start - offset;
+        if (st.st_size >= 128 && fseek(fp, -128, SEEK_END) == 0 && fread(tag, 1, 3, fp) == 3 && memcmp(tag, "TAG", 3) == 0)
+            bytes -= 128;
+        d->samples = (bytes > 0 ? (long long)bytes * 8 * f.rate / (f.bitrate * 1000LL) : 0);
+        d->exact = FALSE;
+    }
+    fclose(fp);
+    return 0;
+}
+
+int duration_count(const char *path, struct duration *d, const int *stop)
+{
+    unsigned char *buf;
+    struct frame first, f;
+    FILE *fp;
+    long start, offset, base, pos, avail;
+    long long frames = 0, samples = 0;
+
+    fp = fopen(path, "rb");
+    buf = malloc(COUNT_CHUNK);
+    if (fp == NULL || buf == NULL)
+    {
+        if (fp != NULL)
+        {
+            fclose(fp);
+            errno = ENOMEM;
+        }
+        free(buf);
+        return -1;
+    }
+    start = audio_start(fp);
+    avail = 0;
+    if (fseek(fp, start, SEEK_SET) == 0)
+        avail = fread(buf, 1, COUNT_CHUNK, fp);
+    offset = first_frame(buf, avail, &first);
+    if (offset < 0)
+    {
+        free(buf);
+        fclose(fp);
+        errno = EINVAL;
+        return -1;
+    }
+    base = start;
+    pos = start + offset;
+    for (;;)
+    {
+        if (pos + 4 > base + avail)
+        {
+            // On to the next piece
+            if (__atomic_load_n(stop, __ATOMIC_ACQUIRE))
+                break;
+            base = pos;
+            avail = 0;
+            if (fseek(fp, base, SEEK_SET) == 0)
+                avail = fread(buf, 1, COUNT_CHUNK, fp);
+            if (avail < 4)
+                break;
+        }
+        if (parse(buf + (pos - base), &f) == 0 && same_stream(&f, &first))
+        {
+            frames++;
+            samples += f.samples;
+            pos += f.length;
+        }
+        else
+            pos++;
+    }
+    free(buf);
+    fclose(fp);
+    if (__atomic_load_n(stop, __ATOMIC_ACQUIRE))
+    {
+        errno = ECANCELED;
+        return -1;
+    }
+    d->rate = first.rate;
+    d->channels = first.channels;
+    d->bitrate = first.bitrate;
+    d->samples = samples;
+    d->exact = (frames > 0);
+    return 0;
+}
+
+int duration_probe(const char *path, int frames)
+{
+    unsigned char buf[DURATION_READ];
+    struct frame first, f;
+    FILE *fp;
+    long start, offset, len = 0;
+    int n = 0;
+
+    fp = fopen(path, "rb");
+    if (fp == NULL)
+        return -1;
+    start = audio_start(fp);
+    if (fseek(fp, start, SEEK_SET) == 0)
+        len = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+    offset = first_frame(buf, len, &first);
+    // Frames back to back from there, as far as we read
+    while (offset >= 0 && n < frames && offset + 4 <= len)
+    {
+        if (parse(buf + offset, &f) != 0 || same_stream(&f, &first) == FALSE)
+            break;
+        offset += f.length;
+        n++;
+    }
+    if (n == 0 || (n < frames && offset + 4 <= len))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+long duration_ms(const struct duration *d)
+{
+    return (d->rate > 0 ? (long)(d->samples * 1000 / d->rate) : 0);
+}
@@ -0,0 +1,48 @@
+/*
+ * header file for duration.c
+ *
+ * How long an mp3 is, without decoding it.  Most encoders put a Xing
+ * ("Info" for CBR) or VBRI header in the first frame with the number of
+ * frames, and LAME adds the encoder delay and padding, which is exact
+ * and costs one small read.  Without one the length is worked out from
+ * the file size and the first frame's bit rate (right for CBR), and can
+ * then be made exact by counting the frames: that only reads the frame
+ * headers, but it reads through the whole file, so it's done in the
+ * background.
+ */
+
+#ifndef DURATION_H
+#define DURATION_H
+
+#define DURATION_READ 4096   // bytes read after the ID3v2 tag to find the first frame
+
+struct duration {
+	long rate;
+	int channels;
+	int bitrate;            // kbit/s of the first frame
+	long long samples;      // a channel; 0 if not known
+	int exact;              // FALSE if it's an estimate
+};
+
+/*
+  From the first frame's headers, or an estimate.
+  Returns 0 on success, -1 on failure (errno is set; EINVAL if it isn't an mp3)
+*/
+int duration_read(const char *path, struct duration *d);
+/*
+  Counts the frames, giving up (returning -1 with errno ECANCELED) as soon
+  as *stop is set.
+  Returns 0 on success, -1 on failure (errno is set)
+*/
+int duration_count(const char *path, struct duration *d, const int *stop);
+/*
+  Whether path starts like an mp3 we can play: the first frame after any
+  ID3v2 tag and the frames after it, up to frames of them (as many as
+  there are in DURATION_READ bytes), one straight after the other.
+  Returns 0 if so, -1 if not (errno is set; EINVAL if it isn't an mp3)
+*/
+int duration_probe(const char *path, int frames);
+// In ms
+long duration_ms(const struct duration *d);
+
+#endif
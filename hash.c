@@ -0,0 +1,33 @@
+/*
+ * hash.c
+ *
+ * FNV-1a; see hash.h.
+ */
+
+#include "hash.h"
+
+#define HASH_PRIME 16777619u
+
+uint32_t hash_add(uint32_t h, const void *s, size_t len)
+{
+    const unsigned char *p = s;
+
+    while (len-- > 0)
+    {
+        h ^= *p++;
+        h *= HASH_PRIME;
+    }
+    return h;
+}
+
+uint32_t hash_str(const char *s)
+{
+    uint32_t h = HASH_INIT;
+
+    while (*s)
+    {
+        h ^= (unsigned char)*s++;
+        h *= HASH_PRIME;
+    }
+    return h;
+}
@@ -0,0 +1,23 @@
+/*
+ * header file for hash.c
+ *
+ * FNV-1a, the one string hash used everywhere: the hash tables on paths
+ * and words, the journal's check that it's still the same song, and the
+ * library's id.  The values are kept on disk (the journal), so it must
+ * never change.
+ */
+
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define HASH_INIT 2166136261u
+
+// Carries on hashing the len bytes at s from h (HASH_INIT to start)
+uint32_t hash_add(uint32_t h, const void *s, size_t len);
+// The hash of string s
+uint32_t hash_str(const char *s);
+
+#endif
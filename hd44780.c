@@ -0,0 +1,466 @@
+/*
+ * hd44780.c
+ *
+ * HD44780 LCD driver; see hd44780.h.
+ *
+ * Everything is sent as two nibbles.  On GPIO each nibble is one write of
+ * all six lines with E high and one with E low (plus one first if RS
+ * changes, so it's steady before E goes up); we remember when the display
+ * will be done with the last write and only wait if the next one comes
+ * sooner.  On I2C the same bytes are queued up and sent in one go when the
+ * call returns.  A byte takes 90us at 100kHz (22us at 400kHz) and a
+ * character at least four of them, so the display (37us a character) keeps
+ * up by itself; only clearing (1.5ms) needs the busy flag.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "hd44780.h"
+
+#define TRANSPORT_GPIO 0
+#define TRANSPORT_I2C  1
+#define TRANSPORT_NULL 2   // I2C without the bus
+
+// PCF8574 outputs
+#define PCF_RS 0x01
+#define PCF_RW 0x02
+#define PCF_E  0x04
+#define PCF_BL 0x08
+
+#define CMD_CLEAR   0x01
+#define CMD_ENTRY   0x06   // cursor moves right, the display doesn't shift
+#define CMD_OFF     0x08
+#define CMD_ON      0x0C   // display on, no cursor
+#define CMD_FUNC    0x20   // 4 bit, 5x8 dots (| 0x08 for 2 lines)
+#define CMD_CGRAM   0x40
+#define CMD_DDRAM   0x80
+
+#define EXEC_NS  41000     // 37us, and some for a slow display
+#define CLEAR_NS 1640000
+#define PULSE_NS 500       // E high for at least 450ns
+
+struct hd44780 {
+    int transport;
+    int fd;
+    int addr;              // I2C
+    int cols, rows;
+    int col, row;          // where the next character goes
+    int cursor_set;        // FALSE if the display's address isn't there yet
+    int last;              // I2C: the last byte queued, -1 if unknown
+    int failed;            // I2C: already complained
+    long long ready;       // GPIO: when the display can take the next write
+    unsigned char buf[HD44780_BATCH];
+    int len;
+    struct hd44780_stats stats;
+};
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Sleeps if it's a while; tens of microseconds aren't worth a context switch
+static void wait_until(long long when)
+{
+    struct timespec ts;
+    long long left = when - now_ns();
+
+    if (left > 100000)
+    {
+        ts.tv_sec = left / 1000000000;
+        ts.tv_nsec = left % 1000000000;
+        nanosleep(&ts, NULL);
+    }
+    while (now_ns() < when)
+        ;
+}
+
+/*
+ * GPIO
+ */
+static void gpio_write(struct hd44780 *lcd, int rs, int e, int nibble)
+{
+    struct gpiohandle_data data;
+
+    memset(&data, 0, sizeof(data));
+    data.values[0] = rs;
+    data.values[1] = e;
+    data.values[2] = nibble & 1;
+    data.values[3] = (nibble >> 1) & 1;
+    data.values[4] = (nibble >> 2) & 1;
+    data.values[5] = (nibble >> 3) & 1;
+    ioctl(lcd->fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data);
+    lcd->stats.transfers++;
+}
+
+static void gpio_nibble(struct hd44780 *lcd, int rs, int nibble)
+{
+    if (lcd->last != rs)
+        gpio_write(lcd, rs, 0, nibble);
+    gpio_write(lcd, rs, 1, nibble);
+    wait_until(now_ns() + PULSE_NS);
+    // Latched as E goes low
+    gpio_write(lcd, rs, 0, nibble);
+    lcd->last = rs;
+}
+
+/*
+ * I2C
+ */
+static void i2c_flush(struct hd44780 *lcd)
+{
+    struct i2c_msg msg;
+    struct i2c_rdwr_ioctl_data xfer;
+
+    if (lcd->len == 0)
+        return;
+    if (lcd->transport == TRANSPORT_NULL)
+    {
+        lcd->stats.transfers++;
+        lcd->stats.bytes += lcd->len;
+        lcd->len = 0;
+        return;
+    }
+    msg.addr = lcd->addr;
+    msg.flags = 0;
+    msg.len = lcd->len;
+    msg.buf = lcd->buf;
+    xfer.msgs = &msg;
+    xfer.nmsgs = 1;
+    if (ioctl(lcd->fd, I2C_RDWR, &xfer) < 0 && lcd->failed == 0)
+    {
+        fprintf(stderr, "[%s - %d]: Cannot write to the LCD at 0x%02x: %s\n", __FILE__, __LINE__, lcd->addr, strerror(errno));
+        lcd->failed = 1;
+    }
+    lcd->stats.transfers++;
+    lcd->stats.bytes += lcd->len;
+    lcd->len = 0;
+}
+
+static void i2c_queue(struct hd44780 *lcd, unsigned char byte)
+{
+    if (lcd->len == HD44780_BATCH)
+        i2c_flush(lcd);
+    lcd->buf[lcd->len++] = byte;
+}
+
+static void i2c_nibble(struct hd44780 *lcd, int rs, int nibble)
+{
+    unsigned char byte = (nibble << 4) | (rs ? PCF_RS : 0) | PCF_BL;
+
+    if (lcd->last < 0 || (lcd->last & (PCF_RS | PCF_RW)) != (byte & (PCF_RS | PCF_RW)))
+        i2c_queue(lcd, byte);
+    i2c_queue(lcd, byte | PCF_E);
+    i2c_queue(lcd, byte);
+    lcd->last = byte;
+}
+
+// Reads the busy flag until it's clear (or just waits, if it can't be read)
+static void i2c_wait_busy(struct hd44780 *lcd, long long ns)
+{
+    unsigned char up[2] = { 0xF0 | PCF_RW | PCF_BL, 0xF0 | PCF_RW | PCF_BL | PCF_E };
+    unsigned char down[3] = { 0xF0 | PCF_RW | PCF_BL, 0xF0 | PCF_RW | PCF_BL | PCF_E, 0xF0 | PCF_RW | PCF_BL };
+    unsigned char status = 0x80;
+    struct i2c_msg msgs[3];
+    struct i2c_rdwr_ioctl_data xfer;
+    long long give_up = now_ns() + ns * 4;
+
+    if (lcd->transport == TRANSPORT_NULL)
+        return;
+
+    // D4 - D7 high to read them, E up, read (D7 is the busy flag), E down
+    // and up and down again for the low nibble we don't need
+    msgs[0].addr = msgs[1].addr = msgs[2].addr = lcd->addr;
+    msgs[0].flags = 0;
+    msgs[0].len = sizeof(up);
+    msgs[0].buf = up;
+    msgs[1].flags = I2C_M_RD;
+    msgs[1].len = 1;
+    msgs[1].buf = &status;
+    msgs[2].flags = 0;
+    msgs[2].len = sizeof(down);
+    msgs[2].buf = down;
+    xfer.msgs = msgs;
+    xfer.nmsgs = 3;
+    do
+    {
+        if (ioctl(lcd->fd, I2C_RDWR, &xfer) < 0)
+        {
+            wait_until(now_ns() + ns);
+            break;
+        }
+        lcd->stats.busy_polls++;
+        lcd->stats.transfers++;
+    } while ((status & 0x80) != 0 && now_ns() < give_up);
+    lcd->last = -1;
+}
+
+/*
+ * Both
+ */
+static void nibble(struct hd44780 *lcd, int rs, int value)
+{
+    if (lcd->transport == TRANSPORT_GPIO)
+        gpio_nibble(lcd, rs, value);
+    else
+        i2c_nibble(lcd, rs, value);
+}
+
+static void flush(struct hd44780 *lcd)
+{
+    if (lcd->transport != TRANSPORT_GPIO)
+        i2c_flush(lcd);
+}
+
+// A command (rs 0) or a character (rs 1) that takes exec_ns to carry out
+static void send(struct hd44780 *lcd, int rs, unsigned char value, long long exec_ns)
+{
+    if (lcd->transport == TRANSPORT_GPIO)
+        wait_until(lcd->ready);
+    nibble(lcd, rs, value >> 4);
+    nibble(lcd, rs, value & 0x0F);
+    if (lcd->transport == TRANSPORT_GPIO)
+        lcd->ready = now_ns() + exec_ns;
+    else if (exec_ns > EXEC_NS && lcd->transport == TRANSPORT_I2C)
+    {
+        i2c_flush(lcd);
+        i2c_wait_busy(lcd, exec_ns);
+    }
+}
+
+// Power up: into 4 bit mode by hand (no busy flag yet), then set it up
+static void setup(struct hd44780 *lcd)
+{
+    static const int waits_us[4] = { 4500, 150, 150, 150 };
+    int i;
+
+    if (lcd->transport != TRANSPORT_NULL)
+        usleep(50000);
+    lcd->last = -1;
+    for (i = 0; i < 4; i++)
+    {
+        nibble(lcd, 0, (i < 3 ? 0x3 : 0x2));
+        flush(lcd);
+        if (lcd->transport != TRANSPORT_NULL)
+            usleep(waits_us[i]);
+    }
+    lcd->ready = now_ns();
+    send(lcd, 0, CMD_FUNC | (lcd->rows > 1 ? 0x08 : 0), EXEC_NS);
+    send(lcd, 0, CMD_OFF, EXEC_NS);
+    send(lcd, 0, CMD_CLEAR, CLEAR_NS);
+    send(lcd, 0, CMD_ENTRY, EXEC_NS);
+    send(lcd, 0, CMD_ON, EXEC_NS);
+    flush(lcd);
+    lcd->col = lcd->row = 0;
+    lcd->cursor_set = 1;
+}
+
+static struct hd44780 *new_lcd(int transport, int cols, int rows)
+{
+    struct hd44780 *lcd;
+
+    if (cols < 1 || cols > 40 || rows < 1 || rows > 4 || cols * rows > 80)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    lcd = calloc(1, sizeof(struct hd44780));
+    if (lcd == NULL)
+        return NULL;
+    lcd->transport = transport;
+    lcd->cols = cols;
+    lcd->rows = rows;
+    return lcd;
+}
+
+struct hd44780 *hd44780_open_gpio(const char *chip, const struct hd44780_pins *pins, int cols, int rows)
+{
+    struct gpiohandle_request req;
+    struct hd44780 *lcd;
+    int fd, err;
+
+    lcd = new_lcd(TRANSPORT_GPIO, cols, rows);
+    if (lcd == NULL)
+        return NULL;
+    fd = open(chip, O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+    {
+        free(lcd);
+        return NULL;
+    }
+    memset(&req, 0, sizeof(req));
+    req.lineoffsets[0] = pins->rs;
+    req.lineoffsets[1] = pins->e;
+    req.lineoffsets[2] = pins->d4;
+    req.lineoffsets[3] = pins->d5;
+    req.lineoffsets[4] = pins->d6;
+    req.lineoffsets[5] = pins->d7;
+    req.lines = 6;
+    req.flags = GPIOHANDLE_REQUEST_OUTPUT;
+    snprintf(req.consumer_label, sizeof(req.consumer_label), "lcd-mp3");
+    err = (ioctl(fd, GPIO_GET_LINEHANDLE_IOCTL, &req) < 0 ? errno : 0);
+    close(fd);
+    if (err != 0)
+    {
+        free(lcd);
+        errno = err;
+        return NULL;
+    }
+    lcd->fd = req.fd;
+    setup(lcd);
+    return lcd;
+}
+
+struct hd44780 *hd44780_open_i2c(int bus, int addr, int cols, int rows)
+{
+    unsigned char byte = PCF_BL;
+    struct i2c_msg msg;
+    struct i2c_rdwr_ioctl_data xfer;
+    struct hd44780 *lcd;
+    char dev[32];
+    int err;
+
+    lcd = new_lcd(TRANSPORT_I2C, cols, rows);
+    if (lcd == NULL)
+        return NULL;
+    snprintf(dev, sizeof(dev), "/dev/i2c-%d", bus);
+    lcd->fd = open(dev, O_RDWR | O_CLOEXEC);
+    if (lcd->fd < 0)
+    {
+        free(lcd);
+        return NULL;
+    }
+    lcd->addr = addr;
+    // Is anybody there?
+    msg.addr = addr;
+    msg.flags = 0;
+    msg.len = 1;
+    msg.buf = &byte;
+    xfer.msgs = &msg;
+    xfer.nmsgs = 1;
+    if (ioctl(lcd->fd, I2C_RDWR, &xfer) < 0)
+    {
+        err = errno;
+        close(lcd->fd);
+        free(lcd);
+        errno = err;
+        return NULL;
+    }
+    setup(lcd);
+    return lcd;
+}
+
+struct hd44780 *hd44780_open_null(int cols, int rows)
+{
+    struct hd44780 *lcd;
+
+    lcd = new_lcd(TRANSPORT_NULL, cols, rows);
+    if (lcd == NULL)
+        return NULL;
+    lcd->fd = -1;
+    setup(lcd);
+    return lcd;
+}
+
+void hd44780_close(struct hd44780 *lcd)
+{
+    if (lcd == NULL)
+        return;
+    flush(lcd);
+    if (lcd->fd >= 0)
+        close(lcd->fd);
+    free(lcd);
+}
+
+// Queues c where the cursor is, moving on (to the next row at the end of one)
+static void put(struct hd44780 *lcd, unsigned char c)
+{
+    static const int row_start[4] = { 0x00, 0x40, 0x00, 0x40 };
+
+    if (lcd->cursor_set == 0)
+    {
+        // Rows 3 and 4 carry on from the end of 1 and 2
+        send(lcd, 0, CMD_DDRAM | (row_start[lcd->row] + (lcd->row >= 2 ? lcd->cols : 0) + lcd->col), EXEC_NS);
+        lcd->cursor_set = 1;
+    }
+    send(lcd, 1, c, EXEC_NS);
+    if (++lcd->col == lcd->cols)
+    {
+        lcd->col = 0;
+        lcd->row = (lcd->row + 1) % lcd->rows;
+        lcd->cursor_set = 0;
+    }
+}
+
+void hd44780_clear(struct hd44780 *lcd)
+{
+    send(lcd, 0, CMD_CLEAR, CLEAR_NS);
+    flush(lcd);
+    lcd->col = lcd->row = 0;
+    lcd->cursor_set = 1;
+}
+
+void hd44780_position(struct hd44780 *lcd, int col, int row)
+{
+    if (col < 0 || col >= lcd->cols || row < 0 || row >= lcd->rows)
+        return;
+    if (col != lcd->col || row != lcd->row)
+        lcd->cursor_set = 0;
+    lcd->col = col;
+    lcd->row = row;
+}
+
+void hd44780_putchar(struct hd44780 *lcd, unsigned char c)
+{
+    put(lcd, c);
+    flush(lcd);
+}
+
+void hd44780_puts(struct hd44780 *lcd, const char *s)
+{
+    while (*s != '\0')
+        put(lcd, *s++);
+    flush(lcd);
+}
+
+void hd44780_printf(struct hd44780 *lcd, const char *fmt, ...)
+{
+    char buf[81];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    hd44780_puts(lcd, buf);
+}
+
+void hd44780_chardef(struct hd44780 *lcd, int slot, unsigned char rows[8])
+{
+    int i;
+
+    send(lcd, 0, CMD_CGRAM | ((slot & 7) << 3), EXEC_NS);
+    for (i = 0; i < 8; i++)
+        send(lcd, 1, rows[i] & 0x1F, EXEC_NS);
+    flush(lcd);
+    // The address counter is in CGRAM now
+    lcd->cursor_set = 0;
+}
+
+void hd44780_get_stats(struct hd44780 *lcd, struct hd44780_stats *st)
+{
+    *st = lcd->stats;
+}
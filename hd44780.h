@@ -0,0 +1,60 @@
+/*
+ * header file for hd44780.c
+ *
+ * Our own driver for HD44780 character LCDs, any size up to 40x4, wired
+ * either
+ *   - 4 bit parallel to GPIOs (through the GPIO character device; RW is
+ *     tied to ground, so we wait out the datasheet times instead of reading
+ *     the busy flag), or
+ *   - through a PCF8574 I2C backpack (P0 RS, P1 RW, P2 E, P3 backlight,
+ *     P4 - P7 D4 - D7), where everything a call writes (a row of text,
+ *     a glyph) goes out in one I2C transaction and the busy flag is read
+ *     after the slow commands.
+ *
+ * The functions are the ones wiringPi's lcd.h has.  Moving the cursor
+ * doesn't write anything by itself; it goes out with the next text.
+ */
+
+#ifndef HD44780_H
+#define HD44780_H
+
+#define HD44780_GPIO_CHIP "/dev/gpiochip0"
+#define HD44780_I2C_BUS   1
+#define HD44780_I2C_ADDR  0x27     // 0x3F on PCF8574A backpacks
+#define HD44780_BATCH     1024     // I2C bytes per transaction, at most
+
+struct hd44780;
+
+// GPIO line numbers (BCM numbers on a Pi)
+struct hd44780_pins {
+	int rs, e;
+	int d4, d5, d6, d7;
+};
+
+struct hd44780_stats {
+	unsigned long transfers;    // I2C transactions, or GPIO writes
+	unsigned long bytes;        // I2C bytes
+	unsigned long busy_polls;   // busy flag reads (I2C only)
+};
+
+/*
+  Opens and sets up a cols x rows display.
+  Returns NULL on failure (errno is set)
+*/
+struct hd44780 *hd44780_open_gpio(const char *chip, const struct hd44780_pins *pins, int cols, int rows);
+struct hd44780 *hd44780_open_i2c(int bus, int addr, int cols, int rows);
+// An I2C display with nothing on the other end, for benchmarks
+struct hd44780 *hd44780_open_null(int cols, int rows);
+void hd44780_close(struct hd44780 *lcd);
+
+void hd44780_clear(struct hd44780 *lcd);
+void hd44780_position(struct hd44780 *lcd, int col, int row);
+void hd44780_putchar(struct hd44780 *lcd, unsigned char c);
+void hd44780_puts(struct hd44780 *lcd, const char *s);
+void hd44780_printf(struct hd44780 *lcd, const char *fmt, ...);
+// Draws custom character slot (0 - 7) from 8 rows of 5 bits
+void hd44780_chardef(struct hd44780 *lcd, int slot, unsigned char rows[8]);
+
+void hd44780_get_stats(struct hd44780 *lcd, struct hd44780_stats *st);
+
+#endif
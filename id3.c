@@ -0,0 +1,253 @@
+/*
+ * id3.c
+ *
+ * ID3 tag reader; see id3.h.
+ *
+ * Only the text frames we use (TIT2, TPE1, TALB, TPE2, TCON, TPOS, TRCK
+ * and their v2.2 names) are looked at.  At most ID3_MAX_READ bytes of a v2 tag are read,
+ * so a song with a big picture at the front costs one read, not a megabyte.
+ * If there's no v2 tag (or it has none of those frames) the v1 tag in the
+ * last 128 bytes is used.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "id3.h"
+
+// ID3v1 genres 0 - 79; (NN) in a v2 TCON frame means the same
+static const char *genres[] = {
+    "Blues", "Classic Rock", "Country", "Dance", "Disco", "Funk", "Grunge", "Hip-Hop",
+    "Jazz", "Metal", "New Age", "Oldies", "Other", "Pop", "R&B", "Rap",
+    "Reggae", "Rock", "Techno", "Industrial", "Alternative", "Ska", "Death Metal", "Pranks",
+    "Soundtrack", "Euro-Techno", "Ambient", "Trip-Hop", "Vocal", "Jazz+Funk", "Fusion", "Trance",
+    "Classical", "Instrumental", "Acid", "House", "Game", "Sound Clip", "Gospel", "Noise",
+    "AlternRock", "Bass", "Soul", "Punk", "Space", "Meditative", "Instrumental Pop", "Instrumental Rock",
+    "Ethnic", "Gothic", "Darkwave", "Techno-Industrial", "Electronic", "Pop-Folk", "Eurodance", "Dream",
+    "Southern Rock", "Comedy", "Cult", "Gangsta", "Top 40", "Christian Rap", "Pop/Funk", "Jungle",
+    "Native American", "Cabaret", "New Wave", "Psychadelic", "Rave", "Showtunes", "Trailer", "Lo-Fi",
+    "Tribal", "Acid Punk", "Acid Jazz", "Polka", "Retro", "Musical", "Rock & Roll", "Hard Rock"
+};
+
+// Appends code point c to out as UTF-8 if it fits
+static size_t put_utf8(char *out, size_t len, size_t pos, uint32_t c)
+{
+    if (c < 0x80 && pos + 1 < len)
+        out[pos++] = c;
+    else if (c < 0x800 && pos + 2 < len)
+    {
+        out[pos++] = 0xc0 | (c >> 6);
+        out[pos++] = 0x80 | (c & 0x3f);
+    }
+    else if (c >= 0x800 && c < 0x10000 && pos + 3 < len)
+    {
+        out[pos++] = 0xe0 | (c >> 12);
+        out[pos++] = 0x80 | ((c >> 6) & 0x3f);
+        out[pos++] = 0x80 | (c & 0x3f);
+    }
+    else if (c >= 0x10000 && pos + 4 < len)
+    {
+        out[pos++] = 0xf0 | (c >> 18);
+        out[pos++] = 0x80 | ((c >> 12) & 0x3f);
+        out[pos++] = 0x80 | ((c >> 6) & 0x3f);
+        out[pos++] = 0x80 | (c & 0x3f);
+    }
+    return pos;
+}
+
+// Text in one of the four ID3 encodings to UTF-8, trailing spaces dropped
+static void copy_text(char *out, const unsigned char *p, size_t n, int enc)
+{
+    size_t i = 0, pos = 0;
+    uint32_t c, c2;
+    int big_endian = (enc == 2);
+
+    if (enc == 1 && n >= 2)
+    {
+        big_endian = (p[0] == 0xfe && p[1] == 0xff);
+        if ((p[0] == 0xfe && p[1] == 0xff) || (p[0] == 0xff && p[1] == 0xfe))
+            i = 2;
+    }
+    while (i < n)
+    {
+        if (enc == 1 || enc == 2)
+        {
+            if (i + 1 >= n)
+                break;
+            c = (big_endian ? (p[i] << 8 | p[i + 1]) : (p[i + 1] << 8 | p[i]));
+            i += 2;
+            // Surrogate pair
+            if (c >= 0xd800 && c < 0xdc00 && i + 1 < n)
+            {
+                c2 = (big_endian ? (p[i] << 8 | p[i + 1]) : (p[i + 1] << 8 | p[i]));
+                i += 2;
+                c = 0x10000 + ((c - 0xd800) << 10) + (c2 - 0xdc00);
+            }
+        }
+        else
+            c = p[i++];
+        if (c == 0)
+            break;
+        // UTF-8 is copied byte by byte; Latin-1 bytes are code points
+        if (enc == 3)
+        {
+            if (pos + 1 < ID3_FIELD)
+                out[pos++] = c;
+        }
+        else
+            pos = put_utf8(out, ID3_FIELD, pos, c);
+    }
+    while (pos > 0 && out[pos - 1] == ' ')
+        pos--;
+    out[pos] = '\0';
+}
+
+// "(17)", "17" and "(17)Rock" all mean Rock
+static void fix_genre(char *genre)
+{
+    char *end;
+    long n;
+
+    if (genre[0] == '(' && genre[1] != '(')
+    {
+        end = strchr(genre, ')');
+        if (end != NULL && end[1] != '\0')
+        {
+            memmove(genre, end + 1, strlen(end + 1) + 1);
+            return;
+        }
+        n = strtol(genre + 1, &end, 10);
+    }
+    else
+        n = strtol(genre, &end, 10);
+    if (end != genre && (*end == '\0' || *end == ')') && n >= 0 && n < (long)(sizeof(genres) / sizeof(genres[0])))
+        snprintf(genre, ID3_FIELD, "%s", genres[n]);
+}
+
+static uint32_t syncsafe(const unsigned char *p)
+{
+    return (p[0] & 0x7f) << 21 | (p[1] & 0x7f) << 14 | (p[2] & 0x7f) << 7 | (p[3] & 0x7f);
+}
+
+// Returns 1 if any of the frames were found
+static int read_v2(int fd, struct id3_tags *tags)
+{
+    unsigned char head[10], *buf, *p, *id, *end;
+    uint32_t size, fsize, skip, i, j;
+    ssize_t n;
+    int version, id_len, found = 0;
+    char *field, number[ID3_FIELD];
+    int *num;
+
+    if (read(fd, head, 10) != 10 || memcmp(head, "ID3", 3) != 0 || head[3] < 2 || head[3] > 4)
+        return 0;
+    version = head[3];
+    size = syncsafe(head + 6);
+    if (size > ID3_MAX_READ)
+        size = ID3_MAX_READ;
+    buf = malloc(size);
+    if (buf == NULL)
+        return 0;
+    n = read(fd, buf, size);
+    size = (n > 0 ? n : 0);
+    // Undo unsynchronisation (FF 00 -> FF) for the whole tag
+    if (head[5] & 0x80)
+    {
+        for (i = j = 0; i < size; i++)
+        {
+            buf[j++] = buf[i];
+            if (buf[i] == 0xff && i + 1 < size && buf[i + 1] == 0)
+                i++;
+        }
+        size = j;
+    }
+    p = buf;
+    end = buf + size;
+    // Extended header
+    if ((head[5] & 0x40) && version > 2 && size >= 4)
+    {
+        skip = (version == 3 ? (uint32_t)(p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]) + 4 : syncsafe(p));
+        p += (skip < size ? skip : size);
+    }
+    id_len = (version == 2 ? 3 : 4);
+    while (end - p >= (version == 2 ? 6 : 10) && p[0] != 0)
+    {
+        id = p;
+        if (version == 2)
+            fsize = p[3] << 16 | p[4] << 8 | p[5];
+        else if (version == 3)
+            fsize = (uint32_t)(p[4] << 24 | p[5] << 16 | p[6] << 8 | p[7]);
+        else
+            fsize = syncsafe(p + 4);
+        p += (version == 2 ? 6 : 10);
+        if (fsize > (uint32_t)(end - p))
+            break;
+        field = NULL;
+        num = NULL;
+        if (memcmp(id, (version == 2 ? "TT2" : "TIT2"), id_len) == 0)
+            field = tags->title;
+        else if (memcmp(id, (version == 2 ? "TP1" : "TPE1"), id_len) == 0)
+            field = tags->artist;
+        else if (memcmp(id, (version == 2 ? "TAL" : "TALB"), id_len) == 0)
+            field = tags->album;
+        else if (memcmp(id, (version == 2 ? "TP2" : "TPE2"), id_len) == 0)
+            field = tags->album_artist;
+        else if (memcmp(id, (version == 2 ? "TCO" : "TCON"), id_len) == 0)
+            field = tags->genre;
+        // "3" or "3/12"
+        else if (memcmp(id, (version == 2 ? "TPA" : "TPOS"), id_len) == 0)
+            num = &tags->disc;
+        else if (memcmp(id, (version == 2 ? "TRK" : "TRCK"), id_len) == 0)
+            num = &tags->track;
+        if (num != NULL)
+            field = number;
+        // Skip compressed or encrypted frames
+        if (field != NULL && fsize > 1 && (version == 2 || (p[-1] & (version == 3 ? 0xc0 : 0x0c)) == 0))
+        {
+            copy_text(field, p + 1, fsize - 1, p[0]);
+            if (num != NULL)
+                *num = atoi(number);
+            found = 1;
+        }
+        p += fsize;
+    }
+    free(buf);
+    return found;
+}
+
+static void read_v1(int fd, struct id3_tags *tags)
+{
+    unsigned char tag[128];
+
+    if (lseek(fd, -128, SEEK_END) < 0 || read(fd, tag, 128) != 128 || memcmp(tag, "TAG", 3) != 0)
+        return;
+    copy_text(tags->title, tag + 3, 30, 0);
+    copy_text(tags->artist, tag + 33, 30, 0);
+    copy_text(tags->album, tag + 63, 30, 0);
+    // v1.1 has the track number at the end of the comment
+    if (tag[125] == 0 && tag[126] != 0)
+        tags->track = tag[126];
+    if (tag[127] < sizeof(genres) / sizeof(genres[0]))
+        snprintf(tags->genre, ID3_FIELD, "%s", genres[tag[127]]);
+}
+
+int id3_read(const char *file, struct id3_tags *tags)
+{
+    int fd;
+
+    memset(tags, 0, sizeof(struct id3_tags));
+    fd = open(file, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (read_v2(fd, tags))
+        fix_genre(tags->genre);
+    else
+        read_v1(fd, tags);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,30 @@
+/*
+ * header file for id3.c
+ *
+ * Reads the ID3 tags (v2.2 - v2.4, or v1 at the end of the file) without
+ * going through mpg123, so a whole library can be read quickly.
+ */
+
+#ifndef ID3_H
+#define ID3_H
+
+#define ID3_FIELD    128       // bytes per field, UTF-8
+#define ID3_MAX_READ 65536     // most of a v2 tag we look at (skips big cover art)
+
+struct id3_tags {
+	char title[ID3_FIELD];
+	char artist[ID3_FIELD];
+	char album[ID3_FIELD];
+	char album_artist[ID3_FIELD];
+	char genre[ID3_FIELD];
+	int disc;               // 0 if there's no disc/track number
+	int track;
+};
+
+/*
+  Fills in whatever tags the file has; the rest are left empty.
+  Returns 0 on success, -1 if the file can't be read (errno is set)
+*/
+int id3_read(const char *file, struct id3_tags *tags);
+
+#endif
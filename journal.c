@@ -0,0 +1,349 @@
+/*
+ * journal.c
+ *
+ * Resume journal.
+ *
+ * The journal is a file of fixed size records that only ever gets appended
+ * to; the newest record with a good crc wins, so a write torn by a power cut
+ * just loses that one update.  Once the file holds JOURNAL_MAX records the
+ * newest one is written to a new file which is renamed over the old one.
+ *
+ * All the writing (and fsync'ing) is done by a thread of its own.  The player
+ * thread only stores the sample position in two atomics, and the main loop
+ * only takes journalMutex for long enough to copy a few fields, so neither
+ * of them ever waits on the SD card.  While playing, the position is written
+ * every JOURNAL_INTERVAL seconds; a song change or pause gets written sooner,
+ * but never more than once every JOURNAL_MIN_GAP seconds.  Nothing is written
+ * while nothing changes (e.g. while paused).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <libgen.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "journal.h"
+#include "hash.h"
+
+static pthread_t journal_thread;
+static pthread_mutex_t journalMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t journalCond;
+static int running = FALSE;
+static int flush_wanted = FALSE;
+// The song we're on; guarded by journalMutex
+static struct journal_record latest;
+
+// Player thread
+static int64_t cur_sample = 0;
+static long cur_rate = 0;
+
+// Journal thread only
+static char journal_path[PATH_MAX];
+static int fd = -1;
+static int records = 0;
+static uint32_t seq = 0;
+static struct journal_record written;
+static struct journal_stats stats;
+static int64_t start_secs;
+
+static int64_t now_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static uint32_t crc32(const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    uint32_t crc = 0xffffffff;
+    int bit;
+
+    while (len--)
+    {
+        crc ^= *p++;
+        for (bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+static uint32_t record_crc(const struct journal_record *rec)
+{
+    return crc32(&rec->seq, sizeof(struct journal_record) - offsetof(struct journal_record, seq));
+}
+
+int journal_load(const char *path, struct journal_record *rec)
+{
+    struct journal_record r;
+    int f, found = FALSE;
+
+    f = open(path, O_RDONLY);
+    if (f < 0)
+        return -1;
+    while (read(f, &r, sizeof(r)) == sizeof(r))
+    {
+        if (r.magic != JOURNAL_MAGIC || r.crc != record_crc(&r))
+            continue;
+        if (found == FALSE || (int32_t)(r.seq - rec->seq) > 0)
+        {
+            *rec = r;
+            found = TRUE;
+        }
+    }
+    close(f);
+    return (found ? 0 : -1);
+}
+
+static int write_all(int f, const void *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = write(f, buf, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf = (const char *)buf + n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Replace the journal with a file holding just rec
+static int compact(const struct journal_record *rec)
+{
+    char tmp[PATH_MAX + 8], dir[PATH_MAX];
+    int f, d;
+
+    snprintf(tmp, sizeof(tmp), "%s.new", journal_path);
+    f = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (f < 0)
+        return -1;
+    if (write_all(f, rec, sizeof(*rec)) != 0 || fdatasync(f) != 0)
+    {
+        close(f);
+        unlink(tmp);
+        return -1;
+    }
+    close(f);
+    if (rename(tmp, journal_path) != 0)
+    {
+        unlink(tmp);
+        return -1;
+    }
+    // Make the rename itself stick
+    snprintf(dir, sizeof(dir), "%s", journal_path);
+    d = open(dirname(dir), O_RDONLY | O_DIRECTORY);
+    if (d >= 0)
+    {
+        fsync(d);
+        close(d);
+    }
+    if (fd >= 0)
+        close(fd);
+    fd = open(journal_path, O_WRONLY | O_APPEND);
+    records = 1;
+    stats.bytes += sizeof(*rec);
+    stats.writes++;
+    stats.syncs += 2;
+    stats.compactions++;
+    return 0;
+}
+
+static void append(struct journal_record *rec)
+{
+    int err;
+
+    rec->magic = JOURNAL_MAGIC;
+    rec->seq = ++seq;
+    rec->crc = record_crc(rec);
+    if (fd < 0 || records >= JOURNAL_MAX)
+        err = compact(rec);
+    else
+    {
+        err = write_all(fd, rec, sizeof(*rec));
+        if (err == 0)
+            err = fdatasync(fd);
+        if (err == 0)
+        {
+            records++;
+            stats.bytes += sizeof(*rec);
+            stats.writes++;
+            stats.syncs++;
+        }
+        else
+            records = JOURNAL_MAX; // start over with a clean file next time
+    }
+    if (err != 0)
+        fprintf(stderr, "[%s - %d]: Cannot write journal %s: %s\n", __FILE__, __LINE__, journal_path, strerror(errno));
+    written = *rec;
+}
+
+static int changed(const struct journal_record *rec)
+{
+    return (rec->index != written.index || rec->path_hash != written.path_hash ||
+            rec->playlist_id != written.playlist_id || rec->shuffle != written.shuffle ||
+            rec->sample != written.sample);
+}
+
+// Copy the latest state out; journalMutex must be held
+static int take_latest(struct journal_record *rec)
+{
+    *rec = latest;
+    if (rec->index < 0)
+        return FALSE;
+    rec->rate = __atomic_load_n(&cur_rate, __ATOMIC_ACQUIRE);
+    rec->sample = __atomic_load_n(&cur_sample, __ATOMIC_RELAXED);
+    return TRUE;
+}
+
+static void *journal_loop(void *arg)
+{
+    struct journal_record rec;
+    struct timespec ts;
+    int64_t deadline, last_write = 0, wake;
+    int valid;
+
+    pthread_mutex_lock(&journalMutex);
+    while (running)
+    {
+        deadline = now_secs() + JOURNAL_INTERVAL;
+        for (;;)
+        {
+            wake = deadline;
+            if (flush_wanted)
+                wake = last_write + JOURNAL_MIN_GAP;
+            if (running == FALSE || now_secs() >= wake)
+                break;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            ts.tv_sec += wake - now_secs();
+            pthread_cond_timedwait(&journalCond, &journalMutex, &ts);
+        }
+        if (running == FALSE)
+            break;
+        flush_wanted = FALSE;
+        valid = take_latest(&rec);
+        pthread_mutex_unlock(&journalMutex);
+        if (valid && changed(&rec))
+        {
+            append(&rec);
+            last_write = now_secs();
+        }
+        pthread_mutex_lock(&journalMutex);
+    }
+    // Last word before we go
+    valid = take_latest(&rec);
+    pthread_mutex_unlock(&journalMutex);
+    if (valid && changed(&rec))
+        append(&rec);
+    return NULL;
+}
+
+int journal_open(const char *path)
+{
+    struct journal_record last;
+    pthread_condattr_t attr;
+    struct stat st;
+
+    snprintf(journal_path, sizeof(journal_path), "%s", path);
+    fd = open(journal_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) == 0)
+    {
+        records = st.st_size / sizeof(struct journal_record);
+        // A torn record at the end; start over with a clean file
+        if (st.st_size % sizeof(struct journal_record) != 0)
+            records = JOURNAL_MAX;
+    }
+    if (journal_load(journal_path, &last) == 0)
+    {
+        seq = last.seq;
+        written = last;
+    }
+    memset(&latest, 0, sizeof(latest));
+    latest.index = -1;
+    memset(&stats, 0, sizeof(stats));
+    start_secs = now_secs();
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&journalCond, &attr);
+    pthread_condattr_destroy(&attr);
+    running = TRUE;
+    errno = pthread_create(&journal_thread, NULL, journal_loop, NULL);
+    if (errno != 0)
+    {
+        running = FALSE;
+        close(fd);
+        fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void journal_close(void)
+{
+    if (running == FALSE)
+        return;
+    pthread_mutex_lock(&journalMutex);
+    running = FALSE;
+    pthread_cond_signal(&journalCond);
+    pthread_mutex_unlock(&journalMutex);
+    pthread_join(journal_thread, NULL);
+    close(fd);
+    fd = -1;
+}
+
+void journal_track(uint32_t playlist_id, int index, const char *path, int shuffle, uint32_t seed)
+{
+    pthread_mutex_lock(&journalMutex);
+    if (index != latest.index || playlist_id != latest.playlist_id)
+    {
+        // The player thread for the last song is gone by now
+        __atomic_store_n(&cur_sample, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&cur_rate, 0, __ATOMIC_RELEASE);
+        flush_wanted = TRUE;
+        pthread_cond_signal(&journalCond);
+    }
+    latest.playlist_id = playlist_id;
+    latest.index = index;
+    latest.path_hash = hash_str(path);
+    latest.shuffle = shuffle;
+    latest.seed = seed;
+    pthread_mutex_unlock(&journalMutex);
+}
+
+void journal_flush(void)
+{
+    pthread_mutex_lock(&journalMutex);
+    flush_wanted = TRUE;
+    pthread_cond_signal(&journalCond);
+    pthread_mutex_unlock(&journalMutex);
+}
+
+void journal_position(int64_t sample, long rate)
+{
+    if (__atomic_load_n(&cur_rate, __ATOMIC_RELAXED) != rate)
+        __atomic_store_n(&cur_rate, rate, __ATOMIC_RELEASE);
+    __atomic_store_n(&cur_sample, sample, __ATOMIC_RELAXED);
+}
+
+void journal_get_stats(struct journal_stats *st)
+{
+    *st = stats;
+    st->seconds = now_secs() - start_secs;
+}
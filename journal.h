@@ -0,0 +1,64 @@
+/*
+ * header file for journal.c
+ *
+ * Remembers where we were (which song, how far into it) so the player can
+ * pick up from there after the power has been cut.
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+
+#include "lcd-mp3.h"
+
+#define JOURNAL_FILE     "/var/lib/lcd-mp3/resume"
+#define JOURNAL_MAGIC    0x4c43444a // "LCDJ"
+#define JOURNAL_INTERVAL 30         // seconds between position updates
+#define JOURNAL_MIN_GAP  2          // seconds between writes when skipping songs
+#define JOURNAL_MAX      64         // records in the file before it's compacted
+
+// 64 bytes on disk; a record with a bad magic or crc is ignored
+struct journal_record {
+	uint32_t magic;
+	uint32_t crc;         // of everything after this field
+	uint32_t seq;
+	uint32_t playlist_id; // library_id() of the songs we had
+	uint32_t path_hash;   // hash_str() of the song's path
+	uint32_t seed;        // play queue shuffle seed
+	int32_t index;        // library index of the song
+	int32_t shuffle;
+	int64_t sample;       // how far into the song
+	int32_t rate;         // samples per second
+	uint32_t unused[5];
+};
+
+struct journal_stats {
+	uint64_t bytes;       // everything written, compaction included
+	uint32_t writes;
+	uint32_t syncs;
+	uint32_t compactions;
+	int64_t seconds;      // since journal_open()
+};
+
+/*
+  Starts the journal thread appending to path.
+  Returns 0 on success, -1 on failure (errno is set)
+*/
+int journal_open(const char *path);
+// Writes out the latest position and stops the thread
+void journal_close(void);
+// Finds the newest good record in path; returns -1 if there isn't one
+int journal_load(const char *path, struct journal_record *rec);
+
+// Main loop: a new song started (index -1 for songs that aren't in the library)
+void journal_track(uint32_t playlist_id, int index, const char *path, int shuffle, uint32_t seed);
+// Main loop: get the latest position on disk soon (e.g. when pausing)
+void journal_flush(void);
+// Player thread: called for every block; only stores two numbers, never blocks
+void journal_position(int64_t sample, long rate);
+
+// Only once journal_close() has been called
+void journal_get_stats(struct journal_stats *st);
+
+#endif
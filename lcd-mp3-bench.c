@@ -0,0 +1,488 @@
+/*
+ *  lcd-mp3-bench
+ *
+ *  Times the parts of lcd-mp3 that run a lot or hold up starting, and
+ *  prints the results as JSON, so runs on different boards and releases
+ *  can be compared.  Every benchmark is run a number of times (samples);
+ *  each sample does the operation ops times and gives the time per
+ *  operation, and we report the median and 99th percentile of those.
+ *
+ *    scan_tree        library_scan() of a made-up tree (20 x 500 songs)
+ *    playlist_load    reading the same songs from an .m3u
+ *    library_get      looking up a song by index
+ *    pq_next          next song, shuffle on
+ *    pq_start_at      jumping to a song (as when resuming)
+ *    shuffle          shuffling 10,000 songs
+ *    id3_read         reading a song's ID3v2 tags
+ *    decode_1s        decoding a second of -song (if given); also as x real time
+ *    lcd_render       laying out a scrolled row for the LCD (lcdtext)
+ *    lcd_flush        writing a row to an I2C LCD (the bus itself is left out)
+ *    debounce_tick    debouncing all 7 buttons once
+ *    encoder_isr      the rotary encoder interrupt (GPIO reads mocked)
+ *
+ *  lcd-mp3-bench [-samples N] [-song file.mp3] [-tmp dir]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+
+#include "lcd-mp3.h"
+#include "library.h"
+#include "playlist.h"
+#include "playqueue.h"
+#include "id3.h"
+#include "decoder.h"
+#include "hd44780.h"
+#include "lcdtext.h"
+#include "scroll.h"
+#include "debounce.h"
+#include "rotaryencoder.h"
+
+#define TREE_DIRS   20
+#define TREE_SONGS  500
+#define SONGS       (TREE_DIRS * TREE_SONGS)
+
+typedef void (*bench_fn)(long ops);
+
+static char tmp[200] = "/tmp";
+static char tree[256];
+static char m3u[300];
+static char tagged[300];
+static const char *song = NULL;
+static int first = 1;
+
+static struct library lib;
+static struct playqueue pq;
+
+/*
+ * Mock GPIO for the encoder: wiringPi isn't linked in
+ */
+static int pins[64];
+
+int digitalRead(int pin)
+{
+    return pins[pin & 63];
+}
+
+void pinMode(int pin, int mode)
+{
+    (void)pin;
+    (void)mode;
+}
+
+void pullUpDnControl(int pin, int pud)
+{
+    (void)pin;
+    (void)pud;
+}
+
+int wiringPiISR(int pin, int mode, void (*function)(void))
+{
+    (void)pin;
+    (void)mode;
+    (void)function;
+    return 0;
+}
+
+void updateEncoders();
+
+/*
+ * Timing
+ */
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int by_value(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void json_string(const char *s)
+{
+    putchar('"');
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            printf("\\%c", *s);
+        else if ((unsigned char)*s >= ' ')
+            putchar(*s);
+    }
+    putchar('"');
+}
+
+// Runs fn samples times (after one to warm up) and prints its JSON record
+static void bench(const char *name, bench_fn fn, long ops, int samples, double per_sec)
+{
+    double *v, t;
+    int i;
+
+    v = malloc(samples * sizeof(double));
+    if (v == NULL)
+    {
+        perror("malloc: bench");
+        exit(EXIT_FAILURE);
+    }
+    fn(ops);
+    for (i = 0; i < samples; i++)
+    {
+        t = now_ns();
+        fn(ops);
+        v[i] = (now_ns() - t) / ops;
+    }
+    qsort(v, samples, sizeof(double), by_value);
+    printf("%s\n    {\"name\": ", (first ? "" : ","));
+    json_string(name);
+    printf(", \"unit\": \"ns/op\", \"ops\": %ld, \"samples\": %d, \"median\": %.1f, \"p99\": %.1f, \"min\": %.1f, \"max\": %.1f",
+           ops, samples, v[samples / 2], v[(samples * 99 + 99) / 100 - 1], v[0], v[samples - 1]);
+    // Work per second of something, e.g. seconds of audio: also as "x real time"
+    if (per_sec > 0)
+        printf(", \"realtime_median\": %.2f, \"realtime_p99\": %.2f", per_sec / v[samples / 2], per_sec / v[(samples * 99 + 99) / 100 - 1]);
+    printf("}");
+    first = 0;
+    free(v);
+}
+
+/*
+ * The made-up songs
+ */
+static void put_frame(FILE *fp, const char *id, const char *text)
+{
+    size_t len = strlen(text) + 1;
+    unsigned char head[10] = { 0 };
+
+    memcpy(head, id, 4);
+    head[4] = (len >> 24) & 0xff;
+    head[5] = (len >> 16) & 0xff;
+    head[6] = (len >> 8) & 0xff;
+    head[7] = len & 0xff;
+    fwrite(head, 10, 1, fp);
+    fputc(0, fp);           // ISO-8859-1
+    fwrite(text, len - 1, 1, fp);
+}
+
+static int make_files(void)
+{
+    char path[512];
+    unsigned char head[10] = { 'I', 'D', '3', 3, 0, 0, 0, 0, 0, 0 };
+    FILE *fp, *list;
+    long size;
+    int d, s, fd;
+
+    snprintf(tree, sizeof(tree), "%s/lcd-mp3-bench.XXXXXX", tmp);
+    if (mkdtemp(tree) == NULL)
+        return -1;
+    snprintf(m3u, sizeof(m3u), "%s/list.m3u", tree);
+    snprintf(tagged, sizeof(tagged), "%s/tagged.mp3", tree);
+    list = fopen(m3u, "w");
+    if (list == NULL)
+        return -1;
+    for (d = 0; d < TREE_DIRS; d++)
+    {
+        snprintf(path, sizeof(path), "%s/Artist %02d", tree, d);
+        mkdir(path, 0755);
+        for (s = 0; s < TREE_SONGS; s++)
+        {
+            snprintf(path, sizeof(path), "%s/Artist %02d/%03d - Song Title.mp3", tree, d, s);
+            fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd >= 0)
+                close(fd);
+            fprintf(list, "Artist %02d/%03d - Song Title.mp3\n", d, s);
+        }
+    }
+    fclose(list);
+    // An ID3v2.3 tag like a ripper writes, with some padding
+    fp = fopen(tagged, "wb");
+    if (fp == NULL)
+        return -1;
+    fwrite(head, 10, 1, fp);
+    put_frame(fp, "TIT2", "Knockin' on Heaven's Door (Live at the Isle of Wight)");
+    put_frame(fp, "TPE1", "Bob Dylan");
+    put_frame(fp, "TPE2", "Bob Dylan");
+    put_frame(fp, "TALB", "Another Self Portrait (1969-1971): The Bootleg Series, Vol. 10");
+    put_frame(fp, "TCON", "Folk Rock");
+    put_frame(fp, "TRCK", "7/12");
+    put_frame(fp, "TPOS", "2/2");
+    for (s = 0; s < 1024; s++)
+        fputc(0, fp);
+    size = ftell(fp) - 10;
+    fseek(fp, 6, SEEK_SET);
+    fputc((size >> 21) & 0x7f, fp);
+    fputc((size >> 14) & 0x7f, fp);
+    fputc((size >> 7) & 0x7f, fp);
+    fputc(size & 0x7f, fp);
+    fclose(fp);
+    return 0;
+}
+
+static void remove_files(void)
+{
+    char path[512];
+    int d, s;
+
+    for (d = 0; d < TREE_DIRS; d++)
+    {
+        for (s = 0; s < TREE_SONGS; s++)
+        {
+            snprintf(path, sizeof(path), "%s/Artist %02d/%03d - Song Title.mp3", tree, d, s);
+            unlink(path);
+        }
+        snprintf(path, sizeof(path), "%s/Artist %02d", tree, d);
+        rmdir(path);
+    }
+    unlink(m3u);
+    unlink(tagged);
+    rmdir(tree);
+}
+
+/*
+ * The benchmarks
+ */
+static void scan_tree(long ops)
+{
+    struct library l;
+
+    while (ops-- > 0)
+    {
+        library_init(&l);
+        library_scan(&l, tree);
+        library_free(&l);
+    }
+}
+
+static void load_playlist(long ops)
+{
+    struct library l;
+
+    while (ops-- > 0)
+    {
+        library_init(&l);
+        playlist_load(&l, m3u);
+        library_free(&l);
+    }
+}
+
+static volatile const void *sink;
+
+static void get_song(long ops)
+{
+    unsigned r = 1;
+
+    while (ops-- > 0)
+        sink = library_get(&lib, rand_r(&r) % SONGS);
+}
+
+static void next_song(long ops)
+{
+    while (ops-- > 0)
+        sink = pq_next(&pq);
+}
+
+static void start_at(long ops)
+{
+    unsigned r = 2;
+
+    while (ops-- > 0)
+        sink = pq_start_at(&pq, rand_r(&r) % SONGS);
+}
+
+static void shuffle(long ops)
+{
+    while (ops-- > 0)
+    {
+        pq_set_shuffle(&pq, FALSE);
+        pq_set_shuffle(&pq, TRUE);
+    }
+}
+
+static void read_tags(long ops)
+{
+    struct id3_tags tags;
+
+    while (ops-- > 0)
+        id3_read(tagged, &tags);
+}
+
+// A second of audio each; the song starts again when it runs out
+static void decode(long ops)
+{
+    static mpg123_handle *mh = NULL;
+    static unsigned char *buffer;
+    static size_t size;
+    static long rate;
+    static int channels;
+    size_t done, want;
+    int encoding, err;
+
+    if (mh == NULL)
+    {
+        mh = decoder_open(song, &rate, &channels, &encoding);
+        if (mh == NULL)
+            exit(EXIT_FAILURE);
+        size = mpg123_outblock(mh);
+        buffer = malloc(size);
+        if (buffer == NULL)
+            exit(EXIT_FAILURE);
+    }
+    while (ops-- > 0)
+    {
+        for (want = rate * channels * 2; want > 0; )
+        {
+            err = mpg123_read(mh, buffer, size, &done);
+            want -= (done < want ? done : want);
+            if (err == MPG123_DONE)
+                mpg123_seek(mh, 0, SEEK_SET);
+            else if (err != MPG123_OK && err != MPG123_NEW_FORMAT)
+                exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static struct scroll row;
+static struct hd44780 *lcd;
+
+static void render_row(long ops)
+{
+    char window[SCROLL_WIDTH_MAX + 1];
+
+    while (ops-- > 0)
+    {
+        row.pos = (row.pos + 1) % (row.len + SCROLL_GAP);
+        scroll_window(&row, window);
+        lcdtext_render(0, window);
+    }
+}
+
+static void flush_row(long ops)
+{
+    while (ops-- > 0)
+    {
+        hd44780_position(lcd, 0, 1);
+        hd44780_puts(lcd, "Sigur Ros - Hopp");
+    }
+}
+
+static struct debounce buttons[7];
+
+static void debounce_tick(long ops)
+{
+    static unsigned now = 0;
+    int i;
+
+    while (ops-- > 0)
+    {
+        now++;
+        for (i = 0; i < 7; i++)
+            debounce_pressed(&buttons[i], (now >> (i + 4)) & 1, now);
+    }
+}
+
+static void encoder_isr(long ops)
+{
+    static const int gray[4] = { 0, 1, 3, 2 };
+    static int step = 0;
+
+    while (ops-- > 0)
+    {
+        step = (step + 1) & 3;
+        pins[15] = gray[step] >> 1;
+        pins[16] = gray[step] & 1;
+        updateEncoders();
+    }
+}
+
+static void board(char *buf, size_t len)
+{
+    struct utsname u;
+    FILE *fp;
+
+    buf[0] = '\0';
+    fp = fopen("/proc/device-tree/model", "r");
+    if (fp != NULL)
+    {
+        if (fgets(buf, len, fp) == NULL)
+            buf[0] = '\0';
+        fclose(fp);
+    }
+    if (buf[0] == '\0' && uname(&u) == 0)
+        snprintf(buf, len, "%s", u.machine);
+}
+
+int main(int argc, char **argv)
+{
+    char model[128];
+    int i, samples = 101;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-samples") == 0 && i + 1 < argc)
+            samples = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-song") == 0 && i + 1 < argc)
+            song = argv[++i];
+        else if (strcmp(argv[i], "-tmp") == 0 && i + 1 < argc)
+            snprintf(tmp, sizeof(tmp), "%s", argv[++i]);
+        else
+        {
+            fprintf(stderr, "Usage: %s [-samples N] [-song file.mp3] [-tmp dir]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (samples < 1)
+        samples = 1;
+    if (make_files() != 0)
+    {
+        fprintf(stderr, "Cannot make the test songs in %s: %s\n", tmp, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    library_init(&lib);
+    library_scan(&lib, tree);
+    pq_init(&pq, &lib, TRUE, 1);
+    lcdtext_init(LCDTEXT_A00, NULL);
+    scroll_set(&row, "Björk - Jóga (Live at Royal Opera House)", 15, 0, 0);
+    lcd = hd44780_open_null(16, 2);
+    for (i = 0; i < 7; i++)
+        debounce_set(&buttons[i], 1, DEBOUNCE_MS, 0);
+    setupencoder(15, 16);
+
+    board(model, sizeof(model));
+    printf("{\n  \"tool\": \"lcd-mp3-bench\",\n  \"board\": ");
+    json_string(model);
+    printf(",\n  \"benchmarks\": [");
+    // Slow ones get fewer samples
+    bench("scan_tree", scan_tree, 1, (samples + 4) / 5, 0);
+    bench("playlist_load", load_playlist, 1, (samples + 4) / 5, 0);
+    bench("library_get", get_song, 10000, samples, 0);
+    bench("pq_next", next_song, 10000, samples, 0);
+    bench("pq_start_at", start_at, 100, samples, 0);
+    bench("shuffle", shuffle, 1, samples, 0);
+    bench("id3_read", read_tags, 100, samples, 0);
+    if (song != NULL)
+    {
+        mpg123_init();
+        bench("decode_1s", decode, 1, (samples + 4) / 5, 1e9);
+    }
+    bench("lcd_render", render_row, 1000, samples, 0);
+    bench("lcd_flush", flush_row, 1000, samples, 0);
+    bench("debounce_tick", debounce_tick, 100000, samples, 0);
+    bench("encoder_isr", encoder_isr, 100000, samples, 0);
+    printf("\n  ]\n}\n");
+
+    hd44780_close(lcd);
+    pq_free(&pq);
+    library_free(&lib);
+    remove_files();
+    return 0;
+}
@@ -0,0 +1,202 @@
+/*
+ *  lcd-mp3-ctl
+ *
+ *  Command line client for the lcd-mp3 control socket.
+ *
+ *  lcd-mp3-ctl [-s socket] command [args]
+ *      Sends one command and prints the reply.  "subscribe" keeps
+ *      printing events until killed.
+ *
+ *  lcd-mp3-ctl [-s socket] -bench N [-depth D] [-cmd "status"]
+ *      Load test: sends N commands, D at a time in one write (pipelined),
+ *      and reports requests/second and round trip latency.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "control.h"
+
+static int connect_to(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Read until 'lines' newlines have come in.  Returns -1 on EOF/error.
+static int read_lines(int fd, int lines, int echo)
+{
+    char buf[4096];
+
+    while (lines > 0)
+    {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        ssize_t i;
+
+        if (n <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (echo)
+            fwrite(buf, 1, n, stdout);
+        for (i = 0; i < n; i++)
+        {
+            if (buf[i] == '\n')
+                lines--;
+        }
+    }
+    return 0;
+}
+
+static double now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static int bench(int fd, long total, int depth, const char *cmd)
+{
+    size_t cmd_len = strlen(cmd);
+    char *batch = malloc(depth * (cmd_len + 1));
+    long batches = (total + depth - 1) / depth;
+    double *lat = malloc(batches * sizeof(double));
+    double start, t;
+    long b, sent = 0;
+    int i;
+
+    if (batch == NULL || lat == NULL)
+    {
+        perror("malloc: bench");
+        return 1;
+    }
+    for (i = 0; i < depth; i++)
+    {
+        memcpy(batch + i * (cmd_len + 1), cmd, cmd_len);
+        batch[i * (cmd_len + 1) + cmd_len] = '\n';
+    }
+    start = now_us();
+    for (b = 0; b < batches; b++)
+    {
+        int n = (total - sent < depth ? total - sent : depth);
+
+        t = now_us();
+        if (write_all(fd, batch, n * (cmd_len + 1)) != 0 || read_lines(fd, n, FALSE) != 0)
+        {
+            fprintf(stderr, "connection lost after %ld commands\n", sent);
+            return 1;
+        }
+        lat[b] = now_us() - t;
+        sent += n;
+    }
+    t = now_us() - start;
+    qsort(lat, batches, sizeof(double), cmp_double);
+    printf("commands: %ld  depth: %d  time: %.3f s  rate: %.0f cmd/s\n",
+           total, depth, t / 1e6, total / (t / 1e6));
+    printf("round trip (us): p50 %.1f  p99 %.1f  max %.1f\n",
+           lat[batches / 2], lat[(long)(batches * 0.99)], lat[batches - 1]);
+    free(lat);
+    free(batch);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = CONTROL_SOCKET;
+    const char *bench_cmd = "status";
+    char line[MAXDATALEN + 32];
+    long total = 0;
+    int depth = 1;
+    int i, fd;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++)
+    {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+            path = argv[++i];
+        else if (strcmp(argv[i], "-bench") == 0 && i + 1 < argc)
+            total = atol(argv[++i]);
+        else if (strcmp(argv[i], "-depth") == 0 && i + 1 < argc)
+            depth = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-cmd") == 0 && i + 1 < argc)
+            bench_cmd = argv[++i];
+        else
+            break;
+    }
+    if ((total <= 0 && i >= argc) || depth < 1)
+    {
+        fprintf(stderr, "Usage: %s [-s socket] command [args]\n"
+                "       %s [-s socket] -bench N [-depth D] [-cmd command]\n", argv[0], argv[0]);
+        return EXIT_FAILURE;
+    }
+    fd = connect_to(path);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Cannot connect to %s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    if (total > 0)
+        return bench(fd, total, depth, bench_cmd);
+    // Join the rest of the arguments back into one command line
+    line[0] = '\0';
+    for (; i < argc; i++)
+    {
+        strncat(line, argv[i], sizeof(line) - strlen(line) - 2);
+        strcat(line, i + 1 < argc ? " " : "\n");
+    }
+    if (write_all(fd, line, strlen(line)) != 0)
+        return EXIT_FAILURE;
+    // Subscribers just keep printing events
+    if (strcmp(line, "subscribe\n") == 0)
+        while (read_lines(fd, 1, TRUE) == 0)
+            fflush(stdout);
+    else
+        read_lines(fd, 1, TRUE);
+    close(fd);
+    return 0;
+}
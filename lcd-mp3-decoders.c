@@ -0,0 +1,50 @@
+/*
+ *  lcd-mp3-decoders
+ *
+ *  Times each of mpg123's decoders on a song, the way lcd-mp3 -decoder auto
+ *  does the first time it runs on a board.
+ *
+ *  lcd-mp3-decoders song.mp3 [seconds]   decode seconds (default 10) of the
+ *                                        song with each decoder and print how
+ *                                        many times faster than real time it is
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "decoder.h"
+
+int main(int argc, char **argv)
+{
+    struct decoder_result results[DECODER_MAX];
+    mpg123_handle *mh;
+    double seconds = DECODER_BENCH_SECS;
+    int i, n, best = -1;
+
+    if (argc != 2 && argc != 3)
+    {
+        fprintf(stderr, "Usage: %s song.mp3 [seconds]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (argc == 3)
+        seconds = atof(argv[2]);
+    n = decoder_bench(argv[1], seconds, results);
+    mh = mpg123_new(NULL, NULL);
+    printf("mpg123 would use: %s\n", (mh != NULL ? mpg123_current_decoder(mh) : "?"));
+    if (mh != NULL)
+        mpg123_delete(mh);
+    for (i = 0; i < n; i++)
+    {
+        if (results[i].speed > 0 && (best < 0 || results[i].speed > results[best].speed))
+            best = i;
+    }
+    for (i = 0; i < n; i++)
+    {
+        if (results[i].speed > 0)
+            printf("%c %-16s %7.1fx real time\n", (i == best ? '*' : ' '), results[i].name, results[i].speed);
+        else
+            printf("  %-16s  failed\n", results[i].name);
+    }
+    mpg123_exit();
+    return (best < 0 ? EXIT_FAILURE : 0);
+}
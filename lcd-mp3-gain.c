@@ -0,0 +1,116 @@
+/*
+ *  lcd-mp3-gain
+ *
+ *  Works out the ReplayGain of songs the way lcd-mp3 -replaygain does in
+ *  the background, and how fast.
+ *
+ *  lcd-mp3-gain [-threads N] [-cache file] dir|song.mp3 ...
+ *      measures the songs (those in the cache file are taken from there)
+ *      and prints each one's loudness, gain and peak, then the songs a
+ *      minute and times real time with N threads (default one less than
+ *      there are CPUs)
+ *  lcd-mp3-gain -sweep dir|song.mp3 ...
+ *      measures all of them with 1, 2, ... threads, up to the number of
+ *      CPUs, and prints the songs a minute for each
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "rgain.h"
+#include "library.h"
+
+static double now_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Measures every song with threads threads; returns how long that took
+static double run(struct library *lib, const char *cache, int threads, struct rgain_stats *st)
+{
+    double t0 = now_secs();
+
+    if (rgain_start(lib, cache, threads) != 0)
+    {
+        fprintf(stderr, "Cannot start measuring: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    rgain_wait();
+    t0 = now_secs() - t0;
+    rgain_get_stats(st);
+    return t0;
+}
+
+static void report(int threads, double secs, const struct rgain_stats *st)
+{
+    printf("%d thread%s: %u songs (%u from the cache, %u failed) in %.2f s, %.1f songs a minute, %.1fx real time",
+           threads, (threads == 1 ? "" : "s"), st->tracks, st->cache_hits, st->failed, secs,
+           (secs > 0 ? st->tracks * 60 / secs : 0), (secs > 0 ? st->audio_secs / secs : 0));
+    if (st->busy_secs > 0)
+        printf(", %.1fx a thread", st->audio_secs / st->busy_secs);
+    printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+    struct library songs;
+    struct rgain_stats st;
+    struct stat sb;
+    const char *cache = NULL;
+    double secs, gain, peak;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int i, n, threads = -1, sweep = 0;
+
+    library_init(&songs);
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-cache") == 0 && i + 1 < argc)
+            cache = argv[++i];
+        else if (strcmp(argv[i], "-sweep") == 0)
+            sweep = 1;
+        else if (argv[i][0] == '-')
+            break;
+        else if (stat(argv[i], &sb) == 0 && S_ISDIR(sb.st_mode))
+            library_scan(&songs, argv[i]);
+        else
+            library_add(&songs, argv[i]);
+    }
+    if (i < argc || library_count(&songs) == 0 || threads == 0)
+    {
+        fprintf(stderr, "Usage: %s [-threads N] [-cache file] [-sweep] dir|song.mp3 ...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (sweep)
+    {
+        printf("%d songs, %ld CPUs\n", library_count(&songs), cpus);
+        for (n = 1; n <= cpus && n <= RGAIN_MAX_THREADS; n++)
+        {
+            secs = run(&songs, NULL, n, &st);
+            rgain_stop();
+            report(n, secs, &st);
+        }
+        return 0;
+    }
+    secs = run(&songs, cache, threads, &st);
+    for (i = 0; i < library_count(&songs); i++)
+    {
+        if (rgain_get(library_get(&songs, i)->path, &gain, &peak) == 0)
+            printf("%6.1f LUFS  %+6.2f dB  peak %.3f  %s\n", RGAIN_REFERENCE - gain, gain, peak, library_get(&songs, i)->path);
+        else
+            printf("     -                          %s\n", library_get(&songs, i)->path);
+    }
+    rgain_stop();
+    report(threads > 0 ? threads : (cpus > 1 ? cpus - 1 : 1), secs, &st);
+    return (st.failed > 0 ? EXIT_FAILURE : 0);
+}
@@ -0,0 +1,155 @@
+/*
+ *  lcd-mp3-latency
+ *
+ *  Measures how late a thread set up like lcd-mp3's player wakes up while
+ *  other threads keep the CPUs busy (like cyclictest): first as an ordinary
+ *  thread, then with the player's real-time priority.
+ *
+ *  lcd-mp3-latency [-secs S] [-load N] [-rtprio P] [-cpu C] [-nomlock]
+ *      S seconds each way (default 10), N busy threads (default 2 per CPU),
+ *      P and C as lcd-mp3 takes them
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "rtsched.h"
+
+#define PERIOD_US 1000    // wakes up every ms, about one ALSA period
+#define BUCKETS   10000   // histogram in us; later than this counts as the last one
+#define LOAD_MEM  (4 << 20)
+
+static volatile int stop = 0;
+
+struct run {
+    int realtime;
+    double secs;
+    long count;
+    long max;
+    double sum;
+    long hist[BUCKETS];
+};
+
+// Keeps a CPU and the memory bus busy
+static void *load(void *arg)
+{
+    unsigned char *mem = malloc(LOAD_MEM);
+    size_t i = 0;
+
+    (void)arg;
+    while (!stop && mem != NULL)
+    {
+        mem[i] += i;
+        i = (i + 4093) % LOAD_MEM;
+    }
+    free(mem);
+    return NULL;
+}
+
+static void *measure(void *arg)
+{
+    struct run *run = arg;
+    struct timespec next, now;
+    long late, ticks;
+
+    if (run->realtime && rt_audio_thread() != 0)
+        fprintf(stderr, "Cannot make the thread real-time: %s\n", strerror(errno));
+    ticks = (long)(run->secs * 1000000 / PERIOD_US);
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (run->count < ticks)
+    {
+        next.tv_nsec += PERIOD_US * 1000;
+        if (next.tv_nsec >= 1000000000)
+        {
+            next.tv_nsec -= 1000000000;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        late = ((now.tv_sec - next.tv_sec) * 1000000000L + now.tv_nsec - next.tv_nsec) / 1000;
+        if (late < 0)
+            late = 0;
+        run->hist[late < BUCKETS ? late : BUCKETS - 1]++;
+        run->sum += late;
+        if (late > run->max)
+            run->max = late;
+        run->count++;
+    }
+    return NULL;
+}
+
+// The latency that all but (1 - fraction) of the wake ups beat
+static long percentile(const struct run *run, double fraction)
+{
+    long seen = 0;
+    int i;
+
+    for (i = 0; i < BUCKETS; i++)
+    {
+        seen += run->hist[i];
+        if (seen >= run->count * fraction)
+            return i;
+    }
+    return BUCKETS;
+}
+
+static void report(const char *name, const struct run *run)
+{
+    printf("%-10s %8ld wake ups  avg %6.0f us  99%% %6ld us  99.9%% %6ld us  max %6ld us\n",
+           name, run->count, run->sum / (run->count ? run->count : 1),
+           percentile(run, 0.99), percentile(run, 0.999), run->max);
+}
+
+int main(int argc, char **argv)
+{
+    static struct run ordinary, realtime;
+    pthread_t *loaders, tid;
+    int i, nload = -1, prio = RT_AUDIO_PRIO, cpu = -1, lock = 1;
+    double secs = 10;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-secs") == 0 && i + 1 < argc)
+            secs = atof(argv[++i]);
+        else if (strcmp(argv[i], "-load") == 0 && i + 1 < argc)
+            nload = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-rtprio") == 0 && i + 1 < argc)
+            prio = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-cpu") == 0 && i + 1 < argc)
+            cpu = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-nomlock") == 0)
+            lock = 0;
+        else
+        {
+            fprintf(stderr, "Usage: %s [-secs S] [-load N] [-rtprio P] [-cpu C] [-nomlock]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (nload < 0)
+        nload = 2 * sysconf(_SC_NPROCESSORS_ONLN);
+    rt_setup(prio, cpu, lock);
+    loaders = calloc(nload + 1, sizeof(pthread_t));
+    if (loaders == NULL)
+        return EXIT_FAILURE;
+    for (i = 0; i < nload; i++)
+        pthread_create(&loaders[i], NULL, load, NULL);
+    printf("%d busy threads, waking up every %d us for %.0f s each way\n", nload, PERIOD_US, secs);
+    ordinary.secs = realtime.secs = secs;
+    realtime.realtime = 1;
+    pthread_create(&tid, NULL, measure, &ordinary);
+    pthread_join(tid, NULL);
+    report("ordinary", &ordinary);
+    pthread_create(&tid, NULL, measure, &realtime);
+    pthread_join(tid, NULL);
+    report(prio > 0 ? "real-time" : "-rtprio 0", &realtime);
+    stop = 1;
+    for (i = 0; i < nload; i++)
+        pthread_join(loaders[i], NULL);
+    free(loaders);
+    return 0;
+}
@@ -0,0 +1,109 @@
+/*
+ *  lcd-mp3-lcd
+ *
+ *  Checks the LCD works, and times how long it takes to rewrite the whole
+ *  screen, a row at a time the way lcd-mp3 does.
+ *
+ *  lcd-mp3-lcd [-lcd gpio|i2c[:bus[:addr]]] [-size CxR] [-updates N]
+ *      -lcd as lcd-mp3 takes it (GPIO uses lcd-mp3's pins, as BCM numbers),
+ *      a C x R display (default 16x2), N screens (default 200)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "hd44780.h"
+
+// lcd-mp3's wiring, wiringPi pins 3, 14, 4, 12, 13, 6
+static const struct hd44780_pins pins = { 22, 11, 23, 10, 9, 25 };
+
+static double now_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int usage(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-lcd gpio|i2c[:bus[:addr]]] [-size CxR] [-updates N]\n", progName);
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *wiring = "gpio";
+    struct hd44780 *lcd;
+    struct hd44780_stats before, after;
+    char text[41];
+    int cols = 16, rows = 2, updates = 200;
+    int bus = HD44780_I2C_BUS, addr = HD44780_I2C_ADDR;
+    int i, row, col;
+    double t0, secs;
+    char *end;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-lcd") == 0 && i + 1 < argc)
+            wiring = argv[++i];
+        else if (strcmp(argv[i], "-size") == 0 && i + 1 < argc)
+        {
+            if (sscanf(argv[++i], "%dx%d", &cols, &rows) != 2 || cols < 1 || cols > 40 || rows < 1 || rows > 4)
+                return usage(argv[0]);
+        }
+        else if (strcmp(argv[i], "-updates") == 0 && i + 1 < argc)
+        {
+            updates = atoi(argv[++i]);
+            if (updates < 1)
+                return usage(argv[0]);
+        }
+        else
+            return usage(argv[0]);
+    }
+    if (strncmp(wiring, "i2c", 3) == 0)
+    {
+        if (wiring[3] == ':')
+        {
+            bus = strtol(wiring + 4, &end, 0);
+            if (*end == ':')
+                addr = strtol(end + 1, NULL, 0);
+        }
+        lcd = hd44780_open_i2c(bus, addr, cols, rows);
+    }
+    else
+        lcd = hd44780_open_gpio(HD44780_GPIO_CHIP, &pins, cols, rows);
+    if (lcd == NULL)
+    {
+        fprintf(stderr, "Cannot open the LCD (%s): %s\n", wiring, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    hd44780_get_stats(lcd, &before);
+    t0 = now_secs();
+    for (i = 0; i < updates; i++)
+    {
+        for (row = 0; row < rows; row++)
+        {
+            // Different text every time, so nothing is left as it was
+            for (col = 0; col < cols; col++)
+                text[col] = 'A' + (i + row + col) % 26;
+            text[cols] = '\0';
+            hd44780_position(lcd, 0, row);
+            hd44780_puts(lcd, text);
+        }
+    }
+    secs = now_secs() - t0;
+    hd44780_get_stats(lcd, &after);
+    printf("%s, %dx%d: %d screens, %.0f us a screen, %.1f transfers and %.1f bytes a screen\n",
+           wiring, cols, rows, updates, secs * 1e6 / updates,
+           (double)(after.transfers - before.transfers) / updates,
+           (double)(after.bytes - before.bytes) / updates);
+    hd44780_clear(lcd);
+    hd44780_puts(lcd, "lcd-mp3-lcd done");
+    hd44780_close(lcd);
+    return 0;
+}
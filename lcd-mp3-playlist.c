@@ -0,0 +1,85 @@
+/*
+ *  lcd-mp3-playlist
+ *
+ *  Reads a playlist file the way lcd-mp3 -playlist does.
+ *
+ *  lcd-mp3-playlist file.m3u        print the songs it finds
+ *  lcd-mp3-playlist -bench N [file] write an N song playlist (to file, or
+ *                                   /tmp/lcd-mp3-bench.m3u) and time reading it
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include "playlist.h"
+
+static double now_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench(long n, const char *file)
+{
+    struct library library;
+    struct rusage ru;
+    struct stat st;
+    FILE *fp;
+    double t0, secs;
+    long i;
+    int count;
+
+    fp = fopen(file, "w");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "Cannot write %s: %s\n", file, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    fprintf(fp, "#EXTM3U\n");
+    for (i = 0; i < n; i++)
+        fprintf(fp, "#EXTINF:%ld,Artist %ld - Title %ld\nMusic/Artist %04ld/Album %03ld/%02ld - Title %ld.mp3\n",
+                180 + i % 120, i / 100, i, i / 100, i / 10, i % 10, i);
+    fclose(fp);
+    stat(file, &st);
+    library_init(&library);
+    t0 = now_secs();
+    count = playlist_load(&library, file);
+    secs = now_secs() - t0;
+    getrusage(RUSAGE_SELF, &ru);
+    printf("songs: %d  file: %.1f MB  time: %.3f s  %.0f songs/s  %.1f MB/s  max RSS: %ld KB\n",
+           count, st.st_size / 1e6, secs, count / secs, st.st_size / 1e6 / secs, ru.ru_maxrss);
+    library_free(&library);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct library library;
+    int i, n;
+
+    if (argc >= 3 && strcmp(argv[1], "-bench") == 0)
+        return bench(atol(argv[2]), (argc > 3 ? argv[3] : "/tmp/lcd-mp3-bench.m3u"));
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: %s file.m3u | -bench N [file]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    library_init(&library);
+    n = playlist_load(&library, argv[1]);
+    if (n < 0)
+    {
+        fprintf(stderr, "Cannot read %s: %s\n", argv[1], strerror(errno));
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < n; i++)
+        printf("%s\n", library_get(&library, i)->path);
+    library_free(&library);
+    return 0;
+}
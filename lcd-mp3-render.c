@@ -0,0 +1,211 @@
+/*
+ *  lcd-mp3-render
+ *
+ *  Decodes songs the way lcd-mp3 plays them (same decoder set up, same
+ *  output format), but into a WAV file or nowhere instead of the sound
+ *  card, as fast as it goes.  Prints how many times faster than real time
+ *  that is, bytes a second and where the time went; with -crc also a CRC-32
+ *  of each song's PCM, to check a change decodes bit for bit the same.
+ *
+ *  lcd-mp3-render [-wav file | -null] [-decoder name] [-crc] [-playlist file] [song.mp3 ...]
+ *      -null (the default) throws the audio away; -wav writes every song
+ *      into one file (songs in another format than the first are skipped)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "decoder.h"
+#include "sink.h"
+#include "library.h"
+#include "playlist.h"
+
+enum { STAGE_OPEN, STAGE_DECODE, STAGE_OUTPUT, STAGE_CRC, STAGES };
+static const char *stage_names[STAGES] = { "open", "decode", "output", "crc" };
+static double stage_secs[STAGES];
+
+static uint32_t crc_table[256];
+
+static void crc_init(void)
+{
+    uint32_t c;
+    int i, k;
+
+    for (i = 0; i < 256; i++)
+    {
+        c = i;
+        for (k = 0; k < 8; k++)
+            c = (c >> 1) ^ (0xedb88320 & -(c & 1));
+        crc_table[i] = c;
+    }
+}
+
+// Carries on crc (start with 0) over len more bytes
+static uint32_t crc32(uint32_t crc, const unsigned char *p, size_t len)
+{
+    crc = ~crc;
+    while (len--)
+        crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static double now_secs(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Adds the time since *t to stage and moves *t on
+static void lap(int stage, double *t)
+{
+    double now = now_secs(CLOCK_MONOTONIC);
+
+    stage_secs[stage] += now - *t;
+    *t = now;
+}
+
+/*
+  Renders one song into out (opened here for the first song).
+  Returns the seconds of audio, or -1 if it couldn't be rendered
+*/
+static double render(const char *path, struct sink *out, int kind, const char *wav, int crc)
+{
+    mpg123_handle *mh;
+    unsigned char *buffer;
+    size_t size, done;
+    long rate;
+    int channels, encoding, bits, err;
+    uint32_t sum = 0;
+    uint64_t bytes = 0;
+    double t = now_secs(CLOCK_MONOTONIC);
+
+    mh = decoder_open(path, &rate, &channels, &encoding);
+    bits = (mh != NULL ? mpg123_encsize(encoding) * 8 : 0);
+    if (mh != NULL && out->rate == 0 && sink_open(out, kind, wav, rate, channels, bits) != 0)
+    {
+        fprintf(stderr, "Cannot open %s: %s\n", (wav != NULL ? wav : "the output"), strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    lap(STAGE_OPEN, &t);
+    if (mh == NULL)
+        return -1;
+    if (rate != out->rate || channels != out->channels || bits != out->bits)
+    {
+        fprintf(stderr, "%s: %ld Hz, %d channels isn't the format of the first song; skipped\n", path, rate, channels);
+        decoder_close(mh);
+        return -1;
+    }
+    size = mpg123_outblock(mh);
+    buffer = malloc(size);
+    if (buffer == NULL)
+    {
+        perror("malloc: render");
+        exit(EXIT_FAILURE);
+    }
+    for (;;)
+    {
+        err = mpg123_read(mh, buffer, size, &done);
+        lap(STAGE_DECODE, &t);
+        if (done > 0)
+        {
+            sink_write(out, buffer, done);
+            lap(STAGE_OUTPUT, &t);
+            if (crc)
+            {
+                sum = crc32(sum, buffer, done);
+                lap(STAGE_CRC, &t);
+            }
+            bytes += done;
+        }
+        if (err != MPG123_OK && err != MPG123_NEW_FORMAT)
+            break;
+    }
+    if (err != MPG123_DONE)
+        fprintf(stderr, "%s: stopped early: %s\n", path, mpg123_strerror(mh));
+    free(buffer);
+    decoder_close(mh);
+    if (crc)
+        printf("%08x  %s\n", sum, path);
+    return (double)bytes / (rate * channels * (bits / 8));
+}
+
+int main(int argc, char **argv)
+{
+    struct library songs;
+    struct sink out;
+    const char *wav = NULL, *decoder = NULL;
+    int kind = SINK_NULL, crc = 0, failed = 0;
+    int i, n;
+    double secs, audio = 0, wall, cpu, total = 0;
+
+    library_init(&songs);
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-wav") == 0 && i + 1 < argc)
+        {
+            kind = SINK_WAV;
+            wav = argv[++i];
+        }
+        else if (strcmp(argv[i], "-null") == 0)
+            kind = SINK_NULL;
+        else if (strcmp(argv[i], "-decoder") == 0 && i + 1 < argc)
+            decoder = argv[++i];
+        else if (strcmp(argv[i], "-crc") == 0)
+            crc = 1;
+        else if (strcmp(argv[i], "-playlist") == 0 && i + 1 < argc)
+        {
+            if (playlist_load(&songs, argv[++i]) < 0)
+            {
+                fprintf(stderr, "Cannot read playlist %s: %s\n", argv[i], strerror(errno));
+                return EXIT_FAILURE;
+            }
+        }
+        else if (argv[i][0] == '-')
+            break;
+        else
+            library_add(&songs, argv[i]);
+    }
+    if (i < argc || library_count(&songs) == 0)
+    {
+        fprintf(stderr, "Usage: %s [-wav file | -null] [-decoder name] [-crc] [-playlist file] [song.mp3 ...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    crc_init();
+    mpg123_init();
+    if (decoder != NULL && decoder_choose(decoder, NULL, NULL) != 0)
+        return EXIT_FAILURE;
+    memset(&out, 0, sizeof(out));
+
+    wall = now_secs(CLOCK_MONOTONIC);
+    cpu = now_secs(CLOCK_PROCESS_CPUTIME_ID);
+    n = library_count(&songs);
+    for (i = 0; i < n; i++)
+    {
+        secs = render(library_get(&songs, i)->path, &out, kind, wav, crc);
+        if (secs < 0)
+            failed++;
+        else
+            audio += secs;
+    }
+    sink_close(&out);
+    wall = now_secs(CLOCK_MONOTONIC) - wall;
+    cpu = now_secs(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+
+    printf("%d songs (%d failed), %.1f s of audio in %.2f s (%.2f s CPU) with decoder %s\n",
+           n, failed, audio, wall, cpu, (decoder_name() != NULL ? decoder_name() : "default"));
+    printf("%.1fx real time, %.0f bytes/s out\n", (wall > 0 ? audio / wall : 0), (wall > 0 ? out.bytes / wall : 0));
+    for (i = 0; i < STAGES; i++)
+        total += stage_secs[i];
+    for (i = 0; i < STAGES; i++)
+    {
+        if (i != STAGE_CRC || crc)
+            printf("  %-7s %8.1f ms  %5.1f%%\n", stage_names[i], stage_secs[i] * 1000, (total > 0 ? stage_secs[i] * 100 / total : 0));
+    }
+    mpg123_exit();
+    return (failed > 0 ? EXIT_FAILURE : 0);
+}
@@ -0,0 +1,259 @@
+/*
+ *  lcd-mp3-status
+ *
+ *  Reads the status record lcd-mp3 publishes in shared memory.
+ *
+ *  lcd-mp3-status             print the status once
+ *  lcd-mp3-status -watch ms   print it every ms milliseconds
+ *  lcd-mp3-status -bench N    time N reads and count seqlock retries
+ *  lcd-mp3-status -check secs [readers]
+ *                             check the seqlock for secs: a writer thread
+ *                             publishes records that can be checked (in a
+ *                             segment of its own) while readers (default 4)
+ *                             read them; exits non-zero if any was torn
+ *  lcd-mp3-status -wakeups pid secs
+ *                             count how often process pid's threads are
+ *                             woken (context switches) and its CPU use over
+ *                             secs, e.g. to see lcd-mp3 go idle when paused
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#include "status.h"
+
+#define CHECK_READERS 16
+
+struct checker {
+    const struct status_record *shm;
+    long reads;
+    long retries;
+    long torn;
+};
+
+static int checking = 1;
+
+static void *check_writer(void *arg)
+{
+    (void)arg;
+    while (__atomic_load_n(&checking, __ATOMIC_ACQUIRE))
+        status_check_write();
+    return NULL;
+}
+
+static void *check_reader(void *arg)
+{
+    struct checker *c = arg;
+    struct status_record s;
+    uint64_t last = 0;
+
+    while (__atomic_load_n(&checking, __ATOMIC_ACQUIRE))
+    {
+        c->retries += status_read(c->shm, &s);
+        if (status_check(&s) != 0 || s.updates < last)
+        {
+            if (c->torn++ == 0)
+                fprintf(stderr, "Torn record at update %llu\n", (unsigned long long)s.updates);
+        }
+        last = s.updates;
+        c->reads++;
+    }
+    return NULL;
+}
+
+// -check: a writer and readers going at a segment of our own
+static int check(double secs, int readers)
+{
+    static struct checker c[CHECK_READERS];
+    pthread_t writer, tid[CHECK_READERS];
+    const struct status_record *shm;
+    long reads = 0, retries = 0, torn = 0;
+    int i;
+
+    if (status_open_at(STATUS_CHECK) != 0 || (shm = status_attach_at(STATUS_CHECK)) == NULL)
+    {
+        fprintf(stderr, "Cannot open %s: %s\n", STATUS_CHECK, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    pthread_create(&writer, NULL, check_writer, NULL);
+    for (i = 0; i < readers; i++)
+    {
+        c[i].shm = shm;
+        pthread_create(&tid[i], NULL, check_reader, &c[i]);
+    }
+    usleep((useconds_t)(secs * 1e6));
+    __atomic_store_n(&checking, 0, __ATOMIC_RELEASE);
+    pthread_join(writer, NULL);
+    for (i = 0; i < readers; i++)
+    {
+        pthread_join(tid[i], NULL);
+        reads += c[i].reads;
+        retries += c[i].retries;
+        torn += c[i].torn;
+    }
+    printf("writes: %llu  reads: %ld  retries: %ld  torn: %ld\n", (unsigned long long)shm->updates, reads, retries, torn);
+    status_close();
+    return (torn == 0 ? 0 : EXIT_FAILURE);
+}
+
+static const char *state_name(int state)
+{
+    switch (state)
+    {
+        case PLAY:  return "playing";
+        case PAUSE: return "paused";
+        case STOP:  return "stopped";
+        default:    return "changing";
+    }
+}
+
+static void print_status(const struct status_record *s)
+{
+    printf("state:     %s\n"
+           "path:      %s\n"
+           "title:     %s\n"
+           "artist:    %s\n"
+           "position:  %lld.%03lld / %lld.%03lld s\n"
+           "volume:    %d\n"
+           "buffer:    %lld ms\n"
+           "underruns: %u\n"
+           "cpu time:  %lld.%03lld s\n"
+           "updates:   %llu\n",
+           state_name(s->state), s->path, s->title, s->artist,
+           (long long)s->position_ms / 1000, (long long)s->position_ms % 1000,
+           (long long)s->duration_ms / 1000, (long long)s->duration_ms % 1000,
+           s->volume, (long long)s->buffer_ms, s->underruns,
+           (long long)s->cpu_us / 1000000, (long long)(s->cpu_us / 1000) % 1000,
+           (unsigned long long)s->updates);
+}
+
+// Context switches of all of pid's threads so far, and its CPU time in clock ticks
+static int count_wakeups(const char *pid, unsigned long long *switches, unsigned long long *ticks)
+{
+    char path[300], line[256], *p;
+    unsigned long long n;
+    struct dirent *de;
+    FILE *fp;
+    DIR *dir;
+
+    *switches = *ticks = 0;
+    snprintf(path, sizeof(path), "/proc/%s/task", pid);
+    dir = opendir(path);
+    if (dir == NULL)
+        return -1;
+    while ((de = readdir(dir)) != NULL)
+    {
+        if (de->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "/proc/%s/task/%s/status", pid, de->d_name);
+        fp = fopen(path, "r");
+        if (fp == NULL)
+            continue; // the thread has gone
+        while (fgets(line, sizeof(line), fp) != NULL)
+        {
+            if (sscanf(line, "voluntary_ctxt_switches: %llu", &n) == 1 ||
+                sscanf(line, "nonvoluntary_ctxt_switches: %llu", &n) == 1)
+                *switches += n;
+        }
+        fclose(fp);
+    }
+    closedir(dir);
+    // utime and stime are the 14th and 15th fields; the name (2nd) can have spaces
+    snprintf(path, sizeof(path), "/proc/%s/stat", pid);
+    fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+    if (fgets(line, sizeof(line), fp) != NULL && (p = strrchr(line, ')')) != NULL)
+    {
+        unsigned long long utime, stime;
+
+        if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) == 2)
+            *ticks = utime + stime;
+    }
+    fclose(fp);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const struct status_record *shm;
+    struct status_record s;
+    struct timespec t0, t1;
+    long i, n, retries = 0;
+    double secs;
+
+    if (argc == 4 && strcmp(argv[1], "-wakeups") == 0)
+    {
+        unsigned long long sw0, sw1, tk0, tk1;
+
+        secs = atof(argv[3]);
+        if (count_wakeups(argv[2], &sw0, &tk0) != 0)
+        {
+            fprintf(stderr, "Cannot read /proc/%s: %s\n", argv[2], strerror(errno));
+            return EXIT_FAILURE;
+        }
+        usleep((useconds_t)(secs * 1e6));
+        if (count_wakeups(argv[2], &sw1, &tk1) != 0)
+        {
+            fprintf(stderr, "Cannot read /proc/%s: %s\n", argv[2], strerror(errno));
+            return EXIT_FAILURE;
+        }
+        printf("wake ups: %.1f/s  cpu: %.1f%%\n", (sw1 - sw0) / secs,
+               (tk1 - tk0) * 100.0 / sysconf(_SC_CLK_TCK) / secs);
+        return 0;
+    }
+    if ((argc == 3 || argc == 4) && strcmp(argv[1], "-check") == 0)
+    {
+        n = (argc == 4 ? atol(argv[3]) : 4);
+        if (n < 1 || n > CHECK_READERS)
+        {
+            fprintf(stderr, "1 - %d readers\n", CHECK_READERS);
+            return EXIT_FAILURE;
+        }
+        return check(atof(argv[2]), n);
+    }
+    shm = status_attach();
+    if (shm == NULL)
+    {
+        fprintf(stderr, "Cannot open %s: %s (is lcd-mp3 running?)\n", STATUS_SHM, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    if (argc == 3 && strcmp(argv[1], "-watch") == 0)
+    {
+        for (;;)
+        {
+            status_read(shm, &s);
+            print_status(&s);
+            printf("\n");
+            fflush(stdout);
+            usleep(atol(argv[2]) * 1000);
+        }
+    }
+    else if (argc == 3 && strcmp(argv[1], "-bench") == 0)
+    {
+        n = atol(argv[2]);
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (i = 0; i < n; i++)
+            retries += status_read(shm, &s);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        printf("reads: %ld  time: %.3f s  %.1f ns/read  retries: %ld\n", n, secs, secs * 1e9 / n, retries);
+    }
+    else if (argc == 1)
+    {
+        status_read(shm, &s);
+        print_status(&s);
+    }
+    else
+    {
+        fprintf(stderr, "Usage: %s [-watch ms | -bench N | -wakeups pid secs | -check secs [readers]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
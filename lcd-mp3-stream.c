@@ -0,0 +1,174 @@
+/*
+ *  lcd-mp3-stream
+ *
+ *  Checks that lcd-mp3 -stream stays within its memory however fast the
+ *  other end writes.  A child process writes a song (-repeat times over)
+ *  into a FIFO as fast as it can while it's decoded from there the way
+ *  -stream does it, and the most mpg123 ever held undecoded and the peak
+ *  memory use are printed.
+ *
+ *  lcd-mp3-stream [-wav file | -null] [-realtime] [-repeat n] [-fifo path] song.mp3
+ *      -null (the default) decodes as fast as it goes; -realtime holds it
+ *      back to the speed it would play at, so the writer is always ahead
+ *      Exits 1 if more than STREAM_MAX_BUFFERED bytes were ever held
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <mpg123.h>
+
+#include "stream.h"
+#include "sink.h"
+
+static double now_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The child: song repeat times into the FIFO, as fast as the pipe takes it
+static void writer(const char *fifo, const char *song, int repeat)
+{
+    char buf[65536];
+    long long total = 0;
+    double t0 = now_secs();
+    size_t n;
+    FILE *in;
+    int fd, i;
+
+    fd = open(fifo, O_WRONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Cannot open %s: %s\n", fifo, strerror(errno));
+        _exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < repeat; i++)
+    {
+        in = fopen(song, "rb");
+        if (in == NULL)
+        {
+            fprintf(stderr, "Cannot open %s: %s\n", song, strerror(errno));
+            _exit(EXIT_FAILURE);
+        }
+        while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+        {
+            if (write(fd, buf, n) != (ssize_t)n)
+                _exit(EXIT_FAILURE);
+            total += n;
+        }
+        fclose(in);
+    }
+    close(fd);
+    fprintf(stderr, "writer: %lld bytes in %.2f s\n", total, now_secs() - t0);
+    _exit(0);
+}
+
+int main(int argc, char **argv)
+{
+    struct stream_stats st;
+    struct rusage ru;
+    struct pollfd p;
+    char tmpdir[] = "/tmp/lcd-mp3-stream.XXXXXX", fifo[64];
+    const char *fifo_path = NULL, *wav = NULL, *song = NULL;
+    int i, fd, status, realtime = 0, repeat = 1, made = 0, ok;
+    double secs;
+    pid_t child;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-wav") == 0 && i + 1 < argc)
+            wav = argv[++i];
+        else if (strcmp(argv[i], "-null") == 0)
+            wav = NULL;
+        else if (strcmp(argv[i], "-realtime") == 0)
+            realtime = 1;
+        else if (strcmp(argv[i], "-repeat") == 0 && i + 1 < argc)
+            repeat = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-fifo") == 0 && i + 1 < argc)
+            fifo_path = argv[++i];
+        else if (argv[i][0] == '-' || song != NULL)
+            break;
+        else
+            song = argv[i];
+    }
+    if (i < argc || song == NULL || repeat < 1)
+    {
+        fprintf(stderr, "Usage: %s [-wav file | -null] [-realtime] [-repeat n] [-fifo path] song.mp3\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (fifo_path == NULL)
+    {
+        if (mkdtemp(tmpdir) == NULL)
+        {
+            fprintf(stderr, "Cannot make a directory for the FIFO: %s\n", strerror(errno));
+            return EXIT_FAILURE;
+        }
+        snprintf(fifo, sizeof(fifo), "%s/fifo", tmpdir);
+        fifo_path = fifo;
+    }
+    if (mkfifo(fifo_path, 0600) == 0)
+        made = 1;
+    else if (errno != EEXIST)
+    {
+        fprintf(stderr, "Cannot make %s: %s\n", fifo_path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    // Open our end first, so the writer doesn't wait for us
+    fd = open(fifo_path, O_RDONLY | O_NONBLOCK);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Cannot open %s: %s\n", fifo_path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    child = fork();
+    if (child == 0)
+        writer(fifo_path, song, repeat);
+    if (child < 0)
+    {
+        fprintf(stderr, "Cannot fork: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    // Until the writer has opened it, reading gives end of file
+    p.fd = fd;
+    p.events = POLLIN;
+    poll(&p, 1, -1);
+    mpg123_init();
+    secs = now_secs();
+    ok = (stream_play(fd, (wav != NULL ? SINK_WAV : SINK_NULL), wav, realtime) == 0);
+    if (!ok)
+        fprintf(stderr, "Cannot play the stream: %s\n", strerror(errno));
+    secs = now_secs() - secs;
+    close(fd);
+    waitpid(child, &status, 0);
+    if (made)
+        unlink(fifo_path);
+    if (fifo_path == fifo)
+        rmdir(tmpdir);
+
+    stream_get_stats(&st);
+    getrusage(RUSAGE_SELF, &ru);
+    printf("%llu bytes in, %.1f s of audio in %.2f s (%.1fx real time)\n",
+           (unsigned long long)st.bytes_in, st.audio_secs, secs, (secs > 0 ? st.audio_secs / secs : 0));
+    printf("most held undecoded %ld bytes (limit %d), peak memory %ld KB\n",
+           st.max_buffered, STREAM_MAX_BUFFERED, ru.ru_maxrss);
+    mpg123_exit();
+    if (st.max_buffered > STREAM_MAX_BUFFERED)
+    {
+        printf("FAIL: held more than the limit\n");
+        return EXIT_FAILURE;
+    }
+    return (ok && WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : EXIT_FAILURE);
+}
@@ -0,0 +1,327 @@
+/*
+ *  lcd-mp3-stress
+ *
+ *  Hammers player_state.c the way lcd-mp3 uses it, only much harder: sender
+ *  threads (the buttons and the control socket) push random commands, the
+ *  main thread takes them, publishes snapshots, changes tracks, pauses,
+ *  plays and seeks at random, a player thread waits on pauses and takes the
+ *  seeks, and reader threads (the LCD, the status page) read the snapshots.
+ *  Everything sent and published says what it should look like, so anything
+ *  lost, repeated, out of order or torn is counted as an error, as is a
+ *  main loop that sleeps through a command being sent.  Build it
+ *  with make stress, which uses ThreadSanitizer to catch the races that
+ *  don't show up in the counts.
+ *
+ *  lcd-mp3-stress [-secs S] [-senders N] [-readers N] [-seed N]
+ *      S seconds (default 5), N senders (default 4) and readers (default 4)
+ *
+ *  Exits non-zero if anything went wrong.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "player_state.h"
+
+#define MAX_SENDERS 16
+#define MAX_READERS 8     // player_state.c has this many slots
+#define SHOW_ERRORS 10    // printed; the rest are only counted
+#define WAKE_MS     1000  // a sleeping main loop not woken in this long missed a command
+
+static int stop = FALSE;
+static int errors = 0;
+static unsigned seed = 1;
+static unsigned long sent[MAX_SENDERS];
+static unsigned long reads = 0, seeks = 0, waits = 0;
+
+__attribute__((format(printf, 1, 2)))
+static void error(const char *fmt, ...)
+{
+    va_list ap;
+
+    if (__atomic_fetch_add(&errors, 1, __ATOMIC_RELAXED) < SHOW_ERRORS)
+    {
+        va_start(ap, fmt);
+        vfprintf(stderr, fmt, ap);
+        va_end(ap);
+        fputc('\n', stderr);
+    }
+}
+
+static int stopped(void)
+{
+    return __atomic_load_n(&stop, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Senders: each one numbers its commands and puts its own number and the
+ * command's in the path, so the main thread can tell they all came, once,
+ * in the order they were sent.
+ */
+static void *sender(void *arg)
+{
+    long id = (long)arg;
+    unsigned r = seed + id;
+    char path[MAXDATALEN];
+    unsigned long n = 0;
+
+    while (!stopped())
+    {
+        snprintf(path, MAXDATALEN, "sender %ld command %lu", id, n);
+        if (state_send_cmd(rand_r(&r) % (CMD_BROWSE + 1), n, rand_r(&r) % 2, path) == 0)
+            n++;
+        else
+            sched_yield(); // full
+        // Now and then the queue runs dry, so the main loop gets to sleep
+        if (rand_r(&r) % 8 == 0)
+            usleep(rand_r(&r) % 1000);
+    }
+    __atomic_store_n(&sent[id], n, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void check_cmd(const struct control_cmd *cmd, unsigned long *next, int senders)
+{
+    long id;
+    unsigned long n;
+
+    if (sscanf(cmd->path, "sender %ld command %lu", &id, &n) != 2 || id < 0 || id >= senders)
+    {
+        error("command %d has a bad path '%s'", cmd->cmd, cmd->path);
+        return;
+    }
+    if (n != (unsigned long)cmd->arg || cmd->cmd < 0 || cmd->cmd > CMD_BROWSE)
+        error("sender %ld's command %lu has cmd %d arg %ld", id, n, cmd->cmd, cmd->arg);
+    if (n != next[id])
+        error("sender %ld's command %lu came when %lu was next", id, n, next[id]);
+    next[id] = n + 1;
+}
+
+/*
+ * Snapshots: every field follows from the version, and the track's from
+ * its index, so a reader can check what it gets.
+ */
+static void fill_track(struct track_info *track, int index)
+{
+    memset(track, 0, sizeof(struct track_info));
+    track->index = index;
+    snprintf(track->filename, MAXDATALEN, "/music/%d.mp3", index);
+    snprintf(track->base_filename, MAXDATALEN, "%d.mp3", index);
+    snprintf(track->title, MAXDATALEN, "title %d", index);
+    snprintf(track->artist, MAXDATALEN, "artist %d", index);
+    track->gain_scale = 1.0;
+}
+
+static void fill_snapshot(struct player_snapshot *snap, unsigned long version, const struct track_info *track)
+{
+    snap->version = version;
+    snap->track = track;
+    snap->play_status = version % (QUIT + 1);
+    snap->shuffle = version % 2;
+    snap->volume = version % 100;
+    snap->muted = (version / 2) % 2;
+    snap->queued = (version / 4) % 2;
+}
+
+static void check_snapshot(const struct player_snapshot *snap, unsigned long *last)
+{
+    struct player_snapshot want;
+    struct track_info track;
+
+    fill_snapshot(&want, snap->version, snap->track);
+    if (snap->play_status != want.play_status || snap->shuffle != want.shuffle || snap->volume != want.volume ||
+        snap->muted != want.muted || snap->queued != want.queued)
+        error("snapshot %lu is torn or freed", snap->version);
+    if (snap->version < *last)
+        error("snapshot %lu came after %lu", snap->version, *last);
+    *last = snap->version;
+    if (snap->track == NULL)
+        return;
+    fill_track(&track, snap->track->index);
+    if (memcmp(&track, snap->track, sizeof(track)) != 0)
+        error("track %d of snapshot %lu is torn or freed", snap->track->index, snap->version);
+    if ((unsigned long)snap->track->index > snap->version)
+        error("track %d is newer than snapshot %lu", snap->track->index, snap->version);
+}
+
+static void *reader(void *arg)
+{
+    const struct player_snapshot *snap;
+    unsigned long last = 0, n = 0;
+    int slot = state_reader_register();
+
+    (void)arg;
+    if (slot < 0)
+    {
+        error("no reader slot left");
+        return NULL;
+    }
+    while (!stopped())
+    {
+        snap = state_read_lock(slot);
+        if (snap != NULL)
+            check_snapshot(snap, &last);
+        state_read_unlock(slot);
+        n++;
+    }
+    __atomic_add_fetch(&reads, n, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/*
+ * The player: waits while paused and takes seeks, which the main thread
+ * makes odd when they're relative.
+ */
+static void *player_thread(void *arg)
+{
+    unsigned r = seed - 1;
+    long secs;
+    int relative;
+
+    (void)arg;
+    while (!stopped())
+    {
+        if (rand_r(&r) % 2 ? state_check_pause() : !state_wait_resume(rand_r(&r) % 3))
+            __atomic_add_fetch(&waits, 1, __ATOMIC_RELAXED);
+        if (state_take_seek(&secs, &relative))
+        {
+            if (relative != (secs % 2 != 0))
+                error("seek %ld came with relative %d", secs, relative);
+            __atomic_add_fetch(&seeks, 1, __ATOMIC_RELAXED);
+        }
+        if (state_get_status() < PLAY || state_get_status() > QUIT)
+            error("status %d", state_get_status());
+        state_song_over(rand_r(&r) % 2);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    static pthread_t senders[MAX_SENDERS], readers[MAX_READERS];
+    struct player_snapshot snap;
+    struct control_cmd cmd;
+    struct track_info *track = NULL, *old;
+    unsigned long next[MAX_SENDERS] = { 0 }, version = 0, taken = 0, total = 0, woken = 0;
+    struct timespec start, now, t0;
+    pthread_t tid;
+    int i, nsend = 4, nread = 4;
+    unsigned r;
+    double secs = 5;
+    long n;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-secs") == 0 && i + 1 < argc)
+            secs = atof(argv[++i]);
+        else if (strcmp(argv[i], "-senders") == 0 && i + 1 < argc)
+            nsend = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-readers") == 0 && i + 1 < argc)
+            nread = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc)
+            seed = strtoul(argv[++i], NULL, 0);
+        else
+        {
+            fprintf(stderr, "Usage: %s [-secs S] [-senders N] [-readers N] [-seed N]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (nsend < 1 || nsend > MAX_SENDERS || nread < 0 || nread > MAX_READERS)
+    {
+        fprintf(stderr, "1 - %d senders and 0 - %d readers\n", MAX_SENDERS, MAX_READERS);
+        return EXIT_FAILURE;
+    }
+    r = seed;
+    for (i = 0; i < nsend; i++)
+        pthread_create(&senders[i], NULL, sender, (void *)(long)i);
+    for (i = 0; i < nread; i++)
+        pthread_create(&readers[i], NULL, reader, NULL);
+    pthread_create(&tid, NULL, player_thread, NULL);
+
+    // The main loop
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do
+    {
+        if (rand_r(&r) % 8 == 0)
+        {
+            // Paused: the senders never stop for long, so one must wake us
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            state_wait_cmd(WAKE_MS);
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            n = (now.tv_sec - t0.tv_sec) * 1000000L + (now.tv_nsec - t0.tv_nsec) / 1000;
+            if (n >= WAKE_MS * 1000L)
+                error("the main loop slept %d ms with commands being sent", WAKE_MS);
+            else if (n > 50)
+                woken++;
+        }
+        else if (rand_r(&r) % 2 == 0)
+            state_wait_cmd(rand_r(&r) % 3);
+        while (state_get_cmd(&cmd))
+        {
+            check_cmd(&cmd, next, nsend);
+            taken++;
+        }
+        switch (rand_r(&r) % 4)
+        {
+        case 0:
+            // A new song now and then, the old one retired after the snapshot
+            old = NULL;
+            if (track == NULL || rand_r(&r) % 4 == 0)
+            {
+                old = track;
+                track = malloc(sizeof(struct track_info));
+                if (track == NULL)
+                    return EXIT_FAILURE;
+                fill_track(track, version + 1);
+            }
+            fill_snapshot(&snap, ++version, track);
+            state_publish(&snap);
+            if (old != NULL)
+                state_retire_track(old);
+            break;
+        case 1:
+            state_set_status(rand_r(&r) % (QUIT + 1));
+            break;
+        case 2:
+            n = (long)(rand_r(&r) % 2000) - 1000;
+            state_seek(n, n % 2 != 0);
+            break;
+        default:
+            state_is_song_over();
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while (now.tv_sec - start.tv_sec + (now.tv_nsec - start.tv_nsec) / 1e9 < secs);
+
+    __atomic_store_n(&stop, TRUE, __ATOMIC_RELEASE);
+    // The player may be waiting on a pause
+    state_set_status(PLAY);
+    pthread_join(tid, NULL);
+    for (i = 0; i < nread; i++)
+        pthread_join(readers[i], NULL);
+    for (i = 0; i < nsend; i++)
+        pthread_join(senders[i], NULL);
+    while (state_get_cmd(&cmd))
+    {
+        check_cmd(&cmd, next, nsend);
+        taken++;
+    }
+    for (i = 0; i < nsend; i++)
+    {
+        if (next[i] != sent[i])
+            error("sender %d sent %lu commands, %lu came", i, sent[i], next[i]);
+        total += sent[i];
+    }
+    if (taken != total)
+        error("%lu commands taken, %lu sent", taken, total);
+
+    printf("%lu commands, %lu snapshots, %lu reads, %lu seeks, %lu pauses waited on, %lu sleeps woken: %d errors\n",
+           taken, version, reads, seeks, waits, woken, errors);
+    return (errors == 0 ? 0 : EXIT_FAILURE);
+}
@@ -0,0 +1,214 @@
+/*
+ *  lcd-mp3-tags
+ *
+ *  Builds the tag search index for a directory and searches it.
+ *
+ *  lcd-mp3-tags dir [query]     index dir, then print the songs matching query
+ *                               (or all of them in album order if there's no query)
+ *  lcd-mp3-tags -bench N [dir]  make N small tagged songs in dir (default
+ *                               /tmp/lcd-mp3-tags) and time indexing (with and
+ *                               without the cache), searching and album order
+ *
+ *  The tag cache is dir/../lcd-mp3-tags.cache so it doesn't get in the way
+ *  of the real one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "tagindex.h"
+
+static struct library library;
+
+static double now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+// An ID3v2.3 text frame
+static size_t frame(unsigned char *p, const char *id, const char *text)
+{
+    size_t len = strlen(text) + 1;
+
+    memcpy(p, id, 4);
+    p[4] = len >> 24;
+    p[5] = len >> 16;
+    p[6] = len >> 8;
+    p[7] = len;
+    p[8] = p[9] = 0;
+    p[10] = 0; // Latin-1
+    memcpy(p + 11, text, len - 1);
+    return 10 + len;
+}
+
+static int make_songs(const char *dir, int n)
+{
+    static const char *genres[] = { "Rock", "Pop", "Jazz", "Blues", "(17)", "Classical" };
+    unsigned char tag[1024];
+    char path[PATH_MAX], text[128];
+    size_t len;
+    int i, j, fd;
+
+    // Out of order, like songs copied to a FAT stick
+    for (j = 0; j < n; j++)
+    {
+        i = (int)((j * 7919LL) % n);
+        // 10 songs an album, 5 albums an artist
+        snprintf(path, PATH_MAX, "%s/artist%05d", dir, i / 50);
+        mkdir(path, 0755);
+        snprintf(path, PATH_MAX, "%s/artist%05d/%02d - Song number %d.mp3", dir, i / 50, i % 10, i);
+        len = 10;
+        snprintf(text, sizeof(text), "Song number %d", i);
+        len += frame(tag + len, "TIT2", text);
+        snprintf(text, sizeof(text), "The Artist %d", i / 50);
+        len += frame(tag + len, "TPE1", text);
+        snprintf(text, sizeof(text), "Album %d of %d", i / 10 % 5, i / 50);
+        len += frame(tag + len, "TALB", text);
+        len += frame(tag + len, "TCON", genres[i % 6]);
+        snprintf(text, sizeof(text), "%d/10", i % 10 + 1);
+        len += frame(tag + len, "TRCK", text);
+        memcpy(tag, "ID3\3\0\0", 6);
+        tag[6] = 0;
+        tag[7] = 0;
+        tag[8] = (len - 10) >> 7;
+        tag[9] = (len - 10) & 0x7f;
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || write(fd, tag, len) != (ssize_t)len)
+        {
+            fprintf(stderr, "Cannot write %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+        close(fd);
+    }
+    return 0;
+}
+
+static void index_dir(const char *dir, const char *cache)
+{
+    struct tagindex_stats st;
+    double t0, t1;
+
+    library_free(&library);
+    library_init(&library);
+    t0 = now_ms();
+    if (library_scan(&library, dir) != 0)
+    {
+        fprintf(stderr, "Cannot read %s: %s\n", dir, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    t1 = now_ms();
+    if (tagindex_start(&library, cache) != 0)
+    {
+        fprintf(stderr, "Cannot start indexing: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    tagindex_wait();
+    tagindex_get_stats(&st);
+    printf("%u songs (scan %.0f ms, %u tags from the cache), index built in %.0f ms (tags %.0f ms, index %.0f ms)\n"
+           "%u names, %u words, %u postings, %.1f MB\n"
+           "per 10k songs: %.0f ms to build (%.0f ms of it indexing), %.0f KB\n",
+           st.tracks, t1 - t0, st.cache_hits, now_ms() - t1, st.read_us / 1000.0, st.index_us / 1000.0,
+           st.values, st.terms, st.postings, st.bytes / 1e6,
+           (st.read_us + st.index_us) / 1000.0 * 10000 / (st.tracks ? st.tracks : 1),
+           st.index_us / 1000.0 * 10000 / (st.tracks ? st.tracks : 1),
+           st.bytes / 1024.0 * 10000 / (st.tracks ? st.tracks : 1));
+}
+
+static void album_order(int print)
+{
+    double t0;
+    int *tracks, i, n = library_count(&library);
+
+    tracks = malloc(n * sizeof(int));
+    if (tracks == NULL)
+        return;
+    for (i = 0; i < n; i++)
+        tracks[i] = i;
+    t0 = now_ms();
+    tagindex_album_order(tracks, n);
+    printf("album order of %d songs in %.1f ms\n", n, now_ms() - t0);
+    for (i = 0; print && i < n; i++)
+        printf("  %s\n", library_get(&library, tracks[i])->path);
+    free(tracks);
+}
+
+static int search(const char *query, int print)
+{
+    double t0 = now_ms();
+    int *tracks, i, n;
+
+    n = tagindex_search(query, &tracks);
+    if (n < 0)
+    {
+        fprintf(stderr, "Search failed: %s\n", strerror(errno));
+        return -1;
+    }
+    printf("%-24s %6d songs in %.2f ms\n", query, n, now_ms() - t0);
+    for (i = 0; print && i < n; i++)
+        printf("  %s\n", library_get(&library, tracks[i])->path);
+    free(tracks);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    char artist[128], cache[PATH_MAX];
+    double t0;
+    int *tracks, n;
+    const char *dir;
+
+    library_init(&library);
+    if (argc >= 3 && strcmp(argv[1], "-bench") == 0)
+    {
+        dir = (argc > 3 ? argv[3] : "/tmp/lcd-mp3-tags");
+        snprintf(cache, PATH_MAX, "%s/../lcd-mp3-tags.cache", dir);
+        mkdir(dir, 0755);
+        if (make_songs(dir, atoi(argv[2])) != 0)
+            return EXIT_FAILURE;
+        unlink(cache);
+        index_dir(dir, cache);
+        // Stopping waits for the cache to be written; then again, from the cache
+        tagindex_stop();
+        index_dir(dir, cache);
+        album_order(0);
+        search("artist:the", 0);
+        search("artist:artist 12", 0);
+        search("album:album 3 rock", 0);
+        search("genre:classical", 0);
+        search("song", 0);
+        t0 = now_ms();
+        if (tagindex_artist(0, artist, sizeof(artist)) == 0)
+        {
+            n = tagindex_by_artist(artist, &tracks);
+            printf("first artist '%s': %d songs in %.2f ms (sorting the artists included)\n", artist, n, now_ms() - t0);
+            free(tracks);
+        }
+    }
+    else if (argc == 2 || argc == 3)
+    {
+        snprintf(cache, PATH_MAX, "%s/../lcd-mp3-tags.cache", argv[1]);
+        index_dir(argv[1], cache);
+        if (argc == 3)
+            search(argv[2], 1);
+        else
+            album_order(1);
+    }
+    else
+    {
+        fprintf(stderr, "Usage: %s dir [query] | -bench N [dir]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    tagindex_stop();
+    library_free(&library);
+    return 0;
+}
@@ -0,0 +1,197 @@
+/*
+ *  lcd-mp3-uisim
+ *
+ *  Runs lcd-mp3's button and scrolling logic on the virtual clock: a
+ *  made-up user presses (bouncy) buttons and the odd noise spike comes
+ *  along while both rows scroll, one tick per ms like the main loop.
+ *  Prints what happened, a checksum of everything that went to the LCD
+ *  (the same seed always gives the same one) and the CPU time per tick.
+ *
+ *  lcd-mp3-uisim [-hours H] [-seed S] [-checksum C]
+ *      H hours of simulated time (default 10), S for the made-up user, C
+ *      the checksum the same H and S gave before
+ *
+ *  Exits non-zero if any button saw more or fewer presses than were made,
+ *  or the checksum isn't C.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "vclock.h"
+#include "debounce.h"
+#include "scroll.h"
+#include "lcdtext.h"
+#include "hash.h"
+
+#define BUTTONS  7
+#define COLS     16
+#define TICK_US  1000
+
+static const char *names[BUTTONS] = { "play", "prev", "next", "info", "quit", "shuffle", "mute" };
+
+static const char *titles[] = {
+    "A Day in the Life (Remastered 2009)",
+    "Short",
+    "Ça plane pour moi - Plastic Bertrand",
+    "Bohemian Rhapsody",
+    "Knockin' on Heaven's Door (Live at the Isle of Wight)",
+};
+static const char *artists[] = { "The Beatles", "Motörhead", "Queen", "Sigur Rós", "Bob Dylan" };
+
+// A button being held down: when it goes and comes back, bouncing for a few ms each way
+struct press {
+    unsigned down, up;
+    int bounce;
+};
+
+static uint32_t checksum = HASH_INIT;
+
+static void sum(const char *s, int row)
+{
+    unsigned char r = row;
+
+    checksum = hash_add(checksum, &r, 1);
+    checksum = hash_add(checksum, s, strlen(s));
+}
+
+static double cpu_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// What the pin reads at now: HIGH, LOW while pressed, flapping at the edges
+static int reading(const struct press *p, unsigned now, unsigned seed)
+{
+    if (now < p->down || now >= p->up + p->bounce)
+        return 1;
+    if (now < p->down + p->bounce || now >= p->up)
+        return ((now ^ seed) & 1);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct debounce buttons[BUTTONS];
+    struct press press[BUTTONS];
+    struct scroll rows[2];
+    unsigned long pressed[BUTTONS], expected[BUTTONS], noise = 0, steps = 0;
+    unsigned seed = 1, now, end;
+    unsigned long want = 0;
+    int check = 0, ret = 0;
+    double hours = 10, t0, cpu;
+    long long ticks = 0;
+    char window[SCROLL_WIDTH_MAX + 1];
+    int i, song = 0, showing_artist = 1;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-hours") == 0 && i + 1 < argc)
+            hours = atof(argv[++i]);
+        else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc)
+            seed = strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "-checksum") == 0 && i + 1 < argc)
+        {
+            want = strtoul(argv[++i], NULL, 16);
+            check = 1;
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [-hours H] [-seed S] [-checksum C]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    vclock_virtual(0);
+    lcdtext_init(LCDTEXT_A00, NULL);
+    scroll_configure(SCROLL_MARQUEE, SCROLL_STEP_MS, SCROLL_DWELL_MS);
+    now = vclock_ms();
+    for (i = 0; i < BUTTONS; i++)
+    {
+        debounce_set(&buttons[i], 1, DEBOUNCE_MS, now);
+        press[i].down = press[i].up = 0;
+        press[i].bounce = 0;
+        pressed[i] = expected[i] = 0;
+    }
+    scroll_set(&rows[0], titles[0], COLS - 1, 0, now);
+    scroll_set(&rows[1], artists[0], COLS - 2, 2, now);
+    end = (unsigned)(hours * 3600 * 1000);
+
+    t0 = cpu_secs();
+    for (; (now = vclock_ms()) < end; vclock_advance_us(TICK_US), ticks++)
+    {
+        // Now and then someone presses a button (held 80 - 400 ms), or there's a spike
+        if (rand_r(&seed) % 2000 == 0)
+        {
+            i = rand_r(&seed) % BUTTONS;
+            if (now >= press[i].up + press[i].bounce + DEBOUNCE_MS * 2)
+            {
+                press[i].bounce = rand_r(&seed) % 6;
+                press[i].down = now + 1;
+                if (rand_r(&seed) % 4 == 0)
+                {
+                    // Shorter than the debounce delay; mustn't count
+                    press[i].up = press[i].down + 1 + rand_r(&seed) % (DEBOUNCE_MS / 2);
+                    press[i].bounce = 0;
+                    noise++;
+                }
+                else
+                {
+                    press[i].up = press[i].down + 80 + rand_r(&seed) % 320;
+                    expected[i]++;
+                }
+            }
+        }
+        for (i = 0; i < BUTTONS; i++)
+        {
+            if (debounce_pressed(&buttons[i], reading(&press[i], now, seed), now) == 0)
+                continue;
+            pressed[i]++;
+            sum(names[i], 9);
+            // next: a new song; info: the other second row
+            if (i == 2)
+            {
+                song = (song + 1) % (int)(sizeof(titles) / sizeof(titles[0]));
+                scroll_set(&rows[0], titles[song], COLS - 1, 0, now);
+                scroll_set(&rows[1], artists[song], COLS - 2, 2, now);
+                showing_artist = 1;
+            }
+            else if (i == 3)
+            {
+                showing_artist = !showing_artist;
+                scroll_set(&rows[1], (showing_artist ? artists[song] : "Greatest Hits (Deluxe Edition)"), COLS - 2, 2, now);
+            }
+        }
+        for (i = 0; i < 2; i++)
+        {
+            if (scroll_tick(&rows[i], now, window) == 1)
+            {
+                lcdtext_render(i, window);
+                sum(window, i);
+                steps++;
+            }
+        }
+    }
+    cpu = cpu_secs() - t0;
+
+    printf("%.1f hours simulated in %.2f s CPU: %lld ticks, %.0f ns a tick\n", hours, cpu, ticks, cpu * 1e9 / (ticks ? ticks : 1));
+    for (i = 0; i < BUTTONS; i++)
+    {
+        printf("  %-8s %6lu presses (%lu made)%s\n", names[i], pressed[i], expected[i],
+               pressed[i] != expected[i] ? "  MISMATCH" : "");
+        if (pressed[i] != expected[i])
+            ret = EXIT_FAILURE;
+    }
+    printf("  %lu noise spikes, %lu scroll steps, checksum %08x\n", noise, steps, checksum);
+    if (check && checksum != want)
+    {
+        printf("  checksum MISMATCH: wanted %08lx\n", want);
+        ret = EXIT_FAILURE;
+    }
+    return ret;
+}
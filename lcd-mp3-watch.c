@@ -0,0 +1,134 @@
+/*
+ *  lcd-mp3-watch
+ *
+ *  Runs the -dir library watcher on its own.
+ *
+ *  lcd-mp3-watch dir            print how long the first song and the whole tree took
+ *                               to read in, then the library size after every batch
+ *                               of changes
+ *  lcd-mp3-watch dir -bench N   create N songs in dir, then delete them, and time
+ *                               how long until the library has caught up
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+
+#include "watch.h"
+
+static struct library library;
+
+static double now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static int live_songs(void)
+{
+    int i, n = library_count(&library), live = 0;
+
+    for (i = 0; i < n; i++)
+    {
+        if (library_removed(library_get(&library, i)) == 0)
+            live++;
+    }
+    return live;
+}
+
+// Time from the first change until the library shows all of them
+static void bench_step(const char *what, int n, int delete, const char *dir)
+{
+    struct watch_stats before, after;
+    char path[PATH_MAX];
+    double t0, t1, t2;
+    int i, fd;
+    unsigned gen = watch_generation();
+
+    watch_get_stats(&before);
+    t0 = now_ms();
+    for (i = 0; i < n; i++)
+    {
+        snprintf(path, PATH_MAX, "%s/bench-%06d.mp3", dir, i);
+        if (delete)
+            unlink(path);
+        else if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) >= 0)
+            close(fd);
+    }
+    t1 = now_ms();
+    for (;;)
+    {
+        watch_get_stats(&after);
+        if (watch_generation() != gen &&
+            (delete ? after.removed - before.removed : after.added - before.added) >= (uint32_t)n)
+            break;
+        usleep(1000);
+    }
+    t2 = now_ms();
+    printf("%-7s %d files: changes took %.1f ms, library caught up %.1f ms after the last one "
+           "(%.1f ms after the first; includes %d ms batching)\n"
+           "        events: %u  batches: %u  watcher CPU: %.1f ms (%.1f us/event)\n",
+           what, n, t1 - t0, t2 - t1, t2 - t0, WATCH_BATCH_MS,
+           after.events - before.events, after.batches - before.batches,
+           (after.cpu_us - before.cpu_us) / 1000.0,
+           (double)(after.cpu_us - before.cpu_us) / (after.events - before.events ? after.events - before.events : 1));
+}
+
+int main(int argc, char **argv)
+{
+    struct watch_stats st;
+    unsigned gen;
+    double t0, first = -1;
+
+    if (argc != 2 && !(argc == 4 && strcmp(argv[2], "-bench") == 0))
+    {
+        fprintf(stderr, "Usage: %s dir [-bench N]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    library_init(&library);
+    t0 = now_ms();
+    if (watch_start(&library, argv[1]) != 0)
+    {
+        fprintf(stderr, "Cannot watch %s: %s\n", argv[1], strerror(errno));
+        return EXIT_FAILURE;
+    }
+    // The tree is read in by the watcher; lcd-mp3 can start playing at the first song
+    while (watch_scanning())
+    {
+        if (first < 0 && library_count(&library) > 0)
+            first = now_ms() - t0;
+        usleep(100);
+    }
+    if (first < 0 && library_count(&library) > 0)
+        first = now_ms() - t0;
+    watch_get_stats(&st);
+    printf("%d songs in %u directories: first song after %.1f ms, all of them after %.1f ms\n",
+           library_count(&library), st.dirs, first, now_ms() - t0);
+    fflush(stdout);
+    if (argc == 4)
+    {
+        bench_step("create", atoi(argv[3]), 0, argv[1]);
+        bench_step("delete", atoi(argv[3]), 1, argv[1]);
+        watch_stop();
+        return 0;
+    }
+    gen = watch_generation();
+    for (;;)
+    {
+        usleep(10000);
+        if (watch_generation() == gen)
+            continue;
+        gen = watch_generation();
+        watch_get_stats(&st);
+        printf("songs: %d  (added %u, removed %u, directories %u)\n", live_songs(), st.added, st.removed, st.dirs);
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,140 @@
+/*
+ *  lcd-mp3-zones
+ *
+ *  What each extra zone (lcd-mp3 -zone) costs.  Starts zones one at a
+ *  time, playing the songs given, and after each one has played for a
+ *  while prints the CPU and memory the whole process uses and how much
+ *  more that is than with one zone fewer.
+ *
+ *  lcd-mp3-zones [-zones n] [-secs s] [-device dev ... | -null] dir|song.mp3 ...
+ *      -zones how many to go up to (default 4), -secs how long each step
+ *      plays (default 10).  The zones take the -device ALSA devices in
+ *      turn (default "null", which throws the audio away at the card's
+ *      pace; or e.g. "hw:Loopback,0,0", "hw:Loopback,0,1", ...), or with
+ *      -null no sound card at all
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <ao/ao.h>
+
+#include "zone.h"
+#include "sink.h"
+#include "library.h"
+#include "vclock.h"
+
+static double now_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double cpu_secs(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+// Resident memory now, in KB
+static long rss_kb(void)
+{
+    long pages = 0, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+
+    if (fp != NULL)
+    {
+        if (fscanf(fp, "%ld %ld", &pages, &resident) != 2)
+            resident = 0;
+        fclose(fp);
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+int main(int argc, char **argv)
+{
+    struct library songs;
+    struct zone_stats st;
+    struct stat sb;
+    const char *devices[ZONE_MAX];
+    int i, n, ndev = 0, zones = 4, secs = 10, kind = SINK_AO;
+    long rss, last_rss, base_rss;
+    double t0, c0, cpu, last_cpu = 0;
+    unsigned underruns;
+
+    library_init(&songs);
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-zones") == 0 && i + 1 < argc)
+            zones = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-secs") == 0 && i + 1 < argc)
+            secs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-device") == 0 && i + 1 < argc && ndev < ZONE_MAX)
+            devices[ndev++] = argv[++i];
+        else if (strcmp(argv[i], "-null") == 0)
+            kind = SINK_NULL;
+        else if (argv[i][0] == '-')
+            break;
+        else if (stat(argv[i], &sb) == 0 && S_ISDIR(sb.st_mode))
+            library_scan(&songs, argv[i]);
+        else
+            library_add(&songs, argv[i]);
+    }
+    if (i < argc || library_count(&songs) == 0 || zones < 1 || zones > ZONE_MAX || secs < 1)
+    {
+        fprintf(stderr, "Usage: %s [-zones n (1-%d)] [-secs s] [-device dev ... | -null] dir|song.mp3 ...\n", argv[0], ZONE_MAX);
+        return EXIT_FAILURE;
+    }
+    if (ndev == 0)
+        devices[ndev++] = "null";
+
+    ao_initialize();
+    printf("%d songs, %ld CPUs\n", library_count(&songs), sysconf(_SC_NPROCESSORS_ONLN));
+    base_rss = last_rss = rss_kb();
+    printf("0 zones: rss %ld KB\n", base_rss);
+    for (n = 1; n <= zones; n++)
+    {
+        if (zone_start(&songs, kind, (kind == SINK_AO ? devices[(n - 1) % ndev] : NULL), 1, n, 1.0) < 0)
+        {
+            perror("Cannot start a zone");
+            break;
+        }
+        // Let it get going before measuring
+        vclock_sleep_ms(1000);
+        t0 = now_secs();
+        c0 = cpu_secs();
+        vclock_sleep_ms(secs * 1000);
+        cpu = (cpu_secs() - c0) * 100 / (now_secs() - t0);
+        rss = rss_kb();
+        underruns = 0;
+        for (i = 0; i < n; i++)
+        {
+            if (zone_get_stats(i, &st) == 0)
+                underruns += st.underruns;
+        }
+        printf("%d zone%s: cpu %.1f%% (+%.1f%%), rss %ld KB (+%ld KB), %u underruns\n",
+               n, (n == 1 ? "" : "s"), cpu, cpu - last_cpu, rss, rss - last_rss, underruns);
+        last_cpu = cpu;
+        last_rss = rss;
+    }
+    n--;
+    for (i = 0; i < n; i++)
+    {
+        zone_get_stats(i, &st);
+        printf("zone %d (%s): %u songs, %u failed, %.1f s of audio, %.2f s of CPU\n", i,
+               (kind == SINK_AO ? devices[i % ndev] : "null sink"), st.songs, st.failed, st.audio_secs, st.cpu_secs);
+    }
+    zone_stop_all();
+    ao_shutdown();
+    if (n > 0)
+        printf("each zone: %.1f%% cpu, %ld KB\n", last_cpu / n, (last_rss - base_rss) / n);
+    return 0;
+}
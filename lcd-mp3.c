@@ -76,13 +76,62 @@
 
 // For wiringPi
 #include <wiringPi.h>
-#include <lcd.h>
 
 #include "lcd-mp3.h"
 
 // For rotary encoder for volume
 #include "rotaryencoder.h"
 
+// For the control socket
+#include "control.h"
+
+// For the shared memory status record
+#include "status.h"
+
+// For the play queue / history
+#include "playqueue.h"
+
+// For resuming where we left off
+#include "journal.h"
+#include "hash.h"
+
+// For USB sticks coming and going
+#include "usb.h"
+
+// For reading the songs in while the first ones play
+#include "scan.h"
+
+// For songs coming and going in -dir
+#include "watch.h"
+#include "playlist.h"
+#include "tagindex.h"
+
+// For picking the fastest mp3 decoder, and the sound card
+#include "decoder.h"
+#include "sink.h"
+// For evening out the songs' loudness
+#include "rgain.h"
+// For the song's length without reading through it
+#include "duration.h"
+// For announcements coming down a pipe
+#include "stream.h"
+// For more rooms with sound cards of their own
+#include "zone.h"
+// For skipping songs that can't be played
+#include "quarantine.h"
+
+// For the player thread's priority
+#include "rtsched.h"
+
+// For the clock all the timing goes by, and the buttons
+#include "vclock.h"
+#include "debounce.h"
+
+// For scrolling rows
+#include "scroll.h"
+#include "lcdtext.h"
+#include "hd44780.h"
+
 #define exp10(x) (exp((x) * log(10)))
 
 // --------- BEGIN USER MODIFIABLE VARS ---------
@@ -103,11 +152,11 @@
 // The following is used to test to see if the LCD/button board is attached or not.
 #define boardTestPin 10 // CE0,    BCM  8
 
-// Pins for the LCD display
-const int BS = 4;	// Bits (4 or 8)
-const int CO = 16;	// Number of columns
-const int RO = 2;	// Number of rows
+// Size of the LCD display (-lcdsize 20x4)
+int CO = 16;	// Number of columns
+int RO = 2;	// Number of rows
 
+// Pins for the LCD display when it's wired to the GPIOs (wiringPi numbers)
 const int RS = 3;	// GPIO 3
 const int EN = 14;	// SCK (SPI)
 const int D0 = 4;	// GPIO 4
@@ -117,6 +166,25 @@ const int D3 = 6;	// GPIO 6
 
 #define BTN_DELAY 30
 
+// How long the info + next artist browsing waits for another press before playing the pick (ms)
+#define BROWSE_DELAY 2000
+
+// How far the player can fall behind the audio clock before we call it an underrun
+#define UNDERRUN_SLACK_US 20000
+
+// While a -stream plays, how often the paused song looks whether it has been skipped (ms)
+#define STREAM_WAIT_MS 100
+
+// Paused this long (s), the sound card is let go and the main loop sleeps until play is pressed
+#define IDLE_SECS    30
+// While asleep, how often we still look for a USB stick or new songs (ms)
+#define IDLE_POLL_MS 1000
+
+// How often the songs found so far are worked into the play order and shown (ms)
+#define SCAN_SHOW_MS 500
+// Shuffling, the first song is picked out of at least this many (if there are that many)
+#define SCAN_SHUFFLE_MIN 200
+
 //#define DEBUG 0
 
 // --------- END USER MODIFIABLE VARS ---------
@@ -124,24 +192,146 @@ const int D3 = 6;	// GPIO 6
 /*
  * Debounce tracking stuff
  */
-int  playButtonState, prevButtonState, nextButtonState, infoButtonState, quitButtonState, shufButtonState, muteButtonState;
-int  lastPlayButtonState, lastPrevButtonState, lastNextButtonState, lastInfoButtonState,
-       lastQuitButtonState, lastShufButtonState, lastMuteButtonState;
-long lastPlayDebounceTime, lastPrevDebounceTime, lastNextDebounceTime, lastInfoDebounceTime,
-       lastQuitDebounceTime, lastShufDebounceTime, lastMuteDebounceTime;
-long debounceDelay = 50;
+struct debounce playButton, prevButton, nextButton, infoButton, quitButton, shufButton, muteButton;
+unsigned debounceDelay = DEBOUNCE_MS;
 
 const int numButtons = 7;
 
 const int buttonPins[] = { playButtonPin, prevButtonPin, nextButtonPin, infoButtonPin, quitButtonPin, shufButtonPin, muteButtonPin };
 
-// Global variables
-static int Index = 0;
-static playlist_t Tmp_Playlist;
+// Musical note char for LCD
+static unsigned char musicNote[8] = {
+	0b01111,
+	0b01001,
+	0b01001,
+	0b11001,
+	0b11011,
+	0b00011,
+	0b00000,
+	0b00000,
+};
+
+// Global lcd handle:
+static struct hd44780 *lcdHandle;
+
 static char card[64] = "hw:0";
 snd_mixer_t *handle = NULL;
 snd_mixer_elem_t *elem = NULL;
 
+// Every song we found, and what to play out of it
+static struct library library;
+static struct playqueue queue;
+static uint32_t playlist_id;
+
+// The song playing now and the state we publish; only the main loop changes these
+static struct track_info *cur_track = NULL;
+static struct player_snapshot cur_state;
+
+// What's on the LCD.  The text points at the current track (or a fixed
+// message) instead of being copied around; gen changes whenever a row gets
+// new text so the scrolling knows to start over.
+static struct {
+    const char *FirstRow_text;
+    const char *SecondRow_text;
+    const char *pause_text;  // second row from before we paused
+    const char *muted_text;  // second row from before we muted
+    unsigned FirstRow_gen;
+    unsigned SecondRow_gen;
+    unsigned FirstRow_shown; // gen of what's laid out in the scroll
+    unsigned SecondRow_shown;
+    struct scroll FirstRow_scroll;
+    struct scroll SecondRow_scroll;
+    char SecondRow_window[SCROLL_WIDTH_MAX + 1]; // what's on the bottom row
+    // The bottom row can show the time and a bar instead (INFO)
+    int progress;            // show it for the next songs too
+    char progress_text[SCROLL_WIDTH_MAX + 1];
+    long progress_secs;      // what it was laid out for
+    long progress_length;
+    int progress_px;
+} lcd;
+
+// How long the song is and how far in we are.  The length comes from the
+// mp3's headers; if they only give an estimate a thread counts the frames.
+static struct {
+    long length;             // ms, 0 if not known
+    long pos;                // ms; the player thread keeps it up to date
+    int exact;
+    int stop;                // tells the counting thread to give up
+    int counting;
+    pthread_t thread;
+} songTime;
+
+// Player / display state shared by the buttons and the control socket
+static char lcd_clear[41];   // CO spaces
+static int scroll_SecondRow_Flag = FALSE;
+static int shuffFlag = FALSE;
+
+// Only play songs matching this (-filter)
+static const char *filter_query = NULL;
+static int filtering = FALSE;
+// Play albums in order (-albums)
+static int albumFlag = FALSE;
+// Where the tags are kept between runs (-tagcache)
+static const char *tagcache_path = TAGINDEX_CACHE;
+// Where the songs that can't be played are kept (-quarantine), and whether
+// every song is decoded in the background to find them (-validate)
+static const char *quarantine_path = QUARANTINE_FILE;
+static int validateFlag = FALSE;
+// Play every song at the same loudness (-replaygain), measured in the background
+// by -gainthreads threads (-1 for the spare CPUs) and kept in -gaincache
+static int gainFlag = FALSE;
+static int gain_threads = -1;
+static const char *gaincache_path = RGAIN_CACHE;
+// Play whatever is written to this FIFO (-stream), pausing the song or
+// turning it down by -duck dB while it does
+static const char *stream_path = NULL;
+static double duck_db = 0;
+// Extra zones playing the same songs on other sound cards (-zone dev[=volume])
+static const char *zone_devices[ZONE_MAX];
+static double zone_volumes[ZONE_MAX];
+static int zones = 0;
+// With -stream or -zone the sound card is set up once by main(), since
+// other threads play through it too, instead of by each song
+static int aoShared = FALSE;
+// Which mpg123 decoder to use (-decoder); "auto" times them on the first song
+static const char *decoder = "auto";
+static int decoderChosen = FALSE;
+// The player thread's SCHED_FIFO priority (-rtprio), its own CPU (-cpu) and -nomlock
+static int rt_prio = RT_AUDIO_PRIO;
+static int rt_cpu = -1;
+static int rt_lock = TRUE;
+static int rtWarned = FALSE;
+// Going idle when paused (-idle secs, 0 for never)
+static int idle_secs = IDLE_SECS;
+static int idleISR = FALSE;         // the play button can wake us
+static int idle = FALSE;            // set while asleep; the play button's interrupt clears it
+static unsigned int pauseTime;
+// Songs still being read in (-usb, -dir) while the first ones play
+static struct {
+    int active;              // the play queue hasn't had every song yet
+    int synced;              // how many songs it has had
+    unsigned time;           // when that was
+    char text[MAXDATALEN];   // second row while it goes on
+} songScan;
+// When we started, and when the first sound went out (player thread)
+static long long start_us;
+static long long first_audio_us = 0;
+// How rows too long for the LCD scroll (-scroll ms, -dwell ms, -bounce)
+static int scroll_mode = SCROLL_MARQUEE;
+static unsigned scroll_step = SCROLL_STEP_MS;
+static unsigned scroll_dwell = SCROLL_DWELL_MS;
+// The LCD's character ROM (-rom a00|a02)
+static int lcd_rom = LCDTEXT_A00;
+// How the LCD is wired (-lcd gpio|i2c[:bus[:addr]])
+static const char *lcd_wiring = "gpio";
+// Stepping through the artists with info + next
+static struct {
+    int active;
+    int pos;            // 0 is every song, then the artists in order
+    unsigned int time;  // vclock_ms() of the last step
+    char text[MAXDATALEN];
+} browse;
+
 /*
  * System stuff
  */
@@ -162,7 +352,10 @@ static void die(int sig)
 {
     // Insert any GPIO cleaning here.
     // TODO maybe try to unmount the usb stick or some other clean up here... maybe?
-    lcdClear(lcdHandle);
+    hd44780_clear(lcdHandle);
+    control_stop();
+    status_close();
+    journal_close();
     if (sig != 0 && sig != 2)
         (void)fprintf(stderr, "caught signal %d\n", sig);
     if (sig == 2)
@@ -235,18 +428,24 @@ double map(float x, float x0, float x1, float y0, float y1)
 	return z;
 }
 
-void print_vol_num(snd_mixer_elem_t *elem)
+// Volume as shown on the LCD (0 - 99)
+int get_vol_num(snd_mixer_elem_t *elem)
 {
     int volbar_length = rint(get_normalized_volume(elem) * (double)CO-1);
-    int cur_vol = 0;
 
 //    printf("%d\n", volbar_length);
-    cur_vol = map(volbar_length, -1, CO - 1, 0, 99);
-    lcdPosition(lcdHandle, 14, 1);
-    lcdPrintf(lcdHandle, "%2d", cur_vol);
+    return map(volbar_length, -1, CO - 1, 0, 99);
+}
+
+void print_vol_num(snd_mixer_elem_t *elem)
+{
+    int cur_vol = get_vol_num(elem);
+
+    hd44780_position(lcdHandle, CO - 2, 1);
+    hd44780_printf(lcdHandle, "%2d", cur_vol);
 #if 0
     int volbar_length = rint(get_normalized_volume(elem) * (double)CO-1);
-    char volbar[CO];
+    char volbar[CO + 1];
     int idx = 0;
 
     volbar[idx++] = '-';
@@ -257,15 +456,15 @@ void print_vol_num(snd_mixer_elem_t *elem)
         volbar[idx] = ' ';
     volbar[CO - 1] = '+';
     volbar[CO] = '\0';
-    lcdPosition(lcdHandle, 0, 1);
-    lcdPuts(lcdHandle, volbar);
+    hd44780_position(lcdHandle, 0, 1);
+    hd44780_puts(lcdHandle, volbar);
 #endif
 /*
     strcpy(volume_text, cur_song.SecondRow_text);
     strcpy(cur_song.SecondRow_text, volbar);
     strcpy(cur_song.prevArtist, cur_song.artist);
-    lcdPosition(lcdHandle, 0, 1);
-    lcdPuts(lcdHandle, lcd_clear);
+    hd44780_position(lcdHandle, 0, 1);
+    hd44780_puts(lcdHandle, lcd_clear);
     return printLcdSecondRow();
 */
 }
@@ -286,12 +485,54 @@ int usage(const char *progName)
       "-pins (shows what pins to use for buttons) \n"
       "-dir [dir] \n"
       "-songs [MP3 files]\n"
+      "-playlist [file] (.m3u, .m3u8 or .pls)\n"
       "-usb (this reads in any music found in /MUSIC)\n"
       "\t-halt (part of -usb\n"
       "       allows the program to halt the system after\n"
       "       the 'quit' button was pressed.)\n"
-      "\t-shuffle (part of -usb; shuffles playlist)\n",
-      progName);
+      "\t-shuffle (part of -usb; shuffles playlist)\n"
+      "-ctl [socket] (control socket; default %s)\n"
+      "-noctl (don't open the control socket)\n"
+      "-journal [file] (where to remember the song and position; default %s)\n"
+      "-nojournal (always start from the first song)\n"
+      "-usbdev [prefix] (part of -usb; block devices to watch; default %s)\n"
+      "-filter [search] (only play songs matching e.g. \"artist:beatles\";\n"
+      "       info + next steps through the artists while playing)\n"
+      "-albums (play albums in order: album artist, album, disc, track)\n"
+      "-tagcache [file] (where to keep the songs' tags; default %s)\n"
+      "-notagcache (read every song's tags at start up)\n"
+      "-quarantine [file] (where songs that can't be played are listed so\n"
+      "       they're skipped; default %s)\n"
+      "-noquarantine (only remember them until we quit)\n"
+      "-validate (decode every song in the background to find bad ones)\n"
+      "-replaygain (play every song about as loud; songs without a gain are\n"
+      "       measured in the background)\n"
+      "-gainthreads [n] (threads measuring; default one less than the CPUs,\n"
+      "       0 to only use the gains already measured)\n"
+      "-gaincache [file] (where the gains are kept; default %s)\n"
+      "-stream [fifo|-] (play mp3 written to the named pipe, or stdin, pausing\n"
+      "       the song while it does)\n"
+      "-duck [dB] (with -stream: turn the song down this much instead of\n"
+      "       pausing it; the sound card has to mix, e.g. ALSA's dmix)\n"
+      "-zone [device[=volume]] (also play the songs, in an order of their own,\n"
+      "       on ALSA device e.g. hw:1 at volume 0-100; up to %d times)\n"
+      "-decoder [name|auto|default] (mp3 decoder; auto times each one on the\n"
+      "       first song and keeps the fastest in %s)\n"
+      "-rtprio [n] (real-time priority of the player; default %d, 0 for none)\n"
+      "-cpu [n] (keep CPU n for the player on a multi-core board)\n"
+      "-nomlock (don't lock the player's memory)\n"
+      "-idle [secs] (paused this long, close the sound card and sleep until\n"
+      "       play is pressed; default %d, 0 for never)\n"
+      "-scroll [ms] (time between scrolling steps; default %d)\n"
+      "-dwell [ms] (pause when scrolled text is back at the start; default %d)\n"
+      "-bounce (scroll long text back and forth instead of round)\n"
+      "-rom [a00|a02] (the LCD's character set: a00 Japanese, the usual one,\n"
+      "       or a02 European; default a00)\n"
+      "-lcd [gpio|i2c[:bus[:addr]]] (how the LCD is wired: to the GPIOs, or\n"
+      "       through an I2C backpack; default gpio, i2c is bus %d at 0x%02x)\n"
+      "-lcdsize [colsxrows] (e.g. 20x4; default 16x2)\n",
+      progName, CONTROL_SOCKET, JOURNAL_FILE, USB_DEVICE, TAGINDEX_CACHE, QUARANTINE_FILE, RGAIN_CACHE, ZONE_MAX, DECODER_FILE, RT_AUDIO_PRIO, IDLE_SECS,
+      SCROLL_STEP_MS, SCROLL_DWELL_MS, HD44780_I2C_BUS, HD44780_I2C_ADDR);
     return EXIT_FAILURE;
 }
 
@@ -365,317 +606,147 @@ int checkMount()
         return FILES_OK;
 }
 
-/*
- * Linked list / playlist functions
- *
- * Possible FIXME ... maybe convert this whole program into C++ and make the following a class...?
- */
-// TODO also, why is this even returning anything at all?
-int playlist_init(playlist_t *playlistptr)
-{
-    *playlistptr = NULL;
-    return 1; // ???? Why?
-}
-
-// again; why is this returning anything?
-int playlist_add_song(int index, void *songptr, playlist_t *playlistptr)
-{
-    playlist_node_t *cur, *prev, *new;
-    int found = FALSE;
-
-    for (cur = prev = *playlistptr; cur != NULL; prev = cur, cur = cur->nextptr)
-    {
-        if (cur->index == index)
-        {
-            free(cur->songptr);
-            cur->songptr = songptr;
-            found = TRUE;
-            break;
-        }
-        else if (cur->index > index)
-            break;
-    }
-    if (!found)
-    {
-        new = (playlist_node_t *)malloc(sizeof(playlist_node_t));
-        new->index = index;
-        new->songptr = songptr;
-        new->nextptr = cur;
-        if (cur == *playlistptr)
-            *playlistptr = new;
-        else
-            prev->nextptr = new;
-    }
-    return 1; // WHYWYWYWYWY????
-}
-
-// Get song name from playlist with index
-int playlist_get_song(int index, void **songptr, playlist_t *playlistptr)
-{
-    playlist_node_t *cur, *prev;
-
-    // Initialize to "not found"
-    *songptr = NULL;
-    // Look through index for our entry
-    for (cur = prev = *playlistptr; cur != NULL; prev = cur, cur = cur->nextptr)
-    {
-        if (cur->index == index)
-        {
-            *songptr = cur->songptr;
-            break;
-        }
-        else if (cur->index > index)
-            break;
-    }
-    return 1; // WHY ARE YOU RETURNING ANYTHING?
-}
-
 /*
  * Creates playlist
  */
 
 // NOTE: Brand new! Now we read in sub directories!!
 
-// Recursive function to enter sub directories
-void list_dir(const char *dir_name)
+// Create the playlist; NOTE Now we read in sub directories...
+// The songs are read in the background; see scanWait() and scanProgress()
+void reReadPlaylist(char *dir_name)
 {
-    DIR *d;
-    char *basec, *bname;
-    char *string;
-
-    d = opendir(dir_name);
-    if (!d)
+    if (scan_start(&library, dir_name) != 0)
     {
         fprintf(stderr, "[%s - %d]: Cannot open directory '%s': %s\n", __FILE__, __LINE__, dir_name, strerror(errno));
         exit(EXIT_FAILURE);
     }
-    while (1)
-    {
-        struct dirent *dir;
-        const char *d_name;
-
-        dir = readdir(d);
-        // There are no more entries in this directory, so break out of the while loop.
-        if (!dir)
-            break;
-        d_name = dir->d_name;
-        // 8 = normal file; non-directory
-        if (dir->d_type == 8)
-        {
-            string = malloc(MAXDATALEN);
-            if (string == NULL)
-                perror("malloc: reReadPlaylist");
-            strcpy(string, dir_name);
-            strcat(string, "/");
-            strcat(string, d_name);
-            // Get just the filename, strip the path info
-            basec = strdup(string);
-            bname = basename(basec);
-            // Make sure we only add mp3 files
-            if (strcasecmp(get_filename_ext(bname), "mp3") == 0)
-                playlist_add_song(Index++, string, &Tmp_Playlist); // FIXME I REALLY hate having to use global variables...
-        }
-        if (dir->d_type & DT_DIR)
-        {
-            // Check that the directory is not "d" or d's parent.
-            if (strcmp(d_name, "..") != 0 && strcmp(d_name, ".") != 0)
-            {
-                int path_length;
-                char path[PATH_MAX];
-
-                path_length = snprintf(path, PATH_MAX, "%s/%s", dir_name, d_name);
-                if (path_length >= PATH_MAX)
-                {
-                    fprintf(stderr, "[%s - %d]: Path length has become too long.\n", __FILE__, __LINE__);
-                    exit(EXIT_FAILURE);
-                }
-                list_dir(path); // Recursively call "list_dir" with the new path.
-            }
-        } // end if dir
-    } // end while
-    if (closedir(d))
-    {
-        fprintf(stderr, "[%s - %d]: Could not close '%s': %s\n", __FILE__, __LINE__, dir_name, strerror(errno));
-        exit(EXIT_FAILURE);
-    }
 }
 
-// Create the playlist; NOTE Now we read in sub directories...
-// Tmp_Playlist and Index are global vars...
-playlist_t reReadPlaylist(char *dir_name)
+// TRUE while songs are still being read in
+int scanning()
 {
-    playlist_t new_playlist;
-
-    playlist_init(&new_playlist);
-    playlist_init(&Tmp_Playlist);
-    Index = 0;
-    list_dir(dir_name);
-    new_playlist = Tmp_Playlist;
-    playlist_init(&Tmp_Playlist);
-    pthread_mutex_lock(&cur_song.pauseMutex);
-    num_songs = Index - 1;
-    pthread_mutex_unlock(&cur_song.pauseMutex);
-    return new_playlist;
+    return (scan_running() == TRUE || watch_scanning() == TRUE);
 }
 
-// If USB has been mounted, load in songs.
-
-// NOTE -- OLD METHOD --
-
-#if 0
-playlist_t reReadPlaylist(char *dir_name)
+/*
+  While the songs are still being read in, wait until there are want of
+  them, showing how many have been found (once the LCD is up).
+*/
+void scanWait(int want)
 {
-    int index = 0;
-    char *string;
-    playlist_t new_playlist;
-    DIR *d;
-    struct dirent *dir;
-    char *basec, *bname;
+    int n, shown = -1;
 
-    playlist_init(&new_playlist);
-    d = opendir(dir_name);
-    if (d)
+    while (scanning() == TRUE && (n = library_count(&library)) < want)
     {
-        while ((dir = readdir(d)) != NULL)
+        if (lcdHandle != NULL && n != shown)
         {
-            // 8 = normal file; non-directory
-            if (dir->d_type == 8)
+            if (shown < 0)
             {
-                index = (index == 0 ? 1 : index);
-                string = malloc(MAXDATALEN);
-                if (string == NULL)
-                    perror("malloc: reReadPlaylist");
-                strcpy(string, dir_name);
-                strcat(string, "/");
-                strcat(string, dir->d_name);
-                // Get just the filename, strip the path info and extension
-                basec = strdup(string);
-                bname = basename(basec);
-                // Make sure we only deal with mp3 files
-                if (strcasecmp(get_filename_ext(bname), "mp3") == 0)
-                    playlist_add_song(index++, string, &new_playlist);
+                hd44780_clear(lcdHandle);
+                hd44780_position(lcdHandle, 0, 0);
+                hd44780_puts(lcdHandle, "Reading songs.");
             }
+            hd44780_position(lcdHandle, 0, 1);
+            hd44780_printf(lcdHandle, "Found %d", n);
+            shown = n;
         }
+        vclock_sleep_ms(50);
     }
-    closedir(d);
-    pthread_mutex_lock(&cur_song.pauseMutex);
-    num_songs = index - 1;
-    pthread_mutex_unlock(&cur_song.pauseMutex);
-    return new_playlist;
+    if (lcdHandle != NULL && shown >= 0)
+        hd44780_clear(lcdHandle);
 }
-#endif
 
-// Convert linked list into array so it can be shuffled
-void ll2array(playlist_t *playlistptr, char **arr)
-{
-    int i;
-    playlist_node_t *cur;
+/*
+ * Threading functions
+ *
+ * Functions for when buttons are pressed
+ */
 
-    for (i = 0, cur = *playlistptr; cur != NULL; i++, cur = cur->nextptr)
-    {
-        if (cur->songptr != NULL)
-            arr[i] = cur->songptr;
-    }
+// Publish a new snapshot of cur_state for the other threads
+void publishState()
+{
+    cur_state.version++;
+    state_publish(&cur_state);
 }
 
-// Shuffle / randomize playlist
-playlist_t randomize(playlist_t cur_playlist)
+void setStatus(int play_status)
 {
-    char *tmp[MAXDATALEN];
-    char *string;
-    playlist_t new_playlist;
-    int index = 0;
-
-    ll2array(&cur_playlist, tmp);
-    srand((unsigned)time(NULL));
-    if (num_songs > 1)
-    {
-        size_t i;
-        for (i = 0; i < num_songs - 1; i++)
-        {
-            if (strlen(tmp[i]) > 3)
-            {
-                size_t j = i + rand() / (RAND_MAX / (num_songs - i) + 1);
-                char *t = tmp[j];
-                tmp[j] = tmp[i];
-                tmp[i] = t;
-            }
-        }
-    }
-    // Convert array back into linked list.
-    playlist_init(&new_playlist);
-    index = 0;
-    while (index < num_songs)
-    {
-        string = malloc(MAXDATALEN);
-        if (string == NULL)
-            perror("malloc: shuffle");
-        strcpy(string, tmp[index]);
-        playlist_add_song(index, string, &new_playlist);
-        index++;
-    }
-    return new_playlist;
+    cur_state.play_status = play_status;
+    state_set_status(play_status);
+    publishState();
 }
 
-/*
- * Threading functions
- *
- * Functions for when buttons are pressed
- */
 void nextSong()
 {
-    pthread_mutex_lock(&cur_song.pauseMutex);
-    cur_song.play_status = NEXT;
-    cur_song.song_over = TRUE;
-    pthread_mutex_unlock(&cur_song.pauseMutex);
+    setStatus(NEXT);
 }
 
 void prevSong()
 {
-    pthread_mutex_lock(&cur_song.pauseMutex);
-    cur_song.play_status = PREV;
-    cur_song.song_over = TRUE;
-    pthread_mutex_unlock(&cur_song.pauseMutex);
+    setStatus(PREV);
 }
 
-void shuffleMe()
+void quitMe()
 {
-    pthread_mutex_lock(&cur_song.pauseMutex);
-    cur_song.play_status = SHUFFLE;
-    cur_song.song_over = TRUE;
-    pthread_mutex_unlock(&cur_song.pauseMutex);
+    setStatus(QUIT);
 }
 
-void quitMe()
+void pauseMe()
 {
-    pthread_mutex_lock(&cur_song.pauseMutex);
-    cur_song.play_status = QUIT;
-    cur_song.song_over = TRUE;
-    pthread_mutex_unlock(&cur_song.pauseMutex);
+    setStatus(PAUSE);
+    pauseTime = vclock_ms();
 }
 
-void pauseMe()
+void playMe()
 {
-    pthread_mutex_lock(&cur_song.pauseMutex);
-    cur_song.play_status = PAUSE;
-    pthread_mutex_unlock(&cur_song.pauseMutex);
+    setStatus(PLAY);
 }
 
+/*
+ * Idle (paused for a while)
+ */
+// The play button's interrupt; only does anything while we're asleep
+void idleButton(void)
+{
+    if (__atomic_exchange_n(&idle, FALSE, __ATOMIC_ACQ_REL) == TRUE)
+        state_send_cmd(CMD_TOGGLE, 0, FALSE, NULL);
+}
 
-void playMe()
+/*
+  Instead of polling the buttons and scrolling (a CPU flat out), sleep
+  until play is pressed or a command comes in on the control socket,
+  looking for USB sticks (with usb) and new songs (with watch, since
+  watch_gen) now and then.
+*/
+void idleWait(int usb, int watch, unsigned watch_gen)
+{
+    __atomic_store_n(&idle, TRUE, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&idle, __ATOMIC_ACQUIRE) == TRUE)
+    {
+        if (state_wait_cmd(IDLE_POLL_MS) == TRUE ||
+            (usb == TRUE && usb_changed() == TRUE) ||
+            (watch == TRUE && watch_generation() != watch_gen))
+            break;
+    }
+    // Woken by the play button: it's already been taken as a press
+    if (__atomic_exchange_n(&idle, FALSE, __ATOMIC_ACQ_REL) == FALSE)
+    {
+        debounce_set(&playButton, LOW, debounceDelay, vclock_ms());
+    }
+}
+
+// Point a row of the LCD at new text
+void setFirstRow(const char *text)
 {
-    pthread_mutex_lock(&cur_song.pauseMutex);
-    cur_song.play_status = PLAY;
-    pthread_cond_broadcast(&cur_song.m_resumeCond);
-    pthread_mutex_unlock(&cur_song.pauseMutex);
+    lcd.FirstRow_text = text;
+    lcd.FirstRow_gen++;
 }
 
-void checkPause()
+void setSecondRow(const char *text)
 {
-    pthread_mutex_lock(&cur_song.pauseMutex);
-    while (cur_song.play_status == PAUSE)
-      pthread_cond_wait(&cur_song.m_resumeCond, &cur_song.pauseMutex);
-    pthread_mutex_unlock(&cur_song.pauseMutex);
+    lcd.SecondRow_text = text;
+    lcd.SecondRow_gen++;
 }
 
 /*
@@ -684,7 +755,7 @@ void checkPause()
 
 // Split up a number of lines separated by \n, \r, both or just zero byte
 //   and print out each line with specified prefix.
-void make_id(mpg123_string *inlines, int type)
+void make_id(mpg123_string *inlines, int type, struct track_info *track)
 {
     size_t i;
     int hadcr = 0, hadlf = 0;
@@ -730,16 +801,17 @@ void make_id(mpg123_string *inlines, int type)
     }
     switch (type)
     {
-        case  TITLE: strcpy(cur_song.title,  tmp_name); break;
-        case ARTIST: strcpy(cur_song.artist, tmp_name); break;
-        case  GENRE: strcpy(cur_song.genre,  tmp_name); break;
-        case  ALBUM: strcpy(cur_song.album,  tmp_name); break;
+        case  TITLE: strcpy(track->title,  tmp_name); break;
+        case ARTIST: strcpy(track->artist, tmp_name); break;
+        case  GENRE: strcpy(track->genre,  tmp_name); break;
+        case  ALBUM: strcpy(track->album,  tmp_name); break;
     }
 }
 
-int id3_tagger()
+int id3_tagger(struct track_info *track)
 {
-    int meta;
+    int meta, channels, encoding;
+    long rate;
     mpg123_handle* m;
     mpg123_id3v1 *v1;
     mpg123_id3v2 *v2;
@@ -747,44 +819,52 @@ int id3_tagger()
     // ID3 tag info for the song
     mpg123_init();
     m = mpg123_new(NULL, NULL);
-    if (mpg123_open(m, cur_song.filename) != MPG123_OK)
+    if (m == NULL)
     {
-        fprintf(stderr, "[%s - %d]: Cannot open %s: %s\n", __FILE__, __LINE__, cur_song.filename, mpg123_strerror(m));
+        mpg123_exit();
         return 1;
     }
-    mpg123_scan(m);
+    if (mpg123_open(m, track->filename) != MPG123_OK)
+    {
+        fprintf(stderr, "[%s - %d]: Cannot open %s: %s\n", __FILE__, __LINE__, track->filename, mpg123_strerror(m));
+        mpg123_delete(m);
+        mpg123_exit();
+        return 1;
+    }
+    // The tags come before the first frame, so that's as far as we need to
+    // read (mpg123_scan() would read the whole file just for its length)
+    mpg123_getformat(m, &rate, &channels, &encoding);
     meta = mpg123_meta_check(m);
     if (meta & MPG123_ID3 && mpg123_id3(m, &v1, &v2) == MPG123_OK)
     {
-        make_id(v2->title, TITLE);
-        make_id(v2->artist, ARTIST);
-        make_id(v2->album, ALBUM);
-        make_id(v2->genre, GENRE);
+        make_id(v2->title, TITLE, track);
+        make_id(v2->artist, ARTIST, track);
+        make_id(v2->album, ALBUM, track);
+        make_id(v2->genre, GENRE, track);
     }
     else
     {
         // TODO fix this; maybe there's a better way since UNKNOWN is all the same
-        sprintf(cur_song.title,  "UNKNOWN");
-        sprintf(cur_song.artist, "UNKNOWN");
-        sprintf(cur_song.album,  "UNKNOWN");
-        sprintf(cur_song.genre,  "UNKNOWN");
+        sprintf(track->title,  "UNKNOWN");
+        sprintf(track->artist, "UNKNOWN");
+        sprintf(track->album,  "UNKNOWN");
+        sprintf(track->genre,  "UNKNOWN");
     }
     // If there is no title to be found, set title to the song file name.
-    if (strlen(cur_song.title) == 0)
-      strcpy(cur_song.title, cur_song.base_filename);
-    if (strlen(cur_song.artist) == 0)
-      sprintf(cur_song.artist, "UNKNOWN");
-    if (strlen(cur_song.album) == 0)
-      sprintf(cur_song.album, "UNKNOWN");
-    // Set the second row to be the artist by default.
-    strcpy(cur_song.FirstRow_text, cur_song.title);
-    strcpy(cur_song.SecondRow_text, cur_song.artist);
+    if (strlen(track->title) == 0)
+      strcpy(track->title, track->base_filename);
+    if (strlen(track->artist) == 0)
+      sprintf(track->artist, "UNKNOWN");
+    if (strlen(track->album) == 0)
+      sprintf(track->album, "UNKNOWN");
+    // Set the second row to be the artist by default (or the progress bar
+    // if that's what was last picked).
+    setFirstRow(track->title);
+    setSecondRow(lcd.progress == TRUE ? lcd.progress_text : track->artist);
+    lcd.muted_text = track->artist;
     mpg123_close(m);
     mpg123_delete(m);
     mpg123_exit();
-    // The following two lines are just to see when the scrolling should pause
-    strncpy(cur_song.scroll_FirstRow, cur_song.FirstRow_text, 15);
-    strncpy(cur_song.scroll_SecondRow, cur_song.SecondRow_text, 16);
     return 0;
 }
 
@@ -792,244 +872,1001 @@ int id3_tagger()
  * LCD display functions
  */
 
-// Non-scrolling - Top row
+// Top row: the music note, then the title (or its start if it has to scroll)
 int printLcdFirstRow()
 {
-    int flag = TRUE;
+    char window[SCROLL_WIDTH_MAX + 1];
+    int flag;
     
     // Do I even use this?
-    if (strcmp(cur_song.FirstRow_text, " QUIT - Shutdown") == 0)
+    if (strcmp(lcd.FirstRow_text, " QUIT - Shutdown") == 0)
     {
-      lcdPosition(lcdHandle, 0, 0);
-      lcdPuts(lcdHandle, cur_song.FirstRow_text);
-      flag = FALSE;
+      hd44780_position(lcdHandle, 0, 0);
+      hd44780_puts(lcdHandle, lcd.FirstRow_text);
+      return FALSE;
     }
+    // Lay the text out once; scrolling just moves along it
+    flag = scroll_set(&lcd.FirstRow_scroll, lcd.FirstRow_text, CO - 1, 0, vclock_ms());
+    lcd.FirstRow_shown = lcd.FirstRow_gen;
+    scroll_window(&lcd.FirstRow_scroll, window);
+    lcdtext_render(0, window);
+    hd44780_position(lcdHandle, 0, 0);
+    hd44780_putchar(lcdHandle, LCDTEXT_NOTE_SLOT);
+    hd44780_position(lcdHandle, 1, 0);
+    hd44780_puts(lcdHandle, window);
+    return flag;
+}
+
+// m:ss, with a ~ in front if it's only an estimate; 999:59 at most
+void formatTime(char *buf, size_t len, long ms, int estimate)
+{
+    if (ms < 0)
+        ms = 0;
+    if (ms > 999 * 60000L + 59999)
+        ms = 999 * 60000L + 59999;
+    snprintf(buf, len, "%s%ld:%02ld", (estimate ? "~" : ""), ms / 60000, ms / 1000 % 60);
+}
+
+/*
+  Lays out the progress row: time played, the bar and the length, CO - 2
+  characters of converted text (see lcdtext.h).  Returns FALSE if it comes
+  out the same as last time.
+*/
+int layoutProgress()
+{
+    char played[16], length_text[16], bar[SCROLL_WIDTH_MAX + 1];
+    long pos = __atomic_load_n(&songTime.pos, __ATOMIC_RELAXED);
+    long length = __atomic_load_n(&songTime.length, __ATOMIC_ACQUIRE);
+    int width = CO - 2, barw, px, n;
+
+    formatTime(played, sizeof(played), pos, FALSE);
+    if (length > 0)
+        formatTime(length_text, sizeof(length_text), length, !__atomic_load_n(&songTime.exact, __ATOMIC_RELAXED));
     else
+        strcpy(length_text, "-:--");
+    barw = width - strlen(played) - strlen(length_text) - 2;
+    if (barw < 0)
+        barw = 0;
+    px = (length > 0 ? (int)((long long)pos * barw * LCDTEXT_BAR_STEPS / length) : 0);
+    if (px > barw * LCDTEXT_BAR_STEPS)
+        px = barw * LCDTEXT_BAR_STEPS;
+    if (pos / 1000 == lcd.progress_secs && px == lcd.progress_px && length == lcd.progress_length)
+        return FALSE;
+    lcd.progress_secs = pos / 1000;
+    lcd.progress_px = px;
+    lcd.progress_length = length;
+    lcdtext_bar(bar, barw, px);
+    n = snprintf(lcd.progress_text, width + 1, "%s %s %s", played, bar, length_text);
+    for (; n < width; n++)
+        lcd.progress_text[n] = ' ';
+    lcd.progress_text[width] = '\0';
+    return TRUE;
+}
+
+// The progress row; all draws all of it, otherwise only what has changed
+void showProgress(int all)
+{
+    char window[SCROLL_WIDTH_MAX + 1];
+    int first, last, width = CO - 2;
+
+    if (layoutProgress() == FALSE && all == FALSE)
+        return;
+    strcpy(window, lcd.progress_text);
+    lcdtext_render(1, window);
+    first = 0;
+    last = width;
+    if (all == FALSE)
     {
-      // Have to set to 15 because of music note
-      if (strlen(cur_song.FirstRow_text) < 15)
-      {
-        // New song; set the previous title
-        if (strcmp(cur_song.title, cur_song.prevTitle) != 0)
-          strcpy(cur_song.prevTitle, cur_song.title);
-        lcdCharDef(lcdHandle, 2, musicNote);
-        lcdPosition(lcdHandle, 0, 0);
-        lcdPutchar(lcdHandle, 2);
-        lcdPosition(lcdHandle, 1, 0);
-        lcdPuts(lcdHandle, cur_song.FirstRow_text);
-        flag = FALSE;
-      }
+        while (first < width && window[first] == lcd.SecondRow_window[first])
+            first++;
+        while (last > first && window[last - 1] == lcd.SecondRow_window[last - 1])
+            last--;
     }
-    return flag;
+    strcpy(lcd.SecondRow_window, window);
+    if (first == last)
+        return;
+    window[last] = '\0';
+    hd44780_position(lcdHandle, first, 1);
+    hd44780_puts(lcdHandle, window + first);
 }
 
-// Non-scrolling - Bottom row
+// Bottom row, leaving the last two columns for the volume; it scrolls
+// round twice and then stays put
 int printLcdSecondRow()
 {
-    int flag = TRUE;
+    char window[SCROLL_WIDTH_MAX + 1];
+    int flag;
 
-    if (strlen(cur_song.SecondRow_text) < 15)
+    lcd.SecondRow_shown = lcd.SecondRow_gen;
+    // Changes every second, but never scrolls
+    if (lcd.SecondRow_text == lcd.progress_text)
     {
-      lcdPosition(lcdHandle, 0, 1);
-      lcdPuts(lcdHandle, cur_song.SecondRow_text);
-      flag = FALSE;
-      // New song; set the previous artist
-      if (strcmp(cur_song.artist, cur_song.prevArtist) != 0)
-        strcpy(cur_song.prevArtist, cur_song.artist);
+        lcd.progress_secs = -1;
+        showProgress(TRUE);
+        return FALSE;
     }
+    flag = scroll_set(&lcd.SecondRow_scroll, lcd.SecondRow_text, CO - 2, 2, vclock_ms());
+    scroll_window(&lcd.SecondRow_scroll, window);
+    lcdtext_render(1, window);
+    strcpy(lcd.SecondRow_window, window);
+    hd44780_position(lcdHandle, 0, 1);
+    hd44780_puts(lcdHandle, window);
     return flag;
 }
 
+// The LCD, wired as -lcd says: gpio, or i2c[:bus[:addr]]
+struct hd44780 *openLcd(const char *wiring)
+{
+    struct hd44780_pins pins;
+    int bus = HD44780_I2C_BUS, addr = HD44780_I2C_ADDR;
+    char *end;
+
+    if (strncmp(wiring, "i2c", 3) == 0)
+    {
+        if (wiring[3] == ':')
+        {
+            bus = strtol(wiring + 4, &end, 0);
+            if (*end == ':')
+                addr = strtol(end + 1, NULL, 0);
+        }
+        return hd44780_open_i2c(bus, addr, CO, RO);
+    }
+    pins.rs = wpiPinToGpio(RS);
+    pins.e = wpiPinToGpio(EN);
+    pins.d4 = wpiPinToGpio(D0);
+    pins.d5 = wpiPinToGpio(D1);
+    pins.d6 = wpiPinToGpio(D2);
+    pins.d7 = wpiPinToGpio(D3);
+    return hd44780_open_gpio(HD44780_GPIO_CHIP, &pins, CO, RO);
+}
+
+// Draws an accented letter the ROM doesn't have (see lcdtext.h)
+void defineGlyph(int slot, unsigned char *rows)
+{
+    hd44780_chardef(lcdHandle, slot, rows);
+}
+
 // Scrolling - Top row
-void scroll_Message_FirstRow(int *pause_Scroll_FirstRow_Flag)
+void scroll_Message_FirstRow()
 {
-    char buf[32];
-    char my_songname[MAXDATALEN];
-    static int position = 0;
-    static int timer = 0;
-    int width = 15;
+    char window[SCROLL_WIDTH_MAX + 1];
 
-    if (strcmp(cur_song.title, cur_song.prevTitle) != 0)
+    // New text; start from the beginning
+    if (lcd.FirstRow_shown != lcd.FirstRow_gen)
+      printLcdFirstRow();
+    else if (scroll_tick(&lcd.FirstRow_scroll, vclock_ms(), window) == TRUE)
     {
-      timer = 0;
-      position = 0;
-      strcpy(cur_song.prevTitle, cur_song.title);
+      lcdtext_render(0, window);
+      hd44780_position(lcdHandle, 1, 0);
+      hd44780_puts(lcdHandle, window);
     }
-    strcpy(my_songname, "  ");
-    strncat(my_songname, cur_song.title, strlen(cur_song.title));
-    strcat(my_songname, spaces);
-    my_songname[strlen(my_songname) + 1] = 0;
-    if (millis() < timer)
-      return;
-    timer = millis() + 200;
-    strncpy(buf, &my_songname[position], width);
-    buf[width] = 0;
-    lcdCharDef(lcdHandle, 2, musicNote);
-    lcdPosition(lcdHandle, 0, 0);
-    lcdPutchar(lcdHandle, 2);
-    lcdPosition(lcdHandle, 1, 0);
-    lcdPuts(lcdHandle, buf);
-    position++;
-    if (position == (strlen(my_songname) - width))
-      position = 0;
-    // Pause briefly when text reaches begining line before continuing
-    *pause_Scroll_FirstRow_Flag = (strcmp(buf, cur_song.scroll_FirstRow) == 0 ? TRUE : FALSE);
 }
 
 // Scrolling - Bottom row
-void scroll_Message_SecondRow(int *pause_Scroll_SecondRow_Flag)
+void scroll_Message_SecondRow()
+{
+    char window[SCROLL_WIDTH_MAX + 1];
+
+    if (lcd.SecondRow_shown != lcd.SecondRow_gen)
+      printLcdSecondRow();
+    else if (scroll_tick(&lcd.SecondRow_scroll, vclock_ms(), window) == TRUE)
+    {
+      lcdtext_render(1, window);
+      strcpy(lcd.SecondRow_window, window);
+      hd44780_position(lcdHandle, 0, 1);
+      hd44780_puts(lcdHandle, window);
+    }
+}
+
+// Counts the song's frames for its exact length, as long as nothing else wants the CPU
+void *countFrames(void *arg)
+{
+    char *path = (char *)arg;
+    struct duration d;
+
+    rt_idle_thread();
+    if (duration_count(path, &d, &songTime.stop) == 0 && d.exact == TRUE)
+    {
+        __atomic_store_n(&songTime.exact, TRUE, __ATOMIC_RELAXED);
+        __atomic_store_n(&songTime.length, duration_ms(&d), __ATOMIC_RELEASE);
+    }
+    free(path);
+    return NULL;
+}
+
+// The length of the song about to play; counted in the background if the headers don't say
+void songTimeStart(const char *path)
+{
+    struct duration d;
+    char *copy;
+
+    songTime.pos = 0;
+    songTime.length = 0;
+    songTime.exact = FALSE;
+    songTime.stop = FALSE;
+    songTime.counting = FALSE;
+    if (duration_read(path, &d) != 0)
+        return;
+    songTime.length = duration_ms(&d);
+    songTime.exact = d.exact;
+    if (d.exact == TRUE || (copy = strdup(path)) == NULL)
+        return;
+    if (pthread_create(&songTime.thread, NULL, countFrames, copy) == 0)
+        songTime.counting = TRUE;
+    else
+        free(copy);
+}
+
+void songTimeStop()
 {
-    char buf[32];
-    static int position = 0;
-    static int timer = 0;
-    int width = 14;
-    char my_string[MAXDATALEN];
+    if (songTime.counting == FALSE)
+        return;
+    __atomic_store_n(&songTime.stop, TRUE, __ATOMIC_RELEASE);
+    pthread_join(songTime.thread, NULL);
+    songTime.counting = FALSE;
+}
 
-    if (strcmp(cur_song.artist, cur_song.prevArtist) != 0)
+/*
+  -stream without -duck: the player and the stream take turns with the
+  sound card (it may not mix).  Takes it, waiting while something is being
+  streamed; returns FALSE if the song was skipped meanwhile.
+*/
+static int claimCard(void)
+{
+    int status;
+
+    if (stream_path == NULL || duck_db > 0)
+        return TRUE;
+    while (stream_claim_card() == FALSE)
     {
-      timer = 0;
-      position = 0;
-      strcpy(cur_song.prevArtist, cur_song.artist);
+        status = state_get_status();
+        if (status == QUIT || status == NEXT || status == PREV || status == SHUFFLE)
+            return FALSE;
+        stream_wait(STREAM_WAIT_MS);
     }
-    //strcpy(my_string, spaces);
-    strcpy(my_string, "  ");
-    strncat(my_string, cur_song.SecondRow_text, strlen(cur_song.SecondRow_text));
-    strcat(my_string, spaces);
-    my_string[strlen(my_string) + 1] = 0;
-    if (millis() < timer)
-      return;
-    timer = millis() + 200;
-    strncpy(buf, &my_string[position], width);
-    buf[width] = 0;
-    lcdPosition(lcdHandle, 0, 1);
-    lcdPuts(lcdHandle, buf);
-    position++;
-    if (position == (strlen(my_string) - width))
-      position = 0;
-    // Pause briefly when text reaches begining line before continuing
-    *pause_Scroll_SecondRow_Flag = (strcmp(buf, cur_song.scroll_SecondRow) == 0 ? TRUE : FALSE);
+    return TRUE;
+}
+
+// The sound card has been closed; the stream can have it
+static void releaseCard(void)
+{
+    if (stream_path != NULL && duck_db <= 0)
+        stream_release_card();
 }
 
 // The actual thing that plays the song
 void play_song(void *arguments)
 {
-    struct song_info *args = (struct song_info *)arguments;
+    const struct track_info *track = (const struct track_info *)arguments;
     mpg123_handle *mh;
-    mpg123_pars *mpar;
     unsigned char *buffer;
     size_t buffer_size;
     size_t done;
-    int err;
 
-    int driver;
-    ao_device *dev;
-    ao_sample_format format;
+    struct sink out;
     int channels, encoding;
     long rate;
-
-    ao_initialize();
-    driver = ao_default_driver_id();
+    // For the status record
+    long pos_ms;
+    long long start_us, written_us, now;
+    int frame_bytes, underrun;
+    // For seeking
+    long seek_secs;
+    int seek_relative;
+    off_t pos;
+    int status;
+    // For -replaygain and -duck
+    double volume = 1.0;
+    int ducked = FALSE, skipped;
+
+    // Real-time priority (and maybe a CPU of its own) for the audio; complain only once
+    if (rt_audio_thread() != 0 && rtWarned == FALSE)
+    {
+        fprintf(stderr, "[%s - %d]: Cannot make the player real-time: %s\n", __FILE__, __LINE__, strerror(errno));
+        rtWarned = TRUE;
+    }
+    // With -stream or -zone main() has done it
+    if (aoShared == FALSE)
+        ao_initialize();
     mpg123_init();
-    // Try to not show error messages
-    mh = mpg123_new(NULL, &err);
-    mpar = mpg123_new_pars(&err);
-    mpg123_par(mpar, MPG123_ADD_FLAGS, MPG123_QUIET, 0);
-    mh = mpg123_parnew(mpar, NULL, &err);
+    // Open the file and get the decoding format; if it can't be played, just give up on it
+    mh = decoder_open(track->filename, &rate, &channels, &encoding);
+    if (mh == NULL)
+    {
+        quarantine_add(track->filename, "open");
+        mpg123_exit();
+        if (aoShared == FALSE)
+            ao_shutdown();
+        state_song_over(TRUE);
+        return;
+    }
+    // Bring it to the same loudness as the rest, if it has been measured
+    if (gainFlag == TRUE)
+    {
+        volume = track->gain_scale;
+        mpg123_volume(mh, volume);
+    }
+    // Open the output device, once a stream that's playing is done with it
+    skipped = (claimCard() == FALSE);
+    if (skipped || sink_open(&out, SINK_AO, NULL, rate, channels, mpg123_encsize(encoding) * 8) != 0)
+    {
+        if (skipped == FALSE)
+            fprintf(stderr, "[%s - %d]: Cannot open the audio device (errno %d)\n", __FILE__, __LINE__, errno);
+        releaseCard();
+        decoder_close(mh);
+        mpg123_exit();
+        if (aoShared == FALSE)
+            ao_shutdown();
+        state_song_over(TRUE);
+        return;
+    }
     buffer_size = mpg123_outblock(mh);
     buffer = (unsigned char*) malloc(buffer_size * sizeof(unsigned char));
-    // Open the file and get the decoding format
-    mpg123_open(mh, args->filename);
-    mpg123_getformat(mh, &rate, &channels, &encoding);
-    // Set the output format and open the output device
-    format.bits = mpg123_encsize(encoding) * 8;
-    format.rate = rate;
-    format.channels = channels;
-    format.byte_format = AO_FMT_NATIVE;
-    format.matrix = 0;
-    dev = ao_open_live(driver, &format, NULL);
+    frame_bytes = channels * mpg123_encsize(encoding);
+    // Keep track of how much audio we have written versus how long it has
+    // been; if the clock gets ahead of the audio the device ran dry.
+    start_us = vclock_us();
+    written_us = 0;
     // Decode and play
     while (mpg123_read(mh, buffer, buffer_size, &done) == MPG123_OK)
     {
-      checkPause();
-      ao_play(dev, (char *) buffer, done);
+      // Coming back from a pause the device has drained; start counting again.
+      // Paused for a while, let the sound card go until we play again.
+      if (state_get_status() == PAUSE)
+      {
+        if (idle_secs > 0 && state_wait_resume(idle_secs * 1000L) == FALSE)
+        {
+          sink_close(&out);
+          releaseCard();
+          state_check_pause();
+          if (claimCard() == FALSE)
+            break;
+          if (sink_open(&out, SINK_AO, NULL, rate, channels, mpg123_encsize(encoding) * 8) != 0)
+          {
+            fprintf(stderr, "[%s - %d]: Cannot open the audio device again (errno %d)\n", __FILE__, __LINE__, errno);
+            break;
+          }
+        }
+        else
+          state_check_pause();
+        start_us = vclock_us() - written_us;
+      }
+      // Something is coming down the -stream pipe; turn down, or get out of its way until it's done
+      if (stream_path != NULL && stream_active())
+      {
+        if (duck_db > 0 && ducked == FALSE)
+        {
+          mpg123_volume(mh, volume * pow(10, -duck_db / 20));
+          ducked = TRUE;
+        }
+        else if (duck_db <= 0)
+        {
+          // The stream is waiting for the card
+          sink_close(&out);
+          releaseCard();
+          if (claimCard() == FALSE)
+            break;
+          if (sink_open(&out, SINK_AO, NULL, rate, channels, mpg123_encsize(encoding) * 8) != 0)
+          {
+            fprintf(stderr, "[%s - %d]: Cannot open the audio device again (errno %d)\n", __FILE__, __LINE__, errno);
+            break;
+          }
+          start_us = vclock_us() - written_us;
+        }
+      }
+      else if (ducked == TRUE)
+      {
+        mpg123_volume(mh, volume);
+        ducked = FALSE;
+      }
+      if (state_take_seek(&seek_secs, &seek_relative) == TRUE)
+      {
+        pos = (off_t)seek_secs * rate;
+        if (seek_relative)
+          pos += mpg123_tell(mh);
+        mpg123_seek(mh, (pos < 0 ? 0 : pos), SEEK_SET);
+      }
+      sink_write(&out, buffer, done);
+      if (__atomic_load_n(&first_audio_us, __ATOMIC_RELAXED) == 0)
+        __atomic_store_n(&first_audio_us, vclock_us(), __ATOMIC_RELEASE);
+      written_us += (long long)(done / frame_bytes) * 1000000 / rate;
+      now = vclock_us();
+      underrun = (now - start_us > written_us + UNDERRUN_SLACK_US);
+      if (underrun)
+      {
+        start_us = now - written_us;
+        // Give the player all the CPU it wants for a while
+        rgain_underrun();
+      }
+      // The length is worked out before we start (see songTimeStart())
+      pos_ms = (long)(mpg123_tell(mh) * 1000LL / rate);
+      __atomic_store_n(&songTime.pos, pos_ms, __ATOMIC_RELAXED);
+      status_player(pos_ms, __atomic_load_n(&songTime.length, __ATOMIC_ACQUIRE), (long)((written_us - (now - start_us)) / 1000), underrun);
+      journal_position(mpg123_tell(mh), rate);
       // Stop playing if the user pressed quit, shuffle, next, or prev buttons
-      if (cur_song.play_status == QUIT || cur_song.play_status == NEXT || cur_song.play_status == PREV || cur_song.play_status == SHUFFLE)
+      status = state_get_status();
+      if (status == QUIT || status == NEXT || status == PREV || status == SHUFFLE)
         break;
     }
     // Clean up
     free(buffer);
-    ao_close(dev);
-    mpg123_close(mh);
-    mpg123_delete(mh);
+    sink_close(&out);
+    releaseCard();
+    decoder_close(mh);
     mpg123_exit();
-    ao_shutdown();
-    pthread_mutex_lock(&(cur_song.writeMutex));
-    args->song_over = TRUE;
-    // Only set the status to play if the song finished normally
-    if (cur_song.play_status != QUIT && cur_song.play_status != SHUFFLE && cur_song.play_status != NEXT && cur_song.play_status != PREV)
-      args->play_status = PLAY;
-    cur_status.song_over = TRUE; // FIXME only time cur_status is used?! Might just delete the entire struct...
-    pthread_mutex_unlock(&(cur_song.writeMutex));
+    if (aoShared == FALSE)
+        ao_shutdown();
+    // The main loop works out whether it finished or was skipped
+    state_song_over(TRUE);
+}
+
+/*
+ * Search / filter
+ */
+/*
+  Only play the n songs in tracks (malloc()ed; freed here), e.g. from a
+  search for what ("" for every song), in album order with -albums.
+  Returns -1 (and leaves the play queue alone) if there aren't any.
+*/
+int useFilter(int *tracks, int n, const char *what)
+{
+    if (n <= 0)
+    {
+        if (n == 0)
+            free(tracks);
+        fprintf(stderr, "[%s - %d]: No songs match '%s'\n", __FILE__, __LINE__, what);
+        return -1;
+    }
+    if (albumFlag == TRUE && tagindex_album_order(tracks, n) != 0)
+        fprintf(stderr, "[%s - %d]: Cannot put the songs in album order: %s\n", __FILE__, __LINE__, strerror(errno));
+    n = pq_set_filter(&queue, tracks, n);
+    free(tracks);
+    if (n != 0)
+        return -1;
+    filtering = (what[0] != '\0');
+    control_set("filter", "%s", what);
+    return 0;
+}
+
+// Play every song again (in album order with -albums)
+void clearFilter()
+{
+    int *tracks, i, n = library_count(&library);
+
+    if (albumFlag == FALSE || n == 0 || (tracks = malloc(n * sizeof(int))) == NULL)
+    {
+        pq_set_filter(&queue, NULL, 0);
+        filtering = FALSE;
+        control_set("filter", "%s", "");
+        return;
+    }
+    for (i = 0; i < n; i++)
+        tracks[i] = i;
+    useFilter(tracks, n, "");
+}
+
+// Info + next was pressed; show the next artist (or every song)
+void browseStep()
+{
+    browse.pos++;
+    if (tagindex_artist(browse.pos - 1, browse.text, MAXDATALEN) != 0)
+    {
+        browse.pos = 0;
+        snprintf(browse.text, MAXDATALEN, "All songs");
+    }
+    browse.active = TRUE;
+    browse.time = vclock_ms();
+    setSecondRow(browse.text);
+    hd44780_position(lcdHandle, 0, 1);
+    hd44780_puts(lcdHandle, lcd_clear);
+    scroll_SecondRow_Flag = printLcdSecondRow();
+}
+
+// Nothing has been pressed for a while; play the artist picked
+void browseDone()
+{
+    int *tracks, n;
+
+    browse.active = FALSE;
+    if (browse.pos == 0)
+        clearFilter();
+    else
+    {
+        n = tagindex_by_artist(browse.text, &tracks);
+        if (useFilter(tracks, n, browse.text) != 0)
+        {
+            setSecondRow(cur_track->artist);
+            hd44780_position(lcdHandle, 0, 1);
+            hd44780_puts(lcdHandle, lcd_clear);
+            scroll_SecondRow_Flag = printLcdSecondRow();
+            return;
+        }
+    }
+    nextSong();
+}
+
+/*
+ * Everything the buttons and the control socket can do ends up here
+ */
+void run_command(int cmd, long arg, int relative, const char *path)
+{
+    double vol;
+    int ival, *tracks;
+
+    if (cur_state.play_status == PAUSE)
+    {
+        // Anything that changes the song has to resume first; otherwise the
+        // player thread stays stuck in state_check_pause().
+        if (cmd == CMD_NEXT || cmd == CMD_PREV || cmd == CMD_QUIT || cmd == CMD_SEEK || cmd == CMD_FILTER)
+            run_command(CMD_PLAY, 0, FALSE, NULL);
+        // The second row shows PAUSED; leave it alone.
+        else if (cmd == CMD_INFO || cmd == CMD_MUTE || cmd == CMD_BROWSE)
+            return;
+    }
+    if (cmd == CMD_TOGGLE)
+        cmd = (cur_state.play_status == PAUSE ? CMD_PLAY : CMD_PAUSE);
+    switch (cmd)
+    {
+        case CMD_PLAY:
+            if (cur_state.play_status != PAUSE)
+                break;
+            playMe();
+            setSecondRow(lcd.pause_text);
+            hd44780_position(lcdHandle, 0, 1);
+            hd44780_puts(lcdHandle, lcd_clear);
+            scroll_SecondRow_Flag = printLcdSecondRow();
+            control_set("state", "playing");
+            status_set_state(PLAY);
+            break;
+        case CMD_PAUSE:
+            if (cur_state.play_status == PAUSE)
+                break;
+            pauseMe();
+            // Remember whatever is currently on the second row
+            lcd.pause_text = lcd.SecondRow_text;
+            setSecondRow("PAUSED");
+            hd44780_position(lcdHandle, 0, 1);
+            hd44780_puts(lcdHandle, lcd_clear);
+            scroll_SecondRow_Flag = printLcdSecondRow();
+            control_set("state", "paused");
+            status_set_state(PAUSE);
+            // The power may well go next
+            journal_flush();
+            break;
+        case CMD_MUTE:
+            snd_mixer_selem_get_playback_switch(elem, 0, &ival);
+            if (ival == 1) // 1 = muted
+            {
+                lcd.muted_text = lcd.SecondRow_text;
+                setSecondRow("-- MUTED --");
+            }
+            else
+                setSecondRow(lcd.muted_text);
+            hd44780_position(lcdHandle, 0, 1);
+            hd44780_puts(lcdHandle, lcd_clear);
+            scroll_SecondRow_Flag = printLcdSecondRow();
+            snd_mixer_selem_set_playback_switch(elem, 0, !ival);
+            cur_state.muted = (ival == 1);
+            publishState();
+            control_set("muted", "%s", ival == 1 ? "yes" : "no");
+            break;
+        case CMD_PREV:
+            // The main loop asks the play queue which song once this one stops
+            prevSong();
+            break;
+        case CMD_NEXT:
+            nextSong();
+            break;
+        case CMD_INFO:
+            // Go round what to display: artist, album, how far into the song
+            if (lcd.SecondRow_text == cur_track->artist)
+                setSecondRow(cur_track->album);
+            else if (lcd.SecondRow_text == cur_track->album)
+                setSecondRow(lcd.progress_text);
+            else
+                setSecondRow(cur_track->artist);
+            lcd.progress = (lcd.SecondRow_text == lcd.progress_text);
+            // First clear just the second row, then re-display the second row
+            hd44780_position(lcdHandle, 0, 1);
+            hd44780_puts(lcdHandle, lcd_clear);
+            scroll_SecondRow_Flag = printLcdSecondRow();
+            break;
+        case CMD_QUIT:
+            quitMe();
+            break;
+        case CMD_SHUFFLE:
+            // arg: -1 toggles, otherwise it's the new state
+            if (arg >= 0 && (arg ? TRUE : FALSE) == shuffFlag)
+                break;
+            shuffFlag = (shuffFlag == TRUE ? FALSE : TRUE);
+            // Only what's still to come changes; the current song keeps playing
+            pq_set_shuffle(&queue, shuffFlag);
+            cur_state.shuffle = shuffFlag;
+            publishState();
+            journal_track(playlist_id, cur_track->index, cur_track->filename, shuffFlag, queue.seed);
+            control_set("shuffle", "%s", shuffFlag == TRUE ? "on" : "off");
+            break;
+        case CMD_VOLUME:
+            vol = (relative ? get_vol_num(elem) + arg : arg) / 99.0;
+            set_normalized_volume(elem, vol);
+            cur_state.volume = get_vol_num(elem);
+            publishState();
+            control_set("volume", "%d", cur_state.volume);
+            status_set_volume(cur_state.volume);
+            break;
+        case CMD_SEEK:
+            state_seek(arg, relative);
+            break;
+        case CMD_ENQUEUE:
+            if (pq_enqueue(&queue, path) != 0)
+                fprintf(stderr, "[%s - %d]: Up next queue is full; dropped %s\n", __FILE__, __LINE__, path);
+            break;
+        case CMD_FILTER:
+            // path is the search; empty plays everything again
+            if (path[0] == '\0')
+                clearFilter();
+            else
+            {
+                ival = tagindex_search(path, &tracks);
+                if (useFilter(tracks, ival, path) != 0)
+                    break;
+            }
+            nextSong();
+            break;
+        case CMD_BROWSE:
+            browseStep();
+            break;
+    }
+}
+
+/*
+ * Library / play queue
+ */
+// Swap in a new library (e.g. from a USB stick); the play queue has to be restarted after this
+void useLibrary(struct library *lib)
+{
+    scan_stop();
+    tagindex_stop();
+    rgain_stop();
+    zone_stop_all();
+    quarantine_validate_stop();
+    library_free(&library);
+    library = *lib;
+    free(lib);
+}
+
+// A new library from the USB watcher; read in the songs if there's a stick
+void useStick(struct library *lib)
+{
+    useLibrary(lib);
+    if (usb_mounted() == TRUE && scan_start(&library, "/MUSIC") != 0)
+        fprintf(stderr, "[%s - %d]: Cannot read '/MUSIC': %s\n", __FILE__, __LINE__, strerror(errno));
+}
+
+/*
+  (Re)start the play queue on the current library, from where we left off
+  if the journal has a place in these songs.  The library may still be
+  growing; we only wait for the song we left off at (or for all of them
+  if they have to be filtered or sorted).
+  Returns the first song to play (NULL if there are none).
+*/
+const struct pq_item *startQueue(const char *journal_path, long *resume_secs)
+{
+    struct journal_record resume;
+    struct lib_track *last;
+    const struct pq_item *item = NULL;
+    int resumed = FALSE, *tracks, n, i;
+    unsigned seed = (unsigned)time(NULL);
+
+    pq_free(&queue);
+    if (filter_query != NULL || albumFlag == TRUE)
+        scanWait(INT_MAX);
+    // Index the songs for searching
+    tagindex_stop();
+    if (tagindex_start(&library, tagcache_path) != 0)
+        fprintf(stderr, "[%s - %d]: Cannot index the songs: %s\n", __FILE__, __LINE__, strerror(errno));
+    if (gainFlag == TRUE)
+    {
+        rgain_stop();
+        if (rgain_start(&library, gaincache_path, gain_threads) != 0)
+            fprintf(stderr, "[%s - %d]: Cannot measure the songs' loudness: %s\n", __FILE__, __LINE__, strerror(errno));
+    }
+    if (validateFlag == TRUE && quarantine_validate(&library) != 0)
+        fprintf(stderr, "[%s - %d]: Cannot check the songs: %s\n", __FILE__, __LINE__, strerror(errno));
+    // The other zones go through the same songs, each in its own order
+    zone_stop_all();
+    for (i = 0; i < zones; i++)
+    {
+        if (zone_start(&library, SINK_AO, zone_devices[i], shuffFlag, seed + i + 1, zone_volumes[i]) < 0)
+            fprintf(stderr, "[%s - %d]: Cannot start zone %s: %s\n", __FILE__, __LINE__, zone_devices[i], strerror(errno));
+    }
+    *resume_secs = 0;
+    if (journal_path != NULL && journal_load(journal_path, &resume) == 0 && resume.index >= 0)
+    {
+        // The songs are read in the same order every time, so if the song
+        // is still there it turns up at the same index
+        scanWait(resume.index + 1);
+        last = library_get(&library, resume.index);
+        if (last != NULL && hash_str(last->path) == resume.path_hash)
+        {
+            shuffFlag = (resume.shuffle ? TRUE : FALSE);
+            seed = resume.seed;
+            resumed = TRUE;
+        }
+    }
+    // Something to pick from; the songs found later are shuffled in among
+    // the ones that haven't played yet
+    scanWait(resumed == FALSE && shuffFlag == TRUE ? SCAN_SHUFFLE_MIN : 1);
+    // Changes as songs are read in; scanProgress() has the last word
+    playlist_id = library_id(&library);
+    songScan.active = scanning();
+    songScan.synced = library_count(&library);
+    songScan.time = vclock_ms();
+    if (pq_init(&queue, &library, shuffFlag, seed) != 0)
+        exit(EXIT_FAILURE);
+    if (filter_query != NULL || albumFlag == TRUE)
+    {
+        // These need every song's tags; the only wait for the index there is
+        // (quick if they're in the tag cache)
+        tagindex_wait();
+        if (filter_query != NULL)
+            n = tagindex_search(filter_query, &tracks);
+        if (filter_query == NULL || useFilter(tracks, n, filter_query) != 0)
+            clearFilter();
+    }
+    if (resumed == TRUE)
+    {
+        // NULL if the song isn't in the filter (any more)
+        item = pq_start_at(&queue, resume.index);
+        if (item != NULL && hash_str(item->path) == resume.path_hash && resume.rate > 0)
+            *resume_secs = (long)(resume.sample / resume.rate);
+    }
+    if (item == NULL)
+        item = pq_next(&queue);
+    cur_state.shuffle = shuffFlag;
+    control_set("shuffle", "%s", shuffFlag == TRUE ? "on" : "off");
+    return item;
+}
+
+/*
+  While the songs are still being read in: every so often work the new
+  ones into the play order and show how many there are on the second row
+  (instead of the artist; PAUSED, MUTED and browsing are left alone).
+  Once they're all in, the artist comes back.
+*/
+void scanProgress()
+{
+    long long first = __atomic_load_n(&first_audio_us, __ATOMIC_ACQUIRE);
+    int n;
+
+    // Just the once
+    if (first != 0 && start_us != 0)
+    {
+        fprintf(stderr, "First audio %lld ms after start up\n", (first - start_us) / 1000);
+        start_us = 0;
+    }
+    if (songScan.active == FALSE || vclock_ms() - songScan.time < SCAN_SHOW_MS)
+        return;
+    songScan.time = vclock_ms();
+    n = library_count(&library);
+    if (n != songScan.synced)
+    {
+        songScan.synced = n;
+        pq_sync(&queue);
+        tagindex_update();
+        rgain_update();
+    }
+    if (scanning() == TRUE)
+    {
+        if (cur_state.play_status != PLAY ||
+            (lcd.SecondRow_text != cur_track->artist && lcd.SecondRow_text != songScan.text))
+            return;
+        snprintf(songScan.text, MAXDATALEN, "Scanning %d", n);
+        setSecondRow(songScan.text);
+    }
+    else
+    {
+        songScan.active = FALSE;
+        playlist_id = library_id(&library);
+        if (lcd.pause_text == songScan.text)
+            lcd.pause_text = cur_track->artist;
+        if (lcd.muted_text == songScan.text)
+            lcd.muted_text = cur_track->artist;
+        if (lcd.SecondRow_text != songScan.text)
+            return;
+        setSecondRow(cur_track->artist);
+    }
+    hd44780_position(lcdHandle, 0, 1);
+    hd44780_puts(lcdHandle, lcd_clear);
+    scroll_SecondRow_Flag = printLcdSecondRow();
+}
+
+// Wait for a USB stick with songs on it; returns FALSE if quit was pressed first
+int waitForUSB()
+{
+    struct library *lib;
+    struct control_cmd cmd;
+    int why, shown = FILES_OK;
+
+    for (;;)
+    {
+        lib = usb_take_library();
+        if (lib != NULL)
+        {
+            useStick(lib);
+            scanWait(1);
+            if (library_count(&library) > 0)
+                return TRUE;
+        }
+        why = (usb_mounted() == TRUE ? NO_FILES : MOUNT_ERROR);
+        if (why != shown)
+        {
+            hd44780_clear(lcdHandle);
+            hd44780_position(lcdHandle, 0, 0);
+            hd44780_puts(lcdHandle, (why == NO_FILES ? "No songs on USB." : "No USB inserted."));
+            hd44780_position(lcdHandle, 0, 1);
+            hd44780_puts(lcdHandle, "Waiting for USB.");
+            control_set("state", "waiting");
+            status_set_state(STOP);
+            shown = why;
+        }
+        // The quit button still works (held for a moment so noise doesn't count)
+        if (digitalRead(quitButtonPin) == LOW)
+        {
+            vclock_sleep_ms(debounceDelay);
+            if (digitalRead(quitButtonPin) == LOW)
+                return FALSE;
+        }
+        while (state_get_cmd(&cmd))
+        {
+            if (cmd.cmd == CMD_QUIT)
+                return FALSE;
+        }
+        vclock_sleep_ms(100);
+    }
+}
+
+/*
+  Takes the volume off the end of a -zone dev[=volume] and returns it (1.0
+  if there's none).  ALSA device names have colons, commas and = in them
+  (hw:CARD=x,DEV=0), so the volume is the number after the last =, and
+  only if that = doesn't end an ALSA setting (CARD, DEV, SUBDEV...)
+*/
+static double zoneVolume(char *dev)
+{
+    char *eq = strrchr(dev, '='), *key;
+
+    if (eq == NULL || eq[1] == '\0' || strspn(eq + 1, "0123456789") != strlen(eq + 1))
+        return 1.0;
+    for (key = eq; key > dev && strchr(":,=", key[-1]) == NULL; key--)
+        ;
+    if (key < eq && strspn(key, "ABCDEFGHIJKLMNOPQRSTUVWXYZ") == (size_t)(eq - key))
+        return 1.0;
+    *eq = '\0';
+    return atoi(eq + 1) / 100.0;
 }
 
 // Main function
 int main(int argc, char **argv)
 {
     pthread_t song_thread;
-    playlist_t init_playlist;
-    playlist_t cur_playlist;
-    clock_t startPauseFirstRow;  // For pausing scroll display
-    clock_t startPauseSecondRow; // For pausing scroll display
     char *basec, *bname;
-    char *string;
-    char pause_text[MAXDATALEN];
-    char muted_text[MAXDATALEN];
-    char lcd_clear[] = "                ";
-    int ival; // for mute
+    const char *ctl_path = CONTROL_SOCKET;
+    const char *journal_path = JOURNAL_FILE;
+    const char *usb_dev = USB_DEVICE;
+    struct journal_stats jstats;
+    struct zone_stats zstats;
+    struct quarantine_stats qstats;
+    long resume_secs = 0;
+    struct control_cmd cmd;
+    struct track_info *track, *old_track;
+    struct library *lib;
+    const struct pq_item *item;
+    long seek_secs;
+    int seek_relative;
     int index;
-    int song_index;
     int i;
-    int ctrSecondRowScroll;
-    int reading;
+    unsigned now;
     // Flags
     int haltFlag = FALSE;
-    int shuffFlag = FALSE;
+    int usbFlag = FALSE;
+    int watchFlag = FALSE;
+    unsigned watch_gen = 0;
     int playlistStatusErr = FILES_OK;
 
     int scroll_FirstRow_Flag = FALSE;
-    int scroll_SecondRow_Flag = FALSE;
-    int pause_Scroll_FirstRow_Flag = FALSE;
-    int pause_Scroll_SecondRow_Flag = FALSE;
-    int firstTime_FirstRow_Flag = TRUE;
-    int firstTime_SecondRow_Flag = TRUE;
-    int temp_FirstRow_Flag = FALSE;
-    int temp_SecondRow_Flag = FALSE;
 
     // Initializations
-    playlist_init(&cur_playlist);
-    playlist_init(&init_playlist);
-    ctrSecondRowScroll = 0;
-    cur_song.song_over = FALSE;
-    lastPlayButtonState = lastPrevButtonState =
-      lastNextButtonState = lastInfoButtonState =
-      lastQuitButtonState = lastShufButtonState = lastMuteButtonState = HIGH;
-    lastPlayDebounceTime = lastPrevDebounceTime =
-      lastNextDebounceTime = lastInfoDebounceTime =
-      lastQuitDebounceTime = lastShufDebounceTime = lastMuteDebounceTime = 0;
-    // Use the following instead of delay
-    startPauseFirstRow = clock();
-    startPauseSecondRow = clock();
+    start_us = vclock_us();
+    library_init(&library);
+    debounce_set(&playButton, HIGH, debounceDelay, 0);
+    debounce_set(&prevButton, HIGH, debounceDelay, 0);
+    debounce_set(&nextButton, HIGH, debounceDelay, 0);
+    debounce_set(&infoButton, HIGH, debounceDelay, 0);
+    debounce_set(&quitButton, HIGH, debounceDelay, 0);
+    debounce_set(&shufButton, HIGH, debounceDelay, 0);
+    debounce_set(&muteButton, HIGH, debounceDelay, 0);
     if (argc > 1)
     {
       // Random/shuffle songs on startup
       for (i = 1; i < argc; i++)
       {
         if (strcmp(argv[i], "-shuffle") == 0)
-        {
           shuffFlag = TRUE;
-          break;
+        // Control socket
+        else if (strcmp(argv[i], "-ctl") == 0 && i + 1 < argc)
+          ctl_path = argv[++i];
+        else if (strcmp(argv[i], "-noctl") == 0)
+          ctl_path = NULL;
+        // Resume journal
+        else if (strcmp(argv[i], "-journal") == 0 && i + 1 < argc)
+          journal_path = argv[++i];
+        else if (strcmp(argv[i], "-nojournal") == 0)
+          journal_path = NULL;
+        else if (strcmp(argv[i], "-usbdev") == 0 && i + 1 < argc)
+          usb_dev = argv[++i];
+        else if (strcmp(argv[i], "-filter") == 0 && i + 1 < argc)
+          filter_query = argv[++i];
+        else if (strcmp(argv[i], "-albums") == 0)
+          albumFlag = TRUE;
+        else if (strcmp(argv[i], "-tagcache") == 0 && i + 1 < argc)
+          tagcache_path = argv[++i];
+        else if (strcmp(argv[i], "-notagcache") == 0)
+          tagcache_path = NULL;
+        else if (strcmp(argv[i], "-quarantine") == 0 && i + 1 < argc)
+          quarantine_path = argv[++i];
+        else if (strcmp(argv[i], "-noquarantine") == 0)
+          quarantine_path = NULL;
+        else if (strcmp(argv[i], "-validate") == 0)
+          validateFlag = TRUE;
+        else if (strcmp(argv[i], "-replaygain") == 0)
+          gainFlag = TRUE;
+        else if (strcmp(argv[i], "-gainthreads") == 0 && i + 1 < argc)
+          gain_threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-gaincache") == 0 && i + 1 < argc)
+          gaincache_path = argv[++i];
+        else if (strcmp(argv[i], "-stream") == 0 && i + 1 < argc)
+          stream_path = argv[++i];
+        else if (strcmp(argv[i], "-duck") == 0 && i + 1 < argc)
+          duck_db = atof(argv[++i]);
+        else if (strcmp(argv[i], "-zone") == 0 && i + 1 < argc)
+        {
+          if (zones == ZONE_MAX)
+            return usage(argv[0]);
+          zone_devices[zones] = argv[++i];
+          zone_volumes[zones] = zoneVolume(argv[i]);
+          zones++;
+        }
+        else if (strcmp(argv[i], "-decoder") == 0 && i + 1 < argc)
+          decoder = argv[++i];
+        else if (strcmp(argv[i], "-rtprio") == 0 && i + 1 < argc)
+          rt_prio = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-cpu") == 0 && i + 1 < argc)
+          rt_cpu = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-nomlock") == 0)
+          rt_lock = FALSE;
+        else if (strcmp(argv[i], "-idle") == 0 && i + 1 < argc)
+          idle_secs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-scroll") == 0 && i + 1 < argc)
+          scroll_step = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-dwell") == 0 && i + 1 < argc)
+          scroll_dwell = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-bounce") == 0)
+          scroll_mode = SCROLL_BOUNCE;
+        else if (strcmp(argv[i], "-rom") == 0 && i + 1 < argc)
+          lcd_rom = (strcasecmp(argv[++i], "a02") == 0 ? LCDTEXT_A02 : LCDTEXT_A00);
+        else if (strcmp(argv[i], "-lcd") == 0 && i + 1 < argc)
+          lcd_wiring = argv[++i];
+        else if (strcmp(argv[i], "-lcdsize") == 0 && i + 1 < argc)
+        {
+          // The messages take 16 columns, and the second row is always used
+          if (sscanf(argv[++i], "%dx%d", &CO, &RO) != 2 || CO < 16 || CO > 40 || RO < 2 || RO > 4 || CO * RO > 80)
+            return usage(argv[0]);
         }
       }
+      scroll_configure(scroll_mode, scroll_step, scroll_dwell);
+      // Before any threads are started, so they all keep off the player's CPU
+      rt_setup(rt_prio, rt_cpu, rt_lock);
       if (strcmp(argv[1], "-pins") == 0)
       {
         showPins();
@@ -1039,12 +1876,24 @@ int main(int argc, char **argv)
       {
         for (index = 2; index < argc; index++)
         {
-          string = malloc(MAXDATALEN);
-          if (string == NULL)
-            perror("malloc: -songs");
-          strcpy(string, argv[index]);
-          playlist_add_song(index - 1, string, &init_playlist);
-          num_songs = argc - 2;
+          // Skip over any options
+          if (strcmp(argv[index], "-ctl") == 0 || strcmp(argv[index], "-journal") == 0 ||
+              strcmp(argv[index], "-usbdev") == 0 || strcmp(argv[index], "-filter") == 0 ||
+              strcmp(argv[index], "-tagcache") == 0 || strcmp(argv[index], "-decoder") == 0 ||
+              strcmp(argv[index], "-rtprio") == 0 || strcmp(argv[index], "-cpu") == 0 ||
+              strcmp(argv[index], "-idle") == 0 || strcmp(argv[index], "-scroll") == 0 ||
+              strcmp(argv[index], "-dwell") == 0 || strcmp(argv[index], "-rom") == 0 ||
+              strcmp(argv[index], "-lcd") == 0 || strcmp(argv[index], "-lcdsize") == 0 ||
+              strcmp(argv[index], "-gainthreads") == 0 || strcmp(argv[index], "-gaincache") == 0 ||
+              strcmp(argv[index], "-stream") == 0 || strcmp(argv[index], "-duck") == 0 ||
+              strcmp(argv[index], "-zone") == 0 || strcmp(argv[index], "-quarantine") == 0)
+          {
+            index++;
+            continue;
+          }
+          if (argv[index][0] == '-')
+            continue;
+          library_add(&library, argv[index]);
         }
         // FIXME I'm lazy right now; just threw this in so the test at the end
         // won't fail.
@@ -1065,25 +1914,47 @@ int main(int argc, char **argv)
       else if (strcmp(argv[1], "-usb") == 0)
       {
         // First, check to see if we need to halt
-        if (argc == 3)
+        for (i = 2; i < argc; i++)
         {
-          if (strcmp(argv[2], "-halt") == 0)
+          if (strcmp(argv[i], "-halt") == 0)
             haltFlag = TRUE;
         }
-        // Secondly, check if USB is mounted.
-        playlistStatusErr = checkMount();
-        if (playlistStatusErr != MOUNT_ERROR)
+        // Secondly, watch for sticks going in and out; this also mounts one
+        // that's already in.  If we can't watch, just check the once.
+        if (usb_start(usb_dev, "/MUSIC") == 0)
         {
-          if (playlistStatusErr == FILES_OK)
-            init_playlist = reReadPlaylist("/MUSIC");
-          if (num_songs == 0)
-            playlistStatusErr = NO_FILES;
+          usbFlag = TRUE;
+          lib = usb_take_library();
+          if (lib != NULL)
+            useStick(lib);
+          // No stick (or no songs) isn't the end of it; we wait for one
+          playlistStatusErr = FILES_OK;
+        }
+        else
+        {
+          fprintf(stderr, "[%s - %d]: Cannot watch for USB sticks: %s\n", __FILE__, __LINE__, strerror(errno));
+          playlistStatusErr = checkMount();
+          if (playlistStatusErr != MOUNT_ERROR)
+          {
+            if (playlistStatusErr == FILES_OK)
+              reReadPlaylist("/MUSIC");
+            scanWait(1);
+            if (library_count(&library) == 0)
+              playlistStatusErr = NO_FILES;
+          }
         }
       }
       else if (strcmp(argv[1], "-dir") == 0)
       {
-        init_playlist = reReadPlaylist(argv[2]);
-        if (num_songs == 0)
+        // Keep watching the directory for songs coming and going; if we
+        // can't, just read it the once.
+        if (watch_start(&library, argv[2]) == 0)
+          watchFlag = TRUE;
+        else
+          reReadPlaylist(argv[2]);
+        // Only until the first song turns up; the rest are read in while it plays
+        scanWait(1);
+        if (library_count(&library) == 0)
         {
           fprintf(stderr, "[%s - %d]: No songs found in directory %s\n", __FILE__, __LINE__, argv[2]);
           return -1;
@@ -1092,6 +1963,20 @@ int main(int argc, char **argv)
         // won't fail.
         playlistStatusErr = FILES_OK;
       }
+      else if (strcmp(argv[1], "-playlist") == 0 && argc > 2)
+      {
+        if (playlist_load(&library, argv[2]) < 0)
+        {
+          fprintf(stderr, "[%s - %d]: Cannot read playlist %s: %s\n", __FILE__, __LINE__, argv[2], strerror(errno));
+          return -1;
+        }
+        if (library_count(&library) == 0)
+        {
+          fprintf(stderr, "[%s - %d]: No songs found in playlist %s\n", __FILE__, __LINE__, argv[2]);
+          return -1;
+        }
+        playlistStatusErr = FILES_OK;
+      }
       else if (shuffFlag == FALSE)
           return usage(argv[0]);
     }
@@ -1111,20 +1996,23 @@ int main(int argc, char **argv)
       fprintf(stdout, "[%s - %d]: %s\n", __FILE__, __LINE__, strerror(errno));
       return 1;
     }
-    lcdHandle = lcdInit(RO, CO, BS, RS, EN, D0, D1, D2, D3, D0, D1, D2, D3);
-    if (lcdHandle < 0)
+    lcdHandle = openLcd(lcd_wiring);
+    if (lcdHandle == NULL)
     {
-      fprintf(stderr, "[%s - %d]: %s: lcdInit failed\n", __FILE__, __LINE__, argv[0]);
+      fprintf(stderr, "[%s - %d]: %s: Cannot open the LCD (%s): %s\n", __FILE__, __LINE__, argv[0], lcd_wiring, strerror(errno));
       return -1;
     }
+    memset(lcd_clear, ' ', CO);
+    lcd_clear[CO] = '\0';
+    // The music note keeps its slot; the rest are for letters the ROM doesn't have
+    hd44780_chardef(lcdHandle, LCDTEXT_NOTE_SLOT, musicNote);
+    lcdtext_init(lcd_rom, defineGlyph);
     // Setup buttons
     for (i = 0; i < numButtons; i++)
     {
       pinMode(buttonPins[i], INPUT);
       pullUpDnControl(buttonPins[i], PUD_UP);
     }
-    // Setup our priority
-    piHiPri(99);
     // Setup board test
     pinMode(boardTestPin, INPUT);
     pullUpDnControl(boardTestPin, PUD_UP);
@@ -1135,7 +2023,7 @@ int main(int argc, char **argv)
       if (haltFlag == TRUE)
       {
         wall("LCD and/or buttons not found. Shutting down.");
-        delay(1000);
+        vclock_sleep_ms(1000);
         system("shutdown -h now");
       }
       else
@@ -1147,6 +2035,14 @@ int main(int argc, char **argv)
     if (vol_selector == NULL)
         exit(1);
     int oldvalue = vol_selector->value;
+    // The play button wakes us up once we've gone idle
+    if (idle_secs > 0)
+    {
+      if (wiringPiISR(playButtonPin, INT_EDGE_FALLING, idleButton) < 0)
+        fprintf(stderr, "[%s - %d]: Cannot watch the play button; we won't sleep when paused\n", __FILE__, __LINE__);
+      else
+        idleISR = TRUE;
+    }
     snd_mixer_selem_id_t *sid;
     snd_mixer_selem_id_alloca(&sid);
     snd_mixer_selem_id_set_index(sid, 0);
@@ -1181,446 +2077,368 @@ int main(int argc, char **argv)
         snd_mixer_close(handle);
         exit(1);
     }
+    control_set("volume", "%d", get_vol_num(elem));
+    // Setup the shared memory status record
+    if (status_open() != 0)
+      fprintf(stderr, "[%s - %d]: Cannot create status record %s: %s\n", __FILE__, __LINE__, STATUS_SHM, strerror(errno));
+    status_set_volume(get_vol_num(elem));
+    // Setup the control socket
+    if (ctl_path != NULL && control_start(ctl_path) != 0)
+      fprintf(stderr, "[%s - %d]: Cannot open control socket %s: %s\n", __FILE__, __LINE__, ctl_path, strerror(errno));
+    // The stream and the zones play alongside the songs
+    if (stream_path != NULL || zones > 0)
+    {
+      ao_initialize();
+      aoShared = TRUE;
+    }
+    // Known bad songs from before, so they're skipped without looking
+    quarantine_open(quarantine_path);
+    if (stream_path != NULL && stream_start(stream_path, SINK_AO, NULL) != 0)
+    {
+      fprintf(stderr, "[%s - %d]: Cannot play from %s: %s\n", __FILE__, __LINE__, stream_path, strerror(errno));
+      stream_path = NULL;
+    }
     if (playlistStatusErr == FILES_OK)
     {
-      song_index = 1;
-      if (shuffFlag == TRUE)
-        cur_playlist = randomize(init_playlist);
-      else
-        cur_playlist = init_playlist;
-      cur_song.play_status = PLAY;
-      strcpy(cur_song.prevTitle, cur_song.title);
-      strcpy(cur_song.prevArtist, cur_song.artist);
+      // Pick up where we left off if we still have the same songs
+      item = startQueue(journal_path, &resume_secs);
+      if (journal_path != NULL && journal_open(journal_path) != 0)
+        fprintf(stderr, "[%s - %d]: Cannot open journal %s: %s\n", __FILE__, __LINE__, journal_path, strerror(errno));
+      cur_state.volume = get_vol_num(elem);
+      setStatus(PLAY);
       /*
        * The below was once part of the while loop but I took it out so the playlist can loop.
        * TODO maybe in the future, add it as an option if you don't want it to loop?
        *
        *  && song_index < num_songs)
        */
-      while (cur_song.play_status != QUIT)
+      while (cur_state.play_status != QUIT && (item != NULL || usbFlag == TRUE))
       {
-        // Loop playlist; reset song to begining of list
-        if (song_index > num_songs)
-          song_index = 1;
-        string = malloc(MAXDATALEN);
-        if (string == NULL)
-          perror("malloc: song string");
-        playlist_get_song(song_index, (void **) &string, &cur_playlist);
-        if (string != NULL)
+        // A stick went in or came out, or there's nothing to play; wait for songs
+        if (usbFlag == TRUE && (item == NULL || usb_changed() == TRUE))
+        {
+          if (waitForUSB() == FALSE)
+          {
+            quitMe();
+            break;
+          }
+          hd44780_clear(lcdHandle);
+          item = startQueue(journal_path, &resume_secs);
+          publishState();
+          continue;
+        }
+        // Songs from a playlist file aren't checked when it's read; drop
+        // any that aren't there as they come up
+        if (item->index >= 0 && access(item->path, R_OK) != 0)
+        {
+          fprintf(stderr, "[%s - %d]: Skipping '%s': %s\n", __FILE__, __LINE__, item->path, strerror(errno));
+          library_set_removed(library_get(&library, item->index), TRUE);
+          item = pq_next(&queue);
+          continue;
+        }
+        // Known to be bad, or doesn't even start like an mp3: on to the next
+        // without starting (and tearing down) a player for it
+        quarantine_flush();
+        if (quarantine_check(item->path) == TRUE)
+        {
+          fprintf(stderr, "[%s - %d]: Skipping '%s': quarantined\n", __FILE__, __LINE__, item->path);
+          if (item->index >= 0)
+            library_set_removed(library_get(&library, item->index), TRUE);
+          item = pq_next(&queue);
+          continue;
+        }
+        // Before the first song: pick the decoder, timing them on it if
+        // this board hasn't been seen before
+        if (decoderChosen == FALSE)
+        {
+          decoderChosen = TRUE;
+          if (strcmp(decoder, "auto") == 0)
+          {
+            hd44780_clear(lcdHandle);
+            hd44780_position(lcdHandle, 0, 0);
+            hd44780_puts(lcdHandle, "Timing decoders.");
+          }
+          if (decoder_choose(strcmp(decoder, "default") == 0 ? NULL : decoder, item->path, DECODER_FILE) != 0)
+            fprintf(stderr, "[%s - %d]: Leaving the decoder to mpg123\n", __FILE__, __LINE__);
+        }
+        track = calloc(1, sizeof(struct track_info));
+        if (track == NULL)
+        {
+          perror("calloc: track");
+          exit(EXIT_FAILURE);
+        }
+        basec = strdup(item->path);
+        // Get just the filename, strip the path info and extension
+        bname = basename(basec);
+        track->index = item->index;
+        // Looked up here, not by the player: the gain table's lock is also
+        // taken by the idle-priority workers
+        track->gain_scale = (gainFlag == TRUE ? rgain_scale(item->path) : 1.0);
+        snprintf(track->filename, MAXDATALEN, "%s", item->path);
+        snprintf(track->base_filename, MAXDATALEN, "%s", bname);
+        free(basec);
+        // Show the file name until we find a title
+        strcpy(track->title, track->base_filename);
+        setFirstRow(track->title);
+        setSecondRow(track->artist);
+        lcd.muted_text = track->artist;
+        // See if we can get the song info from the file.
+        id3_tagger(track);
+        // Swap the new track in; the old one is freed once nobody can see it
+        old_track = cur_track;
+        cur_track = track;
+        cur_state.track = track;
+        cur_state.queued = (item->index < 0);
+        publishState();
+        state_retire_track(old_track);
+        control_set("index", "%d", item->index);
+        control_set("file", "%s", track->filename);
+        control_set("title", "%s", track->title);
+        control_set("artist", "%s", track->artist);
+        control_set("album", "%s", track->album);
+        control_set("state", "playing");
+        status_set_track(track->filename, track->title, track->artist);
+        status_set_state(PLAY);
+        journal_track(playlist_id, item->index, item->path, shuffFlag, queue.seed);
+        // Don't carry a seek over from the last song (the player thread isn't running)
+        state_take_seek(&seek_secs, &seek_relative);
+        if (resume_secs > 0)
+        {
+          state_seek(resume_secs, FALSE);
+          resume_secs = 0;
+        }
+        state_song_over(FALSE);
+        // Play the song as a thread
+        songTimeStart(track->filename);
+        pthread_create(&song_thread, NULL, (void *) play_song, (void *) track);
+        // The following displays stuff to the LCD without scrolling
+        scroll_FirstRow_Flag = printLcdFirstRow();
+        scroll_SecondRow_Flag = printLcdSecondRow();
+        // Loop to play the song
+        while (state_is_song_over() == FALSE)
         {
-          basec = strdup(string);
-          // Get just the filename, strip the path info and extension
-          bname = basename(basec);
-          strcpy(cur_song.filename, string);
-          strcpy(cur_song.base_filename, bname);
-          // See if we can get the song info from the file.
-          id3_tagger();
-          // Play the song as a thread
-          pthread_create(&song_thread, NULL, (void *) play_song, (void *) &cur_song);
-          // The following displays stuff to the LCD without scrolling
-          scroll_FirstRow_Flag = printLcdFirstRow();
-          scroll_SecondRow_Flag = printLcdSecondRow();
-          // Loop to play the song
-          while (cur_song.song_over == FALSE)
+          // Scroll whatever doesn't fit
+          if (cur_state.play_status != PAUSE)
           {
-            // First row song-name
-            if (cur_song.play_status != PAUSE)
+            if (scroll_FirstRow_Flag == TRUE)
+              scroll_Message_FirstRow();
+            if (scroll_SecondRow_Flag == TRUE)
+              scroll_Message_SecondRow();
+            else if (lcd.SecondRow_text == lcd.progress_text)
+              showProgress(FALSE);
+          }
+          now = vclock_ms();
+          /*
+           * Play / Pause button
+           */
+          if (debounce_pressed(&playButton, digitalRead(playButtonPin), now))
+            state_send_cmd(CMD_TOGGLE, 0, FALSE, NULL);
+          // Don't even check to see if the prev/next/info/quit/shuffle buttons
+          // have been pressed if we are in a pause state.
+          if (cur_state.play_status != PAUSE)
+          {
+            /*
+             * Mute
+             */
+            if (debounce_pressed(&muteButton, digitalRead(muteButtonPin), now))
+              state_send_cmd(CMD_MUTE, 0, FALSE, NULL);
+            /*
+             * Volume (using rotary encoder)
+             */
+            if (oldvalue != vol_selector->value)
             {
-              if (scroll_FirstRow_Flag == TRUE)
-              {
-                /* 
-                 * NOTE; the following use of tons of flags and such are
-                 * used to avoid having to use the delay function which
-                 * was causing some problems.
-                 */
-                if (firstTime_FirstRow_Flag == TRUE)
+                int change = vol_selector->value - oldvalue;
+                int chn = 0;
+                for (; chn <= SND_MIXER_SCHN_LAST; chn++)
                 {
-                  firstTime_FirstRow_Flag = FALSE;
-                  scroll_Message_FirstRow(&pause_Scroll_FirstRow_Flag);
+                    double vol = get_normalized_volume(elem);
+                    set_normalized_volume(elem, vol + (change * 0.00065105));
                 }
-                else
-                {
-                  // Start the timer
-                  if (pause_Scroll_FirstRow_Flag == TRUE && temp_FirstRow_Flag == FALSE)
-                  {
-                    startPauseFirstRow = clock();
-                    temp_FirstRow_Flag = TRUE;
-                  }
-                  if (temp_FirstRow_Flag == TRUE)
-                  {
-                    // Check to see if 1 second has passed
-                    if ((int)((double)(clock() - startPauseFirstRow) / CLOCKS_PER_SEC) == 1)
-                    {
-                      pause_Scroll_FirstRow_Flag = FALSE;
-                      temp_FirstRow_Flag = FALSE;
-                    }
-                  }
-                }
-                if (pause_Scroll_FirstRow_Flag == FALSE)
-                  scroll_Message_FirstRow(&pause_Scroll_FirstRow_Flag);
-              }
-
-              // Second row (artist / album)
-              if (scroll_SecondRow_Flag == TRUE)
-              {
-                if (firstTime_SecondRow_Flag == TRUE)
-                {
-                  firstTime_SecondRow_Flag = FALSE;
-                  scroll_Message_SecondRow(&pause_Scroll_SecondRow_Flag);
-                  ctrSecondRowScroll = 1;
-                }
-                else
-                {
-                  if (pause_Scroll_SecondRow_Flag == TRUE && temp_SecondRow_Flag == FALSE)
-                  {
-                    startPauseSecondRow = clock();
-                    temp_SecondRow_Flag = TRUE;
-                  }
-                  if (temp_SecondRow_Flag == TRUE)
-                  {
-                    if ((int)((double)(clock() - startPauseSecondRow) / CLOCKS_PER_SEC) == 1)
-                    {
-                      pause_Scroll_SecondRow_Flag = FALSE;
-                      temp_SecondRow_Flag = FALSE;
-                      ctrSecondRowScroll++;
-                    }
-                  }
-                }
-//if (ctrSecondRowScroll != 1) printf("ctr: %d\n", ctrSecondRowScroll);
-//printf("pause2RowFlag: %s  temp2RowFlag: %s\n", printFlag(pause_Scroll_SecondRow_Flag), printFlag(temp_SecondRow_Flag));
-                // Only scroll 2 times; after that just always display.
-                if (ctrSecondRowScroll > 2)
-                  pause_Scroll_SecondRow_Flag = TRUE;
-                if (pause_Scroll_SecondRow_Flag == FALSE)
-                  scroll_Message_SecondRow(&pause_Scroll_SecondRow_Flag);
-              }
+                oldvalue = vol_selector->value;
+                cur_state.volume = get_vol_num(elem);
+                publishState();
+                control_set("volume", "%d", cur_state.volume);
+                status_set_volume(cur_state.volume);
             }
-             /*
-              * NOTE:
-              * I got the following debouncing code from
-              * http://www.arduino.cc/en/Tutorial/Debounce 
-              *
-              * Excerpt from source:
-              *
-              *  created 21 Nov 2006 by David A. Mellis
-              * modified 30 Aug 2011 by Limor Fried
-              * modified 28 Dec 2012 by Mike Walters
-              * This example code is in the public domain.
-              */
             /*
-             * Play / Pause button
+             * Previous button
+             */
+            if (debounce_pressed(&prevButton, digitalRead(prevButtonPin), now))
+              state_send_cmd(CMD_PREV, 0, FALSE, NULL);
+            /*
+             * Next button
              */
-            reading = digitalRead(playButtonPin);
-            // Check to see if you just pressed the button 
-            // (i.e. the input went from HIGH to LOW),  and you've waited 
-            // long enough since the last press to ignore any noise:  
-            // If the switch changed, due to noise or pressing:
-            if (reading != lastPlayButtonState)
-              lastPlayDebounceTime = millis(); // reset the debouncing timer
-            if ((millis() - lastPlayDebounceTime) > debounceDelay)
+            if (debounce_pressed(&nextButton, digitalRead(nextButtonPin), now))
             {
-              // Whatever the reading is at, it's been there for longer
-              // than the debounce delay, so take it as the actual current state:
-              // if the button state has changed:
-              if (reading != playButtonState)
-              {
-                playButtonState = reading;
-                if (playButtonState == LOW)
-                {
-                  if (cur_song.play_status == PAUSE)
-                  {
-                    playMe();
-                    strcpy(cur_song.SecondRow_text, pause_text);
-                    lcdPosition(lcdHandle, 0, 1);
-                    lcdPuts(lcdHandle, lcd_clear);
-                    scroll_SecondRow_Flag = printLcdSecondRow();
-                  }
-                  else
-                  {
-                    pauseMe();
-                    // Copy whatever is currently on the second row
-                    strcpy(pause_text, cur_song.SecondRow_text);
-                    strcpy(cur_song.SecondRow_text, "PAUSED");
-                    strcpy(cur_song.prevArtist, cur_song.artist);
-                    lcdPosition(lcdHandle, 0, 1);
-                    lcdPuts(lcdHandle, lcd_clear);
-                    scroll_SecondRow_Flag = printLcdSecondRow();
-                  }
-                }
-              }
+              // With info held down, next steps through the artists instead
+              if (infoButton.state == LOW)
+                state_send_cmd(CMD_BROWSE, 0, FALSE, NULL);
+              else
+                state_send_cmd(CMD_NEXT, 0, FALSE, NULL);
             }
-            // Save the reading. Next time through the loop, it'll be the lastButtonState:
-            lastPlayButtonState = reading;
-            // Don't even check to see if the prev/next/info/quit/shuffle buttons
-            // have been pressed if we are in a pause state.
-            if (cur_song.play_status != PAUSE)
-            {
-              /*
-               * Mute
-               */
-              reading = digitalRead(muteButtonPin);
-              if (reading != lastMuteButtonState)
-                lastMuteDebounceTime = millis();
-              if ((millis() - lastMuteDebounceTime) > debounceDelay)
-              {
-                if (reading != muteButtonState)
-                {
-                    muteButtonState = reading;
-                    if (muteButtonState == LOW)
-                    {
-                      snd_mixer_selem_get_playback_switch(elem, 0, &ival);
-                      if (ival == 1) // 1 = muted
-                      {
-                          strcpy(muted_text, cur_song.SecondRow_text);
-                          strcpy(cur_song.SecondRow_text, "-- MUTED --");
-                          strcpy(cur_song.prevArtist, cur_song.artist);
-                          lcdPosition(lcdHandle, 0, 1);
-                          lcdPuts(lcdHandle, lcd_clear);
-                          scroll_SecondRow_Flag = printLcdSecondRow();
-                      }
-                      else
-                      {
-                          //if (muted_text[0] == '\0') strcpy(muted_text, cur_song.SecondRow_text);
-                          strcpy(cur_song.SecondRow_text, muted_text);
-                          lcdPosition(lcdHandle, 0, 1);
-                          lcdPuts(lcdHandle, lcd_clear);
-                          scroll_SecondRow_Flag = printLcdSecondRow();
-                      }
-                      snd_mixer_selem_set_playback_switch(elem, 0, !ival);
-                    }
-                }
-              }
-              lastMuteButtonState = reading;
-              /*
-               * Volume (using rotary encoder)
-               */
-              if (oldvalue != vol_selector->value)
-              {
-                  int change = vol_selector->value - oldvalue;
-                  int chn = 0;
-                  for (; chn <= SND_MIXER_SCHN_LAST; chn++)
-                  {
-                      double vol = get_normalized_volume(elem);
-                      set_normalized_volume(elem, vol + (change * 0.00065105));
-                  }
-                  oldvalue = vol_selector->value;
-              }
-              /*
-               * Previous button
-               */
-              reading = digitalRead(prevButtonPin);
-              if (reading != lastPrevButtonState)
-                lastPrevDebounceTime = millis();
-              if ((millis() - lastPrevDebounceTime) > debounceDelay)
-              {
-                if (reading != prevButtonState)
-                {
-                  prevButtonState = reading;
-                  if (prevButtonState == LOW)
-                  {
-                    song_index = (song_index - 1 != 0 ? song_index - 1 : num_songs - 1);
-                    prevSong();
-                  }
-                }
-              }
-              lastPrevButtonState = reading;
-              /*
-               * Next button
-               */
-              reading = digitalRead(nextButtonPin);
-              if (reading != lastNextButtonState)
-                lastNextDebounceTime = millis();
-              if ((millis() - lastNextDebounceTime) > debounceDelay)
-              {
-                if (reading != nextButtonState)
-                {
-                  nextButtonState = reading;
-                  if (nextButtonState == LOW)
-                  {
-                    song_index = (song_index + 1 < num_songs ? song_index + 1 : 1);
-                    nextSong();
-                  }
-                }
-              }
-              lastNextButtonState = reading;
-              /*
-               * Info button
-               */
-              reading = digitalRead(infoButtonPin);
-              if (reading != lastInfoButtonState)
-                lastInfoDebounceTime = millis();
-              if ((millis() - lastInfoDebounceTime) > debounceDelay)
-              {
-                if (reading != infoButtonState)
-                {
-                  infoButtonState = reading;
-                  if (infoButtonState == LOW)
-                  {
-                    // TODO surely there's a better way than always running a strcmp ...
-                    // Toggle what to display
-                    strcpy(cur_song.SecondRow_text, (strcmp(cur_song.SecondRow_text, cur_song.artist) == 0 ? cur_song.album : cur_song.artist));
-                    // First clear just the second row, then re-display the second row
-                    lcdPosition(lcdHandle, 0, 1);
-                    lcdPuts(lcdHandle, lcd_clear);
-                    scroll_SecondRow_Flag = printLcdSecondRow();
-//printf("scroll_SecondRow_flag: %s\n", printFlag(scroll_SecondRow_Flag));
-                  }
-                }
-              }
-              lastInfoButtonState = reading;
-              /*
-               * Quit button
-               */
-              reading = digitalRead(quitButtonPin);
-              if (reading != lastQuitButtonState)
-                lastQuitDebounceTime = millis();
-              if ((millis() - lastQuitDebounceTime) > debounceDelay)
-              {
-                if (reading != quitButtonState)
-                {
-                  quitButtonState = reading;
-                  if (quitButtonState == LOW)
-                    quitMe();
-                }
-              }
-              lastQuitButtonState = reading;
-              /*
-               * Shuffle button
-               */
-              reading = digitalRead(shufButtonPin);
-              if (reading != lastShufButtonState)
-                lastShufDebounceTime = millis();
-              if ((millis() - lastShufDebounceTime) > debounceDelay)
-              {
-                if (reading != shufButtonState)
-                {
-                  shufButtonState = reading;
-                  if (shufButtonState == LOW)
-                  {
-                    // Toggle shuffle state
-                    // (NOTE: shuffFlag is useless here)
-                    shuffFlag = (shuffFlag == TRUE ? FALSE : TRUE);
-                    // The following function signals to go to next song
-                    // and sets the play status to SHUFFLE
-                    shuffleMe();
-                  }
-                }
-              }
-              lastShufButtonState = reading;
-              // TODO if the following is put above, the sound skips ...
-              // FIXME also ... if the following is removed / commented out the song skips ...
-              print_vol_num(elem);
+            /*
+             * Info button
+             */
+            if (debounce_pressed(&infoButton, digitalRead(infoButtonPin), now))
+              state_send_cmd(CMD_INFO, 0, FALSE, NULL);
+            /*
+             * Quit button
+             */
+            if (debounce_pressed(&quitButton, digitalRead(quitButtonPin), now))
+              state_send_cmd(CMD_QUIT, 0, FALSE, NULL);
+            /*
+             * Shuffle button
+             */
+            if (debounce_pressed(&shufButton, digitalRead(shufButtonPin), now))
+              state_send_cmd(CMD_SHUFFLE, -1, FALSE, NULL);
+            // TODO if the following is put above, the sound skips ...
+            // FIXME also ... if the following is removed / commented out the song skips ...
+            print_vol_num(elem);
 // HEYJOHN
-            } // end ! pause
-          } // end while
-          // Reset all the flags.
-          scroll_FirstRow_Flag = scroll_SecondRow_Flag = FALSE;
-          pause_Scroll_FirstRow_Flag = pause_Scroll_SecondRow_Flag = FALSE;
-          firstTime_FirstRow_Flag = firstTime_SecondRow_Flag = TRUE;
-          temp_FirstRow_Flag = temp_SecondRow_Flag = FALSE;
-          ctrSecondRowScroll = 0;
-          if (pthread_join(song_thread, NULL) != 0)
-            perror("join error\n");
-          // Clear the lcd for next song.
-          lcdClear(lcdHandle);
-        }
-        lcdClear(lcdHandle);
-        // Increment the song_index if the song is over but the next/prev wasn't hit
-        if (cur_song.song_over == TRUE && cur_song.play_status == PLAY)
-        {
-          pthread_mutex_lock(&cur_song.pauseMutex);
-          cur_song.song_over = FALSE;
-          pthread_mutex_unlock(&cur_song.pauseMutex);
-          song_index++;
-        }
-        // Reset everything if next, prev, or shuffle buttons were pressed
-        else if (cur_song.song_over == TRUE && (cur_song.play_status == NEXT || cur_song.play_status == PREV || cur_song.play_status == SHUFFLE))
-        {
-          pthread_mutex_lock(&cur_song.pauseMutex);
-          // Empty out song/artist data
-          strcpy(cur_song.title, "");
-          strcpy(cur_song.artist, "");
-          strcpy(cur_song.album, "");
-          if (cur_song.play_status == SHUFFLE)
+          } // end ! pause
+          // Commands from the buttons and the control socket
+          while (state_get_cmd(&cmd))
+            run_command(cmd.cmd, cmd.arg, cmd.relative, cmd.path);
+          // Stop this song if the stick was swapped or pulled out
+          if (usbFlag == TRUE && usb_changed() == TRUE && cur_state.play_status != NEXT)
+            run_command(CMD_NEXT, 0, FALSE, NULL);
+          // Work any songs added to the directory into the play order
+          if (watchFlag == TRUE && watch_generation() != watch_gen)
           {
-            if (shuffFlag == TRUE)
-              cur_playlist = randomize(init_playlist);
-            else
-              cur_playlist = init_playlist;
-            song_index = 1;
+            watch_gen = watch_generation();
+            pq_sync(&queue);
+            tagindex_update();
+            rgain_update();
+            // Sort the new songs in
+            if (albumFlag == TRUE && filtering == FALSE)
+            {
+              tagindex_wait();
+              clearFilter();
+            }
           }
-          cur_song.play_status = PLAY;
-          cur_song.song_over = FALSE;
-          pthread_mutex_unlock(&cur_song.pauseMutex);
-        }
+          // Work songs still being read in into the play order
+          scanProgress();
+          // Done picking an artist
+          if (browse.active == TRUE && vclock_ms() - browse.time > BROWSE_DELAY)
+            browseDone();
+          // Paused for a while; stop polling and sleep
+          if (cur_state.play_status == PAUSE && idleISR == TRUE && idle_secs > 0 &&
+              vclock_ms() - pauseTime > (unsigned)idle_secs * 1000)
+            idleWait(usbFlag, watchFlag, watch_gen);
+        } // end while
+        // Reset all the flags.
+        scroll_FirstRow_Flag = scroll_SecondRow_Flag = FALSE;
+        if (pthread_join(song_thread, NULL) != 0)
+          perror("join error\n");
+        songTimeStop();
+        // Clear the lcd for next song.
+        hd44780_clear(lcdHandle);
+        // Move on if the song finished or next was hit; go back if prev was hit
+        if (cur_state.play_status == PLAY || cur_state.play_status == NEXT)
+          item = pq_next(&queue);
+        else if (cur_state.play_status == PREV)
+          item = pq_prev(&queue);
+        if (cur_state.play_status == NEXT || cur_state.play_status == PREV)
+          setStatus(PLAY);
       }
       // Quit button was pressed
-      lcdClear(lcdHandle);
+      control_stop();
+      status_close();
+      scan_stop();
+      usb_stop();
+      watch_stop();
+      tagindex_stop();
+      rgain_stop();
+      for (i = 0; i < zone_count(); i++)
+      {
+        zone_get_stats(i, &zstats);
+        fprintf(stderr, "zone %s: %u songs, %u failed, %u underruns, %.0f s played, %.1f s CPU\n", zone_devices[i],
+                zstats.songs, zstats.failed, zstats.underruns, zstats.audio_secs, zstats.cpu_secs);
+      }
+      zone_stop_all();
+      stream_stop();
+      if (aoShared == TRUE)
+        ao_shutdown();
+      quarantine_get_stats(&qstats);
+      quarantine_close();
+      if (qstats.probed > 0 || qstats.known > 0)
+        fprintf(stderr, "quarantine: %u songs probed, %u skipped, %u quarantined (%u in all), %u validated\n",
+                qstats.probed, qstats.skipped, qstats.quarantined, qstats.known, qstats.validated);
+      if (journal_path != NULL)
+      {
+        journal_close();
+        journal_get_stats(&jstats);
+        if (jstats.seconds > 0)
+          fprintf(stderr, "journal: %llu bytes, %u writes, %u syncs, %u compactions in %lld s (%llu bytes/hour)\n",
+                  (unsigned long long)jstats.bytes, jstats.writes, jstats.syncs, jstats.compactions,
+                  (long long)jstats.seconds, (unsigned long long)(jstats.bytes * 3600 / jstats.seconds));
+      }
+      hd44780_clear(lcdHandle);
       if (handle != NULL)
           snd_mixer_close(handle);
       // Don't shutdown unless the quit button was pressed.
-      if (cur_song.play_status == QUIT)
+      if (cur_state.play_status == QUIT)
       {
-        lcdPosition(lcdHandle, 0, 0);
-        lcdPuts(lcdHandle, "Good Bye!");
-        lcdPosition(lcdHandle, 0, 1);
+        hd44780_position(lcdHandle, 0, 0);
+        hd44780_puts(lcdHandle, "Good Bye!");
+        hd44780_position(lcdHandle, 0, 1);
         if (haltFlag == TRUE)
         {
-          lcdPuts(lcdHandle, "Shuting down.");
-          delay(1000);
+          hd44780_puts(lcdHandle, "Shuting down.");
+          vclock_sleep_ms(1000);
           system("shutdown -h now");
         }
         else
-          lcdPuts(lcdHandle, "Please shutdown.");
+          hd44780_puts(lcdHandle, "Please shutdown.");
       }
       // The following will never happen because the playlist loops now
       // TODO either remove it or add a possible "loop" flag option
       /*
       else
       {
-        lcdPosition(lcdHandle, 0, 0);
-        lcdPuts(lcdHandle, "No more songs.");
-        lcdPosition(lcdHandle, 0, 1);
+        hd44780_position(lcdHandle, 0, 0);
+        hd44780_puts(lcdHandle, "No more songs.");
+        hd44780_position(lcdHandle, 0, 1);
         if (haltFlag == TRUE)
         {
-          lcdPuts(lcdHandle, "Shuting down.");
-          delay(1000);
+          hd44780_puts(lcdHandle, "Shuting down.");
+          vclock_sleep_ms(1000);
           system("shutdown -h now");
         }
         else
-          lcdPuts(lcdHandle, "Please shutdown.");
+          hd44780_puts(lcdHandle, "Please shutdown.");
       }
       */
     }
     else if (playlistStatusErr == MOUNT_ERROR)
     {
-        lcdClear(lcdHandle);
-        lcdPosition(lcdHandle, 0, 0);
-        lcdPuts(lcdHandle, "No USB inserted.");
-        lcdPosition(lcdHandle, 0, 1);
+        hd44780_clear(lcdHandle);
+        hd44780_position(lcdHandle, 0, 0);
+        hd44780_puts(lcdHandle, "No USB inserted.");
+        hd44780_position(lcdHandle, 0, 1);
         if (haltFlag == TRUE)
         {
-            lcdPuts(lcdHandle, "Shutting down.");
-            delay(1000);
+            hd44780_puts(lcdHandle, "Shutting down.");
+            vclock_sleep_ms(1000);
             system("shutdown -h now");
         }
         else
-            lcdPuts(lcdHandle, "Please shutdown.");
+            hd44780_puts(lcdHandle, "Please shutdown.");
     }
     else if (playlistStatusErr == NO_FILES)
     {
-        lcdClear(lcdHandle);
-        lcdPosition(lcdHandle, 0, 0);
-        lcdPuts(lcdHandle, "No songs on USB.");
-        lcdPosition(lcdHandle, 0, 1);
+        hd44780_clear(lcdHandle);
+        hd44780_position(lcdHandle, 0, 0);
+        hd44780_puts(lcdHandle, "No songs on USB.");
+        hd44780_position(lcdHandle, 0, 1);
         if (haltFlag == TRUE)
         {
-            lcdPuts(lcdHandle, "Shutting down.");
-            delay(1000);
+            hd44780_puts(lcdHandle, "Shutting down.");
+            vclock_sleep_ms(1000);
             system("shutdown -h now");
         }
         else
-          lcdPuts(lcdHandle, "Please shutdown.");
+          hd44780_puts(lcdHandle, "Please shutdown.");
     }
     return 0;
 }
@@ -0,0 +1,412 @@
+/*
+ * lcdtext.c
+ *
+ * UTF-8 to HD44780 characters; see lcdtext.h.
+ *
+ * Code points up to 0xFF go through a 256 entry table, the few above that
+ * we know through a sorted one.  A glyph is stood for by a placeholder byte
+ * the ROM won't be asked for (0x10 - 0x1F, and on A00 the empty 0x80 - 0x9F)
+ * until it's rendered; then it becomes 0x08 + its slot (0x08 - 0x0F show
+ * CGRAM 0 - 7 too, and unlike 0x00 can go in a C string).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lcdtext.h"
+
+#define SLOTS 8
+
+struct glyph {
+    unsigned cp;
+    char fold;                // shown instead if there's no slot for it
+    unsigned char rows[8];
+};
+
+// Accents over a lower case letter (two rows) or a capital (one row)
+#define ACUTE    0x02, 0x04
+#define GRAVE    0x08, 0x04
+#define CIRCUM   0x04, 0x0A
+#define DIAER    0x0A, 0x00
+#define TILDE    0x0D, 0x16
+#define CARON    0x0A, 0x04
+#define DACUTE   0x09, 0x12
+#define ACUTE_UC 0x02
+#define GRAVE_UC 0x08
+#define DIAER_UC 0x0A
+#define RING_UC  0x04
+#define TILDE_UC 0x0D
+// Letters squeezed into five rows (lower case) or six (capitals)
+#define LC_A 0x0E, 0x01, 0x0F, 0x11, 0x0F
+#define LC_C 0x0E, 0x10, 0x10, 0x11, 0x0E
+#define LC_E 0x0E, 0x11, 0x1F, 0x10, 0x0E
+#define LC_I 0x0C, 0x04, 0x04, 0x04, 0x0E
+#define LC_N 0x16, 0x19, 0x11, 0x11, 0x11
+#define LC_O 0x0E, 0x11, 0x11, 0x11, 0x0E
+#define LC_S 0x0F, 0x10, 0x0E, 0x01, 0x1E
+#define LC_U 0x11, 0x11, 0x11, 0x13, 0x0D
+#define LC_Z 0x1F, 0x02, 0x04, 0x08, 0x1F
+#define UC_A 0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11
+#define UC_C 0x0E, 0x11, 0x10, 0x10, 0x11, 0x0E
+#define UC_E 0x1F, 0x10, 0x1E, 0x10, 0x10, 0x1F
+#define UC_N 0x11, 0x19, 0x15, 0x13, 0x11, 0x11
+#define UC_O 0x0E, 0x11, 0x11, 0x11, 0x11, 0x0E
+#define UC_U 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E
+
+// Latin-1 ones first (only A00 needs those), then the ones neither ROM has
+static const struct glyph glyphs[] = {
+    { 0xC0, 'A', { GRAVE_UC, UC_A, 0 } },
+    { 0xC1, 'A', { ACUTE_UC, UC_A, 0 } },
+    { 0xC4, 'A', { DIAER_UC, UC_A, 0 } },
+    { 0xC5, 'A', { RING_UC, UC_A, 0 } },
+    { 0xC6, 'A', { 0x00, 0x0F, 0x14, 0x14, 0x1F, 0x14, 0x17, 0x00 } },
+    { 0xC7, 'C', { 0x00, UC_C, 0x04 } },
+    { 0xC8, 'E', { GRAVE_UC, UC_E, 0 } },
+    { 0xC9, 'E', { ACUTE_UC, UC_E, 0 } },
+    { 0xD1, 'N', { TILDE_UC, UC_N, 0 } },
+    { 0xD3, 'O', { ACUTE_UC, UC_O, 0 } },
+    { 0xD6, 'O', { DIAER_UC, UC_O, 0 } },
+    { 0xD8, 'O', { 0x00, 0x0E, 0x13, 0x15, 0x15, 0x19, 0x0E, 0x00 } },
+    { 0xDC, 'U', { DIAER_UC, UC_U, 0 } },
+    { 0xE0, 'a', { GRAVE, LC_A, 0 } },
+    { 0xE1, 'a', { ACUTE, LC_A, 0 } },
+    { 0xE2, 'a', { CIRCUM, LC_A, 0 } },
+    { 0xE3, 'a', { TILDE, LC_A, 0 } },
+    { 0xE5, 'a', { 0x04, 0x0A, 0x04, 0x0E, 0x01, 0x0F, 0x11, 0x0F } },
+    { 0xE6, 'a', { 0x00, 0x00, 0x1A, 0x05, 0x0F, 0x14, 0x0F, 0x00 } },
+    { 0xE7, 'c', { 0x00, 0x00, LC_C, 0x04 } },
+    { 0xE8, 'e', { GRAVE, LC_E, 0 } },
+    { 0xE9, 'e', { ACUTE, LC_E, 0 } },
+    { 0xEA, 'e', { CIRCUM, LC_E, 0 } },
+    { 0xEB, 'e', { DIAER, LC_E, 0 } },
+    { 0xEC, 'i', { GRAVE, LC_I, 0 } },
+    { 0xED, 'i', { ACUTE, LC_I, 0 } },
+    { 0xEE, 'i', { CIRCUM, LC_I, 0 } },
+    { 0xEF, 'i', { DIAER, LC_I, 0 } },
+    { 0xF2, 'o', { GRAVE, LC_O, 0 } },
+    { 0xF3, 'o', { ACUTE, LC_O, 0 } },
+    { 0xF4, 'o', { CIRCUM, LC_O, 0 } },
+    { 0xF5, 'o', { TILDE, LC_O, 0 } },
+    { 0xF8, 'o', { 0x00, 0x01, 0x0E, 0x13, 0x15, 0x19, 0x0E, 0x10 } },
+    { 0xF9, 'u', { GRAVE, LC_U, 0 } },
+    { 0xFA, 'u', { ACUTE, LC_U, 0 } },
+    { 0xFB, 'u', { CIRCUM, LC_U, 0 } },
+    { 0x0105, 'a', { 0x00, 0x00, LC_A, 0x02 } },
+    { 0x0107, 'c', { ACUTE, LC_C, 0 } },
+    { 0x010D, 'c', { CARON, LC_C, 0 } },
+    { 0x0119, 'e', { 0x00, 0x00, LC_E, 0x02 } },
+    { 0x0141, 'L', { 0x10, 0x10, 0x14, 0x18, 0x10, 0x10, 0x1F, 0x00 } },
+    { 0x0142, 'l', { 0x0C, 0x04, 0x06, 0x0C, 0x04, 0x04, 0x0E, 0x00 } },
+    { 0x0144, 'n', { ACUTE, LC_N, 0 } },
+    { 0x0151, 'o', { DACUTE, LC_O, 0 } },
+    { 0x015B, 's', { ACUTE, LC_S, 0 } },
+    { 0x0161, 's', { CARON, LC_S, 0 } },
+    { 0x0171, 'u', { DACUTE, LC_U, 0 } },
+    { 0x017E, 'z', { CARON, LC_Z, 0 } },
+};
+#define NUM_GLYPHS (int)(sizeof(glyphs) / sizeof(glyphs[0]))
+
+// Progress bar cells with 1 - 5 columns lit, standing in as glyphs NUM_GLYPHS + 0 - 4
+static const unsigned char bars[LCDTEXT_BAR_STEPS][8] = {
+    { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10 },
+    { 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18 },
+    { 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C },
+    { 0x1E, 0x1E, 0x1E, 0x1E, 0x1E, 0x1E, 0x1E, 0x1E },
+    { 0x1F, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F },
+};
+#define BAR_ESCAPE 0x01
+
+// What A00 has above ASCII (or a good stand in)
+static const struct {
+    unsigned cp;
+    unsigned char lcd;
+} a00[] = {
+    { 0x00A5, 0x5C }, { 0x00B0, 0xDF }, { 0x00B5, 0xE4 }, { 0x00B7, 0xA5 },
+    { 0x00DF, 0xE2 }, { 0x00E4, 0xE1 }, { 0x00F1, 0xEE }, { 0x00F6, 0xEF },
+    { 0x00F7, 0xFD }, { 0x00FC, 0xF5 },
+    { 0x03A3, 0xF6 }, { 0x03A9, 0xF4 }, { 0x03B1, 0xE0 }, { 0x03B2, 0xE2 },
+    { 0x03B5, 0xE3 }, { 0x03B8, 0xF2 }, { 0x03BC, 0xE4 }, { 0x03C0, 0xF7 },
+    { 0x03C1, 0xE6 }, { 0x03C3, 0xE5 },
+    { 0x2022, 0xA5 }, { 0x2190, 0x7F }, { 0x2192, 0x7E }, { 0x221E, 0xF3 },
+    { 0x2588, 0xFF },
+};
+
+// Typography either ROM shows as plain ASCII
+static const struct {
+    unsigned cp;
+    const char *lcd;
+} punct[] = {
+    { 0x2010, "-" }, { 0x2013, "-" }, { 0x2014, "-" }, { 0x2018, "'" },
+    { 0x2019, "'" }, { 0x201C, "\"" }, { 0x201D, "\"" }, { 0x2026, "..." },
+};
+
+// Latin-1 0xC0 - 0xFF without accents
+static const char latin1[64] =
+    "AAAAAAACEEEEIIII"
+    "DNOOOOOxOUUUUYPs"
+    "aaaaaaaceeeeiiii"
+    "dnooooo/ouuuuyby";
+
+struct wide {
+    unsigned cp;
+    char lcd[4];
+};
+
+static int ready = 0;
+static int rom_kind = LCDTEXT_A00;
+static unsigned char narrow[256];          // 0: '?'
+static struct wide wide[64];
+static int num_wide;
+static signed char escape_glyph[256];      // -1: not a placeholder
+static void (*define_glyph)(int slot, unsigned char *rows);
+// CGRAM
+static int slot_glyph[SLOTS];
+static unsigned long slot_used[SLOTS];
+static unsigned long use_clock;
+static unsigned char visible[LCDTEXT_ROWS]; // slots showing on each row
+static struct lcdtext_stats stats;
+
+static int by_cp(const void *a, const void *b)
+{
+    const struct wide *x = a, *y = b;
+
+    return (x->cp > y->cp) - (x->cp < y->cp);
+}
+
+static void add_wide(unsigned cp, const char *lcd)
+{
+    if (num_wide == (int)(sizeof(wide) / sizeof(wide[0])))
+        return;
+    wide[num_wide].cp = cp;
+    snprintf(wide[num_wide].lcd, sizeof(wide[0].lcd), "%s", lcd);
+    num_wide++;
+}
+
+void lcdtext_init(int rom, void (*define)(int slot, unsigned char *rows))
+{
+    static const unsigned char escapes[] = {
+        0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F,
+        // A00 only
+        0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8A, 0x8B, 0x8C, 0x8D, 0x8E, 0x8F,
+        0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0x9B, 0x9C, 0x9D, 0x9E, 0x9F,
+    };
+    int num_escapes = (rom == LCDTEXT_A02 ? 16 : (int)sizeof(escapes));
+    unsigned cp;
+    char one[2];
+    int i, e = 0;
+
+    memset(narrow, 0, sizeof(narrow));
+    memset(escape_glyph, -1, sizeof(escape_glyph));
+    num_wide = 0;
+    one[1] = '\0';
+    for (cp = 0x20; cp < 0x7F; cp++)
+        narrow[cp] = cp;
+    for (cp = 0; cp < 0x20; cp++)
+        narrow[cp] = ' ';
+    if (rom == LCDTEXT_A02)
+    {
+        // Latin-1 where Latin-1 has it
+        for (cp = 0xA0; cp <= 0xFF; cp++)
+            narrow[cp] = cp;
+    }
+    else
+    {
+        // A yen sign and an arrow where ASCII has \ and ~
+        narrow['\\'] = '/';
+        narrow['~'] = '-';
+        for (cp = 0xC0; cp <= 0xFF; cp++)
+            narrow[cp] = latin1[cp - 0xC0];
+        for (i = 0; i < (int)(sizeof(a00) / sizeof(a00[0])); i++)
+        {
+            if (a00[i].cp <= 0xFF)
+                narrow[a00[i].cp] = a00[i].lcd;
+            else
+            {
+                one[0] = a00[i].lcd;
+                add_wide(a00[i].cp, one);
+            }
+        }
+    }
+    for (i = 0; i < (int)(sizeof(punct) / sizeof(punct[0])); i++)
+        add_wide(punct[i].cp, punct[i].lcd);
+    // Progress bar cells get the placeholders convert() would otherwise blank
+    for (i = 0; i < LCDTEXT_BAR_STEPS && define != NULL; i++)
+    {
+        narrow[BAR_ESCAPE + i] = BAR_ESCAPE + i;
+        escape_glyph[BAR_ESCAPE + i] = NUM_GLYPHS + i;
+    }
+    // Glyphs for what the ROM doesn't have, while there are placeholders
+    for (i = 0; i < NUM_GLYPHS && define != NULL; i++)
+    {
+        if (glyphs[i].cp <= 0xFF && rom == LCDTEXT_A02)
+            continue;
+        if (e < num_escapes)
+        {
+            escape_glyph[escapes[e]] = i;
+            one[0] = escapes[e++];
+        }
+        else
+            one[0] = glyphs[i].fold;
+        if (glyphs[i].cp <= 0xFF)
+            narrow[glyphs[i].cp] = one[0];
+        else
+            add_wide(glyphs[i].cp, one);
+    }
+    for (i = 0; i < NUM_GLYPHS && define == NULL; i++)
+    {
+        if (glyphs[i].cp > 0xFF)
+        {
+            one[0] = glyphs[i].fold;
+            add_wide(glyphs[i].cp, one);
+        }
+    }
+    qsort(wide, num_wide, sizeof(wide[0]), by_cp);
+    define_glyph = define;
+    rom_kind = rom;
+    for (i = 0; i < SLOTS; i++)
+    {
+        slot_glyph[i] = -1;
+        slot_used[i] = 0;
+    }
+    memset(visible, 0, sizeof(visible));
+    ready = 1;
+}
+
+// The next code point from *p (advancing it); stray bytes are Latin-1
+static unsigned next_cp(const unsigned char **p)
+{
+    const unsigned char *s = *p;
+    unsigned cp;
+    int n, i;
+
+    if (s[0] < 0x80)
+        n = 0;
+    else if ((s[0] & 0xE0) == 0xC0 && s[0] >= 0xC2)
+        n = 1;
+    else if ((s[0] & 0xF0) == 0xE0)
+        n = 2;
+    else if ((s[0] & 0xF8) == 0xF0 && s[0] <= 0xF4)
+        n = 3;
+    else
+        n = -1;
+    for (i = 1; i <= n; i++)
+    {
+        if ((s[i] & 0xC0) != 0x80)
+            n = -1;
+    }
+    if (n <= 0)
+    {
+        *p = s + 1;
+        return s[0];
+    }
+    cp = s[0] & (0x3F >> n);
+    for (i = 1; i <= n; i++)
+        cp = (cp << 6) | (s[i] & 0x3F);
+    *p = s + n + 1;
+    return cp;
+}
+
+int lcdtext_convert(const char *text, char *out, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)text;
+    const struct wide *w;
+    struct wide key;
+    size_t n = 0, l;
+
+    if (!ready)
+        lcdtext_init(LCDTEXT_A00, NULL);
+    while (*p != '\0' && n + 1 < len)
+    {
+        key.cp = next_cp(&p);
+        if (key.cp <= 0xFF)
+        {
+            out[n++] = (narrow[key.cp] != 0 ? narrow[key.cp] : '?');
+            continue;
+        }
+        w = bsearch(&key, wide, num_wide, sizeof(wide[0]), by_cp);
+        if (w == NULL)
+        {
+            out[n++] = '?';
+            continue;
+        }
+        l = strlen(w->lcd);
+        if (n + l >= len)
+            break;
+        memcpy(out + n, w->lcd, l);
+        n += l;
+    }
+    out[n] = '\0';
+    return (int)n;
+}
+
+void lcdtext_bar(char *out, int width, int filled)
+{
+    // A full cell is in the A00 ROM; A02 needs a glyph for it too
+    char full = (rom_kind == LCDTEXT_A00 ? (char)0xFF : (define_glyph != NULL ? BAR_ESCAPE + LCDTEXT_BAR_STEPS - 1 : '#'));
+    int i;
+
+    if (filled < 0)
+        filled = 0;
+    for (i = 0; i < width; i++, filled -= LCDTEXT_BAR_STEPS)
+    {
+        if (filled >= LCDTEXT_BAR_STEPS)
+            out[i] = full;
+        else if (filled > 0 && define_glyph != NULL)
+            out[i] = BAR_ESCAPE + filled - 1;
+        else
+            out[i] = ' ';
+    }
+    out[width] = '\0';
+}
+
+void lcdtext_render(int row, char *text)
+{
+    unsigned char shown = 0, others = 0;
+    int i, g, slot;
+
+    for (i = 0; i < LCDTEXT_ROWS; i++)
+    {
+        if (i != row)
+            others |= visible[i];
+    }
+    stats.renders++;
+    for (; *text != '\0'; text++)
+    {
+        g = escape_glyph[(unsigned char)*text];
+        if (g < 0)
+            continue;
+        for (slot = 0; slot < SLOTS && slot_glyph[slot] != g; slot++)
+            ;
+        if (slot == SLOTS)
+        {
+            // Not there: take the least recently used slot nobody can see
+            slot = -1;
+            for (i = 0; i < SLOTS; i++)
+            {
+                if (i != LCDTEXT_NOTE_SLOT && ((shown | others) & (1 << i)) == 0 &&
+                    (slot < 0 || slot_used[i] < slot_used[slot]))
+                    slot = i;
+            }
+            if (slot < 0)
+            {
+                *text = (g < NUM_GLYPHS ? glyphs[g].fold : ' ');
+                stats.fallbacks++;
+                continue;
+            }
+            define_glyph(slot, (unsigned char *)(g < NUM_GLYPHS ? glyphs[g].rows : bars[g - NUM_GLYPHS]));
+            slot_glyph[slot] = g;
+            stats.uploads++;
+        }
+        slot_used[slot] = ++use_clock;
+        shown |= 1 << slot;
+        *text = 0x08 + slot;
+    }
+    if (row >= 0 && row < LCDTEXT_ROWS)
+        visible[row] = shown;
+}
+
+void lcdtext_get_stats(struct lcdtext_stats *st)
+{
+    *st = stats;
+}
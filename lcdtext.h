@@ -0,0 +1,62 @@
+/*
+ * header file for lcdtext.c
+ *
+ * Turns UTF-8 text (tags, file names) into bytes for the HD44780.  Each
+ * character goes through a lookup table built for the display's character
+ * ROM: the Japanese A00 (the common one) or the European A02.  What the ROM
+ * has is used as it is.  Accented letters it doesn't have get a glyph of
+ * their own, drawn in one of the 8 CGRAM slots when they're on the screen;
+ * the slots are handed out least recently used first, so a glyph that keeps
+ * coming round isn't uploaded again.  Anything else loses its accent or
+ * becomes '?'.  Bytes that aren't UTF-8 are taken as Latin-1, which is what
+ * older tags and FAT file names usually are.  Progress bars are drawn the
+ * same way, a glyph for the cell that's partly lit.
+ */
+
+#ifndef LCDTEXT_H
+#define LCDTEXT_H
+
+#include <stddef.h>
+
+#define LCDTEXT_NOTE_SLOT 2   // the music note's CGRAM slot; never handed out
+#define LCDTEXT_ROWS      4
+#define LCDTEXT_BAR_STEPS 5   // a character's pixel columns
+
+enum lcdtext_rom { LCDTEXT_A00, LCDTEXT_A02 };
+
+struct lcdtext_stats {
+	unsigned long renders;     // windows put on the screen
+	unsigned long uploads;     // glyphs written to CGRAM
+	unsigned long fallbacks;   // glyphs shown without their accent (no slot free)
+};
+
+/*
+  Builds the tables for rom; define writes 8 rows of a glyph to a CGRAM
+  slot (NULL: never use glyphs).  Without this it's A00 and no glyphs.
+*/
+void lcdtext_init(int rom, void (*define)(int slot, unsigned char *rows));
+
+/*
+  Converts text into out (at most len - 1 characters, NUL terminated).
+  Glyphs are left as placeholders until lcdtext_render().
+  Returns the number of LCD characters
+*/
+int lcdtext_convert(const char *text, char *out, size_t len);
+
+/*
+  Just before converted text goes on screen row: swaps the placeholders for
+  CGRAM slots, uploading glyphs that aren't there yet.  Slots showing on the
+  other rows are left alone.
+*/
+void lcdtext_render(int row, char *text);
+/*
+  A progress bar width characters wide with filled of its width *
+  LCDTEXT_BAR_STEPS columns lit, into out (width + 1 bytes).  It's like
+  converted text: it can go in with other converted text, and the cell
+  that's partly lit becomes a glyph in lcdtext_render().
+*/
+void lcdtext_bar(char *out, int width, int filled);
+
+void lcdtext_get_stats(struct lcdtext_stats *st);
+
+#endif
@@ -0,0 +1,152 @@
+/*
+ * library.c
+ *
+ * Song library; see library.h.
+ *
+ * Songs live in fixed size chunks that are never moved or freed while
+ * the program runs, so growing the library never invalidates an index
+ * or a pointer.  count is published with release semantics after the
+ * new entry is filled in, so a reader that sees the new count also sees
+ * the song.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+
+#include "library.h"
+#include "hash.h"
+
+void library_init(struct library *lib)
+{
+    memset(lib, 0, sizeof(struct library));
+}
+
+void library_free(struct library *lib)
+{
+    int i, n = lib->count;
+
+    for (i = 0; i < n; i++)
+        free(lib->chunk[i / LIB_CHUNK][i % LIB_CHUNK].path);
+    for (i = 0; i < LIB_MAX_CHUNKS; i++)
+        free(lib->chunk[i]);
+    library_init(lib);
+}
+
+int library_add(struct library *lib, const char *path)
+{
+    int n = lib->count;
+    struct lib_track *track;
+
+    if (n >= LIB_CHUNK * LIB_MAX_CHUNKS)
+        return -1;
+    if (lib->chunk[n / LIB_CHUNK] == NULL)
+    {
+        lib->chunk[n / LIB_CHUNK] = calloc(LIB_CHUNK, sizeof(struct lib_track));
+        if (lib->chunk[n / LIB_CHUNK] == NULL)
+        {
+            perror("calloc: library_add");
+            return -1;
+        }
+    }
+    track = &lib->chunk[n / LIB_CHUNK][n % LIB_CHUNK];
+    track->path = strdup(path);
+    if (track->path == NULL)
+    {
+        perror("strdup: library_add");
+        return -1;
+    }
+    track->removed = 0;
+    __atomic_store_n(&lib->count, n + 1, __ATOMIC_RELEASE);
+    return n;
+}
+
+struct lib_track *library_get(struct library *lib, int index)
+{
+    if (index < 0 || index >= library_count(lib))
+        return NULL;
+    return &lib->chunk[index / LIB_CHUNK][index % LIB_CHUNK];
+}
+
+void library_set_removed(struct lib_track *track, int removed)
+{
+    __atomic_store_n(&track->removed, removed, __ATOMIC_RELEASE);
+}
+
+int library_removed(struct lib_track *track)
+{
+    return __atomic_load_n(&track->removed, __ATOMIC_ACQUIRE);
+}
+
+int library_count(struct library *lib)
+{
+    return __atomic_load_n(&lib->count, __ATOMIC_ACQUIRE);
+}
+
+static int is_mp3(const char *name)
+{
+    const char *dot = strrchr(name, '.');
+
+    return (dot != NULL && dot != name && strcasecmp(dot + 1, "mp3") == 0);
+}
+
+int library_scan(struct library *lib, const char *dir_name)
+{
+    return library_scan_until(lib, dir_name, NULL);
+}
+
+int library_scan_until(struct library *lib, const char *dir_name, const int *stop)
+{
+    DIR *d;
+    struct dirent *dir;
+    char path[PATH_MAX];
+
+    d = opendir(dir_name);
+    if (!d)
+        return -1;
+    while ((dir = readdir(d)) != NULL)
+    {
+        if (stop != NULL && __atomic_load_n(stop, __ATOMIC_RELAXED))
+            break;
+        if (strcmp(dir->d_name, "..") == 0 || strcmp(dir->d_name, ".") == 0)
+            continue;
+        if (snprintf(path, PATH_MAX, "%s/%s", dir_name, dir->d_name) >= PATH_MAX)
+        {
+            fprintf(stderr, "[%s - %d]: Path length has become too long.\n", __FILE__, __LINE__);
+            continue;
+        }
+        if (dir->d_type == DT_REG)
+        {
+            // Make sure we only add mp3 files
+            if (is_mp3(dir->d_name))
+                library_add(lib, path);
+        }
+        else if (dir->d_type == DT_DIR)
+        {
+            if (library_scan_until(lib, path, stop) != 0)
+                fprintf(stderr, "[%s - %d]: Cannot open directory '%s': %s\n", __FILE__, __LINE__, path, strerror(errno));
+        }
+    }
+    closedir(d);
+    return 0;
+}
+
+// FNV-1a over all the paths, in order
+uint32_t library_id(struct library *lib)
+{
+    uint32_t h = HASH_INIT;
+    int i, n = library_count(lib);
+    const char *s;
+
+    for (i = 0; i < n; i++)
+    {
+        // With the '\0', so "ab" + "c" isn't the same as "a" + "bc"
+        s = library_get(lib, i)->path;
+        h = hash_add(h, s, strlen(s) + 1);
+    }
+    return h;
+}
@@ -0,0 +1,52 @@
+/*
+ * header file for library.c
+ *
+ * Every song we know about, in the order we found them.  Songs are only
+ * ever appended, so a song's index (and the pointer library_get() hands
+ * back) stays good for as long as the program runs.  Songs that go away
+ * are marked removed instead of being taken out.
+ */
+
+#ifndef LIBRARY_H
+#define LIBRARY_H
+
+#include <stdint.h>
+
+#define LIB_CHUNK      1024 // songs per chunk
+#define LIB_MAX_CHUNKS 256  // so at most 256K songs
+
+struct lib_track {
+	char *path;
+	int removed;
+};
+
+struct library {
+	struct lib_track *chunk[LIB_MAX_CHUNKS];
+	int count;
+};
+
+void library_init(struct library *lib);
+void library_free(struct library *lib);
+/*
+  Appends a song and returns its index, or -1 if the library is full
+  or we're out of memory.  Only one thread may add songs, but other
+  threads can keep reading while it does.
+*/
+int library_add(struct library *lib, const char *path);
+// NULL if index is out of range
+struct lib_track *library_get(struct library *lib, int index);
+// Songs can be marked removed (and back) while other threads are reading
+void library_set_removed(struct lib_track *track, int removed);
+int library_removed(struct lib_track *track);
+int library_count(struct library *lib);
+/*
+  Adds every mp3 under dir (sub directories too).
+  Returns -1 if dir can't be opened (errno is set)
+*/
+int library_scan(struct library *lib, const char *dir);
+// The same, but gives up (returning 0) as soon as *stop is set
+int library_scan_until(struct library *lib, const char *dir, const int *stop);
+// A hash of every path, to tell whether we still have the same songs
+uint32_t library_id(struct library *lib);
+
+#endif
@@ -0,0 +1,227 @@
+/*
+ * loudness.c
+ *
+ * EBU R128 loudness; see loudness.h.
+ *
+ * The K-weighting filters are worked out for the song's sample rate (the
+ * standard only gives them for 48kHz), the same way libebur128 does.  The
+ * filters are run a 100 ms piece at a time with their state in locals; for
+ * stereo both channels go through the same loop so the compiler can do
+ * them side by side in one vector register (an IIR filter can't be
+ * vectorised along the samples).
+ *
+ * Rather than keeping every 400 ms block for the gating, each one is
+ * added to a bin of 0.1 LU.  The bins keep the blocks' mean squares added
+ * up, so only where the relative gate falls is rounded to a bin; memory
+ * stays the same however long the song is.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+#include "loudness.h"
+
+#define ABSOLUTE_GATE (-70.0)
+#define RELATIVE_GATE (-10.0)
+
+// The loudness of a mean square
+static double lufs(double energy)
+{
+    return -0.691 + 10 * log10(energy);
+}
+
+int loudness_init(struct loudness *l, long rate, int channels)
+{
+    double f0, g, q, k, vh, vb, a0;
+
+    if (rate < 8000 || channels < 1 || channels > LOUDNESS_CHANNELS)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(l, 0, sizeof(struct loudness));
+    l->channels = channels;
+    l->sub_frames = (rate + 5) / 10;
+    // Stage 1, a high shelf of +4 dB
+    f0 = 1681.974450955533;
+    g = 3.999843853973347;
+    q = 0.7071752369554196;
+    k = tan(M_PI * f0 / rate);
+    vh = pow(10.0, g / 20.0);
+    vb = pow(vh, 0.4996667741545416);
+    a0 = 1.0 + k / q + k * k;
+    l->shelf.b0 = (vh + vb * k / q + k * k) / a0;
+    l->shelf.b1 = 2.0 * (k * k - vh) / a0;
+    l->shelf.b2 = (vh - vb * k / q + k * k) / a0;
+    l->shelf.a1 = 2.0 * (k * k - 1.0) / a0;
+    l->shelf.a2 = (1.0 - k / q + k * k) / a0;
+    // Stage 2, a high pass at 38 Hz
+    f0 = 38.13547087602444;
+    q = 0.5003270373238773;
+    k = tan(M_PI * f0 / rate);
+    a0 = 1.0 + k / q + k * k;
+    l->highpass.b0 = 1.0;
+    l->highpass.b1 = -2.0;
+    l->highpass.b2 = 1.0;
+    l->highpass.a1 = 2.0 * (k * k - 1.0) / a0;
+    l->highpass.a2 = (1.0 - k / q + k * k) / a0;
+    return 0;
+}
+
+// Filters frames of mono; returns the sum of the squares
+static double filter1(struct loudness *l, const short *pcm, size_t frames)
+{
+    const struct loudness_filter s = l->shelf, h = l->highpass;
+    double x, y, sum = 0;
+    double s1 = l->z[0][0], s2 = l->z[0][1], h1 = l->z[0][2], h2 = l->z[0][3];
+    size_t i;
+
+    for (i = 0; i < frames; i++)
+    {
+        x = pcm[i] / 32768.0;
+        y = s.b0 * x + s1;
+        s1 = s.b1 * x - s.a1 * y + s2;
+        s2 = s.b2 * x - s.a2 * y;
+        x = y;
+        y = h.b0 * x + h1;
+        h1 = h.b1 * x - h.a1 * y + h2;
+        h2 = h.b2 * x - h.a2 * y;
+        sum += y * y;
+    }
+    l->z[0][0] = s1;
+    l->z[0][1] = s2;
+    l->z[0][2] = h1;
+    l->z[0][3] = h2;
+    return sum;
+}
+
+// The same for interleaved stereo, left and right together
+static double filter2(struct loudness *l, const short *pcm, size_t frames)
+{
+    const struct loudness_filter s = l->shelf, h = l->highpass;
+    double x[2], y[2], sum[2] = { 0, 0 };
+    double s1[2], s2[2], h1[2], h2[2];
+    size_t i;
+    int c;
+
+    for (c = 0; c < 2; c++)
+    {
+        s1[c] = l->z[c][0];
+        s2[c] = l->z[c][1];
+        h1[c] = l->z[c][2];
+        h2[c] = l->z[c][3];
+    }
+    for (i = 0; i < frames; i++)
+    {
+        for (c = 0; c < 2; c++)
+        {
+            x[c] = pcm[i * 2 + c] / 32768.0;
+            y[c] = s.b0 * x[c] + s1[c];
+            s1[c] = s.b1 * x[c] - s.a1 * y[c] + s2[c];
+            s2[c] = s.b2 * x[c] - s.a2 * y[c];
+            x[c] = y[c];
+            y[c] = h.b0 * x[c] + h1[c];
+            h1[c] = h.b1 * x[c] - h.a1 * y[c] + h2[c];
+            h2[c] = h.b2 * x[c] - h.a2 * y[c];
+            sum[c] += y[c] * y[c];
+        }
+    }
+    for (c = 0; c < 2; c++)
+    {
+        l->z[c][0] = s1[c];
+        l->z[c][1] = s2[c];
+        l->z[c][2] = h1[c];
+        l->z[c][3] = h2[c];
+    }
+    return sum[0] + sum[1];
+}
+
+// A 400 ms block with mean square energy (both channels added)
+static void add_block(struct loudness *l, double energy)
+{
+    double level;
+    int bin;
+
+    if (energy <= 0)
+        return;
+    level = lufs(energy);
+    if (level < ABSOLUTE_GATE)
+        return;
+    bin = (int)((level - ABSOLUTE_GATE) * 10);
+    if (bin >= LOUDNESS_BINS)
+        bin = LOUDNESS_BINS - 1;
+    l->count[bin]++;
+    l->energy[bin] += energy;
+}
+
+void loudness_add(struct loudness *l, const short *pcm, size_t frames)
+{
+    size_t n, i, samples;
+    int c, v, peak = l->peak;
+
+    samples = frames * l->channels;
+    for (i = 0; i < samples; i++)
+    {
+        v = (pcm[i] < 0 ? -pcm[i] : pcm[i]);
+        peak = (v > peak ? v : peak);
+    }
+    l->peak = peak;
+    while (frames > 0)
+    {
+        n = l->sub_frames - l->frames;
+        if (n > frames)
+            n = frames;
+        l->sum += (l->channels == 2 ? filter2(l, pcm, n) : filter1(l, pcm, n));
+        l->frames += n;
+        pcm += n * l->channels;
+        frames -= n;
+        if (l->frames < l->sub_frames)
+            break;
+        // Every 100 ms, the block of the last 400
+        l->subs[l->nsubs++ % 4] = l->sum / l->sub_frames;
+        if (l->nsubs >= 4)
+            add_block(l, (l->subs[0] + l->subs[1] + l->subs[2] + l->subs[3]) / 4);
+        l->frames = 0;
+        l->sum = 0;
+        // Silence would leave the filters working on denormals, which is slow
+        for (c = 0; c < l->channels; c++)
+        {
+            for (i = 0; i < 4; i++)
+            {
+                if (fabs(l->z[c][i]) < 1e-20)
+                    l->z[c][i] = 0;
+            }
+        }
+    }
+}
+
+double loudness_integrated(const struct loudness *l)
+{
+    double energy = 0, gate;
+    uint32_t count = 0;
+    int bin, first;
+
+    for (bin = 0; bin < LOUDNESS_BINS; bin++)
+    {
+        count += l->count[bin];
+        energy += l->energy[bin];
+    }
+    if (count == 0)
+        return LOUDNESS_SILENT;
+    gate = lufs(energy / count) + RELATIVE_GATE;
+    first = (gate > ABSOLUTE_GATE ? (int)((gate - ABSOLUTE_GATE) * 10) : 0);
+    energy = 0;
+    count = 0;
+    for (bin = first; bin < LOUDNESS_BINS; bin++)
+    {
+        count += l->count[bin];
+        energy += l->energy[bin];
+    }
+    return lufs(energy / count);
+}
+
+double loudness_peak(const struct loudness *l)
+{
+    return l->peak / 32768.0;
+}
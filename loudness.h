@@ -0,0 +1,51 @@
+/*
+ * header file for loudness.c
+ *
+ * How loud a song is, the EBU R128 way (ITU-R BS.1770): K-weighted, in
+ * 400 ms blocks every 100 ms, leaving out the silence (below -70 LUFS) and
+ * then the quiet parts (10 LU under the average of the rest).  Also the
+ * loudest sample, so a gain can be kept from clipping.
+ */
+
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LOUDNESS_CHANNELS  2
+#define LOUDNESS_BINS      750        // 0.1 LU each, from -70 to +5 LUFS
+#define LOUDNESS_SILENT    (-1000.0)  // nothing louder than -70 LUFS
+
+struct loudness_filter {
+	double b0, b1, b2, a1, a2;
+};
+
+struct loudness {
+	int channels;
+	struct loudness_filter shelf;      // stage 1: the head
+	struct loudness_filter highpass;   // stage 2: RLB
+	double z[LOUDNESS_CHANNELS][4];    // filter state, two per stage
+	long sub_frames;                   // frames in 100 ms
+	long frames;                       // so far in this 100 ms
+	double sum;                        // of the squares so far in this 100 ms
+	double subs[4];                    // the last four 100 ms mean squares
+	long nsubs;
+	uint32_t count[LOUDNESS_BINS];     // blocks in each bin,
+	double energy[LOUDNESS_BINS];      // and their mean squares added up
+	int peak;                          // loudest sample, 0 to 32768
+};
+
+/*
+  Starts measuring a song of 16 bit samples at rate with channels (1 or 2).
+  Returns 0 on success, -1 on failure (errno is set)
+*/
+int loudness_init(struct loudness *l, long rate, int channels);
+// Adds frames of interleaved samples
+void loudness_add(struct loudness *l, const short *pcm, size_t frames);
+// The song's integrated loudness (LUFS), or LOUDNESS_SILENT
+double loudness_integrated(const struct loudness *l);
+// The loudest sample, 1.0 being full scale
+double loudness_peak(const struct loudness *l);
+
+#endif
@@ -0,0 +1,227 @@
+/*
+ * pathcache.c
+ *
+ * Per song cache files; see pathcache.h.
+ *
+ * The table is open addressing on the path, kept at most half full.  A
+ * save puts the whole file together in memory first (with the lock held,
+ * but that's only copying), so the entries can change while it's written.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "lcd-mp3.h"
+#include "pathcache.h"
+#include "hash.h"
+
+static struct pathcache_entry *slot(const struct pathcache *pc, const char *path)
+{
+    uint32_t i = hash_str(path) & (pc->cap - 1);
+
+    while (pc->table[i].path != NULL && strcmp(pc->table[i].path, path) != 0)
+        i = (i + 1) & (pc->cap - 1);
+    return &pc->table[i];
+}
+
+void pathcache_init(struct pathcache *pc, const char *magic, int fields)
+{
+    memset(pc, 0, sizeof(struct pathcache));
+    pc->magic = magic;
+    pc->fields = fields;
+}
+
+void pathcache_free(struct pathcache *pc)
+{
+    uint32_t i;
+
+    for (i = 0; i < pc->cap; i++)
+        free(pc->table[i].path);
+    free(pc->table);
+    pc->table = NULL;
+    pc->n = pc->cap = pc->unsaved = 0;
+}
+
+const struct pathcache_entry *pathcache_find(const struct pathcache *pc, const char *path)
+{
+    struct pathcache_entry *e;
+
+    if (pc->cap == 0)
+        return NULL;
+    e = slot(pc, path);
+    return (e->path != NULL ? e : NULL);
+}
+
+const char *pathcache_get(const struct pathcache *pc, const char *path, const struct stat *st)
+{
+    const struct pathcache_entry *e = pathcache_find(pc, path);
+
+    if (e == NULL || e->mtime != (uint32_t)st->st_mtime || e->size != (uint32_t)st->st_size)
+        return NULL;
+    return e->payload;
+}
+
+int pathcache_put(struct pathcache *pc, const char *path, uint32_t mtime, uint32_t size, const char *payload)
+{
+    struct pathcache_entry *old = pc->table, *e;
+    uint32_t i, cap = pc->cap;
+    size_t len = strlen(path) + 1;
+    char *block;
+
+    if ((pc->n + 1) * 2 > pc->cap)
+    {
+        pc->cap = (cap == 0 ? 1024 : cap * 2);
+        pc->table = calloc(pc->cap, sizeof(struct pathcache_entry));
+        if (pc->table == NULL)
+        {
+            pc->table = old;
+            pc->cap = cap;
+            return -1;
+        }
+        for (i = 0; i < cap; i++)
+        {
+            if (old[i].path != NULL)
+                *slot(pc, old[i].path) = old[i];
+        }
+        free(old);
+    }
+    e = slot(pc, path);
+    block = realloc(e->path, len + strlen(payload) + 1);
+    if (block == NULL)
+        return -1;
+    if (e->path == NULL)
+        pc->n++;
+    e->path = block;
+    memcpy(e->path, path, len);
+    e->payload = e->path + len;
+    strcpy(e->payload, payload);
+    e->mtime = mtime;
+    e->size = size;
+    pc->unsaved++;
+    return 0;
+}
+
+int pathcache_load(struct pathcache *pc, const char *file)
+{
+    FILE *fp;
+    char *line = NULL, *payload, *p;
+    size_t len = 0;
+    ssize_t n;
+    unsigned mtime, size;
+    int used, i, ret = -1;
+
+    fp = fopen(file, "r");
+    if (fp == NULL)
+        return -1;
+    if (getline(&line, &len, fp) > 0 && strncmp(line, pc->magic, strlen(pc->magic)) == 0 &&
+        strcmp(line + strlen(pc->magic), "\n") == 0)
+    {
+        ret = 0;
+        while ((n = getline(&line, &len, fp)) > 0)
+        {
+            // A line cut short (the power went while writing it) is just ignored
+            if (line[n - 1] != '\n')
+                break;
+            line[n - 1] = '\0';
+            if (sscanf(line, "%u\t%u\t%n", &mtime, &size, &used) != 2)
+                continue;
+            // The path is what's left after the payload, tabs and all
+            payload = p = line + used;
+            for (i = 0; i < pc->fields && p != NULL; i++)
+            {
+                p = strchr(p, '\t');
+                if (p != NULL)
+                    p++;
+            }
+            if (p == NULL || *p == '\0')
+                continue;
+            p[-1] = '\0';
+            if (pathcache_put(pc, p, mtime, size, payload) != 0)
+                break;
+        }
+    }
+    pc->unsaved = 0;
+    free(line);
+    fclose(fp);
+    return ret;
+}
+
+// The whole file in one block; NULL if we're out of memory
+static char *dump(const struct pathcache *pc, size_t *len)
+{
+    const struct pathcache_entry *e;
+    char *buf;
+    size_t size = strlen(pc->magic) + 1, used;
+    uint32_t i;
+
+    for (i = 0; i < pc->cap; i++)
+    {
+        if (pc->table[i].path != NULL)
+            size += strlen(pc->table[i].path) + strlen(pc->table[i].payload) + 25;
+    }
+    buf = malloc(size + 1);
+    if (buf == NULL)
+        return NULL;
+    used = sprintf(buf, "%s\n", pc->magic);
+    for (i = 0; i < pc->cap; i++)
+    {
+        e = &pc->table[i];
+        if (e->path != NULL && strchr(e->path, '\n') == NULL && strchr(e->payload, '\n') == NULL)
+            used += sprintf(buf + used, "%u\t%u\t%s\t%s\n", e->mtime, e->size, e->payload, e->path);
+    }
+    *len = used;
+    return buf;
+}
+
+int pathcache_save(struct pathcache *pc, const char *file, pthread_mutex_t *lock)
+{
+    char tmp[PATH_MAX], *buf;
+    size_t len;
+    FILE *fp;
+    uint32_t unsaved = pc->unsaved;
+    int ok, err = 0;
+
+    if (pc->saving == TRUE)
+        return 0;
+    buf = dump(pc, &len);
+    if (buf == NULL)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    pc->saving = TRUE;
+    pc->unsaved = 0;
+    if (lock != NULL)
+        pthread_mutex_unlock(lock);
+
+    snprintf(tmp, PATH_MAX, "%s.new", file);
+    fp = fopen(tmp, "w");
+    if (fp == NULL)
+        err = errno;
+    else
+    {
+        ok = (fwrite(buf, 1, len, fp) == len && fflush(fp) == 0 && fsync(fileno(fp)) == 0);
+        if (!ok)
+            err = errno;
+        if (fclose(fp) != 0 && err == 0)
+            err = errno;
+        if (err == 0 && rename(tmp, file) != 0)
+            err = errno;
+        if (err != 0)
+            unlink(tmp);
+    }
+    free(buf);
+
+    if (lock != NULL)
+        pthread_mutex_lock(lock);
+    pc->saving = FALSE;
+    // Still to be written (a full or read-only card may come right)
+    if (err != 0)
+        pc->unsaved += unsaved;
+    errno = err;
+    return (err == 0 ? 0 : -1);
+}
@@ -0,0 +1,68 @@
+/*
+ * header file for pathcache.c
+ *
+ * Something kept about each song between runs (its tags, its gain, whether
+ * it plays), with the file's time and size so it's only believed until the
+ * song changes.  In memory it's a hash table on the path; on disk it's one
+ * line a song:
+ *
+ *   mtime<TAB>size<TAB>payload<TAB>path
+ *
+ * The payload is the user's and has a fixed number of tab separated fields.
+ * The file is written to a new one, synced and renamed over the old, so a
+ * power cut leaves one or the other.
+ */
+
+#ifndef PATHCACHE_H
+#define PATHCACHE_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+struct pathcache_entry {
+	char *path;             // NULL for an empty slot
+	char *payload;          // in the same block as path
+	uint32_t mtime;
+	uint32_t size;
+};
+
+struct pathcache {
+	const char *magic;      // the file's first line
+	int fields;             // tab separated fields in a payload
+	struct pathcache_entry *table;
+	uint32_t n;
+	uint32_t cap;
+	uint32_t unsaved;       // entries put since the file was last written
+	int saving;
+};
+
+void pathcache_init(struct pathcache *pc, const char *magic, int fields);
+void pathcache_free(struct pathcache *pc);
+
+/*
+  Adds what's in file.
+  Returns 0 on success, -1 if it can't be read or isn't one of ours
+*/
+int pathcache_load(struct pathcache *pc, const char *file);
+// path's entry whether or not the song has changed since; NULL if there's none
+const struct pathcache_entry *pathcache_find(const struct pathcache *pc, const char *path);
+// path's payload if the song is still as st says; NULL if not
+const char *pathcache_get(const struct pathcache *pc, const char *path, const struct stat *st);
+/*
+  Adds path, or replaces what we had for it.
+  Returns 0 on success, -1 if we're out of memory
+*/
+int pathcache_put(struct pathcache *pc, const char *path, uint32_t mtime, uint32_t size, const char *payload);
+
+/*
+  Writes every entry to file.  If lock isn't NULL the caller holds it; it's
+  let go of once the entries are copied and taken again at the end, so
+  nobody waits on the disk.  If another thread is writing the file already
+  this does nothing (what's changed since gets written next time).  If the
+  write fails the entries still count as unsaved, for the next try.
+  Returns 0 on success, -1 on failure (errno is set)
+*/
+int pathcache_save(struct pathcache *pc, const char *file, pthread_mutex_t *lock);
+
+#endif
@@ -0,0 +1,344 @@
+/*
+ * player_state.c
+ *
+ * Lock-free player state; see player_state.h for the overview.
+ *
+ * Snapshot reclamation is epoch based.  Every publish bumps the global
+ * epoch; a reader records the epoch it started in before loading the
+ * snapshot pointer.  Anything retired at epoch E can be freed once no
+ * reader is still inside a read section that started before E.  Only the
+ * main loop publishes and retires, so the retired list needs no locking.
+ *
+ * The command queue is a bounded multi-producer/single-consumer ring where
+ * each cell carries a sequence number (Vyukov style); producers claim a
+ * slot with a compare and swap, so a full queue fails instead of blocking.
+ * When the main loop sleeps (paused for a while) it says so in cmd_sleeping
+ * and senders wake it; otherwise sending never touches a lock.  Neither
+ * side may miss the other (a command sent as the main loop goes to sleep),
+ * so the sender's store of the cell's sequence and load of cmd_sleeping,
+ * and the main loop's exchange of cmd_sleeping and load of the sequence,
+ * are all sequentially consistent: whichever comes second sees the first.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sched.h>
+#include <time.h>
+
+#include "player_state.h"
+
+#define MAX_READERS 8
+#define MAX_RETIRED 32
+#define CMD_QUEUE   64 // must be a power of 2
+
+struct player_control player = {
+    .play_status = PLAY,
+    .song_over = FALSE,
+    .seek_request = 0,
+    .pauseMutex = PTHREAD_MUTEX_INITIALIZER,
+    .resumeCond = PTHREAD_COND_INITIALIZER
+};
+
+/*
+ * Snapshots
+ */
+static const struct player_snapshot *current = NULL;
+static unsigned long epoch = 1;
+static unsigned long reader_epoch[MAX_READERS]; // 0 = not reading
+static int num_readers = 0;
+
+struct retired {
+    const void *ptr;
+    unsigned long epoch;
+};
+static struct retired retired[MAX_RETIRED];
+static int num_retired = 0;
+
+/*
+ * Command queue
+ */
+struct cmd_cell {
+    unsigned long seq; // stored minus the cell's index so zero-init is valid
+    struct control_cmd cmd;
+};
+static struct cmd_cell cmd_cells[CMD_QUEUE];
+static unsigned long cmd_enqueue_pos = 0;
+static unsigned long cmd_dequeue_pos = 0;
+static int cmd_sleeping = FALSE;
+static pthread_mutex_t cmd_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cmd_cond = PTHREAD_COND_INITIALIZER;
+
+// Epoch of the oldest reader still in a read section
+static unsigned long oldest_reader(void)
+{
+    unsigned long oldest = ULONG_MAX, e;
+    int i, n = __atomic_load_n(&num_readers, __ATOMIC_ACQUIRE);
+
+    for (i = 0; i < n && i < MAX_READERS; i++)
+    {
+        e = __atomic_load_n(&reader_epoch[i], __ATOMIC_SEQ_CST);
+        if (e != 0 && e < oldest)
+            oldest = e;
+    }
+    return oldest;
+}
+
+static void reclaim(void)
+{
+    unsigned long oldest = oldest_reader();
+    int i, kept = 0;
+
+    for (i = 0; i < num_retired; i++)
+    {
+        if (retired[i].epoch <= oldest)
+            free((void *)retired[i].ptr);
+        else
+            retired[kept++] = retired[i];
+    }
+    num_retired = kept;
+}
+
+static void retire(const void *ptr)
+{
+    if (ptr == NULL)
+        return;
+    // Readers hold a snapshot for microseconds, so this hardly ever spins.
+    while (num_retired == MAX_RETIRED)
+    {
+        reclaim();
+        if (num_retired == MAX_RETIRED)
+            sched_yield();
+    }
+    retired[num_retired].ptr = ptr;
+    retired[num_retired].epoch = __atomic_add_fetch(&epoch, 1, __ATOMIC_SEQ_CST);
+    num_retired++;
+    reclaim();
+}
+
+void state_publish(const struct player_snapshot *snap)
+{
+    struct player_snapshot *copy;
+    const struct player_snapshot *old;
+
+    copy = malloc(sizeof(struct player_snapshot));
+    if (copy == NULL)
+    {
+        perror("malloc: state_publish");
+        return;
+    }
+    *copy = *snap;
+    old = __atomic_exchange_n(&current, copy, __ATOMIC_SEQ_CST);
+    retire(old);
+}
+
+void state_retire_track(const struct track_info *track)
+{
+    retire(track);
+}
+
+int state_reader_register(void)
+{
+    int slot = __atomic_fetch_add(&num_readers, 1, __ATOMIC_ACQ_REL);
+
+    if (slot >= MAX_READERS)
+    {
+        __atomic_fetch_sub(&num_readers, 1, __ATOMIC_ACQ_REL);
+        return -1;
+    }
+    return slot;
+}
+
+const struct player_snapshot *state_read_lock(int slot)
+{
+    __atomic_store_n(&reader_epoch[slot], __atomic_load_n(&epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&current, __ATOMIC_SEQ_CST);
+}
+
+void state_read_unlock(int slot)
+{
+    __atomic_store_n(&reader_epoch[slot], 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Command queue
+ */
+int state_send_cmd(int cmd, long arg, int relative, const char *path)
+{
+    struct cmd_cell *cell;
+    unsigned long pos, seq;
+    long diff;
+
+    pos = __atomic_load_n(&cmd_enqueue_pos, __ATOMIC_RELAXED);
+    for (;;)
+    {
+        cell = &cmd_cells[pos & (CMD_QUEUE - 1)];
+        seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) + (pos & (CMD_QUEUE - 1));
+        diff = (long)(seq - pos);
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&cmd_enqueue_pos, &pos, pos + 1, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if (diff < 0)
+            return -1; // full
+        else
+            pos = __atomic_load_n(&cmd_enqueue_pos, __ATOMIC_RELAXED);
+    }
+    cell->cmd.cmd = cmd;
+    cell->cmd.arg = arg;
+    cell->cmd.relative = relative;
+    cell->cmd.path[0] = '\0';
+    if (path != NULL)
+        snprintf(cell->cmd.path, MAXDATALEN, "%s", path);
+    // Either state_wait_cmd() sees the command or we see it asleep
+    __atomic_store_n(&cell->seq, pos + 1 - (pos & (CMD_QUEUE - 1)), __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&cmd_sleeping, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock(&cmd_mutex);
+        pthread_cond_broadcast(&cmd_cond);
+        pthread_mutex_unlock(&cmd_mutex);
+    }
+    return 0;
+}
+
+static int cmd_ready(void)
+{
+    unsigned long pos = cmd_dequeue_pos;
+    struct cmd_cell *cell = &cmd_cells[pos & (CMD_QUEUE - 1)];
+    unsigned long seq = __atomic_load_n(&cell->seq, __ATOMIC_SEQ_CST) + (pos & (CMD_QUEUE - 1));
+
+    return (long)(seq - (pos + 1)) >= 0;
+}
+
+// Condition variables here use the real time clock
+static void deadline(struct timespec *ts, long ms)
+{
+    clock_gettime(CLOCK_REALTIME, ts);
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (ms % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000)
+    {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+int state_wait_cmd(long ms)
+{
+    struct timespec ts;
+    int ready;
+
+    deadline(&ts, ms);
+    pthread_mutex_lock(&cmd_mutex);
+    __atomic_exchange_n(&cmd_sleeping, TRUE, __ATOMIC_SEQ_CST);
+    while (!(ready = cmd_ready()))
+    {
+        if (pthread_cond_timedwait(&cmd_cond, &cmd_mutex, &ts) != 0)
+            break;
+    }
+    __atomic_store_n(&cmd_sleeping, FALSE, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&cmd_mutex);
+    return (ready || cmd_ready());
+}
+
+int state_get_cmd(struct control_cmd *cmd)
+{
+    unsigned long pos = cmd_dequeue_pos;
+    struct cmd_cell *cell = &cmd_cells[pos & (CMD_QUEUE - 1)];
+    unsigned long seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) + (pos & (CMD_QUEUE - 1));
+
+    if ((long)(seq - (pos + 1)) < 0)
+        return FALSE; // empty
+    *cmd = cell->cmd;
+    __atomic_store_n(&cell->seq, pos + CMD_QUEUE - (pos & (CMD_QUEUE - 1)), __ATOMIC_RELEASE);
+    cmd_dequeue_pos = pos + 1;
+    return TRUE;
+}
+
+/*
+ * Player thread control
+ */
+void state_set_status(int play_status)
+{
+    // Only leaving PAUSE needs the lock, to wake the player thread up.
+    if (__atomic_load_n(&player.play_status, __ATOMIC_RELAXED) == PAUSE && play_status != PAUSE)
+    {
+        pthread_mutex_lock(&player.pauseMutex);
+        __atomic_store_n(&player.play_status, play_status, __ATOMIC_RELEASE);
+        pthread_cond_broadcast(&player.resumeCond);
+        pthread_mutex_unlock(&player.pauseMutex);
+    }
+    else
+        __atomic_store_n(&player.play_status, play_status, __ATOMIC_RELEASE);
+}
+
+// Packed as secs * 4 + relative * 2 + 1 so it can be swapped in one go
+void state_seek(long secs, int relative)
+{
+    __atomic_store_n(&player.seek_request, (long long)secs * 4 + (relative ? 2 : 0) + 1, __ATOMIC_RELEASE);
+}
+
+int state_get_status(void)
+{
+    return __atomic_load_n(&player.play_status, __ATOMIC_ACQUIRE);
+}
+
+int state_check_pause(void)
+{
+    int waited = FALSE;
+
+    if (state_get_status() != PAUSE)
+        return FALSE;
+    pthread_mutex_lock(&player.pauseMutex);
+    while (state_get_status() == PAUSE)
+    {
+        pthread_cond_wait(&player.resumeCond, &player.pauseMutex);
+        waited = TRUE;
+    }
+    pthread_mutex_unlock(&player.pauseMutex);
+    return waited;
+}
+
+int state_wait_resume(long ms)
+{
+    struct timespec ts;
+    int resumed;
+
+    if (state_get_status() != PAUSE)
+        return TRUE;
+    deadline(&ts, ms);
+    pthread_mutex_lock(&player.pauseMutex);
+    while (!(resumed = (state_get_status() != PAUSE)))
+    {
+        if (pthread_cond_timedwait(&player.resumeCond, &player.pauseMutex, &ts) != 0)
+            break;
+    }
+    pthread_mutex_unlock(&player.pauseMutex);
+    return (resumed || state_get_status() != PAUSE);
+}
+
+int state_take_seek(long *secs, int *relative)
+{
+    long long req;
+
+    if (__atomic_load_n(&player.seek_request, __ATOMIC_RELAXED) == 0)
+        return FALSE;
+    req = __atomic_exchange_n(&player.seek_request, 0, __ATOMIC_ACQUIRE);
+    if (req == 0)
+        return FALSE;
+    *relative = (req & 2) ? TRUE : FALSE;
+    *secs = (long)((req - (req & 3)) / 4);
+    return TRUE;
+}
+
+void state_song_over(int over)
+{
+    __atomic_store_n(&player.song_over, over, __ATOMIC_RELEASE);
+}
+
+int state_is_song_over(void)
+{
+    return __atomic_load_n(&player.song_over, __ATOMIC_ACQUIRE);
+}
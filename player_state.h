@@ -0,0 +1,129 @@
+/*
+ * header file for player_state.c
+ *
+ * Player state shared between the main loop, the player thread and the
+ * control socket.
+ *
+ * - Track info and playback snapshots are immutable once published; the
+ *   main loop swaps in a new one and readers use it without locking
+ *   (RCU style; see state_read_lock()).
+ * - Commands from the buttons and the control socket go through a lock-free
+ *   queue that only the main loop takes from.
+ * - The player thread only needs the few atomics in struct player_control;
+ *   it never takes a lock while playing.
+ */
+
+#ifndef PLAYER_STATE_H
+#define PLAYER_STATE_H
+
+#include "lcd-mp3.h"
+
+// Immutable once published
+struct track_info {
+	int index;
+	char filename[MAXDATALEN];
+	char base_filename[MAXDATALEN];
+	char title[MAXDATALEN];
+	char artist[MAXDATALEN];
+	char album[MAXDATALEN];
+	char genre[MAXDATALEN];
+	double gain_scale;              // what -replaygain scales the samples by; 1.0 for as they are
+};
+
+// Immutable once published
+struct player_snapshot {
+	unsigned long version;
+	const struct track_info *track; // NULL until the first song starts
+	int play_status;                // status_enum
+	int shuffle;
+	int volume;                     // 0 - 99
+	int muted;
+	int queued;                     // track came from the up next queue
+};
+
+// Commands coming in from the buttons or the control socket
+typedef enum {
+	CMD_PLAY,
+	CMD_PAUSE,
+	CMD_TOGGLE,
+	CMD_NEXT,
+	CMD_PREV,
+	CMD_SHUFFLE,
+	CMD_INFO,
+	CMD_MUTE,
+	CMD_QUIT,
+	CMD_VOLUME,
+	CMD_SEEK,
+	CMD_ENQUEUE,
+	CMD_FILTER,
+	CMD_BROWSE
+} command_enum;
+
+struct control_cmd {
+	int cmd;
+	long arg;      // volume (0-99), seek seconds, shuffle (-1 toggle, 0 off, 1 on)
+	int relative;  // arg is +/- the current value
+	char path[MAXDATALEN]; // enqueue: the song; filter: the search
+};
+
+/*
+  What the player thread looks at while playing.  Only the main loop writes
+  play_status and seek_request.  The main loop clears song_over before it
+  starts the player thread and the player thread sets it when it stops.
+*/
+struct player_control {
+	int play_status;          // status_enum
+	int song_over;
+	long long seek_request;   // 0 = none, see state_seek()
+	pthread_mutex_t pauseMutex;
+	pthread_cond_t resumeCond;
+};
+
+extern struct player_control player;
+
+/*
+ * Snapshots (main loop publishes; anyone reads)
+ */
+// Publishes a copy of snap; the previous one is freed once no reader can see it.
+void state_publish(const struct player_snapshot *snap);
+/*
+  Readers get a slot once per thread and bracket every use of a snapshot
+  (and the track it points to) with state_read_lock()/state_read_unlock().
+  Returns -1 if all the slots are taken.
+*/
+int state_reader_register(void);
+const struct player_snapshot *state_read_lock(int slot);
+void state_read_unlock(int slot);
+// Retire a track once the snapshot pointing to it has been replaced
+void state_retire_track(const struct track_info *track);
+
+/*
+ * Command queue (anyone sends; main loop receives)
+ */
+// Returns -1 if the queue is full
+int state_send_cmd(int cmd, long arg, int relative, const char *path);
+// Never blocks; returns TRUE if cmd was filled in
+int state_get_cmd(struct control_cmd *cmd);
+// Sleeps until a command is sent or ms have passed; returns TRUE if there is one
+int state_wait_cmd(long ms);
+
+/*
+ * Player thread control (main loop side)
+ */
+void state_set_status(int play_status);
+void state_seek(long secs, int relative);
+
+/*
+ * Player thread side
+ */
+int state_get_status(void);
+// Blocks while paused; returns TRUE if it had to wait
+int state_check_pause(void);
+// Same, for at most ms; returns TRUE if we're no longer paused
+int state_wait_resume(long ms);
+// Returns TRUE and fills in secs/relative if a seek was asked for
+int state_take_seek(long *secs, int *relative);
+void state_song_over(int over);
+int state_is_song_over(void);
+
+#endif
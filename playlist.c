@@ -0,0 +1,142 @@
+/*
+ * playlist.c
+ *
+ * Playlist files.
+ *
+ * The file is read a line at a time through a fixed buffer, so a 100,000
+ * song list costs no more memory than the library entries themselves.
+ *
+ *   M3U / M3U8: one path per line; lines starting with # are comments
+ *               (#EXTM3U, #EXTINF ...).
+ *   PLS:        FileN=path lines; everything else is ignored.
+ *
+ * file:// URLs are turned into paths (%XX escapes and all); other URLs
+ * (streams) are skipped.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <limits.h>
+#include <libgen.h>
+
+#include "lcd-mp3.h"
+#include "playlist.h"
+
+static int is_pls(const char *file)
+{
+    const char *dot = strrchr(file, '.');
+
+    return (dot != NULL && strcasecmp(dot + 1, "pls") == 0);
+}
+
+// Strip the line ending (and a UTF-8 byte order mark on the first line)
+static char *trim(char *line, int first)
+{
+    size_t len = strlen(line);
+
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r' || line[len - 1] == ' ' || line[len - 1] == '\t'))
+        line[--len] = '\0';
+    if (first && strncmp(line, "\xef\xbb\xbf", 3) == 0)
+        line += 3;
+    while (*line == ' ' || *line == '\t')
+        line++;
+    return line;
+}
+
+// "File12=/some/song.mp3" -> "/some/song.mp3"; NULL for anything else
+static char *pls_entry(char *line)
+{
+    char *p;
+
+    if (strncasecmp(line, "file", 4) != 0)
+        return NULL;
+    for (p = line + 4; isdigit((unsigned char)*p); p++)
+        ;
+    if (p == line + 4 || *p != '=')
+        return NULL;
+    return p + 1;
+}
+
+static int hex(char c)
+{
+    return (isdigit((unsigned char)c) ? c - '0' : tolower((unsigned char)c) - 'a' + 10);
+}
+
+// The %XX escapes of a file:// URL, in place: "a%20b" -> "a b"
+static void url_decode(char *s)
+{
+    char *out = s;
+
+    for (; *s; s++)
+    {
+        if (*s == '%' && isxdigit((unsigned char)s[1]) && isxdigit((unsigned char)s[2]) &&
+            (s[1] != '0' || s[2] != '0'))
+        {
+            *out++ = hex(s[1]) * 16 + hex(s[2]);
+            s += 2;
+        }
+        else
+            *out++ = *s;
+    }
+    *out = '\0';
+}
+
+int playlist_load(struct library *lib, const char *file)
+{
+    FILE *fp;
+    char line[PATH_MAX], path[PATH_MAX], dir[PATH_MAX], tmp[PATH_MAX];
+    char *entry, *p;
+    int pls = is_pls(file), first = TRUE, added = 0, c;
+    size_t len;
+
+    fp = fopen(file, "r");
+    if (fp == NULL)
+        return -1;
+    snprintf(tmp, sizeof(tmp), "%s", file);
+    snprintf(dir, sizeof(dir), "%s", dirname(tmp));
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        len = strlen(line);
+        // Too long to be a path we could open; skip the rest of it
+        if (len == sizeof(line) - 1 && line[len - 1] != '\n')
+        {
+            while ((c = fgetc(fp)) != EOF && c != '\n')
+                ;
+            continue;
+        }
+        entry = trim(line, first);
+        first = FALSE;
+        if (pls)
+            entry = pls_entry(entry);
+        else if (*entry == '#')
+            entry = NULL;
+        if (entry == NULL || *entry == '\0')
+            continue;
+        if (strncmp(entry, "file://", 7) == 0)
+        {
+            entry += 7;
+            if (strncmp(entry, "localhost/", 10) == 0)
+                entry += 9;
+            url_decode(entry);
+        }
+        else if (strstr(entry, "://") != NULL)
+            continue;
+        // Lists made on Windows
+        for (p = entry; *p; p++)
+        {
+            if (*p == '\\')
+                *p = '/';
+        }
+        if (entry[0] == '/')
+            snprintf(path, sizeof(path), "%s", entry);
+        else if (snprintf(path, sizeof(path), "%s/%s", dir, entry) >= (int)sizeof(path))
+            continue;
+        if (library_add(lib, path) >= 0)
+            added++;
+    }
+    fclose(fp);
+    return added;
+}
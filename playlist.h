@@ -0,0 +1,20 @@
+/*
+ * header file for playlist.c
+ *
+ * Reads M3U / M3U8 / PLS playlist files into the library.
+ */
+
+#ifndef PLAYLIST_H
+#define PLAYLIST_H
+
+#include "library.h"
+
+/*
+  Adds every song in the playlist file to lib, in order.  Relative paths
+  are taken to be relative to the playlist's directory.  The songs aren't
+  checked here; ones that are missing get skipped when they come up.
+  Returns the number of songs added, or -1 if file can't be read (errno is set)
+*/
+int playlist_load(struct library *lib, const char *file);
+
+#endif
@@ -0,0 +1,299 @@
+/*
+ * playqueue.c
+ *
+ * Play order, history and up next queue; see playqueue.h.
+ *
+ * New songs are slotted into the shuffled order by swapping them with a
+ * random song that hasn't played yet (an "inside out" Fisher-Yates), so
+ * pq_sync() stays O(1) per song and starting up with shuffle on needs no
+ * separate pass.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "playqueue.h"
+
+// Random number from 0 to n - 1
+static int random_below(struct playqueue *pq, int n)
+{
+    return rand_r(&pq->seed) / (RAND_MAX / n + 1);
+}
+
+static struct pq_item *hist_at(struct playqueue *pq, int back)
+{
+    return &pq->history[(pq->hist_head - 1 - back) & (PQ_HISTORY - 1)];
+}
+
+static const struct pq_item *push(struct playqueue *pq, int index, int pos, const char *path)
+{
+    struct pq_item *item = &pq->history[pq->hist_head & (PQ_HISTORY - 1)];
+    size_t len = strnlen(path, MAXDATALEN - 1);
+
+    item->index = index;
+    item->pos = pos;
+    // path can be an up next entry, in pq too (never the history, though)
+    memcpy(item->path, path, len);
+    item->path[len] = '\0';
+    pq->hist_head++;
+    if (pq->hist_len < PQ_HISTORY)
+        pq->hist_len++;
+    pq->hist_back = 0;
+    return item;
+}
+
+/*
+  Rebuild the play order.  keep is a library index to put first (and
+  make the current position) or -1 to start from the top.  If keep
+  isn't in the order we start from the top too.
+*/
+static void build_order(struct playqueue *pq, int keep)
+{
+    int i, j, t, start = 0;
+
+    pq->pos = -1;
+    for (i = 0; i < pq->order_len; i++)
+    {
+        pq->order[i] = (pq->filter != NULL ? pq->filter[i] : i);
+        if (pq->order[i] == keep)
+            pq->pos = i;
+    }
+    if (pq->shuffle == FALSE || pq->order_len < 2)
+        return;
+    if (pq->pos >= 0)
+    {
+        pq->order[pq->pos] = pq->order[0];
+        pq->order[0] = keep;
+        pq->pos = 0;
+        start = 1;
+    }
+    for (i = start; i < pq->order_len - 1; i++)
+    {
+        j = i + random_below(pq, pq->order_len - i);
+        t = pq->order[j];
+        pq->order[j] = pq->order[i];
+        pq->order[i] = t;
+    }
+}
+
+int pq_init(struct playqueue *pq, struct library *lib, int shuffle, unsigned seed)
+{
+    memset(pq, 0, sizeof(struct playqueue));
+    pq->lib = lib;
+    pq->shuffle = shuffle;
+    pq->seed = seed;
+    pq->pos = -1;
+    return pq_sync(pq);
+}
+
+void pq_free(struct playqueue *pq)
+{
+    free(pq->order);
+    free(pq->filter);
+    pq->order = NULL;
+    pq->filter = NULL;
+    pq->filter_len = 0;
+    pq->order_len = pq->order_cap = 0;
+}
+
+// Make room in the play order for n songs
+static int order_room(struct playqueue *pq, int n)
+{
+    int cap, *order;
+
+    if (n > pq->order_cap)
+    {
+        cap = (pq->order_cap ? pq->order_cap : 64);
+        while (cap < n)
+            cap *= 2;
+        order = realloc(pq->order, cap * sizeof(int));
+        if (order == NULL)
+        {
+            perror("realloc: order_room");
+            return -1;
+        }
+        pq->order = order;
+        pq->order_cap = cap;
+    }
+    return 0;
+}
+
+int pq_sync(struct playqueue *pq)
+{
+    int n = library_count(pq->lib);
+    int j;
+
+    if (pq->filter != NULL)
+        return 0;
+    if (order_room(pq, n) != 0)
+        return -1;
+    while (pq->order_len < n)
+    {
+        pq->order[pq->order_len] = pq->order_len;
+        // Somewhere among the songs we haven't got to yet
+        if (pq->shuffle == TRUE && pq->order_len > pq->pos + 1)
+        {
+            j = pq->pos + 1 + random_below(pq, pq->order_len - pq->pos);
+            pq->order[pq->order_len] = pq->order[j];
+            pq->order[j] = pq->order_len;
+        }
+        pq->order_len++;
+    }
+    return 0;
+}
+
+const struct pq_item *pq_current(struct playqueue *pq)
+{
+    if (pq->hist_len == 0)
+        return NULL;
+    return hist_at(pq, pq->hist_back);
+}
+
+const struct pq_item *pq_next(struct playqueue *pq)
+{
+    struct lib_track *track;
+    const struct pq_item *item;
+    int tries, last;
+
+    // Going forward again after going back
+    if (pq->hist_back > 0)
+    {
+        pq->hist_back--;
+        return hist_at(pq, pq->hist_back);
+    }
+    if (pq->up_head != pq->up_tail)
+    {
+        item = &pq->upnext[pq->up_tail & (PQ_UPNEXT - 1)];
+        pq->up_tail++;
+        return push(pq, -1, -1, item->path);
+    }
+    for (tries = 0; tries < pq->order_len; tries++)
+    {
+        if (pq->pos + 1 >= pq->order_len)
+        {
+            // Played them all; shuffle again but don't repeat the last song straight away
+            last = pq->order[pq->order_len - 1];
+            build_order(pq, -1);
+            if (pq->shuffle == TRUE && pq->order_len > 1 && pq->order[0] == last)
+            {
+                pq->order[0] = pq->order[pq->order_len - 1];
+                pq->order[pq->order_len - 1] = last;
+            }
+        }
+        pq->pos++;
+        track = library_get(pq->lib, pq->order[pq->pos]);
+        if (track != NULL && library_removed(track) == FALSE)
+            return push(pq, pq->order[pq->pos], pq->pos, track->path);
+    }
+    return NULL;
+}
+
+const struct pq_item *pq_prev(struct playqueue *pq)
+{
+    struct lib_track *track;
+    struct pq_item *item;
+    int tries, back;
+
+    if (pq->hist_back + 1 < pq->hist_len)
+    {
+        pq->hist_back++;
+        return hist_at(pq, pq->hist_back);
+    }
+    // Back past the start of the history; go back through the play order
+    // from the oldest song we still know the place of (not from the newest,
+    // pq->pos) and start a new history from there.
+    for (back = pq->hist_len - 1; back >= 0; back--)
+    {
+        item = hist_at(pq, back);
+        // Queued songs have no place, and a reshuffle moves the others
+        if (item->pos >= 0 && item->pos < pq->order_len && pq->order[item->pos] == item->index)
+        {
+            pq->pos = item->pos;
+            break;
+        }
+    }
+    for (tries = 0; tries < pq->order_len; tries++)
+    {
+        pq->pos = (pq->pos <= 0 ? pq->order_len - 1 : pq->pos - 1);
+        track = library_get(pq->lib, pq->order[pq->pos]);
+        if (track != NULL && library_removed(track) == FALSE)
+        {
+            pq->hist_len = 0;
+            return push(pq, pq->order[pq->pos], pq->pos, track->path);
+        }
+    }
+    return NULL;
+}
+
+const struct pq_item *pq_start_at(struct playqueue *pq, int index)
+{
+    struct lib_track *track = library_get(pq->lib, index);
+
+    if (track == NULL || library_removed(track) == TRUE)
+        return NULL;
+    build_order(pq, index);
+    if (pq->pos < 0)
+        return NULL;
+    return push(pq, index, pq->pos, track->path);
+}
+
+int pq_enqueue(struct playqueue *pq, const char *path)
+{
+    if (pq->up_head - pq->up_tail == PQ_UPNEXT)
+        return -1;
+    snprintf(pq->upnext[pq->up_head & (PQ_UPNEXT - 1)].path, MAXDATALEN, "%s", path);
+    pq->up_head++;
+    return 0;
+}
+
+int pq_queued(struct playqueue *pq)
+{
+    return pq->up_head - pq->up_tail;
+}
+
+void pq_set_shuffle(struct playqueue *pq, int shuffle)
+{
+    const struct pq_item *item = pq_current(pq);
+    int keep = -1;
+
+    // Keep our place at the song playing now, or the last one from the
+    // library if this one was queued.
+    if (item != NULL && item->index >= 0)
+        keep = item->index;
+    else if (pq->pos >= 0)
+        keep = pq->order[pq->pos];
+    pq->shuffle = shuffle;
+    build_order(pq, keep);
+}
+
+int pq_set_filter(struct playqueue *pq, const int *tracks, int n)
+{
+    const struct pq_item *item = pq_current(pq);
+    int *filter = NULL;
+    int len = library_count(pq->lib);
+
+    if (tracks != NULL)
+    {
+        filter = malloc((n ? n : 1) * sizeof(int));
+        if (filter == NULL)
+        {
+            perror("malloc: pq_set_filter");
+            return -1;
+        }
+        memcpy(filter, tracks, n * sizeof(int));
+        len = n;
+    }
+    if (order_room(pq, len) != 0)
+    {
+        free(filter);
+        return -1;
+    }
+    free(pq->filter);
+    pq->filter = filter;
+    pq->filter_len = n;
+    pq->order_len = len;
+    pq->hist_back = 0;
+    build_order(pq, (item != NULL ? item->index : -1));
+    return 0;
+}
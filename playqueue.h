@@ -0,0 +1,87 @@
+/*
+ * header file for playqueue.c
+ *
+ * What to play next and what we played before.
+ *
+ * - The play order is an array of library indices (shuffled or not); it is
+ *   only rebuilt when shuffle is turned on or the order wraps around.
+ * - The history is a ring of the songs actually played, so prev goes back
+ *   to what you heard even if the order has been reshuffled since.  After
+ *   going back, next walks forward through the history again before
+ *   carrying on with the play order.
+ * - Songs queued with pq_enqueue() play before the rest of the order.
+ * - A filter (e.g. search results) limits the order to some of the songs,
+ *   or puts them in some other order (e.g. by album).
+ *
+ * next/prev/enqueue are O(1) and never allocate.  Only the main loop uses
+ * the queue, so there's no locking.
+ */
+
+#ifndef PLAYQUEUE_H
+#define PLAYQUEUE_H
+
+#include "lcd-mp3.h"
+#include "library.h"
+
+#define PQ_HISTORY 64 // must be a power of 2
+#define PQ_UPNEXT  32 // must be a power of 2
+
+struct pq_item {
+	int index;              // library index; -1 if it was queued by path
+	int pos;                // where it was in the play order; -1 if queued
+	char path[MAXDATALEN];
+};
+
+struct playqueue {
+	struct library *lib;
+	int *order;             // library indices in play order
+	int order_len;
+	int order_cap;
+	int pos;                // place in order of the last library song; -1 before the first
+	int *filter;            // only play these library indices (NULL for all of them)
+	int filter_len;
+	int shuffle;
+	unsigned seed;
+	struct pq_item history[PQ_HISTORY];
+	unsigned hist_head;     // number of songs ever played
+	int hist_len;           // how many of them are still in the ring
+	int hist_back;          // how far back prev has taken us
+	struct pq_item upnext[PQ_UPNEXT];
+	unsigned up_head;
+	unsigned up_tail;
+};
+
+// Returns -1 if it can't get memory for the play order
+int pq_init(struct playqueue *pq, struct library *lib, int shuffle, unsigned seed);
+void pq_free(struct playqueue *pq);
+// Adds any songs the library has gained to the play order
+int pq_sync(struct playqueue *pq);
+
+/*
+  Move to the next/previous song and return it, or NULL if there is
+  nothing to play.  The item stays valid until the song has been pushed
+  out of the history.
+*/
+const struct pq_item *pq_next(struct playqueue *pq);
+const struct pq_item *pq_prev(struct playqueue *pq);
+// The song we're on now (NULL before the first pq_next())
+const struct pq_item *pq_current(struct playqueue *pq);
+// Start from library song index instead (NULL if there's no such song)
+const struct pq_item *pq_start_at(struct playqueue *pq, int index);
+
+// Returns -1 if the up next queue is full
+int pq_enqueue(struct playqueue *pq, const char *path);
+int pq_queued(struct playqueue *pq);
+
+// Reorders what's left; the current song keeps playing
+void pq_set_shuffle(struct playqueue *pq, int shuffle);
+/*
+  Only play the n library indices in tracks (copied; in that order unless
+  shuffled), or every song again if tracks is NULL.  We keep our place if
+  the song playing now is one of them, otherwise start from the top.  Songs
+  the library gains while a filter is on are left out of it.
+  Returns -1 if it can't get memory.
+*/
+int pq_set_filter(struct playqueue *pq, const int *tracks, int n);
+
+#endif
@@ -0,0 +1,276 @@
+/*
+ * quarantine.c
+ *
+ * Songs that can't be played; see quarantine.h.
+ *
+ * What we know about each song is kept in a pathcache, like the gains:
+ * bad songs with what was wrong, and songs the validator decoded all the
+ * way through ("ok") so it doesn't do them again next time.  The file is
+ * written again by the main loop between songs, by the validator every
+ * QUARANTINE_SAVE_EVERY songs, and at the end.  The players
+ * (quarantine_add(), quarantine_check()) take the same lock, so it's only
+ * held to copy the table; the writing is done without it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <mpg123.h>
+
+#include "lcd-mp3.h"
+#include "quarantine.h"
+#include "pathcache.h"
+#include "duration.h"
+#include "decoder.h"
+#include "rtsched.h"
+#include "vclock.h"
+
+#define FILE_MAGIC "LCDQ 1"
+#define OK         "ok"
+
+static pthread_mutex_t quarantineMutex = PTHREAD_MUTEX_INITIALIZER;
+static const char *list_file = NULL;
+static struct quarantine_stats stats;
+
+static pthread_t validator;
+static int validating = FALSE;
+static struct library *lib = NULL;
+
+// What's wrong with each song, or OK
+static struct pathcache songs;
+
+// Returns 0 on success, -1 if we're out of memory
+static int put(const char *path, uint32_t mtime, uint32_t size, const char *why)
+{
+    const struct pathcache_entry *e = pathcache_find(&songs, path);
+    int was_bad = (e != NULL && strcmp(e->payload, OK) != 0);
+
+    if (pathcache_put(&songs, path, mtime, size, why) != 0)
+        return -1;
+    stats.known += (strcmp(why, OK) != 0) - was_bad;
+    return 0;
+}
+
+// Writes out everything we know; called with quarantineMutex held
+static void list_save(const char *file)
+{
+    if (pathcache_save(&songs, file, &quarantineMutex) != 0)
+        fprintf(stderr, "[%s - %d]: Cannot write quarantine list %s: %s\n", __FILE__, __LINE__, file, strerror(errno));
+}
+
+int quarantine_open(const char *file)
+{
+    uint32_t i;
+
+    pthread_mutex_lock(&quarantineMutex);
+    pathcache_free(&songs);
+    pathcache_init(&songs, FILE_MAGIC, 1);
+    memset(&stats, 0, sizeof(stats));
+    list_file = file;
+    if (file != NULL)
+        pathcache_load(&songs, file);
+    for (i = 0; i < songs.cap; i++)
+    {
+        if (songs.table[i].path != NULL && strcmp(songs.table[i].payload, OK) != 0)
+            stats.known++;
+    }
+    pthread_mutex_unlock(&quarantineMutex);
+    mpg123_init();
+    return 0;
+}
+
+void quarantine_close(void)
+{
+    quarantine_validate_stop();
+    pthread_mutex_lock(&quarantineMutex);
+    if (songs.unsaved > 0 && list_file != NULL)
+        list_save(list_file);
+    pathcache_free(&songs);
+    list_file = NULL;
+    pthread_mutex_unlock(&quarantineMutex);
+}
+
+void quarantine_flush(void)
+{
+    pthread_mutex_lock(&quarantineMutex);
+    if (songs.unsaved > 0 && list_file != NULL)
+        list_save(list_file);
+    pthread_mutex_unlock(&quarantineMutex);
+}
+
+void quarantine_add(const char *path, const char *why)
+{
+    struct stat st;
+
+    if (stat(path, &st) != 0)
+        return;
+    pthread_mutex_lock(&quarantineMutex);
+    if (put(path, st.st_mtime, st.st_size, why) == 0)
+        stats.quarantined++;
+    pthread_mutex_unlock(&quarantineMutex);
+}
+
+int quarantine_check(const char *path)
+{
+    mpg123_handle *mh;
+    const char *why;
+    struct stat st;
+    long rate;
+    int channels, encoding, bad = -1;
+
+    // Not there at all is for the caller to see to
+    if (stat(path, &st) != 0)
+        return FALSE;
+    pthread_mutex_lock(&quarantineMutex);
+    if ((why = pathcache_get(&songs, path, &st)) != NULL)
+    {
+        bad = (strcmp(why, OK) != 0);
+        if (bad)
+            stats.skipped++;
+    }
+    else
+        stats.probed++;
+    pthread_mutex_unlock(&quarantineMutex);
+    if (bad >= 0)
+        return bad;
+    if (duration_probe(path, QUARANTINE_FRAMES) == 0)
+        return FALSE;
+    // mpg123 looks further for the first frame than we do; let it have a go
+    mh = decoder_open(path, &rate, &channels, &encoding);
+    if (mh != NULL)
+    {
+        decoder_close(mh);
+        return FALSE;
+    }
+    quarantine_add(path, "probe");
+    return TRUE;
+}
+
+/*
+ * The validator
+ */
+/*
+  Decodes all of path.  Returns NULL if it's fine, what's wrong with it if
+  not, or "" if we were stopped first
+*/
+static const char *decode_all(const char *path)
+{
+    mpg123_handle *mh;
+    unsigned char *buffer;
+    size_t size, done;
+    long rate, samples = 0;
+    int channels, encoding, err = MPG123_OK;
+
+    mh = decoder_open(path, &rate, &channels, &encoding);
+    if (mh == NULL)
+        return "open";
+    size = mpg123_outblock(mh);
+    buffer = malloc(size);
+    if (buffer == NULL)
+        err = MPG123_ERR;
+    while (err == MPG123_OK && __atomic_load_n(&validating, __ATOMIC_ACQUIRE) == TRUE)
+    {
+        err = mpg123_read(mh, buffer, size, &done);
+        samples += done;
+        if (err == MPG123_NEW_FORMAT)
+            err = MPG123_OK;
+    }
+    free(buffer);
+    decoder_close(mh);
+    if (err == MPG123_OK)
+        return "";
+    return (err == MPG123_DONE && samples > 0 ? NULL : "decode");
+}
+
+static void *validate(void *arg)
+{
+    struct lib_track *track;
+    struct stat st;
+    const char *why;
+    unsigned waited;
+    int i = 0, known, bad = FALSE;
+
+    (void)arg;
+    // Only with what everything else leaves over
+    rt_idle_thread();
+    while (__atomic_load_n(&validating, __ATOMIC_ACQUIRE) == TRUE)
+    {
+        if (i >= library_count(lib))
+        {
+            // Done them all; write it out and look for new songs now and then
+            quarantine_flush();
+            for (waited = 0; waited < QUARANTINE_IDLE_MS && __atomic_load_n(&validating, __ATOMIC_ACQUIRE) == TRUE; waited += 100)
+                vclock_sleep_ms(100);
+            continue;
+        }
+        track = library_get(lib, i++);
+        if (track == NULL || library_removed(track) || stat(track->path, &st) != 0)
+            continue;
+        pthread_mutex_lock(&quarantineMutex);
+        why = pathcache_get(&songs, track->path, &st);
+        known = (why != NULL);
+        if (known)
+            bad = (strcmp(why, OK) != 0);
+        pthread_mutex_unlock(&quarantineMutex);
+        // Known bad from before: out of the play order now, not when it comes up
+        if (known)
+        {
+            if (bad)
+                library_set_removed(track, TRUE);
+            continue;
+        }
+        why = decode_all(track->path);
+        if (why != NULL && why[0] == '\0')
+            break;
+        pthread_mutex_lock(&quarantineMutex);
+        if (put(track->path, st.st_mtime, st.st_size, (why != NULL ? why : OK)) == 0)
+        {
+            if (why != NULL)
+                stats.quarantined++;
+            else
+                stats.validated++;
+        }
+        if (songs.unsaved >= QUARANTINE_SAVE_EVERY && list_file != NULL)
+            list_save(list_file);
+        pthread_mutex_unlock(&quarantineMutex);
+        if (why != NULL)
+        {
+            fprintf(stderr, "[%s - %d]: Quarantined '%s' (%s)\n", __FILE__, __LINE__, track->path, why);
+            library_set_removed(track, TRUE);
+        }
+    }
+    return NULL;
+}
+
+int quarantine_validate(struct library *library)
+{
+    quarantine_validate_stop();
+    lib = library;
+    validating = TRUE;
+    errno = pthread_create(&validator, NULL, validate, NULL);
+    if (errno != 0)
+    {
+        validating = FALSE;
+        return -1;
+    }
+    return 0;
+}
+
+void quarantine_validate_stop(void)
+{
+    if (validating == FALSE)
+        return;
+    __atomic_store_n(&validating, FALSE, __ATOMIC_RELEASE);
+    pthread_join(validator, NULL);
+}
+
+void quarantine_get_stats(struct quarantine_stats *st)
+{
+    pthread_mutex_lock(&quarantineMutex);
+    *st = stats;
+    pthread_mutex_unlock(&quarantineMutex);
+}
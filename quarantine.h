@@ -0,0 +1,66 @@
+/*
+ * header file for quarantine.c
+ *
+ * Songs that can't be played, so we stop trying.  Sticks people bring
+ * along have all sorts on them: files cut short, something else renamed
+ * .mp3, ones that start fine and go to noise.  Before a song is played its
+ * first few frames are looked at (duration_probe(), one small read); a
+ * song that fails that, or that the player can't open, is quarantined and
+ * skipped straight away from then on, in this run and the next ones (the
+ * list is kept in a file with the tag cache), until the file changes.  A
+ * thread can also decode every song in the background at idle priority
+ * and quarantine the ones that don't decode all the way through.
+ */
+
+#ifndef QUARANTINE_H
+#define QUARANTINE_H
+
+#include <stdint.h>
+
+#include "library.h"
+
+#define QUARANTINE_FILE       "/var/lib/lcd-mp3/quarantine"
+#define QUARANTINE_FRAMES     4      // good frames in a row a song has to start with
+#define QUARANTINE_SAVE_EVERY 25     // songs checked between writing the file
+#define QUARANTINE_IDLE_MS    5000   // how often the validator looks for new songs
+
+struct quarantine_stats {
+	uint32_t probed;       // songs looked at before playing
+	uint32_t skipped;      // known bad ones skipped without looking
+	uint32_t quarantined;  // found bad in this run
+	uint32_t validated;    // decoded all the way through by the validator
+	uint32_t known;        // songs in the list that are bad
+};
+
+/*
+  Loads the list from file (NULL to keep it in memory only).
+  Returns 0 on success, -1 on failure (errno is set); a file that isn't
+  there yet is fine
+*/
+int quarantine_open(const char *file);
+// Stops the validator and writes the list out
+void quarantine_close(void);
+
+/*
+  Before path is played: TRUE if it's known to be bad (and hasn't changed
+  since), or doesn't start like an mp3 and mpg123 can't open it either
+  (it's then quarantined).  FALSE if it looks playable.
+*/
+int quarantine_check(const char *path);
+// The player couldn't play path (why says what went wrong)
+void quarantine_add(const char *path, const char *why);
+// Writes out what has been found since last time (the main loop, between songs)
+void quarantine_flush(void);
+
+/*
+  Decodes every song of lib in the background at idle priority, new ones
+  too as they're found; songs that fail are quarantined and marked removed.
+  Songs already done (and not changed since) aren't done again.
+  Returns 0 on success, -1 on failure (errno is set)
+*/
+int quarantine_validate(struct library *lib);
+void quarantine_validate_stop(void);
+
+void quarantine_get_stats(struct quarantine_stats *st);
+
+#endif
@@ -0,0 +1,309 @@
+/*
+ * rgain.c
+ *
+ * Background ReplayGain analysis; see rgain.h.
+ *
+ * The workers take the library's songs in order, one each at a time.  A
+ * song is decoded exactly as the player would (decoder_open()) and fed to
+ * loudness.c a buffer at a time; between buffers a worker looks whether
+ * it should stop, or wait because the player has just fallen behind.
+ *
+ * The gains are kept in a pathcache, so a changed song is measured again.
+ * The cache file is written again (by whichever worker gets there) every
+ * RGAIN_SAVE_EVERY songs and once they're all done, so not much is lost
+ * if the power goes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "lcd-mp3.h"
+#include "rgain.h"
+#include "pathcache.h"
+#include "loudness.h"
+#include "decoder.h"
+#include "rtsched.h"
+#include "vclock.h"
+
+#define CACHE_MAGIC "LCDG 1"
+
+static pthread_mutex_t gainMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t moreCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t doneCond = PTHREAD_COND_INITIALIZER;
+static pthread_t workers[RGAIN_MAX_THREADS];
+static int nworkers = 0;
+static int running = FALSE;
+
+static struct library *lib = NULL;
+static const char *cache_file = NULL;
+static int next = 0;          // the next song to look at
+static int busy = 0;          // workers in the middle of a song
+static long long backoff_until = 0;
+static struct rgain_stats stats;
+
+// "gain<TAB>peak" for every song measured
+static struct pathcache gains;
+
+/*
+  Writes every gain we have.  Called with gainMutex held, which is let go
+  of while the file is written (megabytes to the SD card for a big library)
+*/
+static void cache_save(const char *file)
+{
+    if (pathcache_save(&gains, file, &gainMutex) != 0)
+        fprintf(stderr, "[%s - %d]: Cannot write gain cache %s: %s\n", __FILE__, __LINE__, file, strerror(errno));
+}
+
+/*
+ * Analysis
+ */
+// Waits while the player is catching up; returns FALSE once we're to stop
+static int carry_on(void)
+{
+    long long until;
+    int backed_off = FALSE;
+
+    while (__atomic_load_n(&running, __ATOMIC_ACQUIRE) == TRUE)
+    {
+        until = __atomic_load_n(&backoff_until, __ATOMIC_ACQUIRE);
+        if (until == 0 || vclock_us() >= until)
+            return TRUE;
+        if (backed_off == FALSE)
+        {
+            backed_off = TRUE;
+            pthread_mutex_lock(&gainMutex);
+            stats.backoffs++;
+            pthread_mutex_unlock(&gainMutex);
+        }
+        vclock_sleep_ms(100);
+    }
+    return FALSE;
+}
+
+/*
+  Measures the song at path.
+  Returns the seconds of audio, or -1 if it couldn't be decoded (or we're stopping)
+*/
+static double measure(const char *path, double *gain, double *peak)
+{
+    struct loudness *l;
+    mpg123_handle *mh;
+    unsigned char *buffer;
+    size_t size, done;
+    long rate, frames = 0;
+    int channels, encoding, err = MPG123_OK;
+    double level;
+
+    mh = decoder_open(path, &rate, &channels, &encoding);
+    if (mh == NULL)
+        return -1;
+    l = malloc(sizeof(struct loudness));
+    size = mpg123_outblock(mh);
+    buffer = malloc(size);
+    if (l == NULL || buffer == NULL || mpg123_encsize(encoding) != 2 || loudness_init(l, rate, channels) != 0)
+        err = MPG123_ERR;
+    while (err == MPG123_OK && carry_on() == TRUE)
+    {
+        err = mpg123_read(mh, buffer, size, &done);
+        loudness_add(l, (const short *)buffer, done / (channels * 2));
+        frames += done / (channels * 2);
+        // decoder_setup() keeps the samples 16 bit; nothing else matters here
+        if (err == MPG123_NEW_FORMAT)
+            err = MPG123_OK;
+    }
+    decoder_close(mh);
+    free(buffer);
+    if (err != MPG123_DONE)
+    {
+        free(l);
+        return -1;
+    }
+    level = loudness_integrated(l);
+    *gain = (level == LOUDNESS_SILENT ? 0 : RGAIN_REFERENCE - level);
+    *peak = loudness_peak(l);
+    free(l);
+    return (double)frames / rate;
+}
+
+static void *analyse(void *arg)
+{
+    struct lib_track *track;
+    struct stat st;
+    char payload[32];
+    double gain, peak, secs;
+    long long t0;
+    int i;
+
+    (void)arg;
+    // Nothing else may wait for us
+    rt_idle_thread();
+    pthread_mutex_lock(&gainMutex);
+    while (running == TRUE)
+    {
+        if (next >= library_count(lib))
+        {
+            if (busy == 0)
+                pthread_cond_broadcast(&doneCond);
+            if (busy == 0 && gains.unsaved > 0 && gains.saving == FALSE && cache_file != NULL)
+                cache_save(cache_file);
+            else
+                pthread_cond_wait(&moreCond, &gainMutex);
+            continue;
+        }
+        i = next++;
+        busy++;
+        pthread_mutex_unlock(&gainMutex);
+        track = library_get(lib, i);
+        // Songs that are gone are left for now
+        secs = 0;
+        if (library_removed(track) || stat(track->path, &st) != 0)
+            secs = -1;
+        pthread_mutex_lock(&gainMutex);
+        if (secs == 0 && pathcache_get(&gains, track->path, &st) != NULL)
+        {
+            stats.cache_hits++;
+            secs = -1;
+        }
+        if (secs < 0)
+        {
+            busy--;
+            continue;
+        }
+        pthread_mutex_unlock(&gainMutex);
+        t0 = vclock_us();
+        secs = measure(track->path, &gain, &peak);
+        pthread_mutex_lock(&gainMutex);
+        busy--;
+        if (secs < 0)
+        {
+            if (running == TRUE)
+                stats.failed++;
+            continue;
+        }
+        snprintf(payload, sizeof(payload), "%.2f\t%.6f", gain, peak);
+        if (pathcache_put(&gains, track->path, st.st_mtime, st.st_size, payload) != 0)
+        {
+            fprintf(stderr, "[%s - %d]: Out of memory; no more songs are measured\n", __FILE__, __LINE__);
+            break;
+        }
+        stats.tracks++;
+        stats.audio_secs += secs;
+        stats.busy_secs += (vclock_us() - t0) / 1e6;
+        if (gains.unsaved >= RGAIN_SAVE_EVERY && cache_file != NULL)
+            cache_save(cache_file);
+    }
+    pthread_cond_broadcast(&doneCond);
+    pthread_mutex_unlock(&gainMutex);
+    return NULL;
+}
+
+int rgain_start(struct library *library, const char *cache, int threads)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int err = 0;
+
+    lib = library;
+    cache_file = cache;
+    next = busy = 0;
+    backoff_until = 0;
+    memset(&stats, 0, sizeof(stats));
+    pathcache_init(&gains, CACHE_MAGIC, 2);
+    if (cache != NULL)
+        pathcache_load(&gains, cache);
+    // The player and the display keep a CPU between them
+    if (threads < 0)
+        threads = (cpus > 1 ? cpus - 1 : 1);
+    if (threads > RGAIN_MAX_THREADS)
+        threads = RGAIN_MAX_THREADS;
+    running = TRUE;
+    mpg123_init();
+    for (nworkers = 0; nworkers < threads; nworkers++)
+    {
+        err = pthread_create(&workers[nworkers], NULL, analyse, NULL);
+        if (err != 0)
+            break;
+    }
+    if (err != 0 && nworkers == 0)
+    {
+        running = FALSE;
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+void rgain_stop(void)
+{
+    int i;
+
+    pthread_mutex_lock(&gainMutex);
+    __atomic_store_n(&running, FALSE, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&moreCond);
+    pthread_mutex_unlock(&gainMutex);
+    for (i = 0; i < nworkers; i++)
+        pthread_join(workers[i], NULL);
+    nworkers = 0;
+    pthread_mutex_lock(&gainMutex);
+    if (gains.unsaved > 0 && cache_file != NULL)
+        cache_save(cache_file);
+    pathcache_free(&gains);
+    pthread_mutex_unlock(&gainMutex);
+}
+
+void rgain_update(void)
+{
+    pthread_mutex_lock(&gainMutex);
+    pthread_cond_broadcast(&moreCond);
+    pthread_mutex_unlock(&gainMutex);
+}
+
+void rgain_wait(void)
+{
+    pthread_mutex_lock(&gainMutex);
+    while (running == TRUE && nworkers > 0 && (next < library_count(lib) || busy > 0))
+        pthread_cond_wait(&doneCond, &gainMutex);
+    pthread_mutex_unlock(&gainMutex);
+}
+
+int rgain_get(const char *path, double *gain, double *peak)
+{
+    const struct pathcache_entry *e;
+    int ret = -1;
+
+    pthread_mutex_lock(&gainMutex);
+    e = pathcache_find(&gains, path);
+    if (e != NULL && sscanf(e->payload, "%lf\t%lf", gain, peak) == 2)
+        ret = 0;
+    pthread_mutex_unlock(&gainMutex);
+    return ret;
+}
+
+double rgain_scale(const char *path)
+{
+    double gain, peak, scale;
+
+    if (rgain_get(path, &gain, &peak) != 0)
+        return 1.0;
+    scale = pow(10.0, gain / 20.0);
+    if (peak > 0 && scale * peak > 1.0)
+        scale = 1.0 / peak;
+    return scale;
+}
+
+void rgain_underrun(void)
+{
+    __atomic_store_n(&backoff_until, vclock_us() + RGAIN_BACKOFF_MS * 1000LL, __ATOMIC_RELEASE);
+}
+
+void rgain_get_stats(struct rgain_stats *st)
+{
+    pthread_mutex_lock(&gainMutex);
+    *st = stats;
+    pthread_mutex_unlock(&gainMutex);
+}
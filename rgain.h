@@ -0,0 +1,64 @@
+/*
+ * header file for rgain.c
+ *
+ * ReplayGain 2.0 for songs that don't have it, so they all play about as
+ * loud as each other.  Threads in the background decode every song in the
+ * library that hasn't been measured yet and work out its gain to -18 LUFS
+ * (loudness.c); the gains are kept in a cache file so each song is only
+ * ever done once.  The threads run SCHED_IDLE on the spare cores, and stop
+ * for a while whenever the player falls behind.
+ */
+
+#ifndef RGAIN_H
+#define RGAIN_H
+
+#include <stdint.h>
+
+#include "library.h"
+
+#define RGAIN_CACHE       "/var/lib/lcd-mp3/gain"
+#define RGAIN_REFERENCE   (-18.0) // LUFS every song is brought to
+#define RGAIN_MAX_THREADS 8
+#define RGAIN_BACKOFF_MS  5000    // analysis stops this long after an underrun
+#define RGAIN_SAVE_EVERY  25      // songs measured between writing the cache
+
+struct rgain_stats {
+	uint32_t tracks;      // songs measured
+	uint32_t cache_hits;  // songs whose gain came from the cache file
+	uint32_t failed;      // songs that couldn't be decoded
+	uint32_t backoffs;    // times the player fell behind
+	double audio_secs;    // of songs measured
+	double busy_secs;     // time the threads spent measuring them, added up
+};
+
+/*
+  Starts measuring the songs of lib with threads threads (-1 for one less
+  than there are CPUs, 0 only to load the cache), taking the gains of songs
+  that haven't changed from the cache file (NULL for none) and writing new
+  ones back to it.  lib must not be freed before rgain_stop().
+  Returns 0 on success, -1 on failure (errno is set)
+*/
+int rgain_start(struct library *lib, const char *cache, int threads);
+void rgain_stop(void);
+// The library has gained songs
+void rgain_update(void);
+// Blocks until every song in the library has been measured
+void rgain_wait(void);
+
+/*
+  The gain (dB) and peak (1.0 is full scale) of the song at path.
+  Returns 0 if it has been measured, -1 if not
+*/
+int rgain_get(const char *path, double *gain, double *peak);
+/*
+  What to scale path's samples by: its gain, less if that would clip; 1.0
+  if not known.  These take the lock the workers use, so look the gain up
+  before the player thread starts, not in it.
+*/
+double rgain_scale(const char *path);
+// The player calls this when it has fallen behind
+void rgain_underrun(void);
+
+void rgain_get_stats(struct rgain_stats *st);
+
+#endif
@@ -0,0 +1,130 @@
+/*
+ * rtsched.c
+ *
+ * Thread priorities, CPU affinity and memory locking; see rtsched.h.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "rtsched.h"
+
+static int audio_prio = 0;
+static int audio_cpu = -1;
+
+int rt_setup(int prio, int cpu, int lock)
+{
+    cpu_set_t set;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int i, err = 0;
+
+    audio_prio = prio;
+    audio_cpu = -1;
+    if (cpu >= 0 && cpu < cpus && cpus > 1)
+    {
+        // Everyone else (this thread and whatever it starts) keeps off it
+        CPU_ZERO(&set);
+        for (i = 0; i < cpus; i++)
+        {
+            if (i != cpu)
+                CPU_SET(i, &set);
+        }
+        if (sched_setaffinity(0, sizeof(set), &set) == 0)
+            audio_cpu = cpu;
+        else
+        {
+            err = errno;
+            fprintf(stderr, "[%s - %d]: Cannot keep CPU %d for the player: %s\n", __FILE__, __LINE__, cpu, strerror(errno));
+        }
+    }
+    else if (cpu >= 0)
+        fprintf(stderr, "[%s - %d]: There is no CPU %d to spare (%ld CPUs)\n", __FILE__, __LINE__, cpu, cpus);
+    if (lock)
+    {
+        // Locking every thread's whole stack up front would be a lot of
+        // memory on a Pi; where we can, pages are locked once they're used.
+#ifdef MCL_ONFAULT
+        if (mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT) != 0 && mlockall(MCL_CURRENT) != 0)
+#else
+        if (mlockall(MCL_CURRENT) != 0)
+#endif
+        {
+            err = errno;
+            fprintf(stderr, "[%s - %d]: Cannot lock memory: %s\n", __FILE__, __LINE__, strerror(errno));
+        }
+    }
+    if (err != 0)
+    {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+int rt_audio_thread(void)
+{
+    struct sched_param param;
+    cpu_set_t set;
+
+    if (audio_cpu >= 0)
+    {
+        CPU_ZERO(&set);
+        CPU_SET(audio_cpu, &set);
+        if ((errno = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0)
+            return -1;
+    }
+    if (audio_prio > 0)
+    {
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = audio_prio;
+        if ((errno = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+int rt_zone_thread(int zone)
+{
+    struct sched_param param;
+    cpu_set_t set;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int i, n = 0;
+
+    if (cpus > 1)
+    {
+        // The zone-th CPU of those the player isn't keeping, round and round
+        zone %= (audio_cpu >= 0 ? cpus - 1 : cpus);
+        CPU_ZERO(&set);
+        for (i = 0; i < cpus; i++)
+        {
+            if (i != audio_cpu && n++ == zone)
+                CPU_SET(i, &set);
+        }
+        if ((errno = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0)
+            return -1;
+    }
+    if (audio_prio > 0)
+    {
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = audio_prio;
+        if ((errno = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+int rt_idle_thread(void)
+{
+    struct sched_param param;
+
+    memset(&param, 0, sizeof(param));
+    if ((errno = pthread_setschedparam(pthread_self(), SCHED_IDLE, &param)) != 0)
+        return -1;
+    return 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * header file for rtsched.c
+ *
+ * Who runs when.  Only the player thread (which decodes the song and feeds
+ * the sound card) gets a real-time priority.  The display/button loop and
+ * the background threads (control socket, journal, scanning, indexing) stay
+ * ordinary threads, so a busy loop in one of them can't starve the audio.
+ * The rotary encoder's interrupt threads keep the priority wiringPi gives
+ * them (SCHED_FIFO 55).  The loudness analysis runs below all of them
+ * (SCHED_IDLE).  On a board with more than one core the player can have a
+ * CPU to itself.
+ */
+
+#ifndef RTSCHED_H
+#define RTSCHED_H
+
+#define RT_AUDIO_PRIO 70   // SCHED_FIFO priority of the player thread (above the encoder's 55)
+
+/*
+  Call from main() before any threads are started (they inherit what's set
+  here).  prio is the player's SCHED_FIFO priority, 0 to leave it an
+  ordinary thread.  cpu is a CPU to keep for the player, -1 for none: every
+  other thread is kept off it.  With lock, memory is locked as it's touched
+  (mlockall) so the player never waits for a page to come back from swap.
+  Returns 0 on success, -1 if some of it couldn't be done (errno is set;
+  whatever could be done still is)
+*/
+int rt_setup(int prio, int cpu, int lock);
+
+/*
+  The player thread calls this on itself when it starts.
+  Returns 0 on success, -1 on failure (errno is set)
+*/
+int rt_audio_thread(void);
+
+/*
+  The player thread of an extra zone (zone.h) calls this on itself: the
+  player's priority, and a CPU of its own if there are enough, so the
+  zones decode side by side.
+  Returns 0 on success, -1 on failure (errno is set)
+*/
+int rt_zone_thread(int zone);
+
+/*
+  Background work that may only have what the rest leave over (e.g. the
+  ReplayGain analysis) calls this on itself: SCHED_IDLE.
+  Returns 0 on success, -1 on failure (errno is set)
+*/
+int rt_idle_thread(void);
+
+#endif
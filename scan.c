@@ -0,0 +1,75 @@
+/*
+ * scan.c
+ *
+ * Background song scanning; see scan.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#include "lcd-mp3.h"
+#include "scan.h"
+
+static struct library *lib;
+static char *root = NULL;
+static pthread_t scan_thread;
+static int started = FALSE;   // there's a thread to join
+static int running = FALSE;   // it's still reading
+static int stop = FALSE;
+
+static void *scan_loop(void *arg)
+{
+    (void)arg;
+    if (library_scan_until(lib, root, &stop) != 0)
+        fprintf(stderr, "[%s - %d]: Cannot open directory '%s': %s\n", __FILE__, __LINE__, root, strerror(errno));
+    __atomic_store_n(&running, FALSE, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+int scan_start(struct library *library, const char *dir)
+{
+    DIR *d;
+
+    scan_stop();
+    // So the caller hears about a directory that isn't there
+    d = opendir(dir);
+    if (!d)
+        return -1;
+    closedir(d);
+    root = strdup(dir);
+    if (root == NULL)
+        return -1;
+    lib = library;
+    stop = FALSE;
+    running = TRUE;
+    errno = pthread_create(&scan_thread, NULL, scan_loop, NULL);
+    if (errno != 0)
+    {
+        running = FALSE;
+        free(root);
+        root = NULL;
+        return -1;
+    }
+    started = TRUE;
+    return 0;
+}
+
+int scan_running(void)
+{
+    return __atomic_load_n(&running, __ATOMIC_ACQUIRE);
+}
+
+void scan_stop(void)
+{
+    if (started == FALSE)
+        return;
+    __atomic_store_n(&stop, TRUE, __ATOMIC_RELAXED);
+    pthread_join(scan_thread, NULL);
+    started = FALSE;
+    free(root);
+    root = NULL;
+}
@@ -0,0 +1,26 @@
+/*
+ * header file for scan.c
+ *
+ * Reads the songs under a directory into the library in the background,
+ * so the first one can be playing while the rest of a big stick is still
+ * being read.  The library can be used all along; it just keeps growing
+ * (pq_sync() works the new songs into the play order).
+ */
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include "library.h"
+
+/*
+  Starts reading dir into lib (stopping any scan still running first).
+  Nothing else may add songs to lib until the scan is over or stopped.
+  Returns 0 on success, -1 on failure (errno is set)
+*/
+int scan_start(struct library *lib, const char *dir);
+// TRUE until every song has been read in
+int scan_running(void);
+// Gives up on the rest of the songs and waits for the thread to go
+void scan_stop(void);
+
+#endif
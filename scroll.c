@@ -0,0 +1,87 @@
+/*
+ * scroll.c
+ *
+ * Pre-rendered scrolling rows; see scroll.h.
+ *
+ * A marquee strip is the text, the gap and then the first width characters
+ * of the text again, so every window is one run of the strip and going
+ * round is just pos going back to 0.  A bounce strip is the text alone.
+ * Text that fits is padded out to the width.
+ */
+
+#include <string.h>
+
+#include "lcd-mp3.h"
+#include "lcdtext.h"
+#include "scroll.h"
+
+static int mode = SCROLL_MARQUEE;
+static unsigned step = SCROLL_STEP_MS;
+static unsigned dwell = SCROLL_DWELL_MS;
+
+void scroll_configure(int scroll_mode, unsigned step_ms, unsigned dwell_ms)
+{
+    mode = scroll_mode;
+    step = (step_ms > 0 ? step_ms : 1);
+    dwell = dwell_ms;
+}
+
+int scroll_set(struct scroll *s, const char *text, int width, int loops, unsigned now)
+{
+    if (width > SCROLL_WIDTH_MAX)
+        width = SCROLL_WIDTH_MAX;
+    s->len = lcdtext_convert(text, s->strip, SCROLL_TEXT + 1);
+    s->width = width;
+    s->pos = 0;
+    s->dir = 1;
+    s->loops = loops;
+    s->laps = 0;
+    s->next = now + dwell;
+    s->scrolling = (s->len > width ? TRUE : FALSE);
+    if (s->scrolling == FALSE)
+        memset(s->strip + s->len, ' ', width - s->len);
+    else if (mode == SCROLL_MARQUEE)
+    {
+        memset(s->strip + s->len, ' ', SCROLL_GAP);
+        memcpy(s->strip + s->len + SCROLL_GAP, s->strip, width);
+    }
+    return s->scrolling;
+}
+
+int scroll_tick(struct scroll *s, unsigned now, char *window)
+{
+    int lap = FALSE;
+
+    if (s->scrolling == FALSE || (int)(now - s->next) < 0)
+        return FALSE;
+    if (mode == SCROLL_BOUNCE)
+    {
+        s->pos += s->dir;
+        if (s->pos >= s->len - s->width)
+            s->dir = -1;
+        else if (s->pos <= 0)
+        {
+            s->dir = 1;
+            lap = TRUE;
+        }
+    }
+    else if (++s->pos == s->len + SCROLL_GAP)
+    {
+        s->pos = 0;
+        lap = TRUE;
+    }
+    // Back at the start (or, bouncing, at the end): stay a while
+    s->next = now + step;
+    if (lap || (mode == SCROLL_BOUNCE && s->pos == s->len - s->width))
+        s->next = now + dwell;
+    if (lap && s->loops > 0 && ++s->laps >= s->loops)
+        s->scrolling = FALSE;
+    scroll_window(s, window);
+    return TRUE;
+}
+
+void scroll_window(const struct scroll *s, char *window)
+{
+    memcpy(window, s->strip + s->pos, s->width);
+    window[s->width] = '\0';
+}
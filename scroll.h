@@ -0,0 +1,55 @@
+/*
+ * header file for scroll.c
+ *
+ * A row of the LCD that scrolls text too long for it.  When the text
+ * changes it's turned into LCD characters (see lcdtext.h) and laid out in a
+ * strip once; after that each step just copies a window of the strip.
+ *
+ * Marquee: the text goes round (with a gap), pausing whenever it's back at
+ * the start.  Bounce: it goes along to the end, pauses, comes back, pauses.
+ */
+
+#ifndef SCROLL_H
+#define SCROLL_H
+
+#define SCROLL_TEXT      256   // longest text, in LCD characters
+#define SCROLL_WIDTH_MAX 40    // widest row
+#define SCROLL_GAP       4     // marquee: spaces between the end and the start again
+#define SCROLL_STRIP     (SCROLL_TEXT + SCROLL_GAP + SCROLL_WIDTH_MAX + 1)
+
+#define SCROLL_STEP_MS  200    // defaults for scroll_configure()
+#define SCROLL_DWELL_MS 1000
+
+enum scroll_mode { SCROLL_MARQUEE, SCROLL_BOUNCE };
+
+struct scroll {
+	char strip[SCROLL_STRIP];
+	int len;             // characters of text
+	int width;
+	int scrolling;       // FALSE if it fits
+	int pos;             // window start
+	int dir;             // bouncing: 1 or -1
+	int loops;           // times round before stopping at the start; 0 = forever
+	int laps;
+	unsigned next;       // millis() of the next step
+};
+
+// For every row: how it scrolls, ms between steps and the pause at the start (and end)
+void scroll_configure(int mode, unsigned step_ms, unsigned dwell_ms);
+
+/*
+  Lays text out for a row width characters wide, starting at the start
+  (which stays up for the dwell time).  loops is how many times it goes round
+  before stopping, 0 for forever.
+  Returns TRUE if it's too long and needs to scroll
+*/
+int scroll_set(struct scroll *s, const char *text, int width, int loops, unsigned now);
+/*
+  Moves along if it's time to (now is millis()).
+  Returns TRUE and fills in window (width characters) if it moved
+*/
+int scroll_tick(struct scroll *s, unsigned now, char *window);
+// What's showing: width characters, padded with spaces if the text is short
+void scroll_window(const struct scroll *s, char *window);
+
+#endif
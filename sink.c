@@ -0,0 +1,126 @@
+/*
+ * sink.c
+ *
+ * Audio output; see sink.h.
+ *
+ * WAV files are 16 byte PCM "fmt " plus "data", with the sizes written as 0
+ * and filled in when the file is closed (little endian, like the Pi).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "sink.h"
+
+#define WAV_HEADER 44
+
+static void put16(unsigned char *p, unsigned v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+}
+
+static void put32(unsigned char *p, uint32_t v)
+{
+    put16(p, v & 0xffff);
+    put16(p + 2, v >> 16);
+}
+
+static void wav_header(struct sink *s, unsigned char *h)
+{
+    uint32_t data = (s->bytes > 0xffffffffu - 36 ? 0xffffffffu - 36 : (uint32_t)s->bytes);
+    int block = s->channels * s->bits / 8;
+
+    memcpy(h, "RIFF", 4);
+    put32(h + 4, 36 + data);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    put32(h + 16, 16);
+    put16(h + 20, 1);             // PCM
+    put16(h + 22, s->channels);
+    put32(h + 24, s->rate);
+    put32(h + 28, s->rate * block);
+    put16(h + 32, block);
+    put16(h + 34, s->bits);
+    memcpy(h + 36, "data", 4);
+    put32(h + 40, data);
+}
+
+int sink_open(struct sink *s, int kind, const char *path, long rate, int channels, int bits)
+{
+    ao_sample_format format;
+    ao_option *options = NULL;
+    unsigned char header[WAV_HEADER];
+
+    memset(s, 0, sizeof(struct sink));
+    s->kind = kind;
+    s->rate = rate;
+    s->channels = channels;
+    s->bits = bits;
+    switch (kind)
+    {
+        case SINK_AO:
+            memset(&format, 0, sizeof(format));
+            format.bits = bits;
+            format.rate = rate;
+            format.channels = channels;
+            format.byte_format = AO_FMT_NATIVE;
+            format.matrix = 0;
+            if (path == NULL)
+                s->dev = ao_open_live(ao_default_driver_id(), &format, NULL);
+            else
+            {
+                // A card of its own, e.g. for a zone
+                ao_append_option(&options, "dev", path);
+                s->dev = ao_open_live(ao_driver_id("alsa"), &format, options);
+                ao_free_options(options);
+            }
+            return (s->dev != NULL ? 0 : -1);
+        case SINK_WAV:
+            s->fp = fopen(path, "wb");
+            if (s->fp == NULL)
+                return -1;
+            wav_header(s, header);
+            if (fwrite(header, WAV_HEADER, 1, s->fp) != 1)
+            {
+                fclose(s->fp);
+                s->fp = NULL;
+                return -1;
+            }
+            return 0;
+        case SINK_NULL:
+            return 0;
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+int sink_write(struct sink *s, const unsigned char *buf, size_t len)
+{
+    int ok = 1;
+
+    if (s->kind == SINK_AO)
+        ok = ao_play(s->dev, (char *)buf, len);
+    else if (s->kind == SINK_WAV)
+        ok = (fwrite(buf, 1, len, s->fp) == len);
+    s->bytes += len;
+    return (ok ? 0 : -1);
+}
+
+void sink_close(struct sink *s)
+{
+    unsigned char header[WAV_HEADER];
+
+    if (s->kind == SINK_AO && s->dev != NULL)
+        ao_close(s->dev);
+    else if (s->kind == SINK_WAV && s->fp != NULL)
+    {
+        wav_header(s, header);
+        if (fseek(s->fp, 0, SEEK_SET) != 0 || fwrite(header, WAV_HEADER, 1, s->fp) != 1)
+            fprintf(stderr, "[%s - %d]: Cannot finish the WAV file: %s\n", __FILE__, __LINE__, strerror(errno));
+        fclose(s->fp);
+    }
+    s->dev = NULL;
+    s->fp = NULL;
+}
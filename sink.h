@@ -0,0 +1,39 @@
+/*
+ * header file for sink.c
+ *
+ * Where decoded audio goes: the sound card (libao), a WAV file, or nowhere
+ * at all.  The last two take it as fast as it comes, for lcd-mp3-render.
+ */
+
+#ifndef SINK_H
+#define SINK_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <ao/ao.h>
+
+enum sink_kind { SINK_AO, SINK_WAV, SINK_NULL };
+
+struct sink {
+	int kind;
+	ao_device *dev;     // SINK_AO
+	FILE *fp;           // SINK_WAV
+	long rate;
+	int channels;
+	int bits;
+	uint64_t bytes;     // written since it was opened
+};
+
+/*
+  Opens the sound card (ao_initialize() first; path is the ALSA device,
+  e.g. "hw:1", or NULL for libao's default), the WAV file path or the
+  null sink for audio in this format.
+  Returns 0 on success, -1 on failure (errno is set)
+*/
+int sink_open(struct sink *s, int kind, const char *path, long rate, int channels, int bits);
+// Returns 0 on success, -1 on failure
+int sink_write(struct sink *s, const unsigned char *buf, size_t len);
+// A WAV file gets its sizes filled in here
+void sink_close(struct sink *s);
+
+#endif
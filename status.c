@@ -0,0 +1,255 @@
+/*
+ * status.c
+ *
+ * Publishes the player status in a POSIX shared memory segment.
+ *
+ * The record is guarded by a seqlock: the writer bumps seq to an odd value,
+ * updates the fields and bumps it back to even.  Readers copy the record and
+ * retry if seq was odd or changed underneath them, so any number of readers
+ * can poll it without a syscall and without ever holding up the player.
+ *
+ * There are two writers (the main loop and the player thread), so writers
+ * take writeMutex between themselves; the player thread only ever trylocks
+ * it and skips that update if the main loop is in the middle of one.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "status.h"
+
+static struct status_record *rec = NULL;
+static const char *rec_name = STATUS_SHM;
+static pthread_mutex_t writeMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Player thread only
+static unsigned pending_underruns = 0;
+static int64_t last_cpu_check = 0;
+
+static void write_begin(void)
+{
+    __atomic_store_n(&rec->seq, rec->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void write_end(void)
+{
+    rec->updates++;
+    __atomic_store_n(&rec->seq, rec->seq + 1, __ATOMIC_RELEASE);
+}
+
+static int64_t now_us(clockid_t clk)
+{
+    struct timespec ts;
+
+    clock_gettime(clk, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int status_open(void)
+{
+    return status_open_at(STATUS_SHM);
+}
+
+int status_open_at(const char *name)
+{
+    int fd;
+
+    fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if (fd < 0)
+        return -1;
+    if (ftruncate(fd, sizeof(struct status_record)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    rec = mmap(NULL, sizeof(struct status_record), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (rec == MAP_FAILED)
+    {
+        rec = NULL;
+        return -1;
+    }
+    rec_name = name;
+    pthread_mutex_lock(&writeMutex);
+    write_begin();
+    memset((char *)rec + sizeof(rec->magic) + sizeof(rec->layout) + sizeof(rec->seq), 0,
+           sizeof(struct status_record) - sizeof(rec->magic) - sizeof(rec->layout) - sizeof(rec->seq));
+    rec->magic = STATUS_MAGIC;
+    rec->layout = STATUS_LAYOUT;
+    rec->state = STOP;
+    write_end();
+    pthread_mutex_unlock(&writeMutex);
+    return 0;
+}
+
+void status_close(void)
+{
+    if (rec == NULL)
+        return;
+    pthread_mutex_lock(&writeMutex);
+    munmap(rec, sizeof(struct status_record));
+    rec = NULL;
+    pthread_mutex_unlock(&writeMutex);
+    shm_unlink(rec_name);
+}
+
+void status_set_track(const char *path, const char *title, const char *artist)
+{
+    if (rec == NULL)
+        return;
+    pthread_mutex_lock(&writeMutex);
+    write_begin();
+    snprintf(rec->path, MAXDATALEN, "%s", path);
+    snprintf(rec->title, MAXDATALEN, "%s", title);
+    snprintf(rec->artist, MAXDATALEN, "%s", artist);
+    rec->position_ms = rec->duration_ms = rec->buffer_ms = 0;
+    write_end();
+    pthread_mutex_unlock(&writeMutex);
+}
+
+void status_set_state(int state)
+{
+    if (rec == NULL)
+        return;
+    pthread_mutex_lock(&writeMutex);
+    write_begin();
+    rec->state = state;
+    write_end();
+    pthread_mutex_unlock(&writeMutex);
+}
+
+void status_set_volume(int volume)
+{
+    if (rec == NULL)
+        return;
+    pthread_mutex_lock(&writeMutex);
+    write_begin();
+    rec->volume = volume;
+    write_end();
+    pthread_mutex_unlock(&writeMutex);
+}
+
+void status_player(long position_ms, long duration_ms, long buffer_ms, int underrun)
+{
+    int64_t now;
+
+    if (underrun)
+        pending_underruns++;
+    if (rec == NULL || pthread_mutex_trylock(&writeMutex) != 0)
+        return;
+    write_begin();
+    rec->position_ms = position_ms;
+    rec->duration_ms = duration_ms;
+    rec->buffer_ms = buffer_ms;
+    rec->underruns += pending_underruns;
+    pending_underruns = 0;
+    // Reading the CPU clock is a real syscall; once a second is plenty.
+    now = now_us(CLOCK_MONOTONIC);
+    if (now - last_cpu_check >= 1000000)
+    {
+        rec->cpu_us = now_us(CLOCK_PROCESS_CPUTIME_ID);
+        last_cpu_check = now;
+    }
+    write_end();
+    pthread_mutex_unlock(&writeMutex);
+}
+
+const struct status_record *status_attach(void)
+{
+    return status_attach_at(STATUS_SHM);
+}
+
+const struct status_record *status_attach_at(const char *name)
+{
+    const struct status_record *shm;
+    int fd;
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return NULL;
+    shm = mmap(NULL, sizeof(struct status_record), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED)
+        return NULL;
+    if (shm->magic != STATUS_MAGIC || shm->layout != STATUS_LAYOUT)
+    {
+        munmap((void *)shm, sizeof(struct status_record));
+        errno = EPROTO;
+        return NULL;
+    }
+    return shm;
+}
+
+int status_read(const struct status_record *shm, struct status_record *out)
+{
+    uint32_t seq1, seq2;
+    int retries = 0;
+
+    for (;;)
+    {
+        seq1 = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+        if ((seq1 & 1) == 0)
+        {
+            memcpy(out, (const void *)shm, sizeof(struct status_record));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            seq2 = __atomic_load_n(&shm->seq, __ATOMIC_RELAXED);
+            if (seq1 == seq2)
+                break;
+        }
+        retries++;
+    }
+    out->seq = seq1;
+    return retries;
+}
+
+/*
+ * Checking the seqlock: the strings are filled right up with one letter so
+ * a copy that's half old and half new shows.
+ */
+static void check_fill(struct status_record *r, uint64_t updates)
+{
+    r->state = updates % (QUIT + 1);
+    r->volume = updates % 100;
+    r->underruns = (uint32_t)(updates * 3);
+    r->position_ms = updates * 5;
+    r->duration_ms = updates * 7;
+    r->buffer_ms = updates % 1000;
+    r->cpu_us = updates * 11;
+    memset(r->path, 'a' + updates % 26, MAXDATALEN - 1);
+    memset(r->title, 'A' + updates % 26, MAXDATALEN - 1);
+    memset(r->artist, '0' + updates % 10, MAXDATALEN - 1);
+    r->path[MAXDATALEN - 1] = r->title[MAXDATALEN - 1] = r->artist[MAXDATALEN - 1] = '\0';
+}
+
+void status_check_write(void)
+{
+    if (rec == NULL)
+        return;
+    pthread_mutex_lock(&writeMutex);
+    write_begin();
+    check_fill(rec, rec->updates + 1);
+    write_end();
+    pthread_mutex_unlock(&writeMutex);
+}
+
+int status_check(const struct status_record *r)
+{
+    struct status_record want;
+
+    check_fill(&want, r->updates);
+    if (r->magic != STATUS_MAGIC || r->layout != STATUS_LAYOUT || r->state != want.state ||
+        r->volume != want.volume || r->underruns != want.underruns || r->position_ms != want.position_ms ||
+        r->duration_ms != want.duration_ms || r->buffer_ms != want.buffer_ms || r->cpu_us != want.cpu_us ||
+        memcmp(r->path, want.path, MAXDATALEN) != 0 || memcmp(r->title, want.title, MAXDATALEN) != 0 ||
+        memcmp(r->artist, want.artist, MAXDATALEN) != 0)
+        return -1;
+    return 0;
+}
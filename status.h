@@ -0,0 +1,68 @@
+/*
+ * header file for status.c
+ *
+ * Player status published in POSIX shared memory for monitoring agents.
+ */
+
+#ifndef STATUS_H
+#define STATUS_H
+
+#include <stdint.h>
+
+#include "lcd-mp3.h"
+
+#define STATUS_SHM     "/lcd-mp3-status"
+#define STATUS_CHECK   "/lcd-mp3-status-check" // lcd-mp3-status -check's own
+#define STATUS_MAGIC   0x4c43444d // "LCDM"
+#define STATUS_LAYOUT  1          // bump whenever struct status_record changes
+
+/*
+  Fixed layout; readers map it read-only and copy it out with status_read().
+  seq is a seqlock: odd while the player is writing.
+*/
+struct status_record {
+	uint32_t magic;
+	uint32_t layout;
+	uint32_t seq;
+	int32_t state;        // status_enum (PLAY, PAUSE, ...)
+	int32_t volume;       // 0 - 99
+	uint32_t underruns;
+	int64_t position_ms;
+	int64_t duration_ms;
+	int64_t buffer_ms;    // audio estimated to be queued ahead of the device
+	int64_t cpu_us;       // process CPU time
+	uint64_t updates;
+	char path[MAXDATALEN];
+	char title[MAXDATALEN];
+	char artist[MAXDATALEN];
+};
+
+// Player side
+int status_open(void);
+int status_open_at(const char *name);
+void status_close(void);
+void status_set_track(const char *path, const char *title, const char *artist);
+void status_set_state(int state);
+void status_set_volume(int volume);
+// Called from the player thread for every block; never blocks.
+void status_player(long position_ms, long duration_ms, long buffer_ms, int underrun);
+
+// Reader side
+const struct status_record *status_attach(void);
+const struct status_record *status_attach_at(const char *name);
+/*
+  Copy a consistent record out of shared memory.
+  Returns the number of retries needed (0 if there was no writer in the way).
+*/
+int status_read(const struct status_record *shm, struct status_record *out);
+
+/*
+  For checking the seqlock (lcd-mp3-status -check): status_check_write()
+  publishes a record in which every field follows from its updates count,
+  the way the player does, and status_check() returns 0 if a record that
+  was read is one of those, -1 if it's torn.
+*/
+void status_check_write(void);
+int status_check(const struct status_record *r);
+
+#endif
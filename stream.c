@@ -0,0 +1,349 @@
+/*
+ * stream.c
+ *
+ * Playing audio from a pipe; see stream.h.
+ *
+ * The FIFO is opened without blocking, so the thread can look every
+ * POLL_MS whether it should stop while nobody is writing to it.  Once a
+ * writer has been and gone the FIFO stays "hung up", so it's closed and
+ * opened again for the next one.  mpg123 is only fed when it says it needs
+ * more (MPG123_NEED_MORE), a STREAM_CHUNK at a time; everything else waits
+ * in the pipe, and the writer waits when that's full.
+ *
+ * The player and a stream hand the sound card over to each other, so a
+ * card that can't mix (no dmix) works too: when something comes down the
+ * pipe the stream says it's active, which stops the player opening the
+ * card, and waits for the player to close it if it has it open.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <mpg123.h>
+
+#include "lcd-mp3.h"
+#include "stream.h"
+#include "decoder.h"
+#include "sink.h"
+#include "vclock.h"
+
+#define POLL_MS 200
+
+static pthread_mutex_t streamMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idleCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t cardCond = PTHREAD_COND_INITIALIZER;
+static pthread_t streamThread;
+static int running = FALSE;
+static int stop = FALSE;
+static int active = FALSE;
+static int cardHeld = FALSE;   // the player has the sound card open
+static char *pipePath;
+static int sinkKind;
+static char *sinkPath;
+static struct stream_stats stats;
+
+// Waits for more of the stream; returns how much there was, 0 at the end, -1 on error or when stopped
+static ssize_t read_some(int fd, unsigned char *buf)
+{
+    struct pollfd p = { .fd = fd, .events = POLLIN };
+    ssize_t n;
+
+    for (;;)
+    {
+        if (__atomic_load_n(&stop, __ATOMIC_ACQUIRE))
+        {
+            errno = ECANCELED;
+            return -1;
+        }
+        n = read(fd, buf, STREAM_CHUNK);
+        if (n >= 0)
+            return n;
+        if (errno != EAGAIN && errno != EINTR)
+            return -1;
+        poll(&p, 1, POLL_MS);
+    }
+}
+
+int stream_play(int fd, int kind, const char *sink_path, int realtime)
+{
+    mpg123_handle *mh;
+    struct sink out;
+    unsigned char in[STREAM_CHUNK], *buf;
+    size_t buf_size, done;
+    ssize_t n;
+    long rate = 0, fill, max_buffered = 0;
+    int channels = 0, encoding = 0, ret, opened = FALSE, played = FALSE, err = 0;
+    long long start_us = 0, written_us = 0, ahead_us, bytes_in = 0;
+    double secs = 0;
+
+    mh = mpg123_new(NULL, &ret);
+    if (mh == NULL)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    mpg123_param(mh, MPG123_ADD_FLAGS, MPG123_QUIET, 0);
+    decoder_setup(mh);
+    buf_size = mpg123_outblock(mh);
+    buf = malloc(buf_size);
+    if (buf == NULL || mpg123_open_feed(mh) != MPG123_OK)
+    {
+        free(buf);
+        mpg123_delete(mh);
+        errno = ENOMEM;
+        return -1;
+    }
+    for (;;)
+    {
+        ret = mpg123_read(mh, buf, buf_size, &done);
+        if (ret == MPG123_NEW_FORMAT)
+        {
+            // The first frame (or one in another format): (re)open the output for it
+            if (opened)
+                sink_close(&out);
+            mpg123_getformat(mh, &rate, &channels, &encoding);
+            opened = (rate > 0 && sink_open(&out, kind, sink_path, rate, channels, mpg123_encsize(encoding) * 8) == 0);
+            if (opened == FALSE)
+            {
+                err = (rate > 0 ? errno : EINVAL);
+                break;
+            }
+            start_us = vclock_us() - written_us;
+            continue;
+        }
+        if (done > 0 && opened)
+        {
+            if (sink_write(&out, buf, done) != 0)
+            {
+                err = EIO;
+                break;
+            }
+            played = TRUE;
+            written_us += (long long)(done / (channels * mpg123_encsize(encoding))) * 1000000 / rate;
+            // Only the sound card holds us back by itself
+            if (realtime && kind != SINK_AO && (ahead_us = written_us - (vclock_us() - start_us)) >= 1000)
+                vclock_sleep_ms(ahead_us / 1000);
+        }
+        if (ret == MPG123_NEED_MORE)
+        {
+            n = read_some(fd, in);
+            if (n <= 0)
+            {
+                err = (n < 0 ? errno : 0);
+                break;
+            }
+            mpg123_feed(mh, in, n);
+            bytes_in += n;
+            if (mpg123_getstate(mh, MPG123_BUFFERFILL, &fill, NULL) == MPG123_OK && fill > max_buffered)
+                max_buffered = fill;
+        }
+        else if (ret != MPG123_OK)
+        {
+            err = (ret == MPG123_DONE ? 0 : EINVAL);
+            break;
+        }
+        if (__atomic_load_n(&stop, __ATOMIC_ACQUIRE))
+        {
+            err = ECANCELED;
+            break;
+        }
+    }
+    if (opened)
+        sink_close(&out);
+    secs = written_us / 1e6;
+    free(buf);
+    mpg123_close(mh);
+    mpg123_delete(mh);
+    // Something came in, but nothing we could play
+    if (err == 0 && played == FALSE && bytes_in > 0)
+        err = EINVAL;
+
+    pthread_mutex_lock(&streamMutex);
+    stats.streams++;
+    if (err != 0 && err != ECANCELED)
+        stats.failed++;
+    stats.bytes_in += bytes_in;
+    stats.audio_secs += secs;
+    if (max_buffered > stats.max_buffered)
+        stats.max_buffered = max_buffered;
+    pthread_mutex_unlock(&streamMutex);
+    if (err != 0)
+    {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+  Once we're active the player won't take the card again; turning active
+  on waits for it to close the card if it has it open
+*/
+static void set_active(int on)
+{
+    struct timespec ts;
+
+    pthread_mutex_lock(&streamMutex);
+    __atomic_store_n(&active, on, __ATOMIC_RELEASE);
+    if (on == FALSE)
+        pthread_cond_broadcast(&idleCond);
+    else if (cardHeld == TRUE)
+    {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += STREAM_HANDOFF_MS / 1000;
+        ts.tv_nsec += (STREAM_HANDOFF_MS % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000)
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        while (cardHeld == TRUE && __atomic_load_n(&stop, __ATOMIC_ACQUIRE) == FALSE)
+        {
+            if (pthread_cond_timedwait(&cardCond, &streamMutex, &ts) != 0)
+                break;
+        }
+    }
+    pthread_mutex_unlock(&streamMutex);
+}
+
+// Plays whatever comes down the pipe, one writer after another
+static void *stream_thread(void *arg)
+{
+    struct pollfd p;
+    int fd, from_stdin = (strcmp(pipePath, "-") == 0), ready;
+
+    if (from_stdin)
+        fcntl(0, F_SETFL, fcntl(0, F_GETFL) | O_NONBLOCK);
+    while (__atomic_load_n(&stop, __ATOMIC_ACQUIRE) == FALSE)
+    {
+        fd = (from_stdin ? 0 : open(pipePath, O_RDONLY | O_NONBLOCK));
+        if (fd < 0)
+        {
+            fprintf(stderr, "[%s - %d]: Cannot open %s: %s\n", __FILE__, __LINE__, pipePath, strerror(errno));
+            break;
+        }
+        // Nothing until something writes to it
+        p.fd = fd;
+        p.events = POLLIN;
+        do
+        {
+            p.revents = 0;
+            ready = poll(&p, 1, POLL_MS);
+        } while ((ready == 0 || (ready < 0 && errno == EINTR)) && __atomic_load_n(&stop, __ATOMIC_ACQUIRE) == FALSE);
+        if (p.revents & POLLIN)
+        {
+            set_active(TRUE);
+            if (stream_play(fd, sinkKind, sinkPath, FALSE) != 0 && errno != ECANCELED)
+                fprintf(stderr, "[%s - %d]: Cannot play what came from %s: %s\n", __FILE__, __LINE__, pipePath, strerror(errno));
+            set_active(FALSE);
+        }
+        // stdin only ends once; a FIFO gets the next writer
+        if (from_stdin)
+            break;
+        close(fd);
+    }
+    return NULL;
+}
+
+int stream_start(const char *path, int kind, const char *sink_path)
+{
+    if (running)
+        stream_stop();
+    pipePath = strdup(path);
+    sinkPath = (sink_path != NULL ? strdup(sink_path) : NULL);
+    if (pipePath == NULL || (sink_path != NULL && sinkPath == NULL))
+    {
+        free(pipePath);
+        free(sinkPath);
+        errno = ENOMEM;
+        return -1;
+    }
+    sinkKind = kind;
+    stop = FALSE;
+    errno = pthread_create(&streamThread, NULL, stream_thread, NULL);
+    if (errno != 0)
+    {
+        free(pipePath);
+        free(sinkPath);
+        return -1;
+    }
+    running = TRUE;
+    return 0;
+}
+
+void stream_stop(void)
+{
+    if (running == FALSE)
+        return;
+    pthread_mutex_lock(&streamMutex);
+    __atomic_store_n(&stop, TRUE, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&cardCond);
+    pthread_mutex_unlock(&streamMutex);
+    pthread_join(streamThread, NULL);
+    running = FALSE;
+    free(pipePath);
+    free(sinkPath);
+    pipePath = sinkPath = NULL;
+}
+
+int stream_active(void)
+{
+    return __atomic_load_n(&active, __ATOMIC_ACQUIRE);
+}
+
+int stream_wait(long ms)
+{
+    struct timespec ts;
+    int idle;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    pthread_mutex_lock(&streamMutex);
+    while (!(idle = (active == FALSE)))
+    {
+        if (pthread_cond_timedwait(&idleCond, &streamMutex, &ts) != 0)
+            break;
+    }
+    idle = (active == FALSE);
+    pthread_mutex_unlock(&streamMutex);
+    return idle;
+}
+
+int stream_claim_card(void)
+{
+    int claimed;
+
+    pthread_mutex_lock(&streamMutex);
+    claimed = (active == FALSE);
+    if (claimed)
+        cardHeld = TRUE;
+    pthread_mutex_unlock(&streamMutex);
+    return claimed;
+}
+
+void stream_release_card(void)
+{
+    pthread_mutex_lock(&streamMutex);
+    cardHeld = FALSE;
+    pthread_cond_broadcast(&cardCond);
+    pthread_mutex_unlock(&streamMutex);
+}
+
+void stream_get_stats(struct stream_stats *st)
+{
+    pthread_mutex_lock(&streamMutex);
+    *st = stats;
+    pthread_mutex_unlock(&streamMutex);
+}
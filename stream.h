@@ -0,0 +1,67 @@
+/*
+ * header file for stream.c
+ *
+ * Audio that isn't a file: announcements or speech from another program,
+ * written into a named pipe (or our stdin) while the songs play.  It is
+ * decoded as it comes with mpg123's feed API, so it can't be seeked in and
+ * nothing is written to disk.  The pipe is read a little at a time and
+ * only when the decoder wants more, so however fast the other program
+ * writes, it is held back by the pipe and we never hold more than a chunk
+ * or two of it.  While something is being streamed the player pauses the
+ * song (or turns it down, -duck) and carries on afterwards.
+ */
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdint.h>
+
+#define STREAM_CHUNK        4096          // read from the pipe at a time
+#define STREAM_MAX_BUFFERED (64 * 1024)   // most mpg123 should ever be holding, undecoded
+#define STREAM_HANDOFF_MS   2000          // longest a stream waits for the player to let go of the card
+
+struct stream_stats {
+	uint32_t streams;      // times something was streamed in
+	uint32_t failed;       // of those, how many weren't audio we could play
+	uint64_t bytes_in;
+	double audio_secs;     // played
+	long max_buffered;     // most bytes fed to mpg123 and not yet decoded
+};
+
+/*
+  Starts a thread playing whatever is written to path (a FIFO; "-" for
+  stdin) through a sink of kind (see sink.h; sink_path for SINK_WAV), each
+  time something opens it and writes to it.  The sound card has to have
+  been set up (ao_initialize()) first, and stay that way until stream_stop().
+  Returns 0 on success, -1 on failure (errno is set)
+*/
+int stream_start(const char *path, int kind, const char *sink_path);
+void stream_stop(void);
+// TRUE while something is being streamed in
+int stream_active(void);
+// Waits up to ms for the stream to finish; returns TRUE if nothing is streaming
+int stream_wait(long ms);
+
+/*
+  Plays one stream from fd until it ends (or stream_stop()).  Sinks other
+  than the sound card take it as fast as it comes unless realtime is set,
+  which holds it back to the speed it would play at.
+  Returns 0 on success, -1 on failure (errno is set; EINVAL if it wasn't
+  audio)
+*/
+int stream_play(int fd, int kind, const char *sink_path, int realtime);
+
+/*
+  For a sound card only one of us can have open at a time (hw:N without
+  dmix): the player takes the card before opening it and gives it back
+  once it's closed, and a stream waits for it to be given back before
+  opening it (for up to STREAM_HANDOFF_MS; then it tries anyway).
+  stream_claim_card() returns FALSE, and the player mustn't open the card,
+  while something is being streamed.
+*/
+int stream_claim_card(void);
+void stream_release_card(void);
+
+void stream_get_stats(struct stream_stats *st);
+
+#endif
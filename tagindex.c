@@ -0,0 +1,1016 @@
+/*
+ * tagindex.c
+ *
+ * Tag search index; see tagindex.h.
+ *
+ * Kept small enough for 100,000 songs on a 512MB board:
+ * - every string (artist/album/genre names and index words) is stored once,
+ *   packed into 64KB pool chunks, and referred to by a 32 bit id;
+ * - a song costs 12 bytes (its artist, album and genre ids) plus 4 bytes
+ *   for each different word in its tags and the last two parts of its path;
+ * - each word's song list is only ever appended to, in library order, so
+ *   it stays sorted without any work.
+ * Words are kept with the tag they came from ("a:beatles", "l:abbey") so
+ * artist: etc. are just a different prefix.  For prefix matching the words
+ * are sorted, but only when a search comes along after new words were added.
+ *
+ * The tags are also written to a cache file (a pathcache, with each
+ * song's size and time), so next time only new or changed songs are read.
+ * The file is loaded by the indexing thread, used for the first pass over
+ * the library and then freed; it's written again whenever the index has
+ * caught up with the library after reading some songs.
+ *
+ * Album order is a radix sort on a 64 bit key per song: where its album
+ * artist and album come in alphabetical order (22 bits each), then disc
+ * (8) and track (12).  Only songs with the same key (e.g. no tags at all)
+ * need comparing by name.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "lcd-mp3.h"
+#include "tagindex.h"
+#include "id3.h"
+#include "pathcache.h"
+#include "hash.h"
+
+#define POOL_CHUNK  (64 * 1024)
+#define CACHE_MAGIC "LCDT 1"
+#define RANK_BITS   22
+
+struct pool_chunk {
+    struct pool_chunk *next;
+    size_t used;
+    char text[POOL_CHUNK];
+};
+
+// Strings by id; open addressing on (id + 1), 0 is an empty slot
+struct strtab {
+    const char **str;
+    uint32_t n;
+    uint32_t cap;
+    uint32_t *slots;
+    uint32_t nslots;
+};
+
+// Songs a word appears in
+struct posting {
+    uint32_t *track;
+    uint32_t n;
+    uint32_t cap;
+};
+
+// What the tags of a song are; ids in values, 0 if it hasn't got that tag
+struct tagged {
+    uint32_t artist;
+    uint32_t album;
+    uint32_t album_artist;
+    uint32_t genre;
+    uint32_t mtime;     // for the cache
+    uint32_t size;
+    uint16_t track;
+    uint8_t disc;
+};
+
+// Album order sort entry
+struct order_key {
+    uint64_t key;
+    int track;
+};
+
+static struct library *lib;
+static pthread_t index_thread;
+static int index_thread_started = FALSE;
+static int running = FALSE;
+static pthread_mutex_t indexMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t moreCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t doneCond = PTHREAD_COND_INITIALIZER;
+static const char *cache_file = NULL;
+
+// The cache file as loaded, only used by the indexing thread.  Each song's
+// payload is disc, track, artist, album artist, album and genre.
+#define CACHE_FIELDS 6
+static struct pathcache cache;
+
+// Everything below is only touched with indexMutex held
+static int indexed = 0;
+static struct pool_chunk *pool = NULL;
+static struct strtab values;
+static struct strtab terms;
+static struct posting *postings = NULL;
+static uint32_t postings_cap = 0;
+static struct tagged *tracks = NULL;
+static uint32_t tracks_cap = 0;
+// Term ids in alphabetical order (the first sorted_n terms)
+static uint32_t *sorted = NULL;
+static uint32_t sorted_n = 0;
+// Artist ids in alphabetical order, as of when artists_for songs were indexed
+static uint32_t *artists = NULL;
+static uint32_t artists_n = 0;
+static int artists_for = -1;
+// Where each name comes in alphabetical order (for the first ranks_n names)
+static uint32_t *ranks = NULL;
+static uint32_t ranks_n = 0;
+static struct tagindex_stats stats;
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// realloc() that keeps count of how much the index has
+static void *grow(void *p, size_t old_size, size_t new_size)
+{
+    p = realloc(p, new_size);
+    if (p != NULL)
+        stats.bytes += new_size - old_size;
+    return p;
+}
+
+static const char *pool_add(const char *s, size_t len)
+{
+    struct pool_chunk *chunk = pool;
+    char *copy;
+
+    if (chunk == NULL || chunk->used + len + 1 > POOL_CHUNK)
+    {
+        chunk = grow(NULL, 0, sizeof(struct pool_chunk));
+        if (chunk == NULL)
+            return NULL;
+        chunk->next = pool;
+        chunk->used = 0;
+        pool = chunk;
+    }
+    copy = chunk->text + chunk->used;
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    chunk->used += len + 1;
+    return copy;
+}
+
+// Slot for s: either the one holding it or the empty one where it would go
+static uint32_t *slot_for(struct strtab *t, const char *s, size_t len)
+{
+    uint32_t i = hash_add(HASH_INIT, s, len) & (t->nslots - 1);
+    const char *str;
+
+    while (t->slots[i] != 0)
+    {
+        str = t->str[t->slots[i] - 1];
+        if (strncmp(str, s, len) == 0 && str[len] == '\0')
+            break;
+        i = (i + 1) & (t->nslots - 1);
+    }
+    return &t->slots[i];
+}
+
+// Returns s's id, or -1 if it isn't there
+static int64_t lookup(struct strtab *t, const char *s, size_t len)
+{
+    uint32_t *slot;
+
+    if (t->nslots == 0)
+        return -1;
+    slot = slot_for(t, s, len);
+    return (*slot == 0 ? -1 : (int64_t)*slot - 1);
+}
+
+// Returns s's id, adding it if need be; -1 if we're out of memory
+static int64_t intern(struct strtab *t, const char *s, size_t len)
+{
+    uint32_t *slot, *slots, nslots, i, j;
+    const char **str, *copy;
+
+    // Keep the table at most half full
+    if ((t->n + 1) * 2 > t->nslots)
+    {
+        nslots = (t->nslots ? t->nslots * 2 : 256);
+        slots = grow(NULL, 0, nslots * sizeof(uint32_t));
+        if (slots == NULL)
+            return -1;
+        memset(slots, 0, nslots * sizeof(uint32_t));
+        for (i = 0; i < t->n; i++)
+        {
+            j = hash_add(HASH_INIT, t->str[i], strlen(t->str[i])) & (nslots - 1);
+            while (slots[j] != 0)
+                j = (j + 1) & (nslots - 1);
+            slots[j] = i + 1;
+        }
+        stats.bytes -= t->nslots * sizeof(uint32_t);
+        free(t->slots);
+        t->slots = slots;
+        t->nslots = nslots;
+    }
+    slot = slot_for(t, s, len);
+    if (*slot != 0)
+        return *slot - 1;
+    if (t->n == t->cap)
+    {
+        str = grow(t->str, t->cap * sizeof(char *), (t->cap ? t->cap * 2 : 256) * sizeof(char *));
+        if (str == NULL)
+            return -1;
+        t->str = str;
+        t->cap = (t->cap ? t->cap * 2 : 256);
+    }
+    copy = pool_add(s, len);
+    if (copy == NULL)
+        return -1;
+    t->str[t->n] = copy;
+    *slot = t->n + 1;
+    return t->n++;
+}
+
+static void strtab_free(struct strtab *t)
+{
+    free(t->str);
+    free(t->slots);
+    memset(t, 0, sizeof(struct strtab));
+}
+
+// Adds song track to the list for word (with the tag letter in front)
+static int add_term(char tag, const char *word, size_t len, uint32_t track)
+{
+    char key[TAGINDEX_WORD + 2];
+    struct posting *p;
+    uint32_t *list, cap;
+    int64_t id;
+
+    key[0] = tag;
+    key[1] = ':';
+    if (len > TAGINDEX_WORD)
+        len = TAGINDEX_WORD;
+    memcpy(key + 2, word, len);
+    id = intern(&terms, key, len + 2);
+    if (id < 0)
+        return -1;
+    if (id >= postings_cap)
+    {
+        cap = terms.cap;
+        p = grow(postings, postings_cap * sizeof(struct posting), cap * sizeof(struct posting));
+        if (p == NULL)
+            return -1;
+        memset(p + postings_cap, 0, (cap - postings_cap) * sizeof(struct posting));
+        postings = p;
+        postings_cap = cap;
+    }
+    p = &postings[id];
+    // Already there (the word is in the tags twice)
+    if (p->n > 0 && p->track[p->n - 1] == track)
+        return 0;
+    if (p->n == p->cap)
+    {
+        cap = (p->cap ? p->cap * 2 : 2);
+        list = grow(p->track, p->cap * sizeof(uint32_t), cap * sizeof(uint32_t));
+        if (list == NULL)
+            return -1;
+        p->track = list;
+        p->cap = cap;
+    }
+    p->track[p->n++] = track;
+    stats.postings++;
+    return 0;
+}
+
+/*
+  Splits text into words and calls fn on each one, lower case.  Words are
+  runs of letters and digits; anything that isn't ASCII counts as a letter
+  so UTF-8 names stay in one piece.
+*/
+static int split_words(const char *text, size_t len, size_t min_len,
+                       int (*fn)(const char *word, size_t len, void *arg), void *arg)
+{
+    char word[TAGINDEX_WORD];
+    size_t i, n = 0;
+    unsigned char c;
+
+    for (i = 0; i <= len; i++)
+    {
+        c = (i < len ? (unsigned char)text[i] : ' ');
+        if (c >= 0x80 || (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+        {
+            if (n < TAGINDEX_WORD)
+                word[n++] = (c >= 'A' && c <= 'Z' ? c + 'a' - 'A' : c);
+        }
+        else
+        {
+            if (n >= min_len && fn(word, n, arg) != 0)
+                return -1;
+            n = 0;
+        }
+    }
+    return 0;
+}
+
+struct add_arg {
+    char tag;
+    uint32_t track;
+};
+
+static int add_word(const char *word, size_t len, void *arg)
+{
+    struct add_arg *a = arg;
+
+    return add_term(a->tag, word, len, a->track);
+}
+
+static int add_words(char tag, const char *text, size_t len, uint32_t track)
+{
+    struct add_arg a = { tag, track };
+
+    // One letter words would be in half the library
+    return split_words(text, len, 2, add_word, &a);
+}
+
+static int add_track(uint32_t track, const struct id3_tags *tags, const char *path, const struct stat *st)
+{
+    struct tagged *t;
+    const char *start, *end;
+    int64_t artist, album, album_artist, genre;
+    uint32_t cap;
+    int slashes = 0;
+
+    if (track >= tracks_cap)
+    {
+        cap = (tracks_cap ? tracks_cap * 2 : 1024);
+        while (cap <= track)
+            cap *= 2;
+        t = grow(tracks, tracks_cap * sizeof(struct tagged), cap * sizeof(struct tagged));
+        if (t == NULL)
+            return -1;
+        tracks = t;
+        tracks_cap = cap;
+    }
+    artist = intern(&values, tags->artist, strlen(tags->artist));
+    album = intern(&values, tags->album, strlen(tags->album));
+    album_artist = intern(&values, tags->album_artist, strlen(tags->album_artist));
+    genre = intern(&values, tags->genre, strlen(tags->genre));
+    if (artist < 0 || album < 0 || album_artist < 0 || genre < 0)
+        return -1;
+    t = &tracks[track];
+    t->artist = artist;
+    t->album = album;
+    t->album_artist = album_artist;
+    t->genre = genre;
+    t->mtime = st->st_mtime;
+    t->size = st->st_size;
+    t->disc = (tags->disc > 0 && tags->disc < 255 ? tags->disc : (tags->disc > 0 ? 255 : 0));
+    t->track = (tags->track > 0 && tags->track < 4095 ? tags->track : (tags->track > 0 ? 4095 : 0));
+    // Only the directory the song is in and its own name; the rest of the
+    // path is the same for every song.
+    for (start = path + strlen(path); start > path; start--)
+    {
+        if (start[-1] == '/' && ++slashes == 2)
+            break;
+    }
+    end = strrchr(path, '.');
+    if (end == NULL || end < start)
+        end = path + strlen(path);
+    if (add_words('a', tags->artist, strlen(tags->artist), track) != 0 ||
+        add_words('l', tags->album, strlen(tags->album), track) != 0 ||
+        add_words('g', tags->genre, strlen(tags->genre), track) != 0 ||
+        add_words('p', start, end - start, track) != 0)
+        return -1;
+    return 0;
+}
+
+/*
+ * Cache file
+ */
+// Returns 0 if the cache has tags for path and the file hasn't changed since
+static int cache_get(const char *path, const struct stat *st, struct id3_tags *tags)
+{
+    char buf[CACHE_FIELDS * ID3_FIELD], *field[CACHE_FIELDS], *p;
+    const char *payload = pathcache_get(&cache, path, st);
+    int i;
+
+    if (payload == NULL)
+        return -1;
+    snprintf(buf, sizeof(buf), "%s", payload);
+    for (i = 0, p = buf; i < CACHE_FIELDS; i++)
+    {
+        field[i] = p;
+        p = strchr(p, '\t');
+        if (p != NULL)
+            *p++ = '\0';
+        else if (i < CACHE_FIELDS - 1)
+            return -1;
+    }
+    memset(tags, 0, sizeof(struct id3_tags));
+    tags->disc = atoi(field[0]);
+    tags->track = atoi(field[1]);
+    snprintf(tags->artist, ID3_FIELD, "%s", field[2]);
+    snprintf(tags->album_artist, ID3_FIELD, "%s", field[3]);
+    snprintf(tags->album, ID3_FIELD, "%s", field[4]);
+    snprintf(tags->genre, ID3_FIELD, "%s", field[5]);
+    return 0;
+}
+
+// Tabs and new lines would break up the line
+static size_t cache_field(char *buf, size_t len, const char *s, char end)
+{
+    size_t n = 0;
+
+    for (; *s && n + 2 < len; s++)
+        buf[n++] = (*s == '\t' || *s == '\n' || *s == '\r' ? ' ' : *s);
+    buf[n++] = end;
+    buf[n] = '\0';
+    return n;
+}
+
+/*
+  Writes every song indexed so far.  Only the indexing thread changes the
+  index, so it can do this without holding the lock.
+*/
+static void cache_save(const char *file)
+{
+    char payload[CACHE_FIELDS * ID3_FIELD];
+    struct pathcache out;
+    struct tagged *t;
+    size_t n;
+    int i;
+
+    pathcache_init(&out, CACHE_MAGIC, CACHE_FIELDS);
+    for (i = 0; i < indexed; i++)
+    {
+        t = &tracks[i];
+        n = snprintf(payload, sizeof(payload), "%u\t%u\t", t->disc, t->track);
+        n += cache_field(payload + n, sizeof(payload) - n, values.str[t->artist], '\t');
+        n += cache_field(payload + n, sizeof(payload) - n, values.str[t->album_artist], '\t');
+        n += cache_field(payload + n, sizeof(payload) - n, values.str[t->album], '\t');
+        cache_field(payload + n, sizeof(payload) - n, values.str[t->genre], '\0');
+        if (pathcache_put(&out, library_get(lib, i)->path, t->mtime, t->size, payload) != 0)
+            break;
+    }
+    if (pathcache_save(&out, file, NULL) != 0)
+        fprintf(stderr, "[%s - %d]: Cannot write tag cache %s: %s\n", __FILE__, __LINE__, file, strerror(errno));
+    pathcache_free(&out);
+}
+
+/*
+ * Indexing thread
+ */
+static void *index_songs(void *arg)
+{
+    struct id3_tags tags;
+    struct lib_track *track;
+    struct stat st;
+    uint64_t t0, t1;
+    int i, hit, dirty = FALSE;
+
+    pathcache_init(&cache, CACHE_MAGIC, CACHE_FIELDS);
+    if (cache_file != NULL)
+        pathcache_load(&cache, cache_file);
+    pthread_mutex_lock(&indexMutex);
+    while (running == TRUE)
+    {
+        if (indexed >= library_count(lib))
+        {
+            pthread_cond_broadcast(&doneCond);
+            // Songs have gone since the cache was written
+            if (cache.cap > 0 && cache.n != stats.cache_hits)
+                dirty = TRUE;
+            pathcache_free(&cache);
+            if (dirty == TRUE && cache_file != NULL)
+            {
+                dirty = FALSE;
+                pthread_mutex_unlock(&indexMutex);
+                cache_save(cache_file);
+                pthread_mutex_lock(&indexMutex);
+            }
+            else
+                pthread_cond_wait(&moreCond, &indexMutex);
+            continue;
+        }
+        i = indexed;
+        pthread_mutex_unlock(&indexMutex);
+        t0 = now_us();
+        track = library_get(lib, i);
+        hit = FALSE;
+        // Songs we can't read (or that are gone) just have no tags
+        if (stat(track->path, &st) != 0)
+        {
+            memset(&st, 0, sizeof(st));
+            memset(&tags, 0, sizeof(tags));
+        }
+        else if (cache_get(track->path, &st, &tags) == 0)
+            hit = TRUE;
+        else
+        {
+            id3_read(track->path, &tags);
+            dirty = TRUE;
+        }
+        t1 = now_us();
+        pthread_mutex_lock(&indexMutex);
+        if (add_track(i, &tags, track->path, &st) != 0)
+        {
+            fprintf(stderr, "[%s - %d]: Out of memory; only the first %d songs can be searched\n", __FILE__, __LINE__, i);
+            break;
+        }
+        indexed++;
+        if (hit == TRUE)
+            stats.cache_hits++;
+        stats.read_us += t1 - t0;
+        stats.index_us += now_us() - t1;
+    }
+    pathcache_free(&cache);
+    running = FALSE;
+    pthread_cond_broadcast(&doneCond);
+    pthread_mutex_unlock(&indexMutex);
+    return NULL;
+}
+
+int tagindex_start(struct library *library, const char *cache)
+{
+    int err;
+
+    lib = library;
+    cache_file = cache;
+    memset(&stats, 0, sizeof(stats));
+    // Id 0 is "no tag"
+    if (intern(&values, "", 0) != 0)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    running = TRUE;
+    err = pthread_create(&index_thread, NULL, index_songs, NULL);
+    if (err != 0)
+    {
+        running = FALSE;
+        tagindex_stop();
+        errno = err;
+        return -1;
+    }
+    __atomic_store_n(&index_thread_started, TRUE, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void tagindex_stop(void)
+{
+    struct pool_chunk *chunk;
+    uint32_t i;
+
+    pthread_mutex_lock(&indexMutex);
+    running = FALSE;
+    pthread_cond_signal(&moreCond);
+    pthread_mutex_unlock(&indexMutex);
+    if (__atomic_exchange_n(&index_thread_started, FALSE, __ATOMIC_ACQ_REL) == TRUE)
+        pthread_join(index_thread, NULL);
+    // Searches from other threads may still be coming in
+    pthread_mutex_lock(&indexMutex);
+    while (pool != NULL)
+    {
+        chunk = pool->next;
+        free(pool);
+        pool = chunk;
+    }
+    for (i = 0; i < postings_cap; i++)
+        free(postings[i].track);
+    free(postings);
+    free(tracks);
+    free(sorted);
+    free(artists);
+    free(ranks);
+    strtab_free(&values);
+    strtab_free(&terms);
+    postings = NULL;
+    tracks = NULL;
+    sorted = artists = ranks = NULL;
+    postings_cap = tracks_cap = sorted_n = artists_n = ranks_n = 0;
+    artists_for = -1;
+    indexed = 0;
+    pthread_mutex_unlock(&indexMutex);
+}
+
+void tagindex_update(void)
+{
+    pthread_mutex_lock(&indexMutex);
+    pthread_cond_signal(&moreCond);
+    pthread_mutex_unlock(&indexMutex);
+}
+
+void tagindex_wait(void)
+{
+    pthread_mutex_lock(&indexMutex);
+    while (running == TRUE && indexed < library_count(lib))
+        pthread_cond_wait(&doneCond, &indexMutex);
+    pthread_mutex_unlock(&indexMutex);
+}
+
+static int by_term(const void *a, const void *b)
+{
+    return strcmp(terms.str[*(const uint32_t *)a], terms.str[*(const uint32_t *)b]);
+}
+
+static int by_value(const void *a, const void *b)
+{
+    return strcasecmp(values.str[*(const uint32_t *)a], values.str[*(const uint32_t *)b]);
+}
+
+static int sort_terms(void)
+{
+    uint32_t *s, i;
+
+    if (sorted_n == terms.n)
+        return 0;
+    s = grow(sorted, sorted_n * sizeof(uint32_t), terms.n * sizeof(uint32_t));
+    if (s == NULL)
+        return -1;
+    sorted = s;
+    for (i = 0; i < terms.n; i++)
+        sorted[i] = i;
+    sorted_n = terms.n;
+    qsort(sorted, sorted_n, sizeof(uint32_t), by_term);
+    return 0;
+}
+
+struct match_arg {
+    const char *tags;    // tag letters to look in
+    unsigned char *all;  // songs that matched every word so far
+    unsigned char *hit;  // songs that match this word
+    size_t bytes;
+    int words;
+};
+
+// Marks the songs of every word starting with prefix
+static void mark(const char *prefix, size_t len, unsigned char *hit)
+{
+    uint32_t lo = 0, hi = sorted_n, mid, i;
+    struct posting *p;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if (strncmp(terms.str[sorted[mid]], prefix, len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (; lo < sorted_n && strncmp(terms.str[sorted[lo]], prefix, len) == 0; lo++)
+    {
+        p = &postings[sorted[lo]];
+        for (i = 0; i < p->n; i++)
+            hit[p->track[i] >> 3] |= 1 << (p->track[i] & 7);
+    }
+}
+
+static int match_word(const char *word, size_t len, void *arg)
+{
+    struct match_arg *m = arg;
+    char prefix[TAGINDEX_WORD + 2];
+    const char *tag;
+    size_t i;
+
+    memset(m->hit, 0, m->bytes);
+    prefix[1] = ':';
+    memcpy(prefix + 2, word, len);
+    for (tag = m->tags; *tag; tag++)
+    {
+        prefix[0] = *tag;
+        mark(prefix, len + 2, m->hit);
+    }
+    if (m->words++ == 0)
+        memcpy(m->all, m->hit, m->bytes);
+    else
+    {
+        for (i = 0; i < m->bytes; i++)
+            m->all[i] &= m->hit[i];
+    }
+    return 0;
+}
+
+// The songs with a bit set in found, without removed ones
+static int collect(const unsigned char *found, int **result)
+{
+    int i, n = 0, *list;
+
+    list = malloc((indexed ? indexed : 1) * sizeof(int));
+    if (list == NULL)
+        return -1;
+    for (i = 0; i < indexed; i++)
+    {
+        if ((found[i >> 3] & (1 << (i & 7))) && library_removed(library_get(lib, i)) == FALSE)
+            list[n++] = i;
+    }
+    *result = list;
+    return n;
+}
+
+int tagindex_search(const char *query, int **result)
+{
+    static const struct {
+        const char *name;
+        const char *tags;
+    } fields[] = {
+        { "artist:", "a" },
+        { "album:",  "l" },
+        { "genre:",  "g" },
+        { "path:",   "p" },
+    };
+    struct match_arg m;
+    const char *word, *end;
+    size_t i;
+    int n = -1;
+
+    pthread_mutex_lock(&indexMutex);
+    m.words = 0;
+    m.bytes = (indexed + 7) / 8 + 1;
+    m.all = calloc(1, m.bytes);
+    m.hit = malloc(m.bytes);
+    if (m.all == NULL || m.hit == NULL || sort_terms() != 0)
+        goto out;
+    for (word = query; *word; word = end)
+    {
+        while (*word == ' ')
+            word++;
+        for (end = word; *end && *end != ' '; end++)
+            ;
+        m.tags = "alpg";
+        for (i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+        {
+            if (strncasecmp(word, fields[i].name, strlen(fields[i].name)) == 0)
+            {
+                m.tags = fields[i].tags;
+                word += strlen(fields[i].name);
+                break;
+            }
+        }
+        split_words(word, end - word, 1, match_word, &m);
+    }
+    // Nothing to look for matches nothing
+    if (m.words == 0)
+        memset(m.all, 0, m.bytes);
+    n = collect(m.all, result);
+out:
+    pthread_mutex_unlock(&indexMutex);
+    free(m.all);
+    free(m.hit);
+    if (n < 0)
+        errno = ENOMEM;
+    return n;
+}
+
+int tagindex_by_artist(const char *artist, int **result)
+{
+    unsigned char *found;
+    int64_t id;
+    int i, n = -1;
+
+    pthread_mutex_lock(&indexMutex);
+    found = calloc(1, (indexed + 7) / 8 + 1);
+    if (found != NULL)
+    {
+        id = lookup(&values, artist, strlen(artist));
+        for (i = 0; id >= 0 && i < indexed; i++)
+        {
+            if (tracks[i].artist == id)
+                found[i >> 3] |= 1 << (i & 7);
+        }
+        n = collect(found, result);
+    }
+    pthread_mutex_unlock(&indexMutex);
+    free(found);
+    if (n < 0)
+        errno = ENOMEM;
+    return n;
+}
+
+// Rebuild the list of artists if more songs have been indexed since
+static int sort_artists(void)
+{
+    unsigned char *seen;
+    uint32_t *a;
+    int i;
+
+    if (artists_for == indexed)
+        return 0;
+    seen = calloc(1, values.n / 8 + 1);
+    a = grow(artists, artists_n * sizeof(uint32_t), values.n * sizeof(uint32_t));
+    if (seen == NULL || a == NULL)
+    {
+        free(seen);
+        return -1;
+    }
+    artists = a;
+    artists_n = 0;
+    for (i = 0; i < indexed; i++)
+    {
+        // Leave out songs without an artist
+        if (tracks[i].artist != 0 && !(seen[tracks[i].artist >> 3] & (1 << (tracks[i].artist & 7))))
+        {
+            seen[tracks[i].artist >> 3] |= 1 << (tracks[i].artist & 7);
+            artists[artists_n++] = tracks[i].artist;
+        }
+    }
+    free(seen);
+    qsort(artists, artists_n, sizeof(uint32_t), by_value);
+    artists_for = indexed;
+    return 0;
+}
+
+int tagindex_artist(int n, char *buf, size_t len)
+{
+    int ret = -1;
+
+    pthread_mutex_lock(&indexMutex);
+    if (sort_artists() == 0 && n >= 0 && (uint32_t)n < artists_n)
+    {
+        snprintf(buf, len, "%s", values.str[artists[n]]);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&indexMutex);
+    return ret;
+}
+
+int tagindex_path(int track, char *buf, size_t len)
+{
+    int ret = -1;
+
+    pthread_mutex_lock(&indexMutex);
+    if (track >= 0 && track < indexed)
+    {
+        snprintf(buf, len, "%s", library_get(lib, track)->path);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&indexMutex);
+    return ret;
+}
+
+/*
+ * Album order
+ */
+// Like strcasecmp, but runs of digits compare as numbers ("2 x" < "10 x")
+static int natural_cmp(const char *a, const char *b)
+{
+    size_t la, lb;
+    int c;
+
+    while (*a && *b)
+    {
+        if (isdigit((unsigned char)*a) && isdigit((unsigned char)*b))
+        {
+            while (*a == '0')
+                a++;
+            while (*b == '0')
+                b++;
+            for (la = 0; isdigit((unsigned char)a[la]); la++)
+                ;
+            for (lb = 0; isdigit((unsigned char)b[lb]); lb++)
+                ;
+            if (la != lb)
+                return (la < lb ? -1 : 1);
+            c = strncmp(a, b, la);
+            if (c != 0)
+                return c;
+            a += la;
+            b += lb;
+        }
+        else
+        {
+            c = tolower((unsigned char)*a) - tolower((unsigned char)*b);
+            if (c != 0)
+                return c;
+            a++;
+            b++;
+        }
+    }
+    return (unsigned char)*a - (unsigned char)*b;
+}
+
+static int by_path(const void *a, const void *b)
+{
+    return natural_cmp(library_get(lib, ((const struct order_key *)a)->track)->path,
+                       library_get(lib, ((const struct order_key *)b)->track)->path);
+}
+
+// Where every name comes in alphabetical order
+static int rank_values(void)
+{
+    uint32_t *r, *ids, i;
+
+    if (ranks_n == values.n)
+        return 0;
+    ids = malloc(values.n * sizeof(uint32_t));
+    r = grow(ranks, ranks_n * sizeof(uint32_t), values.n * sizeof(uint32_t));
+    if (ids == NULL || r == NULL)
+    {
+        free(ids);
+        return -1;
+    }
+    ranks = r;
+    for (i = 0; i < values.n; i++)
+        ids[i] = i;
+    qsort(ids, values.n, sizeof(uint32_t), by_value);
+    for (i = 0; i < values.n; i++)
+        ranks[ids[i]] = (i < (1u << RANK_BITS) ? i : (1u << RANK_BITS) - 1);
+    ranks_n = values.n;
+    free(ids);
+    return 0;
+}
+
+/*
+  LSD radix sort a byte at a time, skipping bytes that are the same in every
+  key.  Returns whichever of keys and tmp the result ended up in.
+*/
+static struct order_key *radix_sort(struct order_key *keys, struct order_key *tmp, int n)
+{
+    static uint32_t count[8][256];
+    struct order_key *swap;
+    uint32_t sum, c;
+    int i, b, k;
+
+    memset(count, 0, sizeof(count));
+    for (i = 0; i < n; i++)
+    {
+        for (b = 0; b < 8; b++)
+            count[b][(keys[i].key >> (b * 8)) & 0xff]++;
+    }
+    for (b = 0; b < 8; b++)
+    {
+        if (count[b][(keys[0].key >> (b * 8)) & 0xff] == (uint32_t)n)
+            continue;
+        for (k = 0, sum = 0; k < 256; k++)
+        {
+            c = count[b][k];
+            count[b][k] = sum;
+            sum += c;
+        }
+        for (i = 0; i < n; i++)
+            tmp[count[b][(keys[i].key >> (b * 8)) & 0xff]++] = keys[i];
+        swap = keys;
+        keys = tmp;
+        tmp = swap;
+    }
+    return keys;
+}
+
+int tagindex_album_order(int *list, int n)
+{
+    struct order_key *keys, *sorted_keys;
+    struct tagged *t;
+    uint32_t artist;
+    int i, j, ret = -1;
+
+    if (n < 2)
+        return 0;
+    keys = malloc(2 * n * sizeof(struct order_key));
+    if (keys == NULL)
+        return -1;
+    pthread_mutex_lock(&indexMutex);
+    if (rank_values() != 0)
+        goto out;
+    for (i = 0; i < n; i++)
+    {
+        keys[i].track = list[i];
+        // Songs not indexed yet go last, in the order they came
+        keys[i].key = UINT64_MAX;
+        if (list[i] >= 0 && list[i] < indexed)
+        {
+            t = &tracks[list[i]];
+            artist = (t->album_artist != 0 ? t->album_artist : t->artist);
+            keys[i].key = (uint64_t)ranks[artist] << (64 - RANK_BITS) |
+                          (uint64_t)ranks[t->album] << (64 - 2 * RANK_BITS) |
+                          (uint64_t)t->disc << 12 | t->track;
+        }
+    }
+    sorted_keys = radix_sort(keys, keys + n, n);
+    // Same album, disc and track (usually no tags at all): by file name
+    for (i = 0; i < n; i = j)
+    {
+        for (j = i + 1; j < n && sorted_keys[j].key == sorted_keys[i].key; j++)
+            ;
+        if (j - i > 1 && sorted_keys[i].key != UINT64_MAX)
+            qsort(sorted_keys + i, j - i, sizeof(struct order_key), by_path);
+    }
+    for (i = 0; i < n; i++)
+        list[i] = sorted_keys[i].track;
+    ret = 0;
+out:
+    pthread_mutex_unlock(&indexMutex);
+    free(keys);
+    if (ret != 0)
+        errno = ENOMEM;
+    return ret;
+}
+
+void tagindex_get_stats(struct tagindex_stats *st)
+{
+    pthread_mutex_lock(&indexMutex);
+    *st = stats;
+    st->tracks = indexed;
+    st->values = values.n;
+    st->terms = terms.n;
+    pthread_mutex_unlock(&indexMutex);
+}
@@ -0,0 +1,78 @@
+/*
+ * header file for tagindex.c
+ *
+ * Search the library by artist, album, genre or file name.
+ *
+ * A thread reads the tags of every song in the library (and of songs
+ * added later, after tagindex_update()) into an inverted index: each word
+ * points to the songs it appears in.  Searching is a prefix match on every
+ * word of the query, e.g. "artist:beat abbey" finds songs by an artist with
+ * a word starting "beat" that also have a word starting "abbey" somewhere.
+ * Searches see whatever has been indexed so far.
+ */
+
+#ifndef TAGINDEX_H
+#define TAGINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "library.h"
+
+#define TAGINDEX_WORD  64 // longer words are cut short
+#define TAGINDEX_CACHE "/var/lib/lcd-mp3/tags"
+
+struct tagindex_stats {
+	uint32_t tracks;      // songs indexed so far
+	uint32_t values;      // different artist/album/genre names
+	uint32_t terms;       // different words
+	uint32_t postings;    // (word, song) pairs
+	uint32_t cache_hits;  // songs whose tags came from the cache file
+	uint64_t bytes;       // memory the index has allocated
+	uint64_t read_us;     // time spent reading tags
+	uint64_t index_us;    // time spent adding them to the index
+};
+
+/*
+  Starts indexing lib in the background, taking the tags of songs that
+  haven't changed from the cache file (NULL for none) and writing it back
+  once done.  lib must not be freed before tagindex_stop(), which also
+  frees the index.
+  Returns 0 on success, -1 on failure (errno is set)
+*/
+int tagindex_start(struct library *lib, const char *cache);
+void tagindex_stop(void);
+// The library has gained songs
+void tagindex_update(void);
+// Blocks until every song in the library has been indexed
+void tagindex_wait(void);
+
+/*
+  Sets *tracks to a malloc()ed array of the library indices (in library
+  order) of the songs matching query, leaving out removed songs.
+  Words can be limited to one tag with artist:, album:, genre: or path:.
+  Returns how many there are, or -1 on failure (errno is set)
+*/
+int tagindex_search(const char *query, int **tracks);
+// Same, for songs whose artist is exactly artist
+int tagindex_by_artist(const char *artist, int **tracks);
+// The n'th artist in alphabetical order; returns -1 if there aren't that many
+int tagindex_artist(int n, char *buf, size_t len);
+/*
+  Copies the path of library song track (as found by a search) to buf.
+  Safe from any thread, even if the library is being swapped; returns -1
+  if the song is no longer there.
+*/
+int tagindex_path(int track, char *buf, size_t len);
+
+/*
+  Sorts the n library indices in tracks into album order: album artist (or
+  artist), album, disc and track number, then file name.  Songs that haven't
+  been indexed yet go last.
+  Returns 0 on success, -1 on failure (errno is set)
+*/
+int tagindex_album_order(int *tracks, int n);
+
+void tagindex_get_stats(struct tagindex_stats *st);
+
+#endif
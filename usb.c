@@ -0,0 +1,232 @@
+/*
+ * usb.c
+ *
+ * USB stick hot-plugging.
+ *
+ * A thread listens for kernel uevents on a netlink socket.  When a block
+ * device whose name starts with the prefix we were given shows up, it tries
+ * to mount it read-only and hands a new (empty) library to the main loop
+ * with an atomic pointer swap; the main loop reads the songs into it
+ * (scan.h) while the first ones are already playing.  When that device goes away it
+ * is lazily unmounted (so anything still reading from it just gets errors)
+ * and an empty library is handed over instead.
+ *
+ * Sticks already plugged in when we start are found through /sys/class/block.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <limits.h>
+#include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/mount.h>
+#include <linux/netlink.h>
+
+#include "lcd-mp3.h"
+#include "usb.h"
+
+#define UEVENT_LEN 4096
+
+// Whatever the stick might be formatted with
+static const char *fs_types[] = { "vfat", "exfat", "ext4", NULL };
+
+static pthread_t usb_thread;
+static int running = FALSE;
+static int nl_fd = -1;
+static char dev_prefix[32];
+static char mount_dir[PATH_MAX];
+static char mounted_dev[64]; // usb thread only
+static int mounted = FALSE;
+static struct library *pending = NULL;
+
+static void publish(struct library *lib)
+{
+    struct library *old;
+
+    old = __atomic_exchange_n(&pending, lib, __ATOMIC_ACQ_REL);
+    // The main loop never got to the last one
+    if (old != NULL)
+    {
+        library_free(old);
+        free(old);
+    }
+}
+
+static void stick_in(const char *dev)
+{
+    struct library *lib;
+    char node[PATH_MAX];
+    int i;
+
+    if (__atomic_load_n(&mounted, __ATOMIC_RELAXED) == TRUE)
+        return;
+    snprintf(node, sizeof(node), "/dev/%s", dev);
+    for (i = 0; fs_types[i] != NULL; i++)
+    {
+        if (mount(node, mount_dir, fs_types[i], MS_RDONLY | MS_SILENT, "") == 0)
+            break;
+        // EBUSY means something is already mounted there; use that
+        if (errno == EBUSY)
+            break;
+    }
+    // A whole disk with partitions on it, or not a filesystem we know
+    if (fs_types[i] == NULL)
+        return;
+    snprintf(mounted_dev, sizeof(mounted_dev), "%s", dev);
+    __atomic_store_n(&mounted, TRUE, __ATOMIC_RELEASE);
+    lib = malloc(sizeof(struct library));
+    if (lib == NULL)
+    {
+        perror("malloc: stick_in");
+        return;
+    }
+    library_init(lib);
+    publish(lib);
+}
+
+static void stick_out(const char *dev)
+{
+    struct library *lib;
+
+    if (__atomic_load_n(&mounted, __ATOMIC_RELAXED) == FALSE || strcmp(dev, mounted_dev) != 0)
+        return;
+    umount2(mount_dir, MNT_DETACH);
+    __atomic_store_n(&mounted, FALSE, __ATOMIC_RELEASE);
+    lib = malloc(sizeof(struct library));
+    if (lib == NULL)
+    {
+        perror("malloc: stick_out");
+        return;
+    }
+    library_init(lib);
+    publish(lib);
+}
+
+// "add@/devices/...\0ACTION=add\0SUBSYSTEM=block\0DEVNAME=sda1\0..."
+static void uevent(char *buf, int len)
+{
+    const char *action = NULL, *subsystem = NULL, *devname = NULL;
+    char *p;
+
+    for (p = buf; p < buf + len; p += strlen(p) + 1)
+    {
+        if (strncmp(p, "ACTION=", 7) == 0)
+            action = p + 7;
+        else if (strncmp(p, "SUBSYSTEM=", 10) == 0)
+            subsystem = p + 10;
+        else if (strncmp(p, "DEVNAME=", 8) == 0)
+            devname = p + 8;
+    }
+    if (action == NULL || subsystem == NULL || devname == NULL)
+        return;
+    if (strcmp(subsystem, "block") != 0 || strncmp(devname, dev_prefix, strlen(dev_prefix)) != 0)
+        return;
+    if (strcmp(action, "add") == 0)
+        stick_in(devname);
+    else if (strcmp(action, "remove") == 0)
+        stick_out(devname);
+}
+
+// Anything that was plugged in before we started
+static void coldplug(void)
+{
+    DIR *d;
+    struct dirent *dir;
+
+    d = opendir("/sys/class/block");
+    if (!d)
+        return;
+    while ((dir = readdir(d)) != NULL && __atomic_load_n(&mounted, __ATOMIC_RELAXED) == FALSE)
+    {
+        if (strncmp(dir->d_name, dev_prefix, strlen(dev_prefix)) == 0)
+            stick_in(dir->d_name);
+    }
+    closedir(d);
+}
+
+static void *usb_loop(void *arg)
+{
+    char buf[UEVENT_LEN];
+    struct pollfd pfd;
+    ssize_t len;
+
+    pfd.fd = nl_fd;
+    pfd.events = POLLIN;
+    while (__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+    {
+        // Wake up now and then to see if we should stop
+        if (poll(&pfd, 1, 500) <= 0)
+            continue;
+        len = recv(nl_fd, buf, sizeof(buf) - 1, 0);
+        if (len <= 0)
+            continue;
+        buf[len] = '\0';
+        uevent(buf, len);
+    }
+    return NULL;
+}
+
+int usb_start(const char *prefix, const char *mount_point)
+{
+    struct sockaddr_nl addr;
+
+    snprintf(dev_prefix, sizeof(dev_prefix), "%s", prefix);
+    snprintf(mount_dir, sizeof(mount_dir), "%s", mount_point);
+    nl_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (nl_fd < 0)
+        return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_pid = 0;
+    addr.nl_groups = 1; // kernel events
+    if (bind(nl_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(nl_fd);
+        nl_fd = -1;
+        return -1;
+    }
+    // Before the thread starts so the caller has the first library straight away
+    coldplug();
+    running = TRUE;
+    errno = pthread_create(&usb_thread, NULL, usb_loop, NULL);
+    if (errno != 0)
+    {
+        running = FALSE;
+        close(nl_fd);
+        nl_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void usb_stop(void)
+{
+    if (__atomic_load_n(&running, __ATOMIC_ACQUIRE) == FALSE)
+        return;
+    __atomic_store_n(&running, FALSE, __ATOMIC_RELEASE);
+    pthread_join(usb_thread, NULL);
+    close(nl_fd);
+    nl_fd = -1;
+}
+
+int usb_changed(void)
+{
+    return (__atomic_load_n(&pending, __ATOMIC_ACQUIRE) != NULL);
+}
+
+struct library *usb_take_library(void)
+{
+    if (__atomic_load_n(&pending, __ATOMIC_RELAXED) == NULL)
+        return NULL;
+    return __atomic_exchange_n(&pending, NULL, __ATOMIC_ACQ_REL);
+}
+
+int usb_mounted(void)
+{
+    return __atomic_load_n(&mounted, __ATOMIC_ACQUIRE);
+}
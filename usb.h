@@ -0,0 +1,33 @@
+/*
+ * header file for usb.c
+ *
+ * Watches for USB sticks going in and out (kernel uevents over netlink)
+ * and mounts them read-only.
+ */
+
+#ifndef USB_H
+#define USB_H
+
+#include "library.h"
+
+#define USB_DEVICE "sd" // block devices to look at (e.g. "loop" to test with an image)
+
+/*
+  Starts the watcher thread; sticks get mounted on mount_point.
+  Returns 0 on success, -1 on failure (errno is set)
+*/
+int usb_start(const char *dev_prefix, const char *mount_point);
+void usb_stop(void);
+
+// TRUE if there's a new library waiting (a stick went in or came out)
+int usb_changed(void);
+/*
+  Hands over a new, empty library, or NULL if nothing has changed.  If
+  usb_mounted(), the songs on the stick are for the caller to read into
+  it.  The caller owns it now.
+*/
+struct library *usb_take_library(void);
+// TRUE if a stick is mounted right now
+int usb_mounted(void);
+
+#endif
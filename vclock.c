@@ -0,0 +1,53 @@
+/*
+ * vclock.c
+ *
+ * Real or virtual time; see vclock.h.
+ */
+
+#include <time.h>
+
+#include "vclock.h"
+
+static int virtual = 0;
+static long long virtual_us;
+
+long long vclock_us(void)
+{
+    struct timespec ts;
+
+    if (__atomic_load_n(&virtual, __ATOMIC_RELAXED))
+        return __atomic_load_n(&virtual_us, __ATOMIC_RELAXED);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+unsigned vclock_ms(void)
+{
+    return (unsigned)(vclock_us() / 1000);
+}
+
+void vclock_sleep_ms(unsigned ms)
+{
+    struct timespec ts;
+
+    if (__atomic_load_n(&virtual, __ATOMIC_RELAXED))
+    {
+        vclock_advance_us(ms * 1000LL);
+        return;
+    }
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000L;
+    while (nanosleep(&ts, &ts) != 0)
+        ;
+}
+
+void vclock_virtual(long long start_us)
+{
+    __atomic_store_n(&virtual_us, start_us, __ATOMIC_RELAXED);
+    __atomic_store_n(&virtual, 1, __ATOMIC_RELAXED);
+}
+
+void vclock_advance_us(long long us)
+{
+    __atomic_add_fetch(&virtual_us, us, __ATOMIC_RELAXED);
+}
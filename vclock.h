@@ -0,0 +1,24 @@
+/*
+ * header file for vclock.c
+ *
+ * The clock all the timing (debouncing, scrolling, browsing, idling, the
+ * player's underrun check) goes by.  Normally it's CLOCK_MONOTONIC.  A
+ * test or benchmark can switch it to a virtual clock that only moves when
+ * told to, so hours of button presses and scrolling run in milliseconds
+ * and come out the same every time.
+ */
+
+#ifndef VCLOCK_H
+#define VCLOCK_H
+
+// Milliseconds; wraps after 49 days, so only compare differences
+unsigned vclock_ms(void);
+long long vclock_us(void);
+// Sleeps; on the virtual clock it just moves the clock on
+void vclock_sleep_ms(unsigned ms);
+
+// From now on time is virtual, starting at start_us
+void vclock_virtual(long long start_us);
+void vclock_advance_us(long long us);
+
+#endif
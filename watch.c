@@ -0,0 +1,516 @@
+/*
+ * watch.c
+ *
+ * Live library updates for -dir; see watch.h.
+ *
+ * Every directory in the tree gets an inotify watch.  Directories are kept
+ * as (parent, name) pairs in a fixed table rather than as full paths, so a
+ * deep tree costs no more than the names themselves and the table never
+ * grows past WATCH_MAX.  Songs are found again by path through a hash table
+ * of library indices, so a delete, rename or re-add touches one entry
+ * instead of the whole library.  The library is append-only: removed songs
+ * are only marked removed, and come back to life if they are added again.
+ *
+ * Events are applied as they are read, but the main loop is only told
+ * (watch_generation()) once a batch is done, i.e. once no new events have
+ * turned up for WATCH_BATCH_MS.  A copy of 1,000 songs is one batch.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <limits.h>
+#include <dirent.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+
+#include "lcd-mp3.h"
+#include "watch.h"
+#include "hash.h"
+
+#define WATCH_EVENTS (IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE | IN_ONLYDIR)
+#define EVENT_BUF    (64 * 1024)
+
+struct wdir {
+    int wd;         // -1 if the slot is free
+    int parent;     // slot of the parent directory; -1 for the top one
+    char *name;     // the top one has the whole path
+};
+
+static struct library *lib;
+static int in_fd = -1;
+static pthread_t watch_thread;
+static int running = FALSE;
+static int scanning = FALSE;
+static unsigned generation = 0;
+static char top[PATH_MAX];
+
+static struct wdir dirs[WATCH_MAX];
+static int num_dirs = 0;
+// Events come in runs for the same directory
+static int last_wd = -1;
+static int last_slot = -1;
+
+// Songs by path; open addressing, holds library indices
+static int *files = NULL;
+static int files_cap = 0;
+static int files_used = 0;
+
+// Counted by the watcher; copied out under statsMutex after every batch
+static struct watch_stats counts;
+static struct watch_stats stats;
+static pthread_mutex_t statsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int is_mp3(const char *name)
+{
+    const char *dot = strrchr(name, '.');
+
+    return (dot != NULL && dot != name && strcasecmp(dot + 1, "mp3") == 0);
+}
+
+/*
+ * Path -> library index
+ */
+static int *find_slot(const char *path)
+{
+    uint32_t i = hash_str(path) & (files_cap - 1);
+
+    while (files[i] >= 0 && strcmp(library_get(lib, files[i])->path, path) != 0)
+        i = (i + 1) & (files_cap - 1);
+    return &files[i];
+}
+
+static int grow_files(void)
+{
+    int *old = files, old_cap = files_cap, i;
+
+    files_cap = (files_cap ? files_cap * 2 : 1024);
+    files = malloc(files_cap * sizeof(int));
+    if (files == NULL)
+    {
+        perror("malloc: grow_files");
+        files = old;
+        files_cap = old_cap;
+        return -1;
+    }
+    for (i = 0; i < files_cap; i++)
+        files[i] = -1;
+    for (i = 0; i < old_cap; i++)
+    {
+        if (old[i] >= 0)
+            *find_slot(library_get(lib, old[i])->path) = old[i];
+    }
+    free(old);
+    return 0;
+}
+
+static void add_file(const char *path)
+{
+    struct lib_track *track;
+    int *slot, index;
+
+    if (files_used * 2 >= files_cap && grow_files() != 0)
+        return;
+    slot = find_slot(path);
+    if (*slot >= 0)
+    {
+        // Deleted and put back (or just rewritten)
+        track = library_get(lib, *slot);
+        if (library_removed(track) == TRUE)
+        {
+            library_set_removed(track, FALSE);
+            counts.added++;
+        }
+        return;
+    }
+    index = library_add(lib, path);
+    if (index < 0)
+        return;
+    *slot = index;
+    files_used++;
+    counts.added++;
+}
+
+static void remove_file(const char *path)
+{
+    struct lib_track *track;
+    int *slot;
+
+    if (files_cap == 0)
+        return;
+    slot = find_slot(path);
+    if (*slot < 0)
+        return;
+    track = library_get(lib, *slot);
+    if (library_removed(track) == FALSE)
+    {
+        library_set_removed(track, TRUE);
+        counts.removed++;
+    }
+}
+
+// A whole directory went; there are no events for what was in it
+static void remove_tree(const char *dir)
+{
+    struct lib_track *track;
+    size_t len = strlen(dir);
+    int i, n = library_count(lib);
+
+    for (i = 0; i < n; i++)
+    {
+        track = library_get(lib, i);
+        if (strncmp(track->path, dir, len) == 0 && track->path[len] == '/' && library_removed(track) == FALSE)
+        {
+            library_set_removed(track, TRUE);
+            counts.removed++;
+        }
+    }
+}
+
+/*
+ * Directories
+ */
+// Full path of a directory (plus name, if it isn't NULL)
+static void dir_path(int slot, const char *name, char *out)
+{
+    int chain[WATCH_MAX], depth = 0;
+    size_t len = 0;
+
+    for (; slot >= 0 && depth < WATCH_MAX; slot = dirs[slot].parent)
+        chain[depth++] = slot;
+    out[0] = '\0';
+    while (depth-- > 0 && len < PATH_MAX)
+        len += snprintf(out + len, PATH_MAX - len, "%s%s", (len ? "/" : ""), dirs[chain[depth]].name);
+    if (name != NULL && len < PATH_MAX)
+        snprintf(out + len, PATH_MAX - len, "/%s", name);
+}
+
+static int slot_of_wd(int wd)
+{
+    int i;
+
+    if (wd == last_wd)
+        return last_slot;
+    for (i = 0; i < num_dirs; i++)
+    {
+        if (dirs[i].wd == wd)
+        {
+            last_wd = wd;
+            last_slot = i;
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int child_slot(int parent, const char *name)
+{
+    int i;
+
+    for (i = 0; i < num_dirs; i++)
+    {
+        if (dirs[i].wd >= 0 && dirs[i].parent == parent && strcmp(dirs[i].name, name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static void free_slot(int slot)
+{
+    if (dirs[slot].wd == last_wd)
+        last_wd = -1;
+    free(dirs[slot].name);
+    dirs[slot].name = NULL;
+    dirs[slot].wd = -1;
+    counts.dirs--;
+    while (num_dirs > 0 && dirs[num_dirs - 1].wd < 0)
+        num_dirs--;
+}
+
+// Watch a directory and add everything in it (and under it)
+static void add_dir(int parent, const char *name)
+{
+    char path[PATH_MAX], file[PATH_MAX];
+    DIR *d;
+    struct dirent *dir;
+    int slot, wd;
+
+    if (parent < 0)
+        snprintf(path, PATH_MAX, "%s", name);
+    else
+        dir_path(parent, name, path);
+    for (slot = 0; slot < num_dirs && dirs[slot].wd >= 0; slot++)
+        ;
+    if (slot == WATCH_MAX)
+    {
+        if (counts.skipped++ == 0)
+            fprintf(stderr, "[%s - %d]: More than %d directories; not watching %s (or any more)\n", __FILE__, __LINE__, WATCH_MAX, path);
+        slot = -1;
+    }
+    else
+    {
+        wd = inotify_add_watch(in_fd, path, WATCH_EVENTS);
+        if (wd >= 0 && slot_of_wd(wd) < 0)
+        {
+            dirs[slot].wd = wd;
+            dirs[slot].parent = parent;
+            dirs[slot].name = strdup(name);
+            if (slot == num_dirs)
+                num_dirs++;
+            counts.dirs++;
+        }
+        else
+            slot = -1;
+    }
+    d = opendir(path);
+    if (!d)
+        return;
+    while ((dir = readdir(d)) != NULL && __atomic_load_n(&running, __ATOMIC_RELAXED))
+    {
+        if (strcmp(dir->d_name, "..") == 0 || strcmp(dir->d_name, ".") == 0)
+            continue;
+        if (dir->d_type == DT_DIR && slot >= 0)
+            add_dir(slot, dir->d_name);
+        else if (dir->d_type == DT_REG && is_mp3(dir->d_name))
+        {
+            if (snprintf(file, PATH_MAX, "%s/%s", path, dir->d_name) < PATH_MAX)
+                add_file(file);
+        }
+    }
+    closedir(d);
+}
+
+// Stop watching a directory and everything under it
+static void drop_dir(int slot)
+{
+    char path[PATH_MAX];
+    int i;
+
+    for (i = 0; i < num_dirs; i++)
+    {
+        if (dirs[i].wd >= 0 && dirs[i].parent == slot)
+            drop_dir(i);
+    }
+    dir_path(slot, NULL, path);
+    remove_tree(path);
+    inotify_rm_watch(in_fd, dirs[slot].wd);
+    free_slot(slot);
+}
+
+/*
+  The kernel dropped events; look through every directory we watch again.
+  This picks up anything new, but songs deleted in the meantime stay in
+  the library until they fail to play.
+*/
+static void rescan(void)
+{
+    char path[PATH_MAX], file[PATH_MAX];
+    DIR *d;
+    struct dirent *dir;
+    int slot, n = num_dirs;
+
+    for (slot = 0; slot < n; slot++)
+    {
+        if (dirs[slot].wd < 0)
+            continue;
+        dir_path(slot, NULL, path);
+        d = opendir(path);
+        if (!d)
+            continue;
+        while ((dir = readdir(d)) != NULL)
+        {
+            if (strcmp(dir->d_name, "..") == 0 || strcmp(dir->d_name, ".") == 0)
+                continue;
+            if (dir->d_type == DT_DIR && child_slot(slot, dir->d_name) < 0)
+                add_dir(slot, dir->d_name);
+            else if (dir->d_type == DT_REG && is_mp3(dir->d_name))
+            {
+                if (snprintf(file, PATH_MAX, "%s/%s", path, dir->d_name) < PATH_MAX)
+                    add_file(file);
+            }
+        }
+        closedir(d);
+    }
+}
+
+static void handle_event(const struct inotify_event *ev)
+{
+    char path[PATH_MAX];
+    int slot, child;
+
+    counts.events++;
+    if (ev->mask & IN_Q_OVERFLOW)
+    {
+        rescan();
+        return;
+    }
+    slot = slot_of_wd(ev->wd);
+    if (slot < 0)
+        return;
+    if (ev->mask & IN_IGNORED)
+    {
+        free_slot(slot);
+        return;
+    }
+    if (ev->len == 0)
+        return;
+    if (ev->mask & IN_ISDIR)
+    {
+        if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+            add_dir(slot, ev->name);
+        else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+        {
+            child = child_slot(slot, ev->name);
+            if (child >= 0)
+                drop_dir(child);
+            else
+            {
+                dir_path(slot, ev->name, path);
+                remove_tree(path);
+            }
+        }
+        return;
+    }
+    if (is_mp3(ev->name) == FALSE)
+        return;
+    dir_path(slot, ev->name, path);
+    if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+        add_file(path);
+    else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+        remove_file(path);
+}
+
+static int64_t thread_cpu_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void publish_stats(void)
+{
+    counts.cpu_us = thread_cpu_us();
+    pthread_mutex_lock(&statsMutex);
+    stats = counts;
+    pthread_mutex_unlock(&statsMutex);
+}
+
+static void *watch_loop(void *arg)
+{
+    char *buf;
+    struct pollfd pfd;
+    const struct inotify_event *ev;
+    ssize_t len;
+    char *p;
+    int pending = FALSE;
+
+    buf = malloc(EVENT_BUF);
+    if (buf == NULL)
+    {
+        perror("malloc: watch_loop");
+        return NULL;
+    }
+    // Read the tree in first; changes made meanwhile wait in in_fd
+    add_dir(-1, top);
+    counts.batches++;
+    publish_stats();
+    __atomic_store_n(&scanning, FALSE, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+    pfd.fd = in_fd;
+    pfd.events = POLLIN;
+    while (__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+    {
+        // Once events stop coming for a bit, the batch is done
+        if (poll(&pfd, 1, (pending ? WATCH_BATCH_MS : 500)) <= 0)
+        {
+            if (pending)
+            {
+                counts.batches++;
+                publish_stats();
+                __atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+                pending = FALSE;
+            }
+            continue;
+        }
+        len = read(in_fd, buf, EVENT_BUF);
+        if (len <= 0)
+            continue;
+        for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ev->len)
+        {
+            ev = (const struct inotify_event *)p;
+            handle_event(ev);
+        }
+        pending = TRUE;
+    }
+    free(buf);
+    return NULL;
+}
+
+int watch_start(struct library *library, const char *dir)
+{
+    DIR *d;
+
+    // Make sure it's there before setting anything up
+    d = opendir(dir);
+    if (!d)
+        return -1;
+    closedir(d);
+    lib = library;
+    snprintf(top, sizeof(top), "%s", dir);
+    in_fd = inotify_init1(IN_CLOEXEC);
+    if (in_fd < 0)
+        return -1;
+    publish_stats();
+    running = TRUE;
+    scanning = TRUE;
+    errno = pthread_create(&watch_thread, NULL, watch_loop, NULL);
+    if (errno != 0)
+    {
+        running = scanning = FALSE;
+        close(in_fd);
+        in_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void watch_stop(void)
+{
+    int i;
+
+    if (__atomic_load_n(&running, __ATOMIC_ACQUIRE) == FALSE)
+        return;
+    __atomic_store_n(&running, FALSE, __ATOMIC_RELEASE);
+    pthread_join(watch_thread, NULL);
+    close(in_fd);
+    in_fd = -1;
+    for (i = 0; i < num_dirs; i++)
+        free(dirs[i].name);
+    num_dirs = 0;
+    free(files);
+    files = NULL;
+    files_cap = files_used = 0;
+}
+
+int watch_scanning(void)
+{
+    return __atomic_load_n(&scanning, __ATOMIC_ACQUIRE);
+}
+
+unsigned watch_generation(void)
+{
+    return __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+}
+
+void watch_get_stats(struct watch_stats *st)
+{
+    pthread_mutex_lock(&statsMutex);
+    *st = stats;
+    pthread_mutex_unlock(&statsMutex);
+}
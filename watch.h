@@ -0,0 +1,44 @@
+/*
+ * header file for watch.c
+ *
+ * Keeps the library up to date with a directory tree (inotify), so songs
+ * copied in (or deleted) while we're running are picked up without
+ * reading the whole tree again.
+ */
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdint.h>
+
+#include "library.h"
+
+#define WATCH_MAX      4096 // directories we'll watch at most
+#define WATCH_BATCH_MS 100  // how long to gather events before applying them
+
+/*
+  Starts the watcher thread, which reads dir into lib (which should be
+  empty) before it starts watching; lib grows while that goes on.  The
+  watcher is the only one adding to lib.
+  Returns 0 on success, -1 on failure (errno is set)
+*/
+int watch_start(struct library *lib, const char *dir);
+void watch_stop(void);
+// TRUE until the tree has been read in the first time
+int watch_scanning(void);
+
+// Goes up by one for every batch of changes applied to the library
+unsigned watch_generation(void);
+
+struct watch_stats {
+	uint32_t dirs;        // being watched
+	uint32_t skipped;     // directories not watched (over WATCH_MAX)
+	uint32_t events;
+	uint32_t batches;
+	uint32_t added;
+	uint32_t removed;
+	int64_t cpu_us;       // watcher thread CPU time
+};
+void watch_get_stats(struct watch_stats *st);
+
+#endif
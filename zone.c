@@ -0,0 +1,240 @@
+/*
+ * zone.c
+ *
+ * Extra players, each with a sound card of its own; see zone.h.
+ *
+ * Each zone is one thread that takes the next song from its own play
+ * queue and plays it the way play_song() does (decoder_open(), then a
+ * buffer at a time to the sink), looking between buffers whether it should
+ * stop, skip or change the volume.  Only the zone's own thread touches its
+ * play queue.  The library is shared: it is only ever appended to, and
+ * readers don't need a lock (library.h).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <mpg123.h>
+
+#include "lcd-mp3.h"
+#include "zone.h"
+#include "playqueue.h"
+#include "quarantine.h"
+#include "decoder.h"
+#include "sink.h"
+#include "rtsched.h"
+#include "vclock.h"
+
+#define SLACK_US 20000   // behind by more than this is an underrun (like the player)
+
+struct zone {
+    struct playqueue queue;
+    int kind;
+    char *device;
+    double volume;
+    unsigned volume_gen;     // changes with the volume
+    int skip;
+    pthread_t thread;
+    struct zone_stats stats;
+};
+
+static pthread_mutex_t zoneMutex = PTHREAD_MUTEX_INITIALIZER;
+static struct zone zones[ZONE_MAX];
+static int count = 0;
+static int stop = FALSE;
+
+static void set_volume(struct zone *z, mpg123_handle *mh, unsigned *gen)
+{
+    double volume;
+
+    pthread_mutex_lock(&zoneMutex);
+    volume = z->volume;
+    *gen = z->volume_gen;
+    pthread_mutex_unlock(&zoneMutex);
+    mpg123_volume(mh, volume);
+}
+
+// Plays one song; returns -1 if the sound card couldn't be opened
+static int play(struct zone *z, const char *path)
+{
+    mpg123_handle *mh;
+    struct sink out;
+    unsigned char *buffer;
+    size_t buffer_size, done;
+    long rate;
+    int channels, encoding, frame_bytes, underruns = 0;
+    unsigned gen;
+    long long start_us, written_us = 0, now;
+
+    mh = decoder_open(path, &rate, &channels, &encoding);
+    if (mh == NULL)
+    {
+        quarantine_add(path, "open");
+        pthread_mutex_lock(&zoneMutex);
+        z->stats.failed++;
+        pthread_mutex_unlock(&zoneMutex);
+        return 0;
+    }
+    set_volume(z, mh, &gen);
+    if (sink_open(&out, z->kind, z->device, rate, channels, mpg123_encsize(encoding) * 8) != 0)
+    {
+        fprintf(stderr, "[%s - %d]: Cannot open %s: %s\n", __FILE__, __LINE__, (z->device != NULL ? z->device : "the sound card"), strerror(errno));
+        decoder_close(mh);
+        pthread_mutex_lock(&zoneMutex);
+        z->stats.failed++;
+        pthread_mutex_unlock(&zoneMutex);
+        return -1;
+    }
+    buffer_size = mpg123_outblock(mh);
+    buffer = malloc(buffer_size);
+    frame_bytes = channels * mpg123_encsize(encoding);
+    start_us = vclock_us();
+    while (buffer != NULL && mpg123_read(mh, buffer, buffer_size, &done) == MPG123_OK)
+    {
+        if (__atomic_load_n(&z->volume_gen, __ATOMIC_RELAXED) != gen)
+            set_volume(z, mh, &gen);
+        sink_write(&out, buffer, done);
+        written_us += (long long)(done / frame_bytes) * 1000000 / rate;
+        now = vclock_us();
+        if (z->kind != SINK_AO)
+        {
+            // Nothing holds us back but ourselves
+            if (written_us - (now - start_us) >= 1000)
+                vclock_sleep_ms((written_us - (now - start_us)) / 1000);
+        }
+        else if (now - start_us > written_us + SLACK_US)
+        {
+            start_us = now - written_us;
+            underruns++;
+        }
+        if (__atomic_load_n(&stop, __ATOMIC_ACQUIRE) || __atomic_exchange_n(&z->skip, FALSE, __ATOMIC_ACQ_REL))
+            break;
+    }
+    free(buffer);
+    sink_close(&out);
+    decoder_close(mh);
+
+    pthread_mutex_lock(&zoneMutex);
+    z->stats.songs++;
+    z->stats.underruns += underruns;
+    z->stats.audio_secs += written_us / 1e6;
+    pthread_mutex_unlock(&zoneMutex);
+    return 0;
+}
+
+static void *zone_thread(void *arg)
+{
+    struct zone *z = (struct zone *)arg;
+    const struct pq_item *item;
+
+    if (rt_zone_thread(z - zones) != 0)
+        fprintf(stderr, "[%s - %d]: Cannot make zone %d real-time: %s\n", __FILE__, __LINE__, (int)(z - zones), strerror(errno));
+    while (__atomic_load_n(&stop, __ATOMIC_ACQUIRE) == FALSE)
+    {
+        // Songs may have been found since
+        pq_sync(&z->queue);
+        item = pq_next(&z->queue);
+        // Known bad (or found to be now): out of this zone's order and on
+        if (item != NULL && quarantine_check(item->path) == TRUE)
+        {
+            if (item->index >= 0)
+                library_set_removed(library_get(z->queue.lib, item->index), TRUE);
+            continue;
+        }
+        // Nothing to play, or no sound card (e.g. unplugged); wait a bit
+        if (item == NULL || play(z, item->path) != 0)
+            vclock_sleep_ms(ZONE_IDLE_MS);
+    }
+    return NULL;
+}
+
+int zone_start(struct library *lib, int kind, const char *device, int shuffle, unsigned seed, double volume)
+{
+    struct zone *z;
+
+    if (count == ZONE_MAX)
+    {
+        errno = ENOSPC;
+        return -1;
+    }
+    z = &zones[count];
+    memset(z, 0, sizeof(struct zone));
+    z->kind = kind;
+    z->volume = volume;
+    if (pq_init(&z->queue, lib, shuffle, seed) != 0)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    if (device != NULL && (z->device = strdup(device)) == NULL)
+    {
+        pq_free(&z->queue);
+        errno = ENOMEM;
+        return -1;
+    }
+    if (count == 0)
+        mpg123_init();
+    errno = pthread_create(&z->thread, NULL, zone_thread, z);
+    if (errno != 0)
+    {
+        pq_free(&z->queue);
+        free(z->device);
+        return -1;
+    }
+    return count++;
+}
+
+void zone_stop_all(void)
+{
+    int i;
+
+    __atomic_store_n(&stop, TRUE, __ATOMIC_RELEASE);
+    for (i = 0; i < count; i++)
+    {
+        pthread_join(zones[i].thread, NULL);
+        pq_free(&zones[i].queue);
+        free(zones[i].device);
+    }
+    count = 0;
+    __atomic_store_n(&stop, FALSE, __ATOMIC_RELEASE);
+}
+
+int zone_count(void)
+{
+    return count;
+}
+
+void zone_set_volume(int zone, double volume)
+{
+    if (zone < 0 || zone >= count)
+        return;
+    pthread_mutex_lock(&zoneMutex);
+    zones[zone].volume = volume;
+    __atomic_add_fetch(&zones[zone].volume_gen, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&zoneMutex);
+}
+
+void zone_next(int zone)
+{
+    if (zone >= 0 && zone < count)
+        __atomic_store_n(&zones[zone].skip, TRUE, __ATOMIC_RELEASE);
+}
+
+int zone_get_stats(int zone, struct zone_stats *st)
+{
+    struct timespec ts;
+    clockid_t cid;
+
+    if (zone < 0 || zone >= count)
+        return -1;
+    pthread_mutex_lock(&zoneMutex);
+    *st = zones[zone].stats;
+    pthread_mutex_unlock(&zoneMutex);
+    st->cpu_secs = 0;
+    if (pthread_getcpuclockid(zones[zone].thread, &cid) == 0 && clock_gettime(cid, &ts) == 0)
+        st->cpu_secs = ts.tv_sec + ts.tv_nsec / 1e9;
+    return 0;
+}
@@ -0,0 +1,49 @@
+/*
+ * header file for zone.c
+ *
+ * More rooms from the one Pi: each extra zone is a player of its own with
+ * its own sound card, play order and volume, going through the same
+ * library as the LCD's player (the songs are only read in and indexed the
+ * once).  The zones have no buttons or LCD; they just play.  Each one's
+ * player thread has the player's priority and, where there are the cores,
+ * a CPU to itself.
+ */
+
+#ifndef ZONE_H
+#define ZONE_H
+
+#include <stdint.h>
+
+#include "library.h"
+
+#define ZONE_MAX     8
+#define ZONE_IDLE_MS 1000   // how often a zone with nothing to play looks again
+
+struct zone_stats {
+	uint32_t songs;        // played (to the end or skipped)
+	uint32_t failed;       // couldn't be played
+	uint32_t underruns;
+	double audio_secs;
+	double cpu_secs;       // used by the zone's thread
+};
+
+/*
+  Starts a zone playing the songs of lib (which must not be freed before
+  zone_stop_all()) in its own order through a sink of kind: for SINK_AO
+  device is the ALSA device (e.g. "hw:1"; ao_initialize() first).
+  SINK_NULL, for trying zones out without the cards, is held back to the
+  speed the songs play at.  volume is what the samples are scaled by.
+  Returns the zone's number, or -1 on failure (errno is set)
+*/
+int zone_start(struct library *lib, int kind, const char *device, int shuffle, unsigned seed, double volume);
+void zone_stop_all(void);
+int zone_count(void);
+
+void zone_set_volume(int zone, double volume);
+// On to the zone's next song
+void zone_next(int zone);
+
+// Returns 0 on success, -1 if there's no such zone
+int zone_get_stats(int zone, struct zone_stats *st);
+
+#endif